@@ -1,5 +1,7 @@
 #define BITLBEE_CORE
 #include "bitlbee.h"
+#include "sha1.h"
+#include <signal.h>
 
 #ifdef WITH_PAM
 extern auth_backend_t auth_pam;
@@ -8,6 +10,47 @@ extern auth_backend_t auth_pam;
 extern auth_backend_t auth_ldap;
 #endif
 
+/* Seconds an idle worker process is kept around. */
+#define AUTH_WORKER_IDLE 60
+
+typedef struct auth_request {
+	char *backend, *nick, *password;
+	auth_backend_done_t done;       /* NULL if canceled */
+	gpointer data;
+} auth_request_t;
+
+typedef struct auth_worker {
+	pid_t pid;
+	int fd;
+	gint inpa, idle_id;
+	auth_request_t *req;    /* NULL while idle */
+	char reply[16];
+	int reply_len;
+} auth_worker_t;
+
+/* What auth_check_pass() is waiting for, per user. */
+typedef struct auth_pending {
+	irc_t *irc;
+	char *nick, *backend, *password;
+	gboolean save;
+	auth_check_pass_done_t done;
+	gpointer data;
+	GDestroyNotify destroy;
+} auth_pending_t;
+
+typedef struct auth_cache_entry {
+	guint8 hash[SHA1_HASH_SIZE];
+	time_t expires;
+} auth_cache_entry_t;
+
+static GQueue auth_queue = G_QUEUE_INIT;
+static GSList *auth_workers;
+static GSList *auth_pending;
+static GHashTable *auth_cache;
+static char auth_cache_key[16];
+
+static void auth_pool_run(void);
+
 GList *auth_init(const char *backend)
 {
 	GList *gl = NULL;
@@ -28,38 +71,471 @@ GList *auth_init(const char *backend)
 	return ok ? gl : NULL;
 }
 
-storage_status_t auth_check_pass(irc_t *irc, const char *nick, const char *password)
+static auth_backend_t *auth_find_backend(const char *name)
 {
 	GList *gl;
-	storage_status_t status = storage_check_pass(irc, nick, password);
 
-	if (status == STORAGE_CHECK_BACKEND) {
-		for (gl = global.auth; gl; gl = gl->next) {
-			auth_backend_t *be = gl->data;
-			if (!strcmp(be->name, irc->auth_backend)) {
-				status = be->check_pass(nick, password);
-				break;
+	for (gl = global.auth; gl; gl = gl->next) {
+		auth_backend_t *be = gl->data;
+		if (!strcmp(be->name, name)) {
+			return be;
+		}
+	}
+
+	return NULL;
+}
+
+/* Positive results are remembered for AuthCacheTimeout seconds, as a keyed
+   hash of the password so the cache itself isn't worth stealing. Saves a
+   round trip to the backend for clients that check the same password twice
+   (SASL followed by identify, reconnects). */
+static void auth_cache_hash(const char *password, guint8 hash[SHA1_HASH_SIZE])
+{
+	if (!auth_cache) {
+		auth_cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+		random_bytes((unsigned char *) auth_cache_key, sizeof(auth_cache_key));
+	}
+
+	sha1_hmac(auth_cache_key, sizeof(auth_cache_key), password, strlen(password), hash);
+}
+
+static gboolean auth_cache_expired(gpointer key, gpointer value, gpointer data)
+{
+	auth_cache_entry_t *ce = value;
+
+	return ce->expires <= *(time_t *) data;
+}
+
+static gboolean auth_cache_check(const char *backend, const char *nick, const char *password)
+{
+	auth_cache_entry_t *ce;
+	guint8 hash[SHA1_HASH_SIZE];
+	char *key;
+	gboolean ret;
+
+	if (global.conf->auth_cache_timeout <= 0 || !auth_cache) {
+		return FALSE;
+	}
+
+	key = g_strdup_printf("%s %s", backend, nick);
+	ce = g_hash_table_lookup(auth_cache, key);
+	g_free(key);
+
+	if (!ce || ce->expires <= time(NULL)) {
+		return FALSE;
+	}
+
+	auth_cache_hash(password, hash);
+	ret = memcmp(hash, ce->hash, SHA1_HASH_SIZE) == 0;
+	memset(hash, 0, sizeof(hash));
+
+	return ret;
+}
+
+static void auth_cache_add(const char *backend, const char *nick, const char *password)
+{
+	auth_cache_entry_t *ce;
+	time_t now = time(NULL);
+
+	if (global.conf->auth_cache_timeout <= 0) {
+		return;
+	}
+
+	ce = g_new0(auth_cache_entry_t, 1);
+	auth_cache_hash(password, ce->hash);
+	ce->expires = now + global.conf->auth_cache_timeout;
+
+	g_hash_table_foreach_remove(auth_cache, auth_cache_expired, &now);
+	g_hash_table_replace(auth_cache, g_strdup_printf("%s %s", backend, nick), ce);
+}
+
+static void auth_request_free(auth_request_t *req)
+{
+	g_free(req->backend);
+	g_free(req->nick);
+	if (req->password) {
+		memset(req->password, 0, strlen(req->password));
+		g_free(req->password);
+	}
+	g_free(req);
+}
+
+static void auth_request_done(auth_request_t *req, storage_status_t status)
+{
+	if (status == STORAGE_OK) {
+		auth_cache_add(req->backend, req->nick, req->password);
+	}
+
+	if (req->done) {
+		req->done(status, req->data);
+	}
+
+	auth_request_free(req);
+}
+
+/* The worker process: reads requests (backend, nick and password, each
+   NUL-terminated), one at a time, and writes back the status as a line
+   of text. Exits once the other end goes away. */
+static void auth_worker_main(int fd)
+{
+	GString *in = g_string_new("");
+	char buf[512], *f[3];
+	int i, n, nuls;
+
+	for (;;) {
+		nuls = 0;
+		while (nuls < 3) {
+			if ((n = read(fd, buf, sizeof(buf))) <= 0) {
+				_exit(0);
+			}
+			for (i = 0; i < n; i++) {
+				nuls += buf[i] == '\0';
 			}
+			g_string_append_len(in, buf, n);
 		}
-	} else if (status == STORAGE_NO_SUCH_USER && global.conf->auth_backend) {
-		for (gl = global.auth; gl; gl = gl->next) {
-			auth_backend_t *be = gl->data;
-			if (!strcmp(be->name, global.conf->auth_backend)) {
-				status = be->check_pass(nick, password);
-				/* Save the user so storage_load will pick them up, similar to
-				 * what the register command would do */
-				if (status == STORAGE_OK) {
-					irc->auth_backend = g_strdup(global.conf->auth_backend);
-					storage_save(irc, (char *)password, 0);
-				}
-				break;
+		memset(buf, 0, sizeof(buf));
+
+		f[0] = in->str;
+		for (i = 1; i < 3; i++) {
+			f[i] = f[i - 1] + strlen(f[i - 1]) + 1;
+		}
+
+		{
+			auth_backend_t *be = auth_find_backend(f[0]);
+			storage_status_t status = be ? be->check_pass(f[1], f[2]) : STORAGE_OTHER_ERROR;
+			char *reply = g_strdup_printf("%d\n", status);
+
+			if (write(fd, reply, strlen(reply)) != strlen(reply)) {
+				_exit(1);
+			}
+			g_free(reply);
+		}
+
+		memset(in->str, 0, in->len);
+		g_string_truncate(in, 0);
+	}
+}
+
+static void auth_worker_free(auth_worker_t *w)
+{
+	auth_request_t *req = w->req;
+
+	auth_workers = g_slist_remove(auth_workers, w);
+	b_event_remove(w->inpa);
+	b_event_remove(w->idle_id);
+	closesocket(w->fd);
+	g_free(w);
+
+	if (req) {
+		auth_request_done(req, STORAGE_OTHER_ERROR);
+	}
+}
+
+static gboolean auth_worker_idle(gpointer data, gint fd, b_input_condition cond)
+{
+	auth_worker_t *w = data;
+
+	/* Closing the socket makes it exit. */
+	w->idle_id = 0;
+	auth_worker_free(w);
+
+	return FALSE;
+}
+
+static gboolean auth_worker_read(gpointer data, gint fd, b_input_condition cond)
+{
+	auth_worker_t *w = data;
+	auth_request_t *req;
+	int st;
+
+	st = read(fd, w->reply + w->reply_len, sizeof(w->reply) - 1 - w->reply_len);
+	if (st < 0 && sockerr_again()) {
+		return TRUE;
+	} else if (st <= 0 || w->req == NULL) {
+		/* Crashed (or got killed) in the middle of a check? */
+		log_message(LOGLVL_WARNING, "Authentication worker %d went away", (int) w->pid);
+		w->inpa = 0;
+		auth_worker_free(w);
+		auth_pool_run();
+		return FALSE;
+	}
+
+	w->reply_len += st;
+	w->reply[w->reply_len] = '\0';
+	if (!strchr(w->reply, '\n')) {
+		return TRUE;
+	}
+
+	req = w->req;
+	w->req = NULL;
+	w->reply_len = 0;
+	w->idle_id = b_timeout_add(AUTH_WORKER_IDLE * 1000, auth_worker_idle, w);
+
+	auth_request_done(req, atoi(w->reply));
+	auth_pool_run();
+
+	/* Could've been replaced if it broke down while we were away. */
+	return g_slist_find(auth_workers, w) != NULL;
+}
+
+static auth_worker_t *auth_worker_new(void)
+{
+	auth_worker_t *w;
+	int fds[2], fd, max;
+	pid_t p;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) < 0) {
+		log_message(LOGLVL_WARNING, "Can't start authentication worker: %s", strerror(errno));
+		return NULL;
+	}
+
+	p = fork();
+	if (p < 0) {
+		log_message(LOGLVL_WARNING, "Can't start authentication worker: %s", strerror(errno));
+		closesocket(fds[0]);
+		closesocket(fds[1]);
+		return NULL;
+	}
+
+	if (!p) {
+		/* child process. It can live for a while, so don't keep
+		   anyone's connections open. */
+		signal(SIGTERM, SIG_DFL);
+		signal(SIGINT, SIG_DFL);
+		max = MIN(sysconf(_SC_OPEN_MAX), 65536);
+		for (fd = 3; fd < max; fd++) {
+			if (fd != fds[1]) {
+				close(fd);
+			}
+		}
+		auth_worker_main(fds[1]);
+		_exit(0);
+	}
+
+	close(fds[1]);
+	sock_make_nonblocking(fds[0]);
+
+	w = g_new0(auth_worker_t, 1);
+	w->pid = p;
+	w->fd = fds[0];
+	w->inpa = b_input_add(w->fd, B_EV_IO_READ, auth_worker_read, w);
+	auth_workers = g_slist_prepend(auth_workers, w);
+
+	return w;
+}
+
+static gboolean auth_worker_send(auth_worker_t *w, auth_request_t *req)
+{
+	GString *s = g_string_new("");
+	gboolean ok;
+
+	g_string_append_len(s, req->backend, strlen(req->backend) + 1);
+	g_string_append_len(s, req->nick, strlen(req->nick) + 1);
+	g_string_append_len(s, req->password, strlen(req->password) + 1);
+
+	/* An idle worker's socket is empty, this always fits. */
+	ok = write(w->fd, s->str, s->len) == s->len;
+
+	memset(s->str, 0, s->len);
+	g_string_free(s, TRUE);
+
+	if (ok) {
+		b_event_remove(w->idle_id);
+		w->idle_id = 0;
+		w->req = req;
+	}
+
+	return ok;
+}
+
+/* Hands queued requests to idle workers, starting new ones up to
+   AuthWorkers. Checks are done in-process if that's not possible. */
+static void auth_pool_run(void)
+{
+	auth_request_t *req;
+	auth_worker_t *w;
+	GSList *l;
+	int n;
+
+	while ((req = g_queue_pop_head(&auth_queue))) {
+		if (!req->done) {
+			auth_request_free(req);
+			continue;
+		}
+
+		w = NULL;
+		for (l = auth_workers, n = 0; l; l = l->next, n++) {
+			if (((auth_worker_t *) l->data)->req == NULL) {
+				w = l->data;
 			}
 		}
+
+		if (w == NULL && n < global.conf->auth_workers) {
+			w = auth_worker_new();
+		}
+
+		if (w && auth_worker_send(w, req)) {
+			continue;
+		} else if (w) {
+			auth_worker_free(w);
+		} else if (n > 0) {
+			/* All busy, wait for one of them. */
+			g_queue_push_head(&auth_queue, req);
+			return;
+		}
+
+		{
+			auth_backend_t *be = auth_find_backend(req->backend);
+			auth_request_done(req, be ? be->check_pass(req->nick, req->password) :
+			                  STORAGE_OTHER_ERROR);
+		}
 	}
+}
+
+void auth_backend_check(const char *backend, const char *nick, const char *password,
+                        auth_backend_done_t done, gpointer data)
+{
+	auth_request_t *req;
+
+	if (auth_cache_check(backend, nick, password)) {
+		done(STORAGE_OK, data);
+		return;
+	}
+
+	req = g_new0(auth_request_t, 1);
+	req->backend = g_strdup(backend);
+	req->nick = g_strdup(nick);
+	req->password = g_strdup(password);
+	req->done = done;
+	req->data = data;
 
+	g_queue_push_tail(&auth_queue, req);
+	auth_pool_run();
+}
+
+/* Forget about the callback, the worker can't be stopped halfway anyway. */
+static void auth_backend_cancel(gpointer data)
+{
+	GList *l;
+	GSList *sl;
+
+	for (l = auth_queue.head; l; l = l->next) {
+		auth_request_t *req = l->data;
+		if (req->data == data) {
+			req->done = NULL;
+		}
+	}
+
+	for (sl = auth_workers; sl; sl = sl->next) {
+		auth_worker_t *w = sl->data;
+		if (w->req && w->req->data == data) {
+			w->req->done = NULL;
+		}
+	}
+}
+
+static void auth_check_pass_finish(irc_t *irc, const char *password, storage_status_t status,
+                                   auth_check_pass_done_t done, gpointer data, GDestroyNotify destroy)
+{
 	if (status == STORAGE_OK) {
 		irc_setpass(irc, password);
 	}
 
-	return status;
+	done(irc, status, data);
+	if (destroy) {
+		destroy(data);
+	}
+}
+
+static void auth_pending_free(auth_pending_t *ap)
+{
+	auth_pending = g_slist_remove(auth_pending, ap);
+	memset(ap->password, 0, strlen(ap->password));
+	g_free(ap->password);
+	g_free(ap->backend);
+	g_free(ap->nick);
+	g_free(ap);
+}
+
+static void auth_check_pass_backend_done(storage_status_t status, gpointer data)
+{
+	auth_pending_t *ap = data;
+	irc_t *irc = ap->irc;
+
+	irc->status &= ~USTATUS_AUTH_PENDING;
+
+	/* The answer is only good for the nick it was asked about. */
+	if (status == STORAGE_OK && irc->user->nick &&
+	    (ap->nick == NULL || nick_cmp(irc, ap->nick, irc->user->nick) != 0)) {
+		status = STORAGE_INVALID_PASSWORD;
+	}
+
+	/* Save the user so storage_load will pick them up, similar to
+	 * what the register command would do */
+	if (status == STORAGE_OK && ap->save) {
+		g_free(irc->auth_backend);
+		irc->auth_backend = g_strdup(ap->backend);
+		storage_save(irc, ap->password, 0);
+	}
+
+	auth_check_pass_finish(irc, ap->password, status, ap->done, ap->data, ap->destroy);
+	auth_pending_free(ap);
+
+	/* Registration may have been put on hold while we were waiting. */
+	if (!(irc->status & USTATUS_LOGGED_IN)) {
+		irc_check_login(irc);
+	}
+}
+
+void auth_check_pass(irc_t *irc, const char *nick, const char *password,
+                     auth_check_pass_done_t done, gpointer data, GDestroyNotify destroy)
+{
+	storage_status_t status = storage_check_pass(irc, nick, password);
+	auth_pending_t *ap;
+	const char *backend = NULL;
+
+	if (status == STORAGE_CHECK_BACKEND) {
+		backend = irc->auth_backend;
+	} else if (status == STORAGE_NO_SUCH_USER && global.conf->auth_backend) {
+		backend = global.conf->auth_backend;
+	}
+
+	if (backend == NULL || auth_find_backend(backend) == NULL) {
+		auth_check_pass_finish(irc, password, status, done, data, destroy);
+		return;
+	}
+
+	ap = g_new0(auth_pending_t, 1);
+	ap->irc = irc;
+	ap->nick = g_strdup(nick);
+	ap->backend = g_strdup(backend);
+	ap->password = g_strdup(password);
+	ap->save = status == STORAGE_NO_SUCH_USER;
+	ap->done = done;
+	ap->data = data;
+	ap->destroy = destroy;
+
+	auth_pending = g_slist_prepend(auth_pending, ap);
+	irc->status |= USTATUS_AUTH_PENDING;
+
+	auth_backend_check(backend, nick, password, auth_check_pass_backend_done, ap);
+}
+
+/* Called from irc_free(). */
+void auth_cancel(irc_t *irc)
+{
+	GSList *l, *next;
+
+	for (l = auth_pending; l; l = next) {
+		auth_pending_t *ap = l->data;
+
+		next = l->next;
+		if (ap->irc == irc) {
+			auth_backend_cancel(ap);
+			if (ap->destroy) {
+				ap->destroy(ap->data);
+			}
+			auth_pending_free(ap);
+		}
+	}
 }
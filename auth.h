@@ -3,11 +3,25 @@
 
 #include "storage.h"
 
+/* check_pass may block for as long as it likes, it normally runs in one
+   of the worker processes (see AuthWorkers in bitlbee.conf), which live
+   on between checks so backends can keep their connections open. */
 typedef struct {
 	const char *name;
 	storage_status_t (*check_pass)(const char *nick, const char *password);
 } auth_backend_t;
 
+typedef void (*auth_backend_done_t)(storage_status_t status, gpointer data);
+typedef void (*auth_check_pass_done_t)(irc_t *irc, storage_status_t status, gpointer data);
+
 GList *auth_init(const char *backend);
-storage_status_t auth_check_pass(irc_t *irc, const char *nick, const char *password);
+
+/* Both call done when the result is in, which may be right away. For
+   auth_check_pass(), destroy (if not NULL) frees data after that, or
+   when the request is cancelled (auth_cancel()) before it finished. */
+void auth_backend_check(const char *backend, const char *nick, const char *password,
+                        auth_backend_done_t done, gpointer data);
+void auth_check_pass(irc_t *irc, const char *nick, const char *password,
+                     auth_check_pass_done_t done, gpointer data, GDestroyNotify destroy);
+void auth_cancel(irc_t *irc);
 #endif
@@ -3,62 +3,88 @@
 #include "bitlbee.h"
 #include <ldap.h>
 
+/* Checks normally run in the (long-lived) auth worker processes, so the
+   connection is kept open between them instead of reconnecting every
+   time. It's bound to the last user checked, so it's rebound anonymously
+   first. */
+static LDAP *ldap_conn;
+
+static void ldap_drop_conn(void)
+{
+	if (ldap_conn) {
+		ldap_unbind_s(ldap_conn);
+		ldap_conn = NULL;
+	}
+}
+
+static int ldap_anon_bind(void)
+{
+	int ret;
+
+	if (!ldap_conn && (ret = ldap_initialize(&ldap_conn, NULL)) != LDAP_SUCCESS) {
+		log_message(LOGLVL_WARNING, "ldap_initialize failed: %s", ldap_err2string(ret));
+		ldap_conn = NULL;
+		return ret;
+	}
+
+	/* First we do an anonymous bind to map uid=$nick to a DN*/
+	if ((ret = ldap_simple_bind_s(ldap_conn, NULL, NULL)) != LDAP_SUCCESS) {
+		ldap_drop_conn();
+		log_message(LOGLVL_WARNING, "Anonymous bind failed: %s", ldap_err2string(ret));
+	}
+
+	return ret;
+}
+
 static storage_status_t ldap_check_pass(const char *nick, const char *password)
 {
-	LDAP *ldap;
 	LDAPMessage *msg, *entry;
 	char *dn = NULL;
 	char *filter;
 	char *attrs[1] = { NULL };
 	int ret, count;
+	gboolean reused = ldap_conn != NULL;
 
-	if((ret = ldap_initialize(&ldap, NULL)) != LDAP_SUCCESS) {
-		log_message(LOGLVL_WARNING, "ldap_initialize failed: %s", ldap_err2string(ret));
-		return STORAGE_OTHER_ERROR;
-	}
-
-	/* First we do an anonymous bind to map uid=$nick to a DN*/
-	if((ret = ldap_simple_bind_s(ldap, NULL, NULL)) != LDAP_SUCCESS) {
-		ldap_unbind_s(ldap);
-		log_message(LOGLVL_WARNING, "Anonymous bind failed: %s", ldap_err2string(ret));
+	/* The server may have closed a connection we kept around, so try
+	   a fresh one before giving up. */
+	if ((ret = ldap_anon_bind()) != LDAP_SUCCESS &&
+	    (!reused || (ret = ldap_anon_bind()) != LDAP_SUCCESS)) {
 		return STORAGE_OTHER_ERROR;
 	}
 
 
 	/* We search and process the result */
 	filter = g_strdup_printf("(uid=%s)", nick);
-	ret = ldap_search_ext_s(ldap, NULL, LDAP_SCOPE_SUBTREE, filter, attrs, 0, NULL, NULL, NULL, 1, &msg);
+	ret = ldap_search_ext_s(ldap_conn, NULL, LDAP_SCOPE_SUBTREE, filter, attrs, 0, NULL, NULL, NULL, 1, &msg);
 	g_free(filter);
 
 	if(ret != LDAP_SUCCESS) {
-		ldap_unbind_s(ldap);
+		ldap_drop_conn();
 		log_message(LOGLVL_WARNING, "uid search failed: %s", ldap_err2string(ret));
 		return STORAGE_OTHER_ERROR;
 	}
 
-	count = ldap_count_entries(ldap, msg);
+	count = ldap_count_entries(ldap_conn, msg);
 	if (count == -1) {
-		ldap_get_option(ldap, LDAP_OPT_ERROR_NUMBER, &ret);
+		ldap_get_option(ldap_conn, LDAP_OPT_ERROR_NUMBER, &ret);
 		ldap_msgfree(msg);
-		ldap_unbind_s(ldap);
+		ldap_drop_conn();
 		log_message(LOGLVL_WARNING, "uid search failed: %s", ldap_err2string(ret));
 		return STORAGE_OTHER_ERROR;
 	}
 
 	if (!count) {
 		ldap_msgfree(msg);
-		ldap_unbind_s(ldap);
 		return STORAGE_NO_SUCH_USER;
 	}
 
-	entry = ldap_first_entry(ldap, msg);
-	dn = ldap_get_dn(ldap, entry);
+	entry = ldap_first_entry(ldap_conn, msg);
+	dn = ldap_get_dn(ldap_conn, entry);
 	ldap_msgfree(msg);
 
 	/* And now we bind as the user to authenticate */
-	ret = ldap_simple_bind_s(ldap, dn, password);
+	ret = ldap_simple_bind_s(ldap_conn, dn, password);
 	g_free(dn);
-	ldap_unbind_s(ldap);
 
 	switch (ret) {
 		case LDAP_SUCCESS:
@@ -66,6 +92,7 @@ static storage_status_t ldap_check_pass(const char *nick, const char *password)
 		case LDAP_INVALID_CREDENTIALS:
 			return STORAGE_INVALID_PASSWORD;
 		default:
+			ldap_drop_conn();
 			log_message(LOGLVL_WARNING, "Authenticated bind failed: %s", ldap_err2string(ret));
 			return STORAGE_OTHER_ERROR;
 	}
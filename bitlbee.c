@@ -190,20 +190,25 @@ int bitlbee_inetd_init()
 gboolean bitlbee_io_current_client_read(gpointer data, gint fd, b_input_condition cond)
 {
 	irc_t *irc = data;
+	b_handle_t handle = irc->handle;
 	char line[513];
 	int st;
 
 	st = read(irc->fd, line, sizeof(line) - 1);
 	if (st == 0) {
-		irc_abort(irc, 1, "Connection reset by peer");
+		if (!irc_detach(irc, "Connection reset by peer")) {
+			irc_abort(irc, 1, "Connection reset by peer");
+		}
 		return FALSE;
 	} else if (st < 0) {
+		int err = errno;
+
 		if (sockerr_again()) {
 			return TRUE;
-		} else {
-			irc_abort(irc, 1, "Read error: %s", strerror(errno));
-			return FALSE;
+		} else if (!irc_detach(irc, "Read error")) {
+			irc_abort(irc, 1, "Read error: %s", strerror(err));
 		}
+		return FALSE;
 	}
 
 	line[st] = '\0';
@@ -217,7 +222,7 @@ gboolean bitlbee_io_current_client_read(gpointer data, gint fd, b_input_conditio
 	irc_process(irc);
 
 	/* Normally, irc_process() shouldn't call irc_free() but irc_abort(). Just in case: */
-	if (!g_slist_find(irc_connection_list, irc)) {
+	if (!b_handle_get(handle)) {
 		log_message(LOGLVL_WARNING, "Abnormal termination of connection with fd %d.", fd);
 		return FALSE;
 	}
@@ -245,7 +250,11 @@ gboolean bitlbee_io_current_client_write(gpointer data, gint fd, b_input_conditi
 	st = write(irc->fd, irc->sendbuffer->str, size);
 
 	if (st == 0 || (st < 0 && !sockerr_again())) {
-		irc_abort(irc, 1, "Write error: %s", strerror(errno));
+		int err = errno;
+
+		if (!irc_detach(irc, "Write error")) {
+			irc_abort(irc, 1, "Write error: %s", strerror(err));
+		}
 		return FALSE;
 	} else if (st < 0) { /* && sockerr_again() */
 		return TRUE;
@@ -135,6 +135,7 @@ extern "C" {
    this password set, use /OPER to change it. */
 #define PASSWORD_PENDING "\r\rchangeme\r\r"
 
+#include "handle.h"
 #include "bee.h"
 #include "irc.h"
 #include "storage.h"
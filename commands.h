@@ -27,6 +27,7 @@
 #define _COMMANDS_H
 
 #include "bitlbee.h"
+#include "cmdtab.h"
 
 typedef struct command {
 	char *command;
@@ -36,6 +37,7 @@ typedef struct command {
 } command_t;
 
 extern command_t root_commands[];
+cmdtab_t *root_command_table(void);
 
 #define IRC_CMD_PRE_LOGIN       1
 #define IRC_CMD_LOGGED_IN       2
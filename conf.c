@@ -57,6 +57,8 @@ conf_t *conf_load(int argc, char *argv[])
 	conf->authmode = AUTHMODE_OPEN;
 	conf->auth_backend = NULL;
 	conf->auth_pass = NULL;
+	conf->auth_workers = 2;
+	conf->auth_cache_timeout = 0;
 	conf->oper_pass = NULL;
 	conf->allow_account_add = 1;
 	conf->configdir = g_strdup(CONFIG);
@@ -71,6 +73,12 @@ conf_t *conf_load(int argc, char *argv[])
 	conf->ft_listen = NULL;
 	conf->protocols = NULL;
 	conf->cafile = NULL;
+	conf->otr_keygen_workers = 2;
+	conf->otr_save_delay = 5;
+	conf->backlog_max = 262144;
+	conf->backlog_timeout = 86400;
+	conf->logins_per_protocol = 20;
+	conf->logins_per_host = 10;
 	proxytype = 0;
 
 	i = conf_loadini(conf, global.conf_file);
@@ -259,6 +267,18 @@ static int conf_loadini(conf_t *conf, char *file)
 					fprintf(stderr, "Invalid %s value: %s\n", ini->key, ini->value);
 					return 0;
 				}
+			} else if (g_strcasecmp(ini->key, "authworkers") == 0) {
+				if (sscanf(ini->value, "%d", &i) != 1 || i < 1) {
+					fprintf(stderr, "Invalid %s value: %s\n", ini->key, ini->value);
+					return 0;
+				}
+				conf->auth_workers = i;
+			} else if (g_strcasecmp(ini->key, "authcachetimeout") == 0) {
+				if (sscanf(ini->value, "%d", &i) != 1 || i < 0) {
+					fprintf(stderr, "Invalid %s value: %s\n", ini->key, ini->value);
+					return 0;
+				}
+				conf->auth_cache_timeout = i;
 			} else if (g_strcasecmp(ini->key, "authpassword") == 0) {
 				g_free(conf->auth_pass);
 				conf->auth_pass = g_strdup(ini->value);
@@ -352,6 +372,42 @@ static int conf_loadini(conf_t *conf, char *file)
 			} else if (g_strcasecmp(ini->key, "cafile") == 0) {
 				g_free(conf->cafile);
 				conf->cafile = g_strdup(ini->value);
+			} else if (g_strcasecmp(ini->key, "otrkeygenworkers") == 0) {
+				if (sscanf(ini->value, "%d", &i) != 1 || i < 1) {
+					fprintf(stderr, "Invalid %s value: %s\n", ini->key, ini->value);
+					return 0;
+				}
+				conf->otr_keygen_workers = i;
+			} else if (g_strcasecmp(ini->key, "otrsavedelay") == 0) {
+				if (sscanf(ini->value, "%d", &i) != 1 || i < 0) {
+					fprintf(stderr, "Invalid %s value: %s\n", ini->key, ini->value);
+					return 0;
+				}
+				conf->otr_save_delay = i;
+			} else if (g_strcasecmp(ini->key, "backlogmax") == 0) {
+				if (sscanf(ini->value, "%d", &i) != 1 || i < 0) {
+					fprintf(stderr, "Invalid %s value: %s\n", ini->key, ini->value);
+					return 0;
+				}
+				conf->backlog_max = i;
+			} else if (g_strcasecmp(ini->key, "backlogtimeout") == 0) {
+				if (sscanf(ini->value, "%d", &i) != 1 || i < 0 || i > G_MAXINT / 1000) {
+					fprintf(stderr, "Invalid %s value: %s\n", ini->key, ini->value);
+					return 0;
+				}
+				conf->backlog_timeout = i;
+			} else if (g_strcasecmp(ini->key, "loginsperprotocol") == 0) {
+				if (sscanf(ini->value, "%d", &i) != 1 || i < 0) {
+					fprintf(stderr, "Invalid %s value: %s\n", ini->key, ini->value);
+					return 0;
+				}
+				conf->logins_per_protocol = i;
+			} else if (g_strcasecmp(ini->key, "loginsperhost") == 0) {
+				if (sscanf(ini->value, "%d", &i) != 1 || i < 0) {
+					fprintf(stderr, "Invalid %s value: %s\n", ini->key, ini->value);
+					return 0;
+				}
+				conf->logins_per_host = i;
 			} else {
 				fprintf(stderr, "Error: Unknown setting `%s` in configuration file (line %d).\n",
 				        ini->key, ini->line);
@@ -38,6 +38,8 @@ typedef struct conf {
 	authmode_t authmode;
 	char *auth_backend;
 	char *auth_pass;
+	int auth_workers;
+	int auth_cache_timeout;
 	char *oper_pass;
 	int allow_account_add;
 	char *hostname;
@@ -55,6 +57,12 @@ typedef struct conf {
 	char *ft_listen;
 	char **protocols;
 	char *cafile;
+	int otr_keygen_workers;
+	int otr_save_delay;
+	int backlog_max;
+	int backlog_timeout;
+	int logins_per_protocol;
+	int logins_per_host;
 } conf_t;
 
 G_GNUC_MALLOC conf_t *conf_load(int argc, char *argv[]);
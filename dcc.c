@@ -66,6 +66,9 @@ gboolean dccs_send_proto(gpointer data, gint fd, b_input_condition cond);
 int dccs_send_request(struct dcc_file_transfer *df, irc_user_t *iu, struct sockaddr_storage *saddr);
 gboolean dccs_recv_proto(gpointer data, gint fd, b_input_condition cond);
 gboolean dccs_recv_write_request(file_transfer_t *ft);
+gboolean dccs_recv_done(file_transfer_t *ft, unsigned int len);
+void dccs_send_sent(file_transfer_t *file, unsigned int len);
+void dccs_send_error(file_transfer_t *file, const char *msg);
 gboolean dcc_progress(gpointer data, gint fd, b_input_condition cond);
 gboolean dcc_abort(dcc_file_transfer_t *df, char *reason, ...);
 
@@ -243,6 +246,8 @@ gboolean dccs_send_proto(gpointer data, gint fd, b_input_condition cond)
 		file->status = FT_STATUS_TRANSFERRING;
 		sock_make_nonblocking(fd);
 
+		df->relay = ft_relay_new(file, fd, dccs_send_sent, dccs_send_error);
+
 		/* IM protocol callback */
 		if (file->accept) {
 			file->accept(file);
@@ -337,6 +342,8 @@ gboolean dccs_recv_start(file_transfer_t *ft)
 	/* watch */
 	df->watch_out = b_input_add(df->fd, B_EV_IO_WRITE, dccs_recv_proto, df);
 	ft->write_request = dccs_recv_write_request;
+	ft->read_fd = fd;
+	ft->read_done = dccs_recv_done;
 
 	df->progress_timeout = b_timeout_add(DCC_MAX_STALL * 1000, dcc_progress, df);
 
@@ -359,7 +366,7 @@ gboolean dccs_recv_proto(gpointer data, gint fd, b_input_condition cond)
 	}
 
 	if (cond & B_EV_IO_READ) {
-		int ret, done;
+		int ret;
 
 		ASSERTSOCKOP(ret = recv(fd, ft->buffer, sizeof(ft->buffer), 0), "Receiving");
 
@@ -371,41 +378,54 @@ gboolean dccs_recv_proto(gpointer data, gint fd, b_input_condition cond)
 			return FALSE;
 		}
 
-		df->bytes_sent += ret;
+		df->watch_in = 0;
+		dccs_recv_done(ft, ret);
+		return FALSE;
+	}
 
-		done = df->bytes_sent >= ft->file_size;
+	return TRUE;
+}
 
-		if (((df->bytes_sent - ft->bytes_transferred) > DCC_PACKET_SIZE) ||
-		    done) {
-			guint32 ack = htonl(ft->bytes_transferred = df->bytes_sent);
-			int ackret;
+/*
+ * Bookkeeping for received data, also called by the sending side when it
+ * read (spliced) the data from our socket itself. Returns FALSE when
+ * there's nothing more to read.
+ */
+gboolean dccs_recv_done(file_transfer_t *ft, unsigned int len)
+{
+	dcc_file_transfer_t *df = ft->priv;
+	int done;
 
-			ASSERTSOCKOP(ackret = send(fd, &ack, 4, 0), "Sending DCC ACK");
+	df->bytes_sent += len;
 
-			if (ackret != 4) {
-				return dcc_abort(df, "Error sending DCC ACK, sent %d instead of 4 bytes", ackret);
-			}
-		}
+	done = df->bytes_sent >= ft->file_size;
 
-		if (df->bytes_sent == ret) {
-			ft->started = time(NULL);
-		}
+	if (((df->bytes_sent - ft->bytes_transferred) > DCC_PACKET_SIZE) ||
+	    done) {
+		guint32 ack = htonl(ft->bytes_transferred = df->bytes_sent);
+		int ackret;
 
-		if (done) {
-			if (df->watch_out) {
-				b_event_remove(df->watch_out);
-			}
+		ASSERTSOCKOP(ackret = send(df->fd, &ack, 4, 0), "Sending DCC ACK");
 
-			df->watch_in = 0;
+		if (ackret != 4) {
+			return dcc_abort(df, "Error sending DCC ACK, sent %d instead of 4 bytes", ackret);
+		}
+	}
 
-			if (df->proto_finished) {
-				dcc_finish(ft);
-			}
+	if (df->bytes_sent == len) {
+		ft->started = time(NULL);
+	}
 
-			return FALSE;
+	if (done) {
+		if (df->watch_out) {
+			b_event_remove(df->watch_out);
+			df->watch_out = 0;
+		}
+
+		if (df->proto_finished) {
+			dcc_finish(ft);
 		}
 
-		df->watch_in = 0;
 		return FALSE;
 	}
 
@@ -425,53 +445,37 @@ gboolean dccs_recv_write_request(file_transfer_t *ft)
 	return TRUE;
 }
 
-gboolean dccs_send_can_write(gpointer data, gint fd, b_input_condition cond)
-{
-	struct dcc_file_transfer *df = data;
-
-	df->watch_out = 0;
-
-	df->ft->write_request(df->ft);
-	return FALSE;
-}
-
 /*
- * Incoming data.
- *
+ * Incoming data. The relay sends it out as the client takes it and asks
+ * for more by itself.
  */
 gboolean dccs_send_write(file_transfer_t *file, char *data, unsigned int data_len)
 {
 	dcc_file_transfer_t *df = file->priv;
-	int ret;
 
 	receivedchunks++; receiveddata += data_len;
 
-	if (df->watch_out) {
-		return dcc_abort(df, "BUG: write() called while watching");
+	if (!df->relay) {
+		return dcc_abort(df, "BUG: write() called before the connection was accepted");
 	}
 
-	ASSERTSOCKOP(ret = send(df->fd, data, data_len, 0), "Sending data");
-
-	if (ret == 0) {
-		return dcc_abort(df, "Remote end closed connection");
-	}
+	return ft_relay_write(df->relay, data, data_len);
+}
 
-	/* TODO: this should really not be fatal */
-	if (ret < data_len) {
-		return dcc_abort(df, "send() sent %d instead of %d", ret, data_len);
-	}
+void dccs_send_sent(file_transfer_t *file, unsigned int len)
+{
+	dcc_file_transfer_t *df = file->priv;
 
 	if (df->bytes_sent == 0) {
 		file->started = time(NULL);
 	}
 
-	df->bytes_sent += ret;
-
-	if (df->bytes_sent < df->ft->file_size) {
-		df->watch_out = b_input_add(df->fd, B_EV_IO_WRITE, dccs_send_can_write, df);
-	}
+	df->bytes_sent += len;
+}
 
-	return TRUE;
+void dccs_send_error(file_transfer_t *file, const char *msg)
+{
+	dcc_abort(file->priv, "%s", msg);
 }
 
 /*
@@ -486,6 +490,7 @@ void dcc_close(file_transfer_t *file)
 		file->free(file);
 	}
 
+	ft_relay_free(df->relay);
 	closesocket(df->fd);
 
 	if (df->watch_in) {
@@ -88,6 +88,9 @@ typedef struct dcc_file_transfer {
 	/* if we're receiving, this is the sender's socket address */
 	struct sockaddr_storage saddr;
 
+	/* if we're sending, buffers the data between the IM protocol and the socket */
+	ft_relay_t *relay;
+
 	/* set to true if the protocol has finished
 	 * (i.e. called imcb_file_finished)
 	 */
@@ -33,6 +33,20 @@
 GSList *child_list = NULL;
 static int ipc_child_recv_fd = -1;
 
+/* OTR keygen slots handed out by the master, and children waiting for one. */
+static int ipc_keygen_running = 0;
+static GSList *ipc_keygen_waiting = NULL;
+
+void (*ipc_child_keygen_hook)(irc_t *irc, char **cmd) = NULL;
+
+/* ForkDaemon children's places in the login queue (see bee_login.c). */
+struct ipc_login {
+	struct bitlbee_child *child;
+	int id;
+	login_req_t *req;
+};
+static GSList *ipc_logins = NULL;
+
 static void ipc_master_takeover_fail(struct bitlbee_child *child, gboolean both);
 static gboolean ipc_send_fd(int fd, int send_fd);
 
@@ -152,7 +166,7 @@ void ipc_master_cmd_identify(irc_t *data, char **cmd)
 	}
 
 	if (l && !child->to_child && !old->to_child) {
-		resp = "TAKEOVER INIT\r\n";
+		resp = old->detached ? "TAKEOVER INIT DETACHED\r\n" : "TAKEOVER INIT\r\n";
 		child->to_child = old;
 		old->to_child = child;
 	} else {
@@ -223,6 +237,246 @@ void ipc_master_cmd_takeover(irc_t *data, char **cmd)
 	}
 }
 
+/* Gives free keygen slots to whoever has been waiting longest. */
+static void ipc_master_keygen_next(void)
+{
+	struct bitlbee_child *child;
+
+	while (ipc_keygen_waiting && ipc_keygen_running < global.conf->otr_keygen_workers) {
+		child = ipc_keygen_waiting->data;
+		ipc_keygen_waiting = g_slist_remove(ipc_keygen_waiting, child);
+
+		child->keygen = TRUE;
+		ipc_keygen_running++;
+		if (write(child->ipc_fd, "KEYGEN GO\r\n", 11) != 11) {
+			ipc_master_free_one(child);
+		}
+	}
+}
+
+static void ipc_master_keygen_release(struct bitlbee_child *child)
+{
+	ipc_keygen_waiting = g_slist_remove(ipc_keygen_waiting, child);
+
+	if (child->keygen) {
+		child->keygen = FALSE;
+		ipc_keygen_running--;
+		ipc_master_keygen_next();
+	}
+}
+
+static void ipc_master_cmd_keygen(irc_t *data, char **cmd)
+{
+	struct bitlbee_child *child = (void *) data;
+	char *resp;
+
+	/* Only ForkDaemon children have to ask, the OTR module keeps its
+	   own count otherwise. */
+	if (child == NULL) {
+		return;
+	}
+
+	if (g_strcasecmp(cmd[1], "REQUEST") == 0) {
+		if (child->keygen) {
+			resp = g_strdup("KEYGEN GO\r\n");
+		} else if (!ipc_keygen_waiting &&
+		           ipc_keygen_running < global.conf->otr_keygen_workers) {
+			child->keygen = TRUE;
+			ipc_keygen_running++;
+			resp = g_strdup("KEYGEN GO\r\n");
+		} else {
+			if (!g_slist_find(ipc_keygen_waiting, child)) {
+				ipc_keygen_waiting = g_slist_append(ipc_keygen_waiting, child);
+			}
+			resp = g_strdup_printf("KEYGEN WAIT %d\r\n",
+			                       g_slist_index(ipc_keygen_waiting, child) + 1);
+		}
+
+		if (write(child->ipc_fd, resp, strlen(resp)) != strlen(resp)) {
+			ipc_master_free_one(child);
+		}
+		g_free(resp);
+	} else if (g_strcasecmp(cmd[1], "DONE") == 0) {
+		ipc_master_keygen_release(child);
+	}
+}
+
+static void ipc_master_backlog_line(const char *nick, const char *host, pid_t pid,
+                                    gboolean detached, gsize size, gsize raw)
+{
+	ipc_to_children_str("OPERMSG :Backlog of %s@%s (PID=%d)%s: %" G_GSIZE_FORMAT
+	                    " bytes (%" G_GSIZE_FORMAT " uncompressed)\r\n",
+	                    nick, host, (int) pid, detached ? ", detached" : "", size, raw);
+}
+
+/* SIZE updates come from ForkDaemon children, anything else is an
+   operator asking for the list. */
+static void ipc_master_cmd_backlog(irc_t *data, char **cmd)
+{
+	struct bitlbee_child *child = (void *) data;
+	gsize total = 0;
+	int n = 0;
+	GSList *l;
+
+	if (cmd[1] && g_strcasecmp(cmd[1], "SIZE") == 0) {
+		if (child && cmd[2] && cmd[3] && cmd[4]) {
+			child->backlog_size = g_ascii_strtoull(cmd[2], NULL, 10);
+			child->backlog_raw = g_ascii_strtoull(cmd[3], NULL, 10);
+			child->detached = atoi(cmd[4]) != 0;
+		}
+		return;
+	}
+
+	if (global.conf->runmode == RUNMODE_FORKDAEMON) {
+		for (l = child_list; l; l = l->next) {
+			struct bitlbee_child *c = l->data;
+
+			if (c->detached || c->backlog_size > 0) {
+				ipc_master_backlog_line(c->nick, c->host, c->pid, c->detached,
+				                        c->backlog_size, c->backlog_raw);
+				total += c->backlog_size;
+				n++;
+			}
+		}
+	} else {
+		for (l = irc_connection_list; l; l = l->next) {
+			irc_t *irc = l->data;
+			gsize size, raw;
+
+			size = irc_backlog_size(irc, &raw);
+			if ((irc->status & USTATUS_DETACHED) || size > 0) {
+				ipc_master_backlog_line(irc->user->nick, irc->user->host, getpid(),
+				                        irc->status & USTATUS_DETACHED, size, raw);
+				total += size;
+				n++;
+			}
+		}
+	}
+
+	ipc_to_children_str("OPERMSG :%d session%s with a backlog, %" G_GSIZE_FORMAT " bytes in total\r\n",
+	                    n, n == 1 ? "" : "s", total);
+}
+
+static void ipc_master_login_write(struct ipc_login *il, const char *fmt, int arg)
+{
+	char *resp = g_strdup_printf(fmt, il->id, arg);
+
+	if (write(il->child->ipc_fd, resp, strlen(resp)) != strlen(resp)) {
+		ipc_master_free_one(il->child);
+	}
+	g_free(resp);
+}
+
+static void ipc_master_login_go(gpointer data)
+{
+	ipc_master_login_write(data, "LOGIN GO %d\r\n", 0);
+}
+
+static void ipc_master_login_wait(gpointer data, int pos)
+{
+	ipc_master_login_write(data, "LOGIN WAIT %d %d\r\n", pos);
+}
+
+static struct ipc_login *ipc_master_login_find(struct bitlbee_child *child, int id)
+{
+	GSList *l;
+
+	for (l = ipc_logins; l; l = l->next) {
+		struct ipc_login *il = l->data;
+
+		if (il->child == child && il->id == id) {
+			return il;
+		}
+	}
+
+	return NULL;
+}
+
+static void ipc_master_login_free(struct ipc_login *il)
+{
+	ipc_logins = g_slist_remove(ipc_logins, il);
+	login_sched_done(il->req);
+	g_free(il);
+}
+
+static void ipc_master_login_release(struct bitlbee_child *child)
+{
+	GSList *l, *next;
+
+	for (l = ipc_logins; l; l = next) {
+		struct ipc_login *il = l->data;
+
+		next = l->next;
+		if (il->child == child) {
+			ipc_master_login_free(il);
+		}
+	}
+}
+
+/* LOGIN REQUEST <id> <prio> <protocol> <host> :<account>, or LOGIN DONE <id> */
+static void ipc_master_cmd_login(irc_t *data, char **cmd)
+{
+	struct bitlbee_child *child = (void *) data;
+	struct ipc_login *il;
+
+	if (child == NULL || cmd[2] == NULL) {
+		return;
+	}
+
+	il = ipc_master_login_find(child, atoi(cmd[2]));
+
+	if (g_strcasecmp(cmd[1], "REQUEST") == 0 && cmd[3] && cmd[4] && cmd[5] && cmd[6]) {
+		char *label;
+
+		if (il) {
+			return;
+		}
+
+		il = g_new0(struct ipc_login, 1);
+		il->child = child;
+		il->id = atoi(cmd[2]);
+
+		label = g_strdup_printf("%s/%s", child->nick ? child->nick : "?", cmd[6]);
+		il->req = login_sched_add(cmd[4], cmd[5], label,
+		                          CLAMP(atoi(cmd[3]), LOGIN_PRIO_USER, LOGIN_PRIO_RECONNECT),
+		                          ipc_master_login_go, ipc_master_login_wait, il);
+		g_free(label);
+
+		ipc_logins = g_slist_prepend(ipc_logins, il);
+	} else if (g_strcasecmp(cmd[1], "DONE") == 0 && il) {
+		ipc_master_login_free(il);
+	}
+}
+
+static void ipc_master_logins_line(login_req_t *req, int pos, gpointer data)
+{
+	static const char *prios[] = { "user", "auto_connect", "reconnect" };
+	int *n = data;
+
+	if (pos == 0) {
+		ipc_to_children_str("OPERMSG :Logging in: %s (%s, %s) for %d seconds\r\n",
+		                    req->label, req->protocol, req->host,
+		                    (int) (time(NULL) - req->started));
+		n[0]++;
+	} else {
+		ipc_to_children_str("OPERMSG :Waiting #%d: %s (%s, %s, %s) for %d seconds\r\n",
+		                    pos, req->label, req->protocol, req->host, prios[req->prio],
+		                    (int) (time(NULL) - req->queued));
+		n[1]++;
+	}
+}
+
+static void ipc_master_cmd_logins(irc_t *data, char **cmd)
+{
+	int n[2] = { 0, 0 };
+
+	login_sched_foreach(ipc_master_logins_line, n);
+	ipc_to_children_str("OPERMSG :%d login%s in progress, %d waiting "
+	                    "(at most %d per protocol, %d per host)\r\n",
+	                    n[0], n[0] == 1 ? "" : "s", n[1],
+	                    global.conf->logins_per_protocol, global.conf->logins_per_host);
+}
+
 static const command_t ipc_master_commands[] = {
 	{ "client",     3, ipc_master_cmd_client,     0 },
 	{ "hello",      0, ipc_master_cmd_client,     0 },
@@ -237,6 +491,10 @@ static const command_t ipc_master_commands[] = {
 	{ "restart",    0, ipc_master_cmd_restart,    0 },
 	{ "identify",   2, ipc_master_cmd_identify,   0 },
 	{ "takeover",   1, ipc_master_cmd_takeover,   0 },
+	{ "keygen",     1, ipc_master_cmd_keygen,     0 },
+	{ "backlog",    0, ipc_master_cmd_backlog,    0 },
+	{ "login",      2, ipc_master_cmd_login,      0 },
+	{ "logins",     0, ipc_master_cmd_logins,     0 },
 	{ NULL }
 };
 
@@ -313,6 +571,9 @@ static void ipc_child_cmd_hello(irc_t *irc, char **cmd)
 	} else {
 		ipc_to_master_str("HELLO %s %s :%s\r\n", irc->user->host, irc->user->nick, irc->user->fullname);
 	}
+
+	/* A new master, it doesn't know about our logins yet. */
+	account_login_resend(irc->b);
 }
 
 static void ipc_child_cmd_takeover_yes(void *data);
@@ -331,8 +592,15 @@ static void ipc_child_cmd_takeover(irc_t *irc, char **cmd)
 		}
 
 		/* Offer to take over the old session, unless for some reason
-		   we're already logging into IM connections. */
-		if (irc->login_source_id != -1) {
+		   we're already logging into IM connections. Nobody's using
+		   a detached session, so don't bother asking in that case. */
+		if (irc->login_source_id != -1 && cmd[2] &&
+		    strcmp(cmd[2], "DETACHED") == 0) {
+			b_event_remove(irc->login_source_id);
+			irc->login_source_id = -1;
+			ipc_child_cmd_takeover_yes(irc);
+			return;
+		} else if (irc->login_source_id != -1) {
 			query_add(irc, NULL,
 			          "You're already connected to this server. "
 			          "Would you like to take over this session?",
@@ -353,6 +621,7 @@ static void ipc_child_cmd_takeover(irc_t *irc, char **cmd)
 			irc_switch_fd(irc, ipc_child_recv_fd);
 			irc_sync(irc);
 			irc_rootmsg(irc, "You've successfully taken over your old session");
+			irc_backlog_replay(irc);
 			ipc_child_recv_fd = -1;
 
 			ipc_to_master_str("TAKEOVER DONE\r\n");
@@ -425,6 +694,28 @@ static void ipc_child_cmd_takeover_no(void *data)
 	cmd_identify_finish(data, 0, 0);
 }
 
+static void ipc_child_cmd_keygen(irc_t *irc, char **cmd)
+{
+	if (ipc_child_keygen_hook) {
+		ipc_child_keygen_hook(irc, cmd);
+	}
+}
+
+static void ipc_child_cmd_login(irc_t *irc, char **cmd)
+{
+	account_t *a;
+
+	if (!irc || !(a = account_by_login_id(irc->b, atoi(cmd[2]))) || !a->login_waiting) {
+		return;
+	}
+
+	if (g_strcasecmp(cmd[1], "GO") == 0) {
+		account_login_go(a);
+	} else if (g_strcasecmp(cmd[1], "WAIT") == 0 && cmd[3]) {
+		account_login_wait(a, atoi(cmd[3]));
+	}
+}
+
 static const command_t ipc_child_commands[] = {
 	{ "die",        0, ipc_child_cmd_die,         0 },
 	{ "wallops",    1, ipc_child_cmd_wallops,     0 },
@@ -434,6 +725,8 @@ static const command_t ipc_child_commands[] = {
 	{ "kill",       2, ipc_child_cmd_kill,        0 },
 	{ "hello",      0, ipc_child_cmd_hello,       0 },
 	{ "takeover",   1, ipc_child_cmd_takeover,    0 },
+	{ "keygen",     1, ipc_child_cmd_keygen,      0 },
+	{ "login",      2, ipc_child_cmd_login,       0 },
 	{ NULL }
 };
 
@@ -452,7 +745,7 @@ gboolean ipc_child_identify(irc_t *irc)
 	} else if (global.conf->runmode == RUNMODE_DAEMON) {
 		GSList *l;
 		irc_t *old = NULL;
-		char *to_init[] = { "TAKEOVER", "INIT", NULL };
+		char *to_init[] = { "TAKEOVER", "INIT", NULL, NULL };
 
 		for (l = irc_connection_list; l; l = l->next) {
 			old = l->data;
@@ -471,6 +764,9 @@ gboolean ipc_child_identify(irc_t *irc)
 			return FALSE;
 		}
 
+		if (old->status & USTATUS_DETACHED) {
+			to_init[2] = "DETACHED";
+		}
 		ipc_child_cmd_takeover(irc, to_init);
 
 		return TRUE;
@@ -504,31 +800,34 @@ static void ipc_master_takeover_fail(struct bitlbee_child *child, gboolean both)
 
 static void ipc_command_exec(void *data, char **cmd, const command_t *commands)
 {
-	int i, j;
+	static cmdtab_t master_cmdtab = CMDTAB_INIT, child_cmdtab = CMDTAB_INIT;
+	cmdtab_t *tab = commands == ipc_master_commands ? &master_cmdtab : &child_cmdtab;
+	const command_t *c;
+	int j;
 
 	if (!cmd[0]) {
 		return;
 	}
 
-	for (i = 0; commands[i].command; i++) {
-		if (g_strcasecmp(commands[i].command, cmd[0]) == 0) {
-			/* There is no typo in this line: */
-			for (j = 1; cmd[j]; j++) {
-				;
-			}
-			j--;
+	if (tab->len == 0) {
+		cmdtab_add_array(tab, commands, sizeof(command_t));
+	}
 
-			if (j < commands[i].required_parameters) {
-				break;
-			}
+	if ((c = cmdtab_find(tab, cmd[0]))) {
+		/* There is no typo in this line: */
+		for (j = 1; cmd[j]; j++) {
+			;
+		}
+		j--;
 
-			if (commands[i].flags & IPC_CMD_TO_CHILDREN) {
-				ipc_to_children(cmd);
-			} else {
-				commands[i].execute(data, cmd);
-			}
+		if (j < c->required_parameters) {
+			return;
+		}
 
-			break;
+		if (c->flags & IPC_CMD_TO_CHILDREN) {
+			ipc_to_children(cmd);
+		} else {
+			c->execute(data, cmd);
 		}
 	}
 }
@@ -776,6 +1075,8 @@ void ipc_master_free_one(struct bitlbee_child *c)
 	}
 
 	child_list = g_slist_remove(child_list, c);
+	ipc_master_keygen_release(c);
+	ipc_master_login_release(c);
 
 	g_free(c->host);
 	g_free(c->nick);
@@ -816,10 +1117,17 @@ void ipc_master_free_all()
 
 void ipc_child_disable()
 {
+	GSList *l;
+
 	b_event_remove(global.listen_watch_source_id);
 	close(global.listen_socket);
 
 	global.listen_socket = -1;
+
+	/* Nobody to hand out login slots anymore, do it ourselves. */
+	for (l = irc_connection_list; l; l = l->next) {
+		account_login_resend(((irc_t *) l->data)->b);
+	}
 }
 
 char *ipc_master_save_state()
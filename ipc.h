@@ -41,6 +41,14 @@ struct bitlbee_child {
 	/* For takeovers: */
 	struct bitlbee_child *to_child;
 	int to_fd;
+
+	/* Holds one of the OTR keygen slots (see OtrKeygenWorkers). */
+	gboolean keygen;
+
+	/* Last BACKLOG SIZE report: no client connected, message backlog
+	   size (and what that would be uncompressed). */
+	gboolean detached;
+	gsize backlog_size, backlog_raw;
 };
 
 
@@ -63,6 +71,9 @@ void ipc_to_children_str(char *format, ...) G_GNUC_PRINTF(1, 2);
 /* We need this function in inetd mode, so let's just make it non-static. */
 void ipc_master_cmd_rehash(irc_t *data, char **cmd);
 
+/* Set by the OTR module to receive KEYGEN replies from the master. */
+extern void (*ipc_child_keygen_hook)(irc_t *irc, char **cmd);
+
 char *ipc_master_save_state();
 int ipc_master_load_state(char *statefile);
 int ipc_master_listen_socket();
@@ -25,6 +25,7 @@
 
 #include "bitlbee.h"
 #include "canohost.h"
+#include "scan.h"
 #include "ipc.h"
 #include "dcc.h"
 #include "lib/ssl_client.h"
@@ -33,10 +34,45 @@ GSList *irc_connection_list;
 GSList *irc_plugins;
 
 static gboolean irc_userping(gpointer _irc, gint fd, b_input_condition cond);
+static gboolean irc_idle_check(gpointer _irc, gint fd, b_input_condition cond);
+/* Called for everything that means the user is actually around. Only
+   messages count, clients send all kinds of other stuff on their own. */
+void irc_activity(irc_t *irc)
+{
+	int timeout = set_getint(&irc->b->set, "inactive_timeout");
+
+	irc->last_activity = time(NULL);
+	bee_set_idle(irc->b, FALSE);
+
+	if (irc->idle_source_id == 0 && timeout > 0) {
+		irc->idle_source_id = b_timeout_add(timeout * 1000, irc_idle_check, irc);
+	}
+}
+
+static gboolean irc_idle_check(gpointer _irc, gint fd, b_input_condition cond)
+{
+	irc_t *irc = _irc;
+	int timeout = set_getint(&irc->b->set, "inactive_timeout");
+	time_t idle = time(NULL) - irc->last_activity;
+
+	irc->idle_source_id = 0;
+
+	if (timeout <= 0) {
+		return FALSE;
+	} else if (idle >= timeout) {
+		bee_set_idle(irc->b, TRUE);
+	} else {
+		irc->idle_source_id = b_timeout_add((timeout - idle) * 1000, irc_idle_check, irc);
+	}
+
+	return FALSE;
+}
+
 static char *set_eval_charset(set_t *set, char *value);
 static char *set_eval_password(set_t *set, char *value);
 static char *set_eval_bw_compat(set_t *set, char *value);
 static char *set_eval_utf8_nicks(set_t *set, char *value);
+static void irc_write_schedule(irc_t *irc);
 
 irc_t *irc_new(int fd)
 {
@@ -56,7 +92,7 @@ irc_t *irc_new(int fd)
 	irc->status = USTATUS_OFFLINE;
 	irc->last_pong = gettime();
 
-	irc->nick_user_hash = g_hash_table_new(g_str_hash, g_str_equal);
+	irc->nick_user_hash = g_hash_table_new(nick_hash, nick_equal);
 	irc->watches = g_hash_table_new(g_str_hash, g_str_equal);
 
 	irc->iconv = (GIConv) - 1;
@@ -69,6 +105,7 @@ irc_t *irc_new(int fd)
 	}
 
 	irc_connection_list = g_slist_append(irc_connection_list, irc);
+	irc->handle = b_handle_new(irc);
 
 	b = irc->b = bee_new();
 	b->ui_data = irc;
@@ -78,11 +115,13 @@ irc_t *irc_new(int fd)
 	s = set_add(&b->set, "away_devoice", "true", set_eval_bw_compat, irc);
 	s->flags |= SET_HIDDEN;
 	s = set_add(&b->set, "away_reply_timeout", "3600", set_eval_int, irc);
+	s = set_add(&b->set, "backlog", "0", set_eval_backlog, irc);
 	s = set_add(&b->set, "charset", "utf-8", set_eval_charset, irc);
 	s = set_add(&b->set, "default_target", "root", NULL, irc);
 	s = set_add(&b->set, "display_namechanges", "false", set_eval_bool, irc);
 	s = set_add(&b->set, "display_timestamps", "true", set_eval_bool, irc);
 	s = set_add(&b->set, "handle_unknown", "add_channel", NULL, irc);
+	s = set_add(&b->set, "inactive_timeout", "900", set_eval_int, irc);
 	s = set_add(&b->set, "last_version", "0", NULL, irc);
 	s->flags |= SET_HIDDEN;
 	s = set_add(&b->set, "nick_format", "%-@nick", NULL, irc);
@@ -250,6 +289,8 @@ void irc_free(irc_t * irc)
 
 	log_message(LOGLVL_INFO, "Destroying connection with fd %d", irc->fd);
 
+	auth_cancel(irc);
+
 	if (irc->status & USTATUS_IDENTIFIED && set_getbool(&irc->b->set, "save_on_quit")) {
 		if (storage_save(irc, NULL, TRUE) != STORAGE_OK) {
 			log_message(LOGLVL_WARNING, "Error while saving settings for user %s", irc->user->nick);
@@ -264,6 +305,7 @@ void irc_free(irc_t * irc)
 	}
 
 	irc_connection_list = g_slist_remove(irc_connection_list, irc);
+	b_handle_free(irc->handle);
 
 	while (irc->queries != NULL) {
 		query_del(irc, irc->queries);
@@ -288,6 +330,12 @@ void irc_free(irc_t * irc)
 	if (irc->ping_source_id > 0) {
 		b_event_remove(irc->ping_source_id);
 	}
+	if (irc->idle_source_id > 0) {
+		b_event_remove(irc->idle_source_id);
+	}
+	if (irc->detach_source_id > 0) {
+		b_event_remove(irc->detach_source_id);
+	}
 	if (irc->r_watch_source_id > 0) {
 		b_event_remove(irc->r_watch_source_id);
 	}
@@ -310,8 +358,12 @@ void irc_free(irc_t * irc)
 		g_iconv_close(irc->oconv);
 	}
 
+	irc_backlog_free(irc);
+
 	g_string_free(irc->sendbuffer, TRUE);
 	g_free(irc->readbuffer);
+	g_free(irc->lines);
+	g_free(irc->cmd);
 	g_free(irc->password);
 
 	g_free(irc);
@@ -357,18 +409,20 @@ static char *set_eval_password(set_t *set, char *value)
 	}
 }
 
-static char **irc_splitlines(char *buffer);
+static char **irc_splitlines(irc_t *irc, char *buffer);
 
 void irc_process(irc_t *irc)
 {
 	char **lines, *temp, **cmd;
+	b_handle_t handle = irc->handle;
 	int i;
 
 	if (irc->readbuffer != NULL) {
-		lines = irc_splitlines(irc->readbuffer);
+		lines = irc_splitlines(irc, irc->readbuffer);
 
 		for (i = 0; *lines[i] != '\0'; i++) {
-			char *conv = NULL;
+			char *line = lines[i], *conv = NULL;
+			gboolean valid = TRUE;
 
 			/* [WvG] If the last line isn't empty, it's an incomplete line and we
 			   should wait for the rest to come in before processing it. */
@@ -383,49 +437,57 @@ void irc_process(irc_t *irc)
 			if (irc->iconv != (GIConv) - 1) {
 				gsize bytes_read, bytes_written;
 
-				conv = g_convert_with_iconv(lines[i], -1, irc->iconv,
+				conv = g_convert_with_iconv(line, -1, irc->iconv,
 				                            &bytes_read, &bytes_written, NULL);
 
-				if (conv == NULL || bytes_read != strlen(lines[i])) {
-					/* GLib can do strange things if things are not in the expected charset,
-					   so let's be a little bit paranoid here: */
-					if (irc->status & USTATUS_LOGGED_IN) {
-						irc_rootmsg(irc, "Error: Charset mismatch detected. The charset "
-						            "setting is currently set to %s, so please make "
-						            "sure your IRC client will send and accept text in "
-						            "that charset, or tell BitlBee which charset to "
-						            "expect by changing the charset setting. See "
-						            "`help set charset' for more information. Your "
-						            "message was ignored.",
-						            set_getstr(&irc->b->set, "charset"));
-
-						g_free(conv);
-						conv = NULL;
-					} else {
-						irc_write(irc, ":%s NOTICE * :%s", irc->root->host,
-						          "Warning: invalid characters received at login time.");
-
-						conv = g_strdup(lines[i]);
-						for (temp = conv; *temp; temp++) {
-							if (*temp & 0x80) {
-								*temp = '?';
-							}
+				if (conv == NULL || bytes_read != strlen(line)) {
+					g_free(conv);
+					conv = NULL;
+					valid = FALSE;
+				}
+				lines[i] = conv;
+			} else if (!scan_utf8_valid(line, strlen(line))) {
+				/* UTF-8 in, UTF-8 out: no need to convert, just
+				   check. */
+				valid = FALSE;
+			}
+
+			if (!valid) {
+				/* GLib can do strange things if things are not in the expected charset,
+				   so let's be a little bit paranoid here: */
+				if (irc->status & USTATUS_LOGGED_IN) {
+					irc_rootmsg(irc, "Error: Charset mismatch detected. The charset "
+					            "setting is currently set to %s, so please make "
+					            "sure your IRC client will send and accept text in "
+					            "that charset, or tell BitlBee which charset to "
+					            "expect by changing the charset setting. See "
+					            "`help set charset' for more information. Your "
+					            "message was ignored.",
+					            set_getstr(&irc->b->set, "charset"));
+
+					lines[i] = NULL;
+				} else {
+					irc_write(irc, ":%s NOTICE * :%s", irc->root->host,
+					          "Warning: invalid characters received at login time.");
+
+					/* The read buffer is ours to mangle anyway. */
+					for (temp = line; *temp; temp++) {
+						if (*temp & 0x80) {
+							*temp = '?';
 						}
 					}
+					lines[i] = line;
 				}
-				lines[i] = conv;
 			}
 
-			if (lines[i] && (cmd = irc_parse_line(lines[i]))) {
+			if (lines[i] && (cmd = irc_parse_line_buf(lines[i], &irc->cmd, &irc->cmd_size))) {
 				irc_exec(irc, cmd);
-				g_free(cmd);
 			}
 
 			g_free(conv);
 
 			/* Shouldn't really happen, but just in case... */
-			if (!g_slist_find(irc_connection_list, irc)) {
-				g_free(lines);
+			if (!b_handle_get(handle)) {
 				return;
 			}
 		}
@@ -434,44 +496,45 @@ void irc_process(irc_t *irc)
 			g_free(irc->readbuffer);
 			irc->readbuffer = NULL;
 		}
-
-		g_free(lines);
 	}
 }
 
 /* Splits a long string into separate lines. The array is NULL-terminated
    and, unless the string contains an incomplete line at the end, ends with
    an empty string. Could use g_strsplit() but this one does it in-place.
-   (So yes, it's destructive.) */
-static char **irc_splitlines(char *buffer)
+   (So yes, it's destructive.) The array is irc->lines, valid until the
+   next call. */
+static char **irc_splitlines(irc_t *irc, char *buffer)
 {
-	int i, j, n = 3;
-	char **lines;
+	char **lines, *s, *end = buffer + strlen(buffer);
+	int j = 0;
 
-	/* Allocate n+1 elements. */
-	lines = g_new(char *, n + 1);
+	/* Always keep room for n+1 elements. */
+	if (irc->lines == NULL) {
+		irc->lines_size = 3;
+		irc->lines = g_new(char *, irc->lines_size + 1);
+	}
+	lines = irc->lines;
 
 	lines[0] = buffer;
 
 	/* Split the buffer in several strings, and accept any kind of line endings,
 	 * knowing that ERC on Windows may send something interesting like \r\r\n,
 	 * and surely there must be clients that think just \n is enough... */
-	for (i = 0, j = 0; buffer[i] != '\0'; i++) {
-		if (buffer[i] == '\r' || buffer[i] == '\n') {
-			while (buffer[i] == '\r' || buffer[i] == '\n') {
-				buffer[i++] = '\0';
-			}
+	for (s = buffer; (s = (char *) scan_any(s, end - s, "\r\n")); ) {
+		while (*s == '\r' || *s == '\n') {
+			*(s++) = '\0';
+		}
 
-			lines[++j] = buffer + i;
+		lines[++j] = s;
 
-			if (j >= n) {
-				n *= 2;
-				lines = g_renew(char *, lines, n + 1);
-			}
+		if (j >= irc->lines_size) {
+			irc->lines_size *= 2;
+			lines = irc->lines = g_renew(char *, lines, irc->lines_size + 1);
+		}
 
-			if (buffer[i] == '\0') {
-				break;
-			}
+		if (*s == '\0') {
+			break;
 		}
 	}
 
@@ -483,6 +546,14 @@ static char **irc_splitlines(char *buffer)
 
 /* Split an IRC-style line into little parts/arguments. */
 char **irc_parse_line(char *line)
+{
+	return irc_parse_line_buf(line, NULL, NULL);
+}
+
+/* Same as irc_parse_line(), but if cmdp is set the result goes into *cmdp
+   (of *sizep elements), which is grown when necessary and must not be
+   freed by the caller. */
+char **irc_parse_line_buf(char *line, char ***cmdp, int *sizep)
 {
 	int i, j;
 	char **cmd;
@@ -517,7 +588,15 @@ char **irc_parse_line(char *line)
 	}
 
 	/* Allocate the space we need. */
-	cmd = g_new(char *, j + 1);
+	if (cmdp == NULL) {
+		cmd = g_new(char *, j + 1);
+	} else {
+		if (*sizep < j + 1) {
+			*sizep = MAX(j + 1, *sizep * 2);
+			*cmdp = g_renew(char *, *cmdp, *sizep);
+		}
+		cmd = *cmdp;
+	}
 	cmd[j] = NULL;
 
 	/* Do the actual line splitting, format is:
@@ -599,6 +678,11 @@ void irc_write_all(int now, char *format, ...)
 	while (temp != NULL) {
 		irc_t *irc = temp->data;
 
+		if (irc->status & USTATUS_DETACHED) {
+			temp = temp->next;
+			continue;
+		}
+
 		if (now) {
 			g_string_assign(irc->sendbuffer, "\r\n");
 		}
@@ -613,16 +697,29 @@ void irc_write_all(int now, char *format, ...)
 	return;
 }
 
+/* With a UTF-8 charset there's no iconv to refuse broken text, so replace
+   whatever isn't valid UTF-8 with question marks before it goes out. */
+static void irc_write_fix_utf8(char *s, gsize len)
+{
+	const gchar *end;
+
+	while (!g_utf8_validate(s, len, &end)) {
+		len -= end - s;
+		s = (char *) end;
+		*s = '?';
+	}
+}
+
 void irc_vawrite(irc_t *irc, char *format, va_list params)
 {
 	char line[IRC_MAX_LINE + 1];
 
-	/* Don't try to write anything new anymore when shutting down. */
-	if (irc->status & USTATUS_SHUTDOWN) {
+	/* Don't try to write anything new anymore when shutting down, and
+	   there's nobody to write to while detached. */
+	if (irc->status & (USTATUS_SHUTDOWN | USTATUS_DETACHED)) {
 		return;
 	}
 
-	memset(line, 0, sizeof(line));
 	g_vsnprintf(line, IRC_MAX_LINE - 2, format, params);
 	strip_newlines(line);
 
@@ -633,16 +730,50 @@ void irc_vawrite(irc_t *irc, char *format, va_list params)
 		conv = g_convert_with_iconv(line, -1, irc->oconv,
 		                            &bytes_read, &bytes_written, NULL);
 
-		if (bytes_read == strlen(line)) {
-			strncpy(line, conv, IRC_MAX_LINE - 2);
+		if (conv && bytes_read == strlen(line)) {
+			/* Converting can make it longer, always leave room for
+			   the \r\n. */
+			g_strlcpy(line, conv, IRC_MAX_LINE - 1);
 		}
 
 		g_free(conv);
+	} else {
+		irc_write_fix_utf8(line, strlen(line));
 	}
 	g_strlcat(line, "\r\n", IRC_MAX_LINE + 1);
 
 	g_string_append(irc->sendbuffer, line);
+	irc_write_schedule(irc);
+}
+
+/* For callers that build a line right in irc->sendbuffer (starting at
+   offset start, without the CRLF): converts it to the client's charset
+   and terminates it. */
+void irc_write_finish(irc_t *irc, gsize start)
+{
+	if (irc->oconv != (GIConv) - 1) {
+		gsize len = irc->sendbuffer->len - start;
+		gsize bytes_read, bytes_written;
+		char *conv;
+
+		conv = g_convert_with_iconv(irc->sendbuffer->str + start, len, irc->oconv,
+		                            &bytes_read, &bytes_written, NULL);
 
+		if (conv && bytes_read == len) {
+			g_string_truncate(irc->sendbuffer, start);
+			g_string_append_len(irc->sendbuffer, conv, bytes_written);
+		}
+
+		g_free(conv);
+	} else {
+		irc_write_fix_utf8(irc->sendbuffer->str + start, irc->sendbuffer->len - start);
+	}
+	g_string_append_len(irc->sendbuffer, "\r\n", 2);
+	irc_write_schedule(irc);
+}
+
+static void irc_write_schedule(irc_t *irc)
+{
 	if (irc->w_watch_source_id == 0) {
 		/* If the buffer is empty we can probably write, so call the write event handler
 		   immediately. If it returns TRUE, it should be called again, so add the event to
@@ -654,8 +785,6 @@ void irc_vawrite(irc_t *irc, char *format, va_list params)
 		/* So just always do it via the event handler. */
 		irc->w_watch_source_id = b_input_add(irc->fd, B_EV_IO_WRITE, bitlbee_io_current_client_write, irc);
 	}
-
-	return;
 }
 
 /* Flush sendbuffer if you can. If it fails, fail silently and let some
@@ -696,9 +825,79 @@ void irc_switch_fd(irc_t *irc, int fd)
 	}
 
 	b_event_remove(irc->r_watch_source_id);
-	closesocket(irc->fd);
+	if (irc->fd >= 0) {
+		closesocket(irc->fd);
+	}
 	irc->fd = fd;
 	irc->r_watch_source_id = b_input_add(irc->fd, B_EV_IO_READ, bitlbee_io_current_client_read, irc);
+
+	if (irc->status & USTATUS_DETACHED) {
+		irc->status &= ~USTATUS_DETACHED;
+		b_event_remove(irc->detach_source_id);
+		irc->detach_source_id = 0;
+
+		irc->last_pong = gettime();
+		if (global.conf->ping_interval > 0 && global.conf->ping_timeout > 0) {
+			irc->ping_source_id = b_timeout_add(global.conf->ping_interval * 1000, irc_userping, irc);
+		}
+	}
+}
+
+static gboolean irc_detach_timeout(gpointer data, gint fd, b_input_condition cond)
+{
+	irc_t *irc = data;
+
+	irc->detach_source_id = 0;
+	irc_abort(irc, 1, "Detached session expired");
+
+	return FALSE;
+}
+
+/* Called when the client went away without saying goodbye. If the user
+   wants a backlog, the session and its IM connections stay around without
+   a client until someone identifies as this user again and takes it over
+   (see ipc.c), or until BacklogTimeout runs out. Returns FALSE if the
+   session should just be closed instead. */
+gboolean irc_detach(irc_t *irc, const char *reason)
+{
+	if (global.conf->runmode == RUNMODE_INETD ||
+	    (global.conf->runmode == RUNMODE_FORKDAEMON && global.listen_socket < 0) ||
+	    global.conf->backlog_max <= 0 || global.conf->backlog_timeout <= 0 ||
+	    (irc->status & (USTATUS_SHUTDOWN | USTATUS_DETACHED)) ||
+	    !(irc->status & USTATUS_IDENTIFIED) || irc->password == NULL ||
+	    set_getint(&irc->b->set, "backlog") <= 0 ||
+	    !set_getbool(&irc->b->set, "allow_takeover")) {
+		return FALSE;
+	}
+
+#ifdef NO_FD_PASSING
+	if (global.conf->runmode == RUNMODE_FORKDAEMON) {
+		return FALSE;
+	}
+#endif
+
+	log_message(LOGLVL_INFO, "Detaching connection with fd %d: %s", irc->fd, reason);
+	ipc_to_master_str("OPERMSG :Client detached: %s@%s [%s]\r\n",
+	                  irc->user->nick, irc->user->host, reason);
+
+	b_event_remove(irc->r_watch_source_id);
+	b_event_remove(irc->w_watch_source_id);
+	b_event_remove(irc->ping_source_id);
+	irc->r_watch_source_id = irc->w_watch_source_id = irc->ping_source_id = 0;
+
+	g_string_truncate(irc->sendbuffer, 0);
+	g_free(irc->readbuffer);
+	irc->readbuffer = NULL;
+
+	closesocket(irc->fd);
+	irc->fd = -1;
+
+	irc->status |= USTATUS_DETACHED;
+	irc->detach_source_id = b_timeout_add(global.conf->backlog_timeout * 1000,
+	                                      irc_detach_timeout, irc);
+	irc_backlog_report(irc);
+
+	return TRUE;
 }
 
 void irc_sync(irc_t *irc)
@@ -718,6 +917,9 @@ void irc_sync(irc_t *irc)
 
 	/* We may be waiting for a PONG from the previous client connection. */
 	irc->pinging = FALSE;
+
+	/* And someone's obviously here. */
+	irc_activity(irc);
 }
 
 void irc_desync(irc_t *irc)
@@ -736,7 +938,8 @@ void irc_desync(irc_t *irc)
 
 int irc_check_login(irc_t *irc)
 {
-	if (irc->user->user && irc->user->nick && !(irc->status & USTATUS_CAP_PENDING)) {
+	if (irc->user->user && irc->user->nick &&
+	    !(irc->status & (USTATUS_CAP_PENDING | USTATUS_AUTH_PENDING))) {
 		if (global.conf->authmode == AUTHMODE_CLOSED && !(irc->status & USTATUS_AUTHORIZED)) {
 			irc_send_num(irc, 464, ":This server is password-protected.");
 			return 0;
@@ -758,6 +961,7 @@ int irc_check_login(irc_t *irc)
 			}
 
 			irc->status |= USTATUS_LOGGED_IN;
+			irc_activity(irc);
 
 			irc_send_login(irc);
 
@@ -882,7 +1086,12 @@ static gboolean irc_userping(gpointer _irc, gint fd, b_input_condition cond)
 	}
 
 	if (fail > 0) {
-		irc_abort(irc, 0, "Ping Timeout: %d seconds", fail);
+		char *reason = g_strdup_printf("Ping Timeout: %d seconds", fail);
+
+		if (!irc_detach(irc, reason)) {
+			irc_abort(irc, 0, "%s", reason);
+		}
+		g_free(reason);
 		return FALSE;
 	}
 
@@ -900,6 +1109,12 @@ static char *set_eval_charset(set_t *set, char *value)
 		value = g_strdup("utf-8");
 	}
 
+	if (g_strcasecmp(value, "utf-8") == 0 || g_strcasecmp(value, "utf8") == 0) {
+		/* Nothing to convert, irc_process() only validates. */
+		ic = oc = (GIConv) - 1;
+		goto set;
+	}
+
 	if ((oc = g_iconv_open(value, "utf-8")) == (GIConv) - 1) {
 		return NULL;
 	}
@@ -921,6 +1136,7 @@ static char *set_eval_charset(set_t *set, char *value)
 		return NULL;
 	}
 
+set:
 	if (irc->iconv != (GIConv) - 1) {
 		g_iconv_close(irc->iconv);
 	}
@@ -53,6 +53,11 @@ typedef enum {
 	                           Currently just blocks irc_vawrite(). */
 	USTATUS_CAP_PENDING = 16,
 	USTATUS_SASL_PLAIN_PENDING = 32,
+	USTATUS_DETACHED = 64,  /* Client went away, IM messages go to the
+	                           backlog until it comes back. */
+	USTATUS_AUTH_PENDING = 128, /* Waiting for an auth backend, see auth.c.
+	                               Holds registration like CAP_PENDING,
+	                               and NICK is refused meanwhile. */
 
 	/* Not really status stuff, but other kinds of flags: For slightly
 	   better password security, since the only way to send passwords
@@ -82,12 +87,20 @@ struct irc_user;
 
 typedef struct irc {
 	int fd;
+	b_handle_t handle; /* Still alive if b_handle_get() returns this. */
 	irc_status_t status;
 	double last_pong;
 	int pinging;
 	GString *sendbuffer;
 	char *readbuffer;
-	GIConv iconv, oconv;
+	GIConv iconv, oconv; /* Both -1 if the charset is UTF-8. */
+
+	/* Scratch arrays for irc_process(), kept around so splitting and
+	   parsing a line doesn't need any allocations. */
+	char **lines;
+	int lines_size;
+	char **cmd;
+	int cmd_size;
 
 	struct irc_user *root;
 	struct irc_user *user;
@@ -112,12 +125,17 @@ typedef struct irc {
 	gint w_watch_source_id;
 	gint ping_source_id;
 	gint login_source_id; /* To slightly delay some events at login time. */
+	gint idle_source_id;
+	time_t last_activity; /* Last PRIVMSG/NOTICE, see inactive_timeout. */
 
 	struct otr *otr; /* OTR state and book keeping, used by the OTR plugin.
 	                    TODO: Some mechanism for plugindata. */
 
 	struct bee *b;
 	guint32 caps;
+
+	struct irc_backlog *backlog;
+	gint detach_source_id; /* Closes a detached session, see BacklogTimeout. */
 } irc_t;
 
 typedef enum {
@@ -280,15 +298,19 @@ void irc_free(irc_t *irc);
 void irc_setpass(irc_t *irc, const char *pass);
 
 void irc_process(irc_t *irc);
+void irc_activity(irc_t *irc);
 char **irc_parse_line(char *line);
+char **irc_parse_line_buf(char *line, char ***cmdp, int *sizep);
 char *irc_build_line(char **cmd);
 
 void irc_write(irc_t *irc, char *format, ...) G_GNUC_PRINTF(2, 3);
 void irc_write_all(int now, char *format, ...) G_GNUC_PRINTF(2, 3);
 void irc_vawrite(irc_t *irc, char *format, va_list params);
+void irc_write_finish(irc_t *irc, gsize start);
 
 void irc_flush(irc_t *irc);
 void irc_switch_fd(irc_t *irc, int fd);
+gboolean irc_detach(irc_t *irc, const char *reason);
 void irc_sync(irc_t *irc);
 void irc_desync(irc_t *irc);
 
@@ -352,6 +374,14 @@ void irc_send_invite(irc_user_t *iu, irc_channel_t *ic);
 void irc_send_cap(irc_t *irc, char *subcommand, char *body);
 void irc_send_away_notify(irc_user_t *iu);
 
+/* Flags for irc_send_msg_render() */
+#define IRC_RENDER_HTML 1
+
+G_GNUC_INTERNAL void irc_send_msg_render(irc_user_t *iu, const char *type, const char *dst, const char *msg,
+                                         const char *prefix, time_t ts, int flags);
+G_GNUC_INTERNAL void irc_send_msg_render_from(irc_t *irc, const char *nick, const char *user, const char *host,
+                                              const char *type, const char *dst, const char *msg,
+                                              const char *prefix, time_t ts, int flags);
 G_GNUC_INTERNAL void irc_send_msg_ts(irc_user_t *iu, const char *type, const char *dst, const char *msg, const char *prefix, time_t ts);
 G_GNUC_INTERNAL void irc_send_msg_raw_tags(irc_user_t *iu, const char *type, const char *dst, const char* tags, const char *msg);
 
@@ -377,4 +407,13 @@ void bee_irc_user_nick_reset(irc_user_t *iu);
 /* irc_cap.c */
 void irc_cmd_cap(irc_t *irc, char **cmd);
 
+/* irc_backlog.c */
+char *set_eval_backlog(struct set *set, char *value);
+void irc_backlog_add(irc_t *irc, irc_user_t *iu, const char *type, const char *dst, const char *msg,
+                     const char *prefix, time_t ts, int flags);
+void irc_backlog_replay(irc_t *irc);
+gsize irc_backlog_size(irc_t *irc, gsize *raw);
+void irc_backlog_report(irc_t *irc);
+void irc_backlog_free(irc_t *irc);
+
 #endif
@@ -0,0 +1,396 @@
+/********************************************************************\
+  * BitlBee -- An IRC to other IM-networks gateway                     *
+  *                                                                    *
+  * Copyright 2002-2013 Wilmer van der Gaast and others                *
+  \********************************************************************/
+
+/* Message backlog for detached sessions                                */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License with
+  the Debian GNU/Linux distribution in /usr/share/common-licenses/GPL;
+  if not, write to the Free Software Foundation, Inc., 51 Franklin St.,
+  Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#define BITLBEE_CORE
+#include "bitlbee.h"
+#include "ipc.h"
+
+#ifdef WITH_ZLIB
+#include <zlib.h>
+#endif
+
+/* While the client is away (see irc_detach()), messages are appended to a
+   plain buffer as they come in. Once that's big enough it's compressed
+   into a block of its own, and the oldest blocks are thrown away whenever
+   the total goes over the user's limit. Messages are stored before any
+   rendering so the replay can use whatever the new client supports.
+
+   Every record is a list of NUL-terminated fields, see IRC_BACKLOG_FIELDS. */
+
+#define IRC_BACKLOG_BLOCK 16384
+
+enum {
+	IRC_BACKLOG_TS,
+	IRC_BACKLOG_FLAGS,
+	IRC_BACKLOG_NICK,
+	IRC_BACKLOG_USER,
+	IRC_BACKLOG_HOST,
+	IRC_BACKLOG_TYPE,
+	IRC_BACKLOG_DST,
+	IRC_BACKLOG_PREFIX,
+	IRC_BACKLOG_MSG,
+	IRC_BACKLOG_FIELDS
+};
+
+typedef struct irc_backlog_block {
+	char *data;
+	gsize len, raw;         /* stored and uncompressed size */
+	int lines;
+	gboolean compressed;
+} irc_backlog_block_t;
+
+struct irc_backlog {
+	GQueue blocks;          /* oldest first */
+	GString *tail;          /* newest records, not compressed yet */
+	int tail_lines;
+	gsize size, raw;        /* blocks only, the tail isn't counted here */
+	int lines, dropped;
+};
+
+static gsize irc_backlog_limit(irc_t *irc)
+{
+	int n = MIN(set_getint(&irc->b->set, "backlog"), global.conf->backlog_max);
+
+	return MAX(n, 0);
+}
+
+static void irc_backlog_block_free(irc_backlog_block_t *b)
+{
+	g_free(b->data);
+	g_free(b);
+}
+
+static void irc_backlog_field(GString *s, const char *field)
+{
+	g_string_append_len(s, field, strlen(field) + 1);
+}
+
+/* Turns the tail into a new (compressed if possible) block. */
+static void irc_backlog_seal(struct irc_backlog *bl)
+{
+	irc_backlog_block_t *b;
+
+	if (bl->tail->len == 0) {
+		return;
+	}
+
+	b = g_new0(irc_backlog_block_t, 1);
+	b->raw = bl->tail->len;
+	b->lines = bl->tail_lines;
+
+#ifdef WITH_ZLIB
+	{
+		uLongf len = compressBound(b->raw);
+
+		b->data = g_malloc(len);
+		if (compress((Bytef *) b->data, &len, (Bytef *) bl->tail->str, b->raw) == Z_OK &&
+		    len < b->raw) {
+			b->data = g_realloc(b->data, len);
+			b->len = len;
+			b->compressed = TRUE;
+		} else {
+			g_free(b->data);
+		}
+	}
+#endif
+	if (!b->compressed) {
+		b->data = g_memdup(bl->tail->str, b->raw);
+		b->len = b->raw;
+	}
+
+	g_queue_push_tail(&bl->blocks, b);
+	bl->size += b->len;
+	bl->raw += b->raw;
+
+	g_string_truncate(bl->tail, 0);
+	bl->tail_lines = 0;
+}
+
+static gsize irc_backlog_record_len(const char *rec)
+{
+	const char *s = rec;
+	int i;
+
+	for (i = 0; i < IRC_BACKLOG_FIELDS; i++) {
+		s += strlen(s) + 1;
+	}
+
+	return s - rec;
+}
+
+/* Cuts the message of the last record in the tail (starting at start)
+   short so that the record is at most max bytes, on a character boundary.
+   Returns FALSE and removes the record if even the other fields don't
+   fit. */
+static gboolean irc_backlog_cap(struct irc_backlog *bl, gsize start, gsize max)
+{
+	char *rec = bl->tail->str + start, *msg = rec;
+	gsize len;
+	int i;
+
+	if (bl->tail->len - start <= max) {
+		return TRUE;
+	}
+
+	for (i = 0; i < IRC_BACKLOG_MSG; i++) {
+		msg += strlen(msg) + 1;
+	}
+	if (msg - rec + 1 > max) {
+		g_string_truncate(bl->tail, start);
+		return FALSE;
+	}
+
+	len = max - (msg - rec) - 1;
+	while (len > 0 && (msg[len] & 0xc0) == 0x80) {
+		len--;
+	}
+	g_string_truncate(bl->tail, msg - bl->tail->str + len);
+	g_string_append_c(bl->tail, '\0');
+
+	return TRUE;
+}
+
+/* Drops the oldest messages until everything fits in limit bytes. */
+static void irc_backlog_trim(struct irc_backlog *bl, gsize limit)
+{
+	irc_backlog_block_t *b;
+
+	while (bl->size + bl->tail->len > limit &&
+	       (b = g_queue_pop_head(&bl->blocks))) {
+		bl->size -= b->len;
+		bl->raw -= b->raw;
+		bl->lines -= b->lines;
+		bl->dropped += b->lines;
+		irc_backlog_block_free(b);
+	}
+
+	/* Then messages from the tail, one by one. */
+	while (bl->tail->len > limit && bl->tail_lines > 1) {
+		g_string_erase(bl->tail, 0, irc_backlog_record_len(bl->tail->str));
+		bl->tail_lines--;
+		bl->lines--;
+		bl->dropped++;
+	}
+
+	/* Only happens when the limit was just lowered below the size of
+	   the newest message. */
+	if (bl->tail->len > limit && !irc_backlog_cap(bl, 0, limit)) {
+		bl->tail_lines = 0;
+		bl->lines--;
+		bl->dropped++;
+	}
+}
+
+/* Called from bee_irc_user_msg() and bee_irc_chat_msg() instead of sending
+   the message while the session is detached. prefix shouldn't contain a
+   timestamp yet, that's added when replaying. */
+void irc_backlog_add(irc_t *irc, irc_user_t *iu, const char *type, const char *dst, const char *msg,
+                     const char *prefix, time_t ts, int flags)
+{
+	struct irc_backlog *bl = irc->backlog;
+	gsize limit = irc_backlog_limit(irc), block, start;
+	char num[24];
+
+	if (limit == 0) {
+		return;
+	}
+
+	if (bl == NULL) {
+		bl = irc->backlog = g_new0(struct irc_backlog, 1);
+		bl->tail = g_string_sized_new(1024);
+	}
+
+	/* Small limits get smaller blocks, or there'd be nothing left to
+	   drop but the one block. */
+	block = MIN(IRC_BACKLOG_BLOCK, MAX(limit / 4, 1024));
+
+	start = bl->tail->len;
+	g_snprintf(num, sizeof(num), "%ld", (long) (ts > 0 ? ts : time(NULL)));
+	irc_backlog_field(bl->tail, num);
+	g_snprintf(num, sizeof(num), "%d", flags);
+	irc_backlog_field(bl->tail, num);
+	irc_backlog_field(bl->tail, iu->nick);
+	irc_backlog_field(bl->tail, iu->user);
+	irc_backlog_field(bl->tail, iu->host);
+	irc_backlog_field(bl->tail, type);
+	irc_backlog_field(bl->tail, dst);
+	irc_backlog_field(bl->tail, prefix ? prefix : "");
+	irc_backlog_field(bl->tail, msg);
+
+	/* A huge message (a paste, probably) shouldn't push out everything
+	   else, it can have a block at most. */
+	if (!irc_backlog_cap(bl, start, MIN(block, limit))) {
+		bl->dropped++;
+		return;
+	}
+	bl->tail_lines++;
+	bl->lines++;
+
+	/* Trim before sealing, so the newest block always fits. */
+	irc_backlog_trim(bl, limit);
+	if (bl->tail->len >= block) {
+		irc_backlog_seal(bl);
+		irc_backlog_report(irc);
+	}
+}
+
+static void irc_backlog_replay_buf(irc_t *irc, const char *buf, gsize len)
+{
+	const char *s = buf, *end = buf + len, *f[IRC_BACKLOG_FIELDS];
+	gboolean stamps = !(irc->caps & CAP_SERVER_TIME) &&
+	                  set_getbool(&irc->b->set, "display_timestamps");
+	int i;
+
+	while (s < end) {
+		char *stamp = NULL, *prefix = NULL;
+		time_t ts;
+
+		for (i = 0; i < IRC_BACKLOG_FIELDS && s < end; i++) {
+			f[i] = s;
+			s += strlen(s) + 1;
+		}
+		if (i < IRC_BACKLOG_FIELDS) {
+			break;
+		}
+
+		ts = strtol(f[IRC_BACKLOG_TS], NULL, 10);
+		if (stamps && (stamp = irc_format_timestamp(irc, ts))) {
+			prefix = g_strconcat(f[IRC_BACKLOG_PREFIX], stamp, NULL);
+		}
+
+		irc_send_msg_render_from(irc, f[IRC_BACKLOG_NICK], f[IRC_BACKLOG_USER], f[IRC_BACKLOG_HOST],
+		                         f[IRC_BACKLOG_TYPE], f[IRC_BACKLOG_DST], f[IRC_BACKLOG_MSG],
+		                         prefix ? prefix : f[IRC_BACKLOG_PREFIX], ts,
+		                         atoi(f[IRC_BACKLOG_FLAGS]));
+
+		g_free(prefix);
+		g_free(stamp);
+	}
+}
+
+/* Sends everything in the backlog to the (new) client and empties it. */
+void irc_backlog_replay(irc_t *irc)
+{
+	struct irc_backlog *bl = irc->backlog;
+	irc_backlog_block_t *b;
+
+	if (bl && bl->lines > 0) {
+		irc_rootmsg(irc, "Replaying %d message%s received while you were away",
+		            bl->lines, bl->lines == 1 ? "" : "s");
+		if (bl->dropped > 0) {
+			irc_rootmsg(irc, "(%d older message%s didn't fit in the backlog)",
+			            bl->dropped, bl->dropped == 1 ? "" : "s");
+		}
+
+		while ((b = g_queue_pop_head(&bl->blocks))) {
+#ifdef WITH_ZLIB
+			if (b->compressed) {
+				uLongf raw = b->raw;
+				char *buf = g_malloc(raw);
+
+				if (uncompress((Bytef *) buf, &raw, (Bytef *) b->data, b->len) == Z_OK) {
+					irc_backlog_replay_buf(irc, buf, raw);
+				}
+				g_free(buf);
+			}
+#endif
+			if (!b->compressed) {
+				irc_backlog_replay_buf(irc, b->data, b->len);
+			}
+			irc_backlog_block_free(b);
+		}
+		irc_backlog_replay_buf(irc, bl->tail->str, bl->tail->len);
+	}
+
+	irc_backlog_free(irc);
+	irc_backlog_report(irc);
+}
+
+/* Bytes used, and what that would be without compression. */
+gsize irc_backlog_size(irc_t *irc, gsize *raw)
+{
+	struct irc_backlog *bl = irc->backlog;
+
+	if (raw) {
+		*raw = bl ? bl->raw + bl->tail->len : 0;
+	}
+
+	return bl ? bl->size + bl->tail->len : 0;
+}
+
+/* In ForkDaemon mode the master keeps track of everyone's backlog for the
+   BACKLOG operator command. In daemon mode it just looks for itself. */
+void irc_backlog_report(irc_t *irc)
+{
+	gsize size, raw;
+
+	if (global.conf->runmode != RUNMODE_FORKDAEMON) {
+		return;
+	}
+
+	size = irc_backlog_size(irc, &raw);
+	ipc_to_master_str("BACKLOG SIZE %" G_GSIZE_FORMAT " %" G_GSIZE_FORMAT " %d\r\n",
+	                  size, raw, (irc->status & USTATUS_DETACHED) ? 1 : 0);
+}
+
+void irc_backlog_free(irc_t *irc)
+{
+	struct irc_backlog *bl = irc->backlog;
+	irc_backlog_block_t *b;
+
+	if (bl == NULL) {
+		return;
+	}
+
+	while ((b = g_queue_pop_head(&bl->blocks))) {
+		irc_backlog_block_free(b);
+	}
+	g_string_free(bl->tail, TRUE);
+	g_free(bl);
+	irc->backlog = NULL;
+}
+
+char *set_eval_backlog(set_t *set, char *value)
+{
+	irc_t *irc = set->data;
+	int n;
+
+	if (set_eval_int(set, value) == SET_INVALID || (n = atoi(value)) < 0) {
+		return SET_INVALID;
+	}
+
+	if (n > global.conf->backlog_max) {
+		irc_rootmsg(irc, "Note: This server keeps at most %d bytes of backlog "
+		            "per user", global.conf->backlog_max);
+	}
+
+	if (n == 0) {
+		irc_backlog_free(irc);
+	} else if (irc->backlog) {
+		irc_backlog_trim(irc->backlog, MIN(n, MAX(global.conf->backlog_max, 0)));
+	}
+
+	return value;
+}
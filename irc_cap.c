@@ -187,6 +187,12 @@ void irc_cmd_cap(irc_t *irc, char **cmd)
 			irc->status &= ~USTATUS_SASL_PLAIN_PENDING;
 		}
 
+		/* Still waiting for an auth backend? Then the login has to wait
+		   too, auth_check_pass() picks it up again when it's done. */
+		if (irc->status & USTATUS_AUTH_PENDING) {
+			return;
+		}
+
 		irc_check_login(irc);
 
 	} else {
@@ -170,6 +170,7 @@ int irc_channel_free(irc_channel_t *ic)
 
 struct irc_channel_free_data {
 	irc_t *irc;
+	b_handle_t irc_handle;
 	irc_channel_t *ic;
 	char *name;
 };
@@ -178,7 +179,7 @@ static gboolean irc_channel_free_callback(gpointer data, gint fd, b_input_condit
 {
 	struct irc_channel_free_data *d = data;
 
-	if (g_slist_find(irc_connection_list, d->irc) &&
+	if (b_handle_get(d->irc_handle) &&
 	    irc_channel_by_name(d->irc, d->name) == d->ic &&
 	    !(d->ic->flags & IRC_CHANNEL_JOINED)) {
 		irc_channel_free(d->ic);
@@ -196,6 +197,7 @@ void irc_channel_free_soon(irc_channel_t *ic)
 	struct irc_channel_free_data *d = g_new0(struct irc_channel_free_data, 1);
 
 	d->irc = ic->irc;
+	d->irc_handle = ic->irc->handle;
 	d->ic = ic;
 	d->name = g_strdup(ic->name);
 
@@ -133,13 +133,9 @@ static gboolean irc_sasl_plain_parse(char *input, char **user, char **pass)
 	}
 }
 
-static gboolean irc_sasl_check_pass(irc_t *irc, char *user, char *pass)
+static void irc_sasl_check_pass_done(irc_t *irc, storage_status_t status, gpointer data)
 {
-	storage_status_t status;
-
-	/* just check the password here to be able to reply with useful numerics
-	 * the actual identification will be handled later */
-	status = auth_check_pass(irc, user, pass);
+	char *user = data;
 
 	if (status == STORAGE_OK) {
 		if (!irc->user->nick) {
@@ -150,7 +146,17 @@ static gboolean irc_sasl_check_pass(irc_t *irc, char *user, char *pass)
 		             irc->user->nick, irc->user->user, irc->user->host,
 			     irc->user->nick, irc->user->nick);
 		irc_send_num(irc, 903, ":Password accepted");
-		return TRUE;
+
+		/* and here we do the same thing as the PASS command.
+		 * auth_check_pass() already did irc_setpass() for us. */
+		if (irc->status & USTATUS_LOGGED_IN) {
+			char *send_cmd[] = { "identify", g_strdup(irc->password), NULL };
+
+			irc_setpass(irc, NULL);
+			root_command(irc, send_cmd);
+			g_free(send_cmd[1]);
+		}
+		/* else no check_login here - wait for CAP END */
 
 	} else if (status == STORAGE_INVALID_PASSWORD) {
 		irc_send_num(irc, 904, ":Incorrect password");
@@ -159,8 +165,13 @@ static gboolean irc_sasl_check_pass(irc_t *irc, char *user, char *pass)
 	} else {
 		irc_send_num(irc, 904, ":Unknown SASL authentication error");
 	}
+}
 
-	return FALSE;
+static void irc_sasl_check_pass(irc_t *irc, char *user, char *pass)
+{
+	/* just check the password here to be able to reply with useful numerics
+	 * the actual identification will be handled later */
+	auth_check_pass(irc, user, pass, irc_sasl_check_pass_done, g_strdup(user), g_free);
 }
 
 static void irc_cmd_authenticate(irc_t *irc, char **cmd)
@@ -186,15 +197,8 @@ static void irc_cmd_authenticate(irc_t *irc, char **cmd)
 		if (user && irc->user->nick && strcmp(user, irc->user->nick) != 0) {
 			irc_send_num(irc, 902, ":Your SASL username does not match your nickname");
 
-		} else if (irc_sasl_check_pass(irc, user, pass)) {
-			/* and here we do the same thing as the PASS command*/
-			if (irc->status & USTATUS_LOGGED_IN) {
-				char *send_cmd[] = { "identify", pass, NULL };
-				root_command(irc, send_cmd);
-			} else {
-				/* no check_login here - wait for CAP END */
-				irc_setpass(irc, pass);
-			}
+		} else {
+			irc_sasl_check_pass(irc, user, pass);
 		}
 
 		g_free(user);
@@ -203,6 +207,9 @@ static void irc_cmd_authenticate(irc_t *irc, char **cmd)
 	} else if (irc->status & USTATUS_IDENTIFIED) {
 		irc_send_num(irc, 907, ":You have already authenticated");
 
+	} else if (irc->status & USTATUS_AUTH_PENDING) {
+		irc_send_num(irc, 904, ":SASL authentication already in progress");
+
 	} else if (strcmp(cmd[1], "*") == 0) {
 		irc_send_num(irc, 906, ":SASL authentication aborted");
 		irc->status &= ~USTATUS_SASL_PLAIN_PENDING;
@@ -235,6 +242,9 @@ static void irc_cmd_nick(irc_t *irc, char **cmd)
 	} else if (!nick_ok(NULL, cmd[1])) {
 		/* [SH] Invalid characters. */
 		irc_send_num(irc, 432, "%s :This nick contains invalid characters", cmd[1]);
+	} else if (irc->status & USTATUS_AUTH_PENDING) {
+		/* The password being checked is for the current nick. */
+		irc_send_num(irc, 437, "%s :Can't change nick while your password is being checked", cmd[1]);
 	} else if (irc->status & USTATUS_LOGGED_IN) {
 		/* WATCH OUT: iu from the first if reused here to check if the
 		   new nickname is the same (other than case, possibly). If it
@@ -473,6 +483,8 @@ static void irc_cmd_privmsg(irc_t *irc, char **cmd)
 		return;
 	}
 
+	irc_activity(irc);
+
 	/* Don't treat CTCP actions as real CTCPs, just convert them right now. */
 	if (g_strncasecmp(cmd[2], "\001ACTION", 7) == 0) {
 		cmd[2] += 4;
@@ -525,6 +537,7 @@ static void irc_cmd_notice(irc_t *irc, char **cmd)
 	if (nick_cmp(NULL, cmd[1], irc->user->nick) == 0) {
 		irc_send_msg(irc->user, "NOTICE", irc->user->nick, cmd[2], NULL);
 	} else if ((iu = irc_user_by_name(irc, cmd[1]))) {
+		irc_activity(irc);
 		iu->f->privmsg(iu, cmd[2]);
 	}
 }
@@ -820,14 +833,15 @@ static void irc_cmd_version(irc_t *irc, char **cmd)
 
 static void irc_cmd_completions(irc_t *irc, char **cmd)
 {
+	cmdtab_t *tab = root_command_table();
 	help_t *h;
 	set_t *s;
 	int i;
 
 	irc_send_msg_raw(irc->root, "NOTICE", irc->user->nick, "COMPLETIONS OK");
 
-	for (i = 0; root_commands[i].command; i++) {
-		irc_send_msg_f(irc->root, "NOTICE", irc->user->nick, "COMPLETIONS %s", root_commands[i].command);
+	for (i = 0; i < tab->len; i++) {
+		irc_send_msg_f(irc->root, "NOTICE", irc->user->nick, "COMPLETIONS %s", tab->entries[i].name);
 	}
 
 	for (h = global.help; h; h = h->next) {
@@ -891,44 +905,50 @@ static const command_t irc_commands[] = {
 	{ "rehash",      0, irc_cmd_rehash,      IRC_CMD_OPER_ONLY },
 	{ "restart",     0, NULL,                IRC_CMD_OPER_ONLY | IRC_CMD_TO_MASTER },
 	{ "kill",        2, NULL,                IRC_CMD_OPER_ONLY | IRC_CMD_TO_MASTER },
+	{ "backlog",     0, NULL,                IRC_CMD_OPER_ONLY | IRC_CMD_TO_MASTER },
+	{ "logins",      0, NULL,                IRC_CMD_OPER_ONLY | IRC_CMD_TO_MASTER },
 	{ "authenticate", 1, irc_cmd_authenticate, 0 },
 	{ NULL }
 };
 
 void irc_exec(irc_t *irc, char *cmd[])
 {
-	int i, n_arg;
+	static cmdtab_t irc_cmdtab = CMDTAB_INIT;
+	const command_t *c;
+	int n_arg;
 
 	if (!cmd[0]) {
 		return;
 	}
 
-	for (i = 0; irc_commands[i].command; i++) {
-		if (g_strcasecmp(irc_commands[i].command, cmd[0]) == 0) {
-			/* There should be no typo in the next line: */
-			for (n_arg = 0; cmd[n_arg]; n_arg++) {
-				;
-			}
-			n_arg--;
-
-			if (irc_commands[i].flags & IRC_CMD_PRE_LOGIN && irc->status & USTATUS_LOGGED_IN) {
-				irc_send_num(irc, 462, ":Only allowed before logging in");
-			} else if (irc_commands[i].flags & IRC_CMD_LOGGED_IN && !(irc->status & USTATUS_LOGGED_IN)) {
-				irc_send_num(irc, 451, ":Register first");
-			} else if (irc_commands[i].flags & IRC_CMD_OPER_ONLY && !strchr(irc->umode, 'o')) {
-				irc_send_num(irc, 481, ":Permission denied - You're not an IRC operator");
-			} else if (n_arg < irc_commands[i].required_parameters) {
-				irc_send_num(irc, 461, "%s :Need more parameters", cmd[0]);
-			} else if (irc_commands[i].flags & IRC_CMD_TO_MASTER) {
-				/* IPC doesn't make sense in inetd mode,
-				    but the function will catch that. */
-				ipc_to_master(cmd);
-			} else {
-				irc_commands[i].execute(irc, cmd);
-			}
+	if (irc_cmdtab.len == 0) {
+		cmdtab_add_array(&irc_cmdtab, irc_commands, sizeof(command_t));
+	}
 
-			return;
+	if ((c = cmdtab_find(&irc_cmdtab, cmd[0]))) {
+		/* There should be no typo in the next line: */
+		for (n_arg = 0; cmd[n_arg]; n_arg++) {
+			;
+		}
+		n_arg--;
+
+		if (c->flags & IRC_CMD_PRE_LOGIN && irc->status & USTATUS_LOGGED_IN) {
+			irc_send_num(irc, 462, ":Only allowed before logging in");
+		} else if (c->flags & IRC_CMD_LOGGED_IN && !(irc->status & USTATUS_LOGGED_IN)) {
+			irc_send_num(irc, 451, ":Register first");
+		} else if (c->flags & IRC_CMD_OPER_ONLY && !strchr(irc->umode, 'o')) {
+			irc_send_num(irc, 481, ":Permission denied - You're not an IRC operator");
+		} else if (n_arg < c->required_parameters) {
+			irc_send_num(irc, 461, "%s :Need more parameters", cmd[0]);
+		} else if (c->flags & IRC_CMD_TO_MASTER) {
+			/* IPC doesn't make sense in inetd mode,
+			    but the function will catch that. */
+			ipc_to_master(cmd);
+		} else {
+			c->execute(irc, cmd);
 		}
+
+		return;
 	}
 
 	if (irc->status & USTATUS_LOGGED_IN) {
@@ -223,13 +223,16 @@ static gboolean bee_irc_user_msg(bee_t *bee, bee_user_t *bu, const char *msg_, g
 	irc_user_t *dst_iu = irc->user;
 	const char *dst;
 	char *prefix = NULL;
-	char *wrapped, *ts = NULL;
+	char *ts = NULL;
 	char *msg = g_strdup(msg_);
 	char *message_type = "PRIVMSG";
+	int render_flags = 0;
 	GSList *l;
 
+	/* The backlog adds timestamps when it's replayed, if needed. */
 	if (sent_at > 0 &&
 	    !(irc->caps & CAP_SERVER_TIME) &&
+	    !(irc->status & USTATUS_DETACHED) &&
 	    set_getbool(&irc->b->set, "display_timestamps")) {
 		ts = irc_format_timestamp(irc, sent_at);
 	}
@@ -296,15 +299,14 @@ static gboolean bee_irc_user_msg(bee_t *bee, bee_user_t *bu, const char *msg_, g
 
 	if ((g_strcasecmp(set_getstr(&bee->set, "strip_html"), "always") == 0) ||
 	    ((bu->ic->flags & OPT_DOES_HTML) && set_getbool(&bee->set, "strip_html"))) {
-		char *s = g_strdup(msg);
-		strip_html(s);
-		g_free(msg);
-		msg = s;
+		render_flags |= IRC_RENDER_HTML;
 	}
 
-	wrapped = word_wrap(msg, IRC_WORD_WRAP);
-	irc_send_msg_ts(src_iu, message_type, dst, wrapped, prefix, sent_at);
-	g_free(wrapped);
+	if (irc->status & USTATUS_DETACHED) {
+		irc_backlog_add(irc, src_iu, message_type, dst, msg, prefix, sent_at, render_flags);
+	} else {
+		irc_send_msg_render(src_iu, message_type, dst, msg, prefix, sent_at, render_flags);
+	}
 
 cleanup:
 	g_free(prefix);
@@ -694,22 +696,25 @@ static gboolean bee_irc_chat_msg(bee_t *bee, struct groupchat *c, bee_user_t *bu
 	irc_t *irc = bee->ui_data;
 	irc_user_t *iu = flags & OPT_SELFMESSAGE ? irc->user : bu->ui_data;
 	irc_channel_t *ic = c->ui_data;
-	char *wrapped, *ts = NULL;
+	char *ts = NULL;
 
 	if (ic == NULL) {
 		return FALSE;
 	}
 
+	if (irc->status & USTATUS_DETACHED) {
+		irc_backlog_add(irc, iu, "PRIVMSG", ic->name, msg, NULL, sent_at, 0);
+		return TRUE;
+	}
+
 	if (sent_at > 0 &&
 	    !(irc->caps & CAP_SERVER_TIME) &&
 	    set_getbool(&bee->set, "display_timestamps")) {
 		ts = irc_format_timestamp(irc, sent_at);
 	}
 
-	wrapped = word_wrap(msg, IRC_WORD_WRAP);
-	irc_send_msg_ts(iu, "PRIVMSG", ic->name, wrapped, ts, sent_at);
+	irc_send_msg_ts(iu, "PRIVMSG", ic->name, msg, ts, sent_at);
 	g_free(ts);
-	g_free(wrapped);
 
 	return TRUE;
 }
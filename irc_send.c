@@ -24,6 +24,7 @@
 */
 
 #include "bitlbee.h"
+#include "scan.h"
 
 void irc_send_num(irc_t *irc, int code, char *format, ...)
 {
@@ -369,49 +370,250 @@ void irc_send_msg(irc_user_t *iu, const char *type, const char *dst, const char
 
 void irc_send_msg_ts(irc_user_t *iu, const char *type, const char *dst, const char *msg, const char *prefix, time_t ts)
 {
-	char last = 0;
-	const char *s = msg, *line = msg;
-	char *tags = NULL;
-	char raw_msg[strlen(msg) + 1024];
+	irc_send_msg_render(iu, type, dst, msg, prefix, ts, 0);
+}
 
-	if (!(iu->irc->caps & CAP_SERVER_TIME)) {
-		ts = 0;
+/* State for irc_send_msg_render(), which builds one IRC line at a time
+   right in the send buffer. */
+typedef struct irc_render {
+	irc_t *irc;
+	GString *buf;
+	const char *head;       /* tags and ":nick!user@host TYPE dst :" */
+	const char *prefix;
+	int budget;             /* bytes per line for prefix-less text */
+	gboolean can_act;       /* "/me " lines may become CTCP ACTIONs */
+
+	gsize start;            /* where the current line starts in buf */
+	gsize text;             /* where its text starts */
+	gsize cut, resume;      /* where it could be wrapped (if cut > text) */
+	gboolean open, action, fresh;
+	int lines;
+} irc_render_t;
+
+static void irc_render_open(irc_render_t *r, gboolean action)
+{
+	r->start = r->buf->len;
+	g_string_append(r->buf, r->head);
+	g_string_append(r->buf, r->prefix);
+	if (action) {
+		g_string_append(r->buf, "\001ACTION ");
 	}
+	r->text = r->buf->len;
+	r->cut = r->resume = 0;
+	r->action = action;
+	r->open = TRUE;
+}
 
-	while (!last) {
-		if (*s == '\r' && *(s + 1) == '\n') {
+static void irc_render_close(irc_render_t *r)
+{
+	if (r->action) {
+		g_string_append_c(r->buf, '\001');
+	} else if (r->buf->len == r->text && !*r->prefix) {
+		/* Some clients don't like empty messages. */
+		g_string_append_c(r->buf, ' ');
+	}
+
+	irc_write_finish(r->irc, r->start);
+	r->open = FALSE;
+	r->lines++;
+}
+
+/* Remembers the character at pos as a place to wrap if it's suitable:
+   a space disappears, a dash stays at the end of the line. */
+static void irc_render_mark(irc_render_t *r, gsize pos)
+{
+	if (r->buf->str[pos] == ' ') {
+		r->cut = pos;
+		r->resume = pos + 1;
+	} else if (r->buf->str[pos] == '-') {
+		r->cut = r->resume = pos + 1;
+	}
+}
+
+static void irc_render_wrap(irc_render_t *r)
+{
+	char carry[IRC_MAX_LINE];
+	gsize i, n = 0;
+
+	/* Take whatever follows the last space/dash to the next line, or
+	   just break right here if there isn't one. */
+	if (r->cut > r->text) {
+		n = r->buf->len - r->resume;
+		memcpy(carry, r->buf->str + r->resume, n);
+		g_string_truncate(r->buf, r->cut);
+	}
+
+	irc_render_close(r);
+	irc_render_open(r, r->action);
+	r->fresh = FALSE;
+
+	g_string_append_len(r->buf, carry, n);
+	for (i = 0; i < n; i++) {
+		irc_render_mark(r, r->text + i);
+	}
+}
+
+/* Adds one (UTF-8) character of text. */
+static void irc_render_char(irc_render_t *r, const char *s, gsize len)
+{
+	int limit;
+
+	if (!r->open) {
+		irc_render_open(r, FALSE);
+		r->fresh = TRUE;
+	}
+
+	if (*s == '\n') {
+		irc_render_close(r);
+		return;
+	}
+
+	limit = r->budget - (r->action ? 9 : 0);
+	while (r->buf->len - r->text + len > limit) {
+		irc_render_wrap(r);
+	}
+
+	g_string_append_len(r->buf, s, len);
+	irc_render_mark(r, r->buf->len - len);
+
+	if (r->fresh && r->can_act && !r->action && r->buf->len - r->text == 4 &&
+	    g_strncasecmp(r->buf->str + r->text, "/me ", 4) == 0) {
+		g_string_truncate(r->buf, r->text);
+		g_string_append(r->buf, "\001ACTION ");
+		r->text = r->buf->len;
+		r->cut = r->resume = 0;
+		r->action = TRUE;
+	}
+}
+
+/* Same as irc_render_char() for every byte of a run of plain ASCII text
+   (no newlines), but appends as much as fits on the line at once. */
+static void irc_render_text(irc_render_t *r, const char *s, gsize len)
+{
+	while (len > 0) {
+		gsize used, n, i;
+		int limit;
+
+		/* Line starts ("/me ") and wrapping are up to irc_render_char(). */
+		used = r->open ? r->buf->len - r->text : 0;
+		limit = r->budget - (r->action ? 9 : 0);
+		if (!r->open || used < 4 || used >= limit) {
+			irc_render_char(r, s, 1);
 			s++;
+			len--;
+			continue;
 		}
-		if (*s == '\n') {
-			last = s[1] == 0;
-		} else {
-			last = s[0] == 0;
-		}
-		if (*s == 0 || *s == '\n') {
-			if (ts) {
-				tags = irc_format_servertime(iu->irc, ts);
+
+		n = MIN(limit - used, len);
+		g_string_append_len(r->buf, s, n);
+
+		/* Only the last space or dash can matter for wrapping. */
+		for (i = n; i > 0; i--) {
+			if (s[i - 1] == ' ' || s[i - 1] == '-') {
+				irc_render_mark(r, r->buf->len - n + i - 1);
+				break;
 			}
-			if (g_strncasecmp(line, "/me ", 4) == 0 && (!prefix || !*prefix) &&
-			    g_strcasecmp(type, "PRIVMSG") == 0) {
-				strcpy(raw_msg, "\001ACTION ");
-				strncat(raw_msg, line + 4, s - line - 4);
-				strcat(raw_msg, "\001");
-				irc_send_msg_raw_tags(iu, type, dst, tags, raw_msg);
-			} else {
-				*raw_msg = '\0';
-				if (prefix && *prefix) {
-					strcpy(raw_msg, prefix);
-				}
-				strncat(raw_msg, line, s - line);
-				irc_send_msg_raw_tags(iu, type, dst, tags, raw_msg);
+		}
+
+		s += n;
+		len -= n;
+	}
+}
+
+/* Length of the UTF-8 character at s, without running past the end of
+   the string (or len) if it's broken. */
+static gsize irc_render_skip(const char *s, gsize len)
+{
+	gsize i, n = MIN((guchar) g_utf8_skip[(guchar) *s], len);
+
+	for (i = 1; i < n; i++) {
+		if (s[i] == '\0') {
+			return i;
+		}
+	}
+
+	return n;
+}
+
+/* Sends msg from iu to dst in as many lines as it takes. Every line is
+   wrapped to fit in IRC_MAX_LINE bytes including the hostmask and prefix
+   (tags don't count), preferably at a space or dash. Lines starting with
+   "/me " become CTCP ACTIONs if there's no prefix. With IRC_RENDER_HTML,
+   tags and entities are decoded on the way. Nothing is copied except the
+   few bytes carried over when wrapping at a space, so huge messages are
+   fine. */
+void irc_send_msg_render(irc_user_t *iu, const char *type, const char *dst, const char *msg,
+                         const char *prefix, time_t ts, int flags)
+{
+	irc_send_msg_render_from(iu->irc, iu->nick, iu->user, iu->host, type, dst, msg, prefix, ts, flags);
+}
+
+/* Same, for senders that may not exist anymore (backlog replay). */
+void irc_send_msg_render_from(irc_t *irc, const char *nick, const char *user, const char *host,
+                              const char *type, const char *dst, const char *msg,
+                              const char *prefix, time_t ts, int flags)
+{
+	irc_render_t r;
+	char *tags = NULL, *head, dec[HTML_DECODE_MAX];
+	const char *s, *p, *end, *special;
+	size_t n, len, i;
+
+	/* Don't try to write anything new anymore when shutting down. */
+	if (irc->status & (USTATUS_SHUTDOWN | USTATUS_DETACHED)) {
+		return;
+	}
+
+	if (irc->caps & CAP_SERVER_TIME) {
+		/* Same for every line, so format it just once. */
+		tags = irc_format_servertime(irc, ts);
+	}
+
+	memset(&r, 0, sizeof(r));
+	r.irc = irc;
+	r.buf = irc->sendbuffer;
+	r.prefix = prefix ? prefix : "";
+	r.head = head = g_strdup_printf("%s%s:%s!%s@%s %s %s :", tags ? tags : "", tags ? " " : "",
+	                                nick, user, host, type, dst);
+	r.budget = IRC_MAX_LINE - 2 - strlen(head) - strlen(r.prefix) + (tags ? strlen(tags) + 1 : 0);
+	r.budget = MAX(r.budget, 16);
+	r.can_act = !*r.prefix && g_strcasecmp(type, "PRIVMSG") == 0;
+
+	/* Anything that isn't plain ASCII text goes one character at a time. */
+	special = flags & IRC_RENDER_HTML ? "\r\n<&" : "\r\n";
+	end = msg + strlen(msg);
+
+	for (s = msg; s < end; s += n) {
+		if ((flags & IRC_RENDER_HTML) && (*s == '<' || *s == '&') &&
+		    (n = html_decode_one(s, dec, &len))) {
+			for (i = 0; i < len; i += irc_render_skip(dec + i, len - i)) {
+				irc_render_char(&r, dec + i, irc_render_skip(dec + i, len - i));
 			}
-			if (ts) {
-				g_free(tags);
+		} else if (*s == '\r') {
+			/* \r\n is just a newline, a lone \r becomes a space. */
+			n = 1;
+			if (s[1] != '\n') {
+				irc_render_char(&r, " ", 1);
 			}
-			line = s + 1;
+		} else if ((p = scan_any_8bit(s, end - s, special)) != s) {
+			n = (p ? p : end) - s;
+			irc_render_text(&r, s, n);
+		} else {
+			n = irc_render_skip(s, 6);
+			irc_render_char(&r, s, n);
 		}
-		s++;
 	}
+
+	/* A trailing newline doesn't start another line, but there's always
+	   at least one. */
+	if (r.open || r.lines == 0) {
+		if (!r.open) {
+			irc_render_open(&r, FALSE);
+		}
+		irc_render_close(&r);
+	}
+
+	g_free(head);
+	g_free(tags);
 }
 
 void irc_send_msg_raw(irc_user_t *iu, const char *type, const char *dst, const char *msg)
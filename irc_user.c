@@ -106,14 +106,9 @@ int irc_user_free(irc_t *irc, irc_user_t *iu)
 
 irc_user_t *irc_user_by_name(irc_t *irc, const char *nick)
 {
-	char key[strlen(nick) + 1];
-
-	strcpy(key, nick);
-	if (nick_lc(irc, key)) {
-		return g_hash_table_lookup(irc->nick_user_hash, key);
-	} else {
-		return NULL;
-	}
+	/* The hash table folds case itself, and invalid nicks can't be in
+	   there, so no need to lowercase or validate anything here. */
+	return g_hash_table_lookup(irc->nick_user_hash, nick);
 }
 
 int irc_user_set_nick(irc_user_t *iu, const char *new)
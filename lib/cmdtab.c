@@ -0,0 +1,120 @@
+/********************************************************************\
+  * BitlBee -- An IRC to other IM-networks gateway                     *
+  *                                                                    *
+  * Copyright 2002-2012 Wilmer van der Gaast and others                *
+  \********************************************************************/
+
+/* Sorted command tables with binary search lookups                    */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License with
+  the Debian GNU/Linux distribution in /usr/share/common-licenses/GPL;
+  if not, write to the Free Software Foundation, Inc., 51 Franklin St.,
+  Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <string.h>
+#include <gmodule.h>
+#include "cmdtab.h"
+
+/* Returns the index of the first entry that doesn't sort before name. */
+static int cmdtab_lower_bound(const cmdtab_t *tab, const char *name)
+{
+	int lo = 0, hi = tab->len;
+
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+
+		if (g_ascii_strcasecmp(tab->entries[mid].name, name) < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return lo;
+}
+
+/* name isn't copied, it has to stay around as long as the table does.
+   Returns FALSE if there already is a command with that name. */
+gboolean cmdtab_add(cmdtab_t *tab, const char *name, void *data)
+{
+	int i = cmdtab_lower_bound(tab, name);
+
+	if (i < tab->len && g_ascii_strcasecmp(tab->entries[i].name, name) == 0) {
+		return FALSE;
+	}
+
+	if (tab->len == tab->size) {
+		tab->size = tab->size ? tab->size * 2 : 16;
+		tab->entries = g_renew(cmdtab_entry_t, tab->entries, tab->size);
+	}
+
+	memmove(tab->entries + i + 1, tab->entries + i,
+	        sizeof(cmdtab_entry_t) * (tab->len - i));
+	tab->entries[i].name = name;
+	tab->entries[i].data = data;
+	tab->len++;
+
+	return TRUE;
+}
+
+/* Adds all elements of a static, NULL-terminated array of structs that
+   each start with a char* containing the command name. data for every
+   command is a pointer to its element. */
+void cmdtab_add_array(cmdtab_t *tab, const void *array, gsize elem_size)
+{
+	const char *p;
+
+	for (p = array; *(char **) p; p += elem_size) {
+		cmdtab_add(tab, *(char **) p, (void *) p);
+	}
+}
+
+void *cmdtab_find(const cmdtab_t *tab, const char *name)
+{
+	int i = cmdtab_lower_bound(tab, name);
+
+	if (i < tab->len && g_ascii_strcasecmp(tab->entries[i].name, name) == 0) {
+		return tab->entries[i].data;
+	}
+
+	return NULL;
+}
+
+/* Like cmdtab_find(), but also accepts any abbreviation of a command as
+   long as it's unique. Exact matches always win. */
+void *cmdtab_find_prefix(const cmdtab_t *tab, const char *name)
+{
+	int i = cmdtab_lower_bound(tab, name);
+	size_t len = strlen(name);
+
+	if (i >= tab->len || g_ascii_strncasecmp(tab->entries[i].name, name, len) != 0) {
+		return NULL;
+	}
+
+	/* Everything starting with name is right here, sorted. */
+	if (tab->entries[i].name[len] != '\0' && i + 1 < tab->len &&
+	    g_ascii_strncasecmp(tab->entries[i + 1].name, name, len) == 0) {
+		return NULL;
+	}
+
+	return tab->entries[i].data;
+}
+
+void cmdtab_free(cmdtab_t *tab)
+{
+	g_free(tab->entries);
+	tab->entries = NULL;
+	tab->len = tab->size = 0;
+}
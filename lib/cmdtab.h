@@ -0,0 +1,56 @@
+/********************************************************************\
+  * BitlBee -- An IRC to other IM-networks gateway                     *
+  *                                                                    *
+  * Copyright 2002-2012 Wilmer van der Gaast and others                *
+  \********************************************************************/
+
+/* Sorted command tables with binary search lookups                    */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License with
+  the Debian GNU/Linux distribution in /usr/share/common-licenses/GPL;
+  if not, write to the Free Software Foundation, Inc., 51 Franklin St.,
+  Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _CMDTAB_H
+#define _CMDTAB_H
+
+#include <gmodule.h>
+
+/* Maps (case-insensitive) command names to whatever the caller wants to
+   keep for them, usually a command_t or similar struct. Entries are kept
+   sorted so lookups are a binary search instead of a string compare per
+   command, and new commands (from plugins, for example) can be added at
+   any time. */
+
+typedef struct cmdtab_entry {
+	const char *name;
+	void *data;
+} cmdtab_entry_t;
+
+typedef struct cmdtab {
+	cmdtab_entry_t *entries;
+	int len;
+	int size;
+} cmdtab_t;
+
+#define CMDTAB_INIT { NULL, 0, 0 }
+
+G_MODULE_EXPORT gboolean cmdtab_add(cmdtab_t *tab, const char *name, void *data);
+G_MODULE_EXPORT void cmdtab_add_array(cmdtab_t *tab, const void *array, gsize elem_size);
+G_MODULE_EXPORT void *cmdtab_find(const cmdtab_t *tab, const char *name);
+G_MODULE_EXPORT void *cmdtab_find_prefix(const cmdtab_t *tab, const char *name);
+G_MODULE_EXPORT void cmdtab_free(cmdtab_t *tab);
+
+#endif
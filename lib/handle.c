@@ -0,0 +1,104 @@
+/********************************************************************\
+  * BitlBee -- An IRC to other IM-networks gateway                     *
+  *                                                                    *
+  * Copyright 2002-2010 Wilmer van der Gaast and others                *
+  \********************************************************************/
+
+/* Handles: small integers standing in for pointers in async callbacks */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License with
+  the Debian GNU/Linux distribution in /usr/share/common-licenses/GPL;
+  if not, write to the Free Software Foundation, Inc., 51 Franklin St.,
+  Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include "handle.h"
+
+/* Low bits are the slot number + 1, high bits the generation. */
+#define HANDLE_SLOT_BITS 20
+#define HANDLE_SLOT_MASK ((1 << HANDLE_SLOT_BITS) - 1)
+#define HANDLE_GEN_MASK (0xfff)
+
+struct handle_slot {
+	gpointer obj;
+	guint32 gen;
+};
+
+static struct handle_slot *slots;
+static guint32 slots_len, slots_used;
+
+/* Free slots are reused oldest first, so a generation count takes as
+   long as possible to wrap around. */
+static GQueue slots_free = G_QUEUE_INIT;
+
+b_handle_t b_handle_new(gpointer obj)
+{
+	struct handle_slot *s;
+	guint32 i;
+
+	if (obj == NULL) {
+		return 0;
+	}
+
+	if (!g_queue_is_empty(&slots_free)) {
+		i = GPOINTER_TO_UINT(g_queue_pop_head(&slots_free)) - 1;
+	} else if (slots_used < HANDLE_SLOT_MASK) {
+		if (slots_used == slots_len) {
+			slots_len = slots_len ? slots_len * 2 : 64;
+			slots = g_renew(struct handle_slot, slots, slots_len);
+		}
+		i = slots_used++;
+		slots[i].gen = 0;
+	} else {
+		return 0;
+	}
+
+	s = &slots[i];
+	s->obj = obj;
+	if ((s->gen = (s->gen + 1) & HANDLE_GEN_MASK) == 0) {
+		s->gen = 1;
+	}
+
+	return (s->gen << HANDLE_SLOT_BITS) | (i + 1);
+}
+
+static struct handle_slot *handle_slot(b_handle_t h)
+{
+	guint32 i = h & HANDLE_SLOT_MASK;
+
+	if (i == 0 || i > slots_used ||
+	    slots[i - 1].gen != (h >> HANDLE_SLOT_BITS) ||
+	    slots[i - 1].obj == NULL) {
+		return NULL;
+	}
+
+	return &slots[i - 1];
+}
+
+gpointer b_handle_get(b_handle_t h)
+{
+	struct handle_slot *s = handle_slot(h);
+
+	return s ? s->obj : NULL;
+}
+
+void b_handle_free(b_handle_t h)
+{
+	struct handle_slot *s = handle_slot(h);
+
+	if (s) {
+		s->obj = NULL;
+		g_queue_push_tail(&slots_free, GUINT_TO_POINTER(h & HANDLE_SLOT_MASK));
+	}
+}
@@ -0,0 +1,45 @@
+/********************************************************************\
+  * BitlBee -- An IRC to other IM-networks gateway                     *
+  *                                                                    *
+  * Copyright 2002-2010 Wilmer van der Gaast and others                *
+  \********************************************************************/
+
+/* Handles: small integers standing in for pointers in async callbacks */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License with
+  the Debian GNU/Linux distribution in /usr/share/common-licenses/GPL;
+  if not, write to the Free Software Foundation, Inc., 51 Franklin St.,
+  Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef _HANDLE_H
+#define _HANDLE_H
+
+#include <glib.h>
+#include <gmodule.h>
+
+/* A handle is a slot number plus a generation count for that slot, so
+   looking one up is an array access, and a handle to an object that's
+   gone (even if its slot got reused since) just returns NULL. 0 is
+   never a valid handle. */
+typedef guint32 b_handle_t;
+
+#define B_HANDLE_TO_POINTER(h) GUINT_TO_POINTER(h)
+#define B_HANDLE_FROM_POINTER(p) ((b_handle_t) GPOINTER_TO_UINT(p))
+
+G_MODULE_EXPORT b_handle_t b_handle_new(gpointer obj);
+G_MODULE_EXPORT gpointer b_handle_get(b_handle_t h);
+G_MODULE_EXPORT void b_handle_free(b_handle_t h);
+
+#endif
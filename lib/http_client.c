@@ -160,6 +160,7 @@ error:
 	if (req->status_string == NULL) {
 		req->status_string = g_strdup("Error while writing HTTP request");
 	}
+	req->flags |= HTTPC_EOF;
 
 	if (req->func != NULL) {
 		req->func(req);
@@ -254,7 +255,7 @@ static gboolean http_incoming_data(gpointer data, int source, b_input_condition
 	}
 
 	if (req->content_length != -1 &&
-	    req->body_size >= req->content_length) {
+	    req->body_consumed + req->body_size >= req->content_length) {
 		goto eof;
 	}
 
@@ -270,8 +271,6 @@ static gboolean http_incoming_data(gpointer data, int source, b_input_condition
 	return FALSE;
 
 eof:
-	req->flags |= HTTPC_EOF;
-
 	/* Maybe if the webserver is overloaded, or when there's bad SSL
 	   support... */
 	if (req->bytes_read == 0) {
@@ -283,13 +282,16 @@ cleanup:
 	/* Avoid g_source_remove warnings */
 	req->inpa = 0;
 
+	/* Also after errors, so streaming users know this is the last call. */
+	req->flags |= HTTPC_EOF;
+
 	if (req->ssl) {
 		ssl_disconnect(req->ssl);
 	} else {
 		closesocket(req->fd);
 	}
 
-	if (req->body_size < req->content_length) {
+	if (req->body_consumed + req->body_size < req->content_length) {
 		req->status_code = -1;
 		g_free(req->status_string);
 		req->status_string = g_strdup("Response truncated");
@@ -379,6 +381,24 @@ static http_ret_t http_process_chunked_data(struct http_request *req, const char
 	return CR_OK;
 }
 
+/* Checks if the headers are complete now. Only looks at what came in just
+   now (and the few bytes before it), the rest was checked already. */
+static gboolean http_headers_complete(struct http_request *req, int len)
+{
+	const char *start = req->reply_headers, *end = start + req->bytes_read, *s;
+
+	s = end - MIN(req->bytes_read, len + 3);
+	while ((s = memchr(s, '\n', end - s))) {
+		if ((s - start >= 1 && s[-1] == '\n') ||
+		    (s - start >= 3 && strncmp(s - 3, "\r\n\r", 3) == 0)) {
+			return TRUE;
+		}
+		s++;
+	}
+
+	return FALSE;
+}
+
 static http_ret_t http_process_data(struct http_request *req, const char *buffer, int len)
 {
 	if (len <= 0) {
@@ -391,8 +411,7 @@ static http_ret_t http_process_data(struct http_request *req, const char *buffer
 		req->bytes_read += len;
 		req->reply_headers[req->bytes_read] = '\0';
 
-		if (strstr(req->reply_headers, "\r\n\r\n") ||
-		    strstr(req->reply_headers, "\n\n")) {
+		if (http_headers_complete(req, len)) {
 			/* We've now received all headers. Look for something
 			   interesting. */
 			if (!http_handle_headers(req)) {
@@ -641,6 +660,7 @@ static gboolean http_handle_headers(struct http_request *req)
 		req->request = new_request;
 		req->request_length = strlen(new_request);
 		req->bytes_read = req->bytes_written = req->inpa = 0;
+		req->body_consumed = 0;
 		req->reply_headers = req->reply_body = NULL;
 		req->sbuf = req->cbuf = NULL;
 		req->sblen = req->cblen = 0;
@@ -677,6 +697,7 @@ void http_flush_bytes(struct http_request *req, size_t len)
 
 	req->reply_body += len;
 	req->body_size -= len;
+	req->body_consumed += len;
 
 	if (req->reply_body - req->sbuf >= 512) {
 		char *new = g_memdup2(req->reply_body, req->body_size + 1);
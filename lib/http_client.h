@@ -76,6 +76,7 @@ struct http_request {
 	int bytes_written;
 	int bytes_read;
 	int content_length;     /* "Content-Length:" header or -1 */
+	int body_consumed;      /* Body bytes dropped by http_flush_bytes(). */
 
 	/* Used in streaming mode. Caller should read from reply_body. */
 	char *sbuf;
@@ -0,0 +1,717 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Incremental (streaming) JSON parser                                      *
+*                                                                           *
+*  Copyright 2002-2012 Wilmer van der Gaast and others                      *
+*                                                                           *
+*  This program is free software; you can redistribute it and/or modify     *
+*  it under the terms of the GNU General Public License as published by     *
+*  the Free Software Foundation; either version 2 of the License, or        *
+*  (at your option) any later version.                                      *
+*                                                                           *
+*  This program is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+*  GNU General Public License for more details.                             *
+*                                                                           *
+*  You should have received a copy of the GNU General Public License along  *
+*  with this program; if not, write to the Free Software Foundation, Inc.,  *
+*  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.              *
+*                                                                           *
+****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <glib.h>
+
+#include "json_stream.h"
+
+#define JSON_STREAM_MAX_DEPTH 512
+#define JSON_STREAM_MAX_NUMBER 64
+#define JSON_ARENA_BLOCK 8192
+
+typedef enum {
+	EXPECT_VALUE,
+	EXPECT_VALUE_OR_END,    /* Right after [ */
+	EXPECT_KEY,
+	EXPECT_KEY_OR_END,      /* Right after { */
+	EXPECT_COLON,
+	EXPECT_COMMA_OR_END,
+	EXPECT_NOTHING,         /* Document is complete */
+} json_expect_t;
+
+typedef enum {
+	TOKEN_NONE,
+	TOKEN_STRING,
+	TOKEN_KEY,
+	TOKEN_NUMBER,
+	TOKEN_LITERAL,
+} json_token_t;
+
+/* Everything json_stream_new_values() builds comes from here, and it's all
+   thrown away at once after every value. */
+struct json_arena_block {
+	struct json_arena_block *next;
+	size_t size;
+};
+
+#define ARENA_HDR ((sizeof(struct json_arena_block) + 7) & ~7)
+
+struct json_stream {
+	json_stream_flags_t flags;
+	json_stream_event_func func;
+	gpointer data;
+
+	json_expect_t expect;
+	GString *stack;         /* '[' or '{' for every level we're in */
+	gboolean got_value;     /* At least one complete document */
+
+	/* A token that didn't fit in one piece of input. */
+	json_token_t token;
+	GString *tok;
+	gboolean escaped;
+
+	size_t offset;
+	char *error;
+
+	/* json_stream_new_values() */
+	int depth;
+	json_stream_value_func value_func;
+	gpointer value_data;
+	GPtrArray *building;    /* GPtrArray of children for every level we're building */
+	int nbuilding;
+	struct json_arena_block *arena;
+	char *arena_pos, *arena_end;
+	char *filter_key;
+	json_stream_filter_func filter_func;
+	gboolean skipping;      /* Rest of the current value was filtered out */
+};
+
+static json_stream_t *json_stream_alloc(json_stream_flags_t flags)
+{
+	json_stream_t *js = g_new0(json_stream_t, 1);
+
+	js->flags = flags;
+	js->expect = EXPECT_VALUE;
+	js->stack = g_string_new("");
+	js->tok = g_string_new("");
+
+	return js;
+}
+
+json_stream_t *json_stream_new(json_stream_event_func func, gpointer data, json_stream_flags_t flags)
+{
+	json_stream_t *js = json_stream_alloc(flags);
+
+	js->func = func;
+	js->data = data;
+
+	return js;
+}
+
+static json_stream_status_t json_stream_fail(json_stream_t *js, const char *fmt, ...) G_GNUC_PRINTF(2, 3);
+static json_stream_status_t json_stream_fail(json_stream_t *js, const char *fmt, ...)
+{
+	va_list params;
+	char *msg;
+
+	va_start(params, fmt);
+	msg = g_strdup_vprintf(fmt, params);
+	va_end(params);
+
+	g_free(js->error);
+	js->error = g_strdup_printf("%s (at byte %zu)", msg, js->offset);
+	g_free(msg);
+
+	return JSON_STREAM_ERROR;
+}
+
+static void *json_arena_alloc(json_stream_t *js, size_t size)
+{
+	void *ret;
+
+	size = (size + 7) & ~7;
+	if (js->arena_pos == NULL || (size_t) (js->arena_end - js->arena_pos) < size) {
+		size_t bsize = MAX(JSON_ARENA_BLOCK, size + ARENA_HDR);
+		struct json_arena_block *b = g_malloc(bsize);
+
+		b->size = bsize;
+		b->next = js->arena;
+		js->arena = b;
+		js->arena_pos = (char *) b + ARENA_HDR;
+		js->arena_end = (char *) b + bsize;
+	}
+
+	ret = js->arena_pos;
+	js->arena_pos += size;
+	return ret;
+}
+
+static char *json_arena_strndup(json_stream_t *js, const char *s, size_t len)
+{
+	char *ret = json_arena_alloc(js, len + 1);
+
+	memcpy(ret, s, len);
+	ret[len] = '\0';
+	return ret;
+}
+
+/* Keep the newest block around for the next value. */
+static void json_arena_reset(json_stream_t *js, gboolean all)
+{
+	struct json_arena_block *b = all ? js->arena : (js->arena ? js->arena->next : NULL);
+
+	while (b) {
+		struct json_arena_block *next = b->next;
+		g_free(b);
+		b = next;
+	}
+
+	if (all || js->arena == NULL) {
+		js->arena = NULL;
+		js->arena_pos = js->arena_end = NULL;
+	} else {
+		js->arena->next = NULL;
+		js->arena_pos = (char *) js->arena + ARENA_HDR;
+	}
+}
+
+/* json_stream_new_values(): values (and all their children) are built in
+   the arena. Children are collected in js->building until their container
+   is complete. */
+static gboolean json_stream_build_add(json_stream_t *js, json_value *v)
+{
+	GPtrArray *items;
+	gboolean ret;
+
+	if (js->nbuilding == 0) {
+		ret = js->value_func(js, v, js->value_data);
+		json_arena_reset(js, FALSE);
+		return ret;
+	}
+
+	items = js->building->pdata[js->nbuilding - 1];
+	g_ptr_array_add(items, v);
+
+	return TRUE;
+}
+
+static gboolean json_stream_build(json_stream_t *js, json_stream_event_t ev,
+                                  const json_value *v, gpointer data)
+{
+	json_value *nv;
+	GPtrArray *items;
+	unsigned int i;
+
+	if (js->skipping) {
+		if ((ev == JSON_STREAM_OBJECT_END || ev == JSON_STREAM_ARRAY_END) &&
+		    (int) js->stack->len == js->depth) {
+			js->skipping = FALSE;
+		}
+		return TRUE;
+	}
+
+	/* Not (in) a value we're interested in. */
+	if (js->nbuilding == 0 && (int) js->stack->len != js->depth) {
+		return TRUE;
+	}
+
+	switch (ev) {
+	case JSON_STREAM_OBJECT_START:
+	case JSON_STREAM_ARRAY_START:
+		if (js->nbuilding == (int) js->building->len) {
+			g_ptr_array_add(js->building, g_ptr_array_new());
+		}
+		items = js->building->pdata[js->nbuilding++];
+		g_ptr_array_set_size(items, 0);
+		return TRUE;
+
+	case JSON_STREAM_KEY:
+		/* Keys and values alternate in the parent's list. */
+		if (js->nbuilding > 0) {
+			items = js->building->pdata[js->nbuilding - 1];
+			g_ptr_array_add(items, json_arena_strndup(js, v->u.string.ptr, v->u.string.length));
+		}
+		return TRUE;
+
+	case JSON_STREAM_VALUE:
+		if (js->filter_func && js->nbuilding == 1 &&
+		    js->stack->str[js->stack->len - 1] == '{') {
+			items = js->building->pdata[0];
+			if (strcmp(items->pdata[items->len - 1], js->filter_key) == 0 &&
+			    !js->filter_func(js, v, js->value_data)) {
+				js->nbuilding = 0;
+				js->skipping = TRUE;
+				json_arena_reset(js, FALSE);
+				return TRUE;
+			}
+		}
+		nv = json_arena_alloc(js, sizeof(json_value));
+		*nv = *v;
+		if (v->type == json_string) {
+			nv->u.string.ptr = json_arena_strndup(js, v->u.string.ptr, v->u.string.length);
+		}
+		return json_stream_build_add(js, nv);
+
+	case JSON_STREAM_OBJECT_END:
+		items = js->building->pdata[--js->nbuilding];
+		nv = json_arena_alloc(js, sizeof(json_value));
+		memset(nv, 0, sizeof(json_value));
+		nv->type = json_object;
+		nv->u.object.length = items->len / 2;
+		nv->u.object.values = json_arena_alloc(js, sizeof(*nv->u.object.values) *
+		                                       nv->u.object.length);
+		for (i = 0; i < nv->u.object.length; i++) {
+			nv->u.object.values[i].name = items->pdata[i * 2];
+			nv->u.object.values[i].name_length = strlen(items->pdata[i * 2]);
+			nv->u.object.values[i].value = items->pdata[i * 2 + 1];
+			nv->u.object.values[i].value->parent = nv;
+		}
+		return json_stream_build_add(js, nv);
+
+	case JSON_STREAM_ARRAY_END:
+		items = js->building->pdata[--js->nbuilding];
+		nv = json_arena_alloc(js, sizeof(json_value));
+		memset(nv, 0, sizeof(json_value));
+		nv->type = json_array;
+		nv->u.array.length = items->len;
+		nv->u.array.values = json_arena_alloc(js, sizeof(json_value *) * items->len);
+		for (i = 0; i < items->len; i++) {
+			nv->u.array.values[i] = items->pdata[i];
+			nv->u.array.values[i]->parent = nv;
+		}
+		return json_stream_build_add(js, nv);
+	}
+
+	return TRUE;
+}
+
+json_stream_t *json_stream_new_values(int depth, json_stream_value_func func, gpointer data,
+                                      json_stream_flags_t flags)
+{
+	json_stream_t *js = json_stream_alloc(flags);
+
+	js->func = json_stream_build;
+	js->depth = depth;
+	js->value_func = func;
+	js->value_data = data;
+	js->building = g_ptr_array_new();
+
+	return js;
+}
+
+void json_stream_set_filter(json_stream_t *js, const char *key, json_stream_filter_func func)
+{
+	g_free(js->filter_key);
+	js->filter_key = g_strdup(key);
+	js->filter_func = func;
+}
+
+/* Decodes escapes in place, returns the new length or -1. */
+static int json_stream_unescape(char *s, size_t len)
+{
+	char *in, *out, *end = s + len;
+	gunichar c, c2;
+	int i;
+
+	if (!(in = memchr(s, '\\', len))) {
+		return len;
+	}
+
+	out = in;
+	while (in < end) {
+		if (*in != '\\') {
+			*out++ = *in++;
+			continue;
+		}
+
+		if (++in == end) {
+			return -1;
+		}
+
+		switch (*in++) {
+		case 'b': *out++ = '\b'; break;
+		case 'f': *out++ = '\f'; break;
+		case 'n': *out++ = '\n'; break;
+		case 'r': *out++ = '\r'; break;
+		case 't': *out++ = '\t'; break;
+		case 'u':
+			if (end - in < 4) {
+				return -1;
+			}
+			for (i = 0, c = 0; i < 4; i++) {
+				int x = g_ascii_xdigit_value(*in++);
+				if (x < 0) {
+					return -1;
+				}
+				c = (c << 4) | x;
+			}
+
+			/* UTF-16 surrogate pair. */
+			if ((c & 0xFC00) == 0xD800 && end - in >= 6 && in[0] == '\\' && in[1] == 'u') {
+				for (i = 0, c2 = 0; i < 4; i++) {
+					int x = g_ascii_xdigit_value(in[2 + i]);
+					if (x < 0) {
+						return -1;
+					}
+					c2 = (c2 << 4) | x;
+				}
+				if ((c2 & 0xFC00) == 0xDC00) {
+					c = 0x10000 + ((c & 0x3FF) << 10) + (c2 & 0x3FF);
+					in += 6;
+				}
+			}
+
+			/* At most 4 bytes for the 6 (or 12) we just read. */
+			out += g_unichar_to_utf8(c, out);
+			break;
+		default:
+			/* \", \\, \/ and anything else that shouldn't be escaped. */
+			*out++ = in[-1];
+		}
+	}
+
+	return out - s;
+}
+
+static json_stream_status_t json_stream_emit(json_stream_t *js, json_stream_event_t ev, const json_value *v)
+{
+	if (!js->func(js, ev, v, js->data)) {
+		return JSON_STREAM_STOPPED;
+	}
+	return JSON_STREAM_MORE;
+}
+
+/* After a complete value (scalar or container). */
+static void json_stream_value_done(json_stream_t *js)
+{
+	if (js->stack->len > 0) {
+		js->expect = EXPECT_COMMA_OR_END;
+	} else {
+		js->got_value = TRUE;
+		js->expect = (js->flags & JSON_STREAM_MULTI) ? EXPECT_VALUE : EXPECT_NOTHING;
+	}
+}
+
+static json_stream_status_t json_stream_string(json_stream_t *js, char *s, size_t len)
+{
+	json_value v;
+	int n;
+
+	if ((n = json_stream_unescape(s, len)) < 0) {
+		return json_stream_fail(js, "Invalid escape sequence");
+	}
+	s[n] = '\0';
+
+	memset(&v, 0, sizeof(v));
+	v.type = json_string;
+	v.u.string.ptr = s;
+	v.u.string.length = n;
+
+	if (js->token == TOKEN_KEY) {
+		js->expect = EXPECT_COLON;
+		return json_stream_emit(js, JSON_STREAM_KEY, &v);
+	} else {
+		json_stream_value_done(js);
+		return json_stream_emit(js, JSON_STREAM_VALUE, &v);
+	}
+}
+
+static json_stream_status_t json_stream_number(json_stream_t *js, const char *s, size_t len)
+{
+	char num[JSON_STREAM_MAX_NUMBER], *end;
+	json_value v;
+
+	if (len >= sizeof(num)) {
+		return json_stream_fail(js, "Number too long");
+	}
+	memcpy(num, s, len);
+	num[len] = '\0';
+
+	memset(&v, 0, sizeof(v));
+	errno = 0;
+	if (strpbrk(num, ".eE") == NULL) {
+		v.type = json_integer;
+		v.u.integer = g_ascii_strtoll(num, &end, 10);
+	}
+	if (strpbrk(num, ".eE") != NULL || errno == ERANGE) {
+		v.type = json_double;
+		v.u.dbl = g_ascii_strtod(num, &end);
+	}
+	if (*end != '\0' || !(g_ascii_isdigit(num[0]) || (num[0] == '-' && g_ascii_isdigit(num[1])))) {
+		return json_stream_fail(js, "Invalid number `%s'", num);
+	}
+
+	json_stream_value_done(js);
+	return json_stream_emit(js, JSON_STREAM_VALUE, &v);
+}
+
+static json_stream_status_t json_stream_literal(json_stream_t *js, const char *s, size_t len)
+{
+	json_value v;
+
+	memset(&v, 0, sizeof(v));
+	if (len == 4 && strncmp(s, "true", 4) == 0) {
+		v.type = json_boolean;
+		v.u.boolean = 1;
+	} else if (len == 5 && strncmp(s, "false", 5) == 0) {
+		v.type = json_boolean;
+	} else if (len == 4 && strncmp(s, "null", 4) == 0) {
+		v.type = json_null;
+	} else {
+		return json_stream_fail(js, "Unknown value `%.*s'", (int) MIN(len, 8), s);
+	}
+
+	json_stream_value_done(js);
+	return json_stream_emit(js, JSON_STREAM_VALUE, &v);
+}
+
+#define IS_NUMBER_CHAR(c) (g_ascii_isdigit(c) || (c) == '-' || (c) == '+' || (c) == '.' || (c) == 'e' || (c) == 'E')
+
+/* Continues the token in js->token from buf[*pos], *pos is updated to just
+   after it. If the end of buf is reached first, it's saved in js->tok. */
+static json_stream_status_t json_stream_token(json_stream_t *js, char *buf, size_t len, size_t *pos,
+                                              gboolean eof)
+{
+	json_stream_status_t st;
+	size_t start = *pos, i = start, n;
+	char *s;
+
+	if (js->token == TOKEN_STRING || js->token == TOKEN_KEY) {
+		if (js->escaped) {
+			i++;
+		}
+		while (i < len && buf[i] != '"') {
+			i += buf[i] == '\\' ? 2 : 1;
+		}
+		if (i >= len) {
+			/* Ended in the middle of an escape sequence? */
+			js->escaped = i > len;
+			g_string_append_len(js->tok, buf + start, len - start);
+			*pos = len;
+			return JSON_STREAM_MORE;
+		}
+		js->escaped = FALSE;
+		*pos = i + 1;
+
+		/* If the whole string is in buf, decode it right there. That
+		   overwrites (at most) the closing quote. */
+		if (js->tok->len == 0) {
+			s = buf + start;
+			n = i - start;
+		} else {
+			g_string_append_len(js->tok, buf + start, i - start);
+			s = js->tok->str;
+			n = js->tok->len;
+		}
+		st = json_stream_string(js, s, n);
+	} else {
+		while (i < len && (js->token == TOKEN_NUMBER ? IS_NUMBER_CHAR(buf[i]) :
+		                   g_ascii_isalpha(buf[i]))) {
+			i++;
+		}
+		if (js->tok->len + (i - start) >= JSON_STREAM_MAX_NUMBER) {
+			return json_stream_fail(js, "Value too long");
+		} else if (i == len && !eof) {
+			g_string_append_len(js->tok, buf + start, len - start);
+			*pos = len;
+			return JSON_STREAM_MORE;
+		}
+		*pos = i;
+
+		if (js->tok->len == 0) {
+			s = buf + start;
+			n = i - start;
+		} else {
+			g_string_append_len(js->tok, buf + start, i - start);
+			s = js->tok->str;
+			n = js->tok->len;
+		}
+		if (js->token == TOKEN_NUMBER) {
+			st = json_stream_number(js, s, n);
+		} else {
+			st = json_stream_literal(js, s, n);
+		}
+	}
+
+	js->token = TOKEN_NONE;
+	g_string_truncate(js->tok, 0);
+	return st;
+}
+
+/* } or ] */
+static json_stream_status_t json_stream_close(json_stream_t *js, char c)
+{
+	if (js->stack->len == 0 || js->stack->str[js->stack->len - 1] != (c == '}' ? '{' : '[')) {
+		return json_stream_fail(js, "Unexpected `%c'", c);
+	}
+
+	g_string_truncate(js->stack, js->stack->len - 1);
+	json_stream_value_done(js);
+	return json_stream_emit(js, c == '}' ? JSON_STREAM_OBJECT_END : JSON_STREAM_ARRAY_END, NULL);
+}
+
+json_stream_status_t json_stream_feed(json_stream_t *js, char *buf, size_t len)
+{
+	json_stream_status_t st = JSON_STREAM_MORE;
+	size_t i = 0, prev;
+	char c;
+
+	if (js->error) {
+		return JSON_STREAM_ERROR;
+	}
+
+	/* UTF-8 BOM */
+	if (js->offset == 0 && len >= 3 && memcmp(buf, "\xEF\xBB\xBF", 3) == 0) {
+		i = js->offset = 3;
+	}
+
+	while (i < len && st == JSON_STREAM_MORE) {
+		if (js->token != TOKEN_NONE) {
+			prev = i;
+			st = json_stream_token(js, buf, len, &i, FALSE);
+			js->offset += i - prev;
+			continue;
+		}
+
+		c = buf[i];
+		if (c == ' ' || c == '\t' || c == '\n' || c == '\r') {
+			i++;
+			js->offset++;
+			continue;
+		}
+
+		switch (js->expect) {
+		case EXPECT_COLON:
+			if (c != ':') {
+				return json_stream_fail(js, "Expected : before `%c'", c);
+			}
+			js->expect = EXPECT_VALUE;
+			break;
+
+		case EXPECT_COMMA_OR_END:
+			if (c == ',') {
+				js->expect = js->stack->str[js->stack->len - 1] == '{' ?
+				             EXPECT_KEY : EXPECT_VALUE;
+			} else if (c == '}' || c == ']') {
+				st = json_stream_close(js, c);
+			} else {
+				return json_stream_fail(js, "Expected , before `%c'", c);
+			}
+			break;
+
+		case EXPECT_KEY_OR_END:
+			if (c == '}') {
+				st = json_stream_close(js, c);
+				break;
+			}
+		/* fall through */
+		case EXPECT_KEY:
+			if (c != '"') {
+				return json_stream_fail(js, "Unexpected `%c' in object", c);
+			}
+			js->token = TOKEN_KEY;
+			break;
+
+		case EXPECT_VALUE_OR_END:
+			if (c == ']') {
+				st = json_stream_close(js, c);
+				break;
+			}
+		/* fall through */
+		case EXPECT_VALUE:
+			if (c == '{' || c == '[') {
+				if (js->stack->len >= JSON_STREAM_MAX_DEPTH) {
+					return json_stream_fail(js, "Nested too deeply");
+				}
+				st = json_stream_emit(js, c == '{' ? JSON_STREAM_OBJECT_START :
+				                      JSON_STREAM_ARRAY_START, NULL);
+				g_string_append_c(js->stack, c);
+				js->expect = c == '{' ? EXPECT_KEY_OR_END : EXPECT_VALUE_OR_END;
+			} else if (c == '"') {
+				js->token = TOKEN_STRING;
+			} else if (c == '-' || g_ascii_isdigit(c)) {
+				/* These tokens start with this char, not after it. */
+				js->token = TOKEN_NUMBER;
+				continue;
+			} else if (g_ascii_isalpha(c)) {
+				js->token = TOKEN_LITERAL;
+				continue;
+			} else {
+				return json_stream_fail(js, "Unexpected `%c' when seeking value", c);
+			}
+			break;
+
+		case EXPECT_NOTHING:
+			return json_stream_fail(js, "Trailing garbage: `%c'", c);
+		}
+
+		i++;
+		js->offset++;
+	}
+
+	if (st == JSON_STREAM_MORE && js->expect == EXPECT_NOTHING) {
+		st = JSON_STREAM_DONE;
+	}
+	return st;
+}
+
+json_stream_status_t json_stream_end(json_stream_t *js)
+{
+	json_stream_status_t st;
+	size_t pos = 0;
+
+	if (js->error) {
+		return JSON_STREAM_ERROR;
+	}
+
+	/* A number or literal at the very end is only complete now. */
+	if (js->token == TOKEN_NUMBER || js->token == TOKEN_LITERAL) {
+		st = json_stream_token(js, NULL, 0, &pos, TRUE);
+		if (st != JSON_STREAM_MORE) {
+			return st;
+		}
+	}
+
+	if (js->token != TOKEN_NONE || js->stack->len > 0 ||
+	    !(js->expect == EXPECT_NOTHING || (js->got_value && js->expect == EXPECT_VALUE))) {
+		return json_stream_fail(js, "Unexpected EOF");
+	}
+
+	return JSON_STREAM_DONE;
+}
+
+int json_stream_depth(const json_stream_t *js)
+{
+	return js->stack->len;
+}
+
+const char *json_stream_error(const json_stream_t *js)
+{
+	return js->error;
+}
+
+void json_stream_free(json_stream_t *js)
+{
+	unsigned int i;
+
+	if (js == NULL) {
+		return;
+	}
+
+	if (js->building) {
+		for (i = 0; i < js->building->len; i++) {
+			g_ptr_array_free(js->building->pdata[i], TRUE);
+		}
+		g_ptr_array_free(js->building, TRUE);
+	}
+	json_arena_reset(js, TRUE);
+	g_free(js->filter_key);
+	g_string_free(js->stack, TRUE);
+	g_string_free(js->tok, TRUE);
+	g_free(js->error);
+	g_free(js);
+}
@@ -0,0 +1,94 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Incremental (streaming) JSON parser                                      *
+*                                                                           *
+*  Copyright 2002-2012 Wilmer van der Gaast and others                      *
+*                                                                           *
+*  This program is free software; you can redistribute it and/or modify     *
+*  it under the terms of the GNU General Public License as published by     *
+*  the Free Software Foundation; either version 2 of the License, or        *
+*  (at your option) any later version.                                      *
+*                                                                           *
+*  This program is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+*  GNU General Public License for more details.                             *
+*                                                                           *
+*  You should have received a copy of the GNU General Public License along  *
+*  with this program; if not, write to the Free Software Foundation, Inc.,  *
+*  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.              *
+*                                                                           *
+****************************************************************************/
+
+#ifndef _JSON_STREAM_H
+#define _JSON_STREAM_H
+
+#include <glib.h>
+#include <json.h>
+
+/* Unlike json_parse(), this one takes its input in pieces of any size (as
+   they come in from http_client, for example) and doesn't need the whole
+   document in memory. It either calls a function for every token (like
+   SAX), or builds json_values for everything at a given depth, one at a
+   time, so for example every status in a timeline can be handled as soon
+   as it's complete. */
+
+typedef enum {
+	JSON_STREAM_OBJECT_START,
+	JSON_STREAM_OBJECT_END,
+	JSON_STREAM_ARRAY_START,
+	JSON_STREAM_ARRAY_END,
+	JSON_STREAM_KEY,        /* A json_string */
+	JSON_STREAM_VALUE,      /* Any string, number, boolean or null */
+} json_stream_event_t;
+
+typedef enum {
+	JSON_STREAM_MORE,       /* Fine so far, feed me more */
+	JSON_STREAM_DONE,       /* Got a complete document */
+	JSON_STREAM_STOPPED,    /* A callback returned FALSE */
+	JSON_STREAM_ERROR,
+} json_stream_status_t;
+
+typedef enum {
+	/* Any number of documents in a row, like the Twitter streaming API
+	   sends them. Feeding never returns JSON_STREAM_DONE then. */
+	JSON_STREAM_MULTI = 1,
+} json_stream_flags_t;
+
+typedef struct json_stream json_stream_t;
+
+/* v is only valid during the call, and NULL for the _START/_END events. */
+typedef gboolean (*json_stream_event_func)(json_stream_t *js, json_stream_event_t ev,
+                                           const json_value *v, gpointer data);
+
+/* v and everything in it is only valid during the call. Don't free it. */
+typedef gboolean (*json_stream_value_func)(json_stream_t *js, json_value *v, gpointer data);
+
+json_stream_t *json_stream_new(json_stream_event_func func, gpointer data, json_stream_flags_t flags);
+
+/* depth 0 means the whole document, 1 every item in the array (or every
+   value in the object) at the top, etc. */
+json_stream_t *json_stream_new_values(int depth, json_stream_value_func func, gpointer data,
+                                      json_stream_flags_t flags);
+
+/* With json_stream_new_values(): func gets the member called key of every
+   object at that depth as soon as it comes in (if it's a string, number,
+   boolean or null). If it returns FALSE, the rest
+   of that object is skipped instead of built, and the value function isn't
+   called for it. */
+typedef gboolean (*json_stream_filter_func)(json_stream_t *js, const json_value *v, gpointer data);
+void json_stream_set_filter(json_stream_t *js, const char *key, json_stream_filter_func func);
+
+/* buf gets modified: strings are decoded in place where possible. */
+json_stream_status_t json_stream_feed(json_stream_t *js, char *buf, size_t len);
+
+/* End of input. Returns JSON_STREAM_DONE only if the document was complete. */
+json_stream_status_t json_stream_end(json_stream_t *js);
+
+/* Number of objects/arrays we're currently in. */
+int json_stream_depth(const json_stream_t *js);
+const char *json_stream_error(const json_stream_t *js);
+void json_stream_free(json_stream_t *js);
+
+#endif
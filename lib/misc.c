@@ -33,6 +33,7 @@
 #define BITLBEE_CORE
 #include "nogaim.h"
 #include "base64.h"
+#include "scan.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -119,125 +120,162 @@ typedef struct htmlentity {
 	char is[3];
 } htmlentity_t;
 
+/* Sorted (case-insensitively) for bsearch(). Numeric entities are decoded
+   separately. */
 static const htmlentity_t ent[] =
 {
-	{ "lt",     "<" },
-	{ "gt",     ">" },
+	{ "aacute", "á" },
+	{ "acirc",  "â" },
+	{ "agrave", "à" },
 	{ "amp",    "&" },
 	{ "apos",   "'" },
-	{ "quot",   "\"" },
-	{ "aacute", "á" },
+	{ "auml",   "ä" },
 	{ "eacute", "é" },
-	{ "iacute", "é" },
-	{ "oacute", "ó" },
-	{ "uacute", "ú" },
-	{ "agrave", "à" },
-	{ "egrave", "è" },
-	{ "igrave", "ì" },
-	{ "ograve", "ò" },
-	{ "ugrave", "ù" },
-	{ "acirc",  "â" },
 	{ "ecirc",  "ê" },
-	{ "icirc",  "î" },
-	{ "ocirc",  "ô" },
-	{ "ucirc",  "û" },
-	{ "auml",   "ä" },
+	{ "egrave", "è" },
 	{ "euml",   "ë" },
+	{ "gt",     ">" },
+	{ "iacute", "í" },
+	{ "icirc",  "î" },
+	{ "igrave", "ì" },
 	{ "iuml",   "ï" },
+	{ "lt",     "<" },
+	{ "nbsp",   " " },
+	{ "oacute", "ó" },
+	{ "ocirc",  "ô" },
+	{ "ograve", "ò" },
 	{ "ouml",   "ö" },
+	{ "quot",   "\"" },
+	{ "uacute", "ú" },
+	{ "ucirc",  "û" },
+	{ "ugrave", "ù" },
 	{ "uuml",   "ü" },
-	{ "nbsp",   " " },
-	{ "#38",    "&" },
-	{ "#39",    "'" },
-	{ "#60",    "<" },
-	{ "#62",    ">" },
-	{ "",        ""  }
 };
 
-void strip_html(char *in)
+static int htmlentity_cmp(const void *key, const void *e)
 {
-	char *start = in;
-	char out[strlen(in) + 1];
-	char *s = out, *cs;
-	int i, matched;
-	int taglen;
+	return g_ascii_strcasecmp(key, ((const htmlentity_t *) e)->code);
+}
 
-	memset(out, 0, sizeof(out));
+/* Tags we turn into IRC formatting, everything else just disappears. */
+static const htmlentity_t tags[] =
+{
+	{ "b",      "\x02" },
+	{ "/b",     "\x02" },
+	{ "i",      "\x1f" },
+	{ "/i",     "\x1f" },
+	{ "br",     "\n" },
+	{ "br/",    "\n" },
+	{ "br /",   "\n" },
+};
 
-	while (*in) {
-		if (*in == '<' && (g_ascii_isalpha(*(in + 1)) || *(in + 1) == '/')) {
-			/* If in points at a < and in+1 points at a letter or a slash, this is probably
-			   a HTML-tag. Try to find a closing > and continue there. If the > can't be
-			   found, assume that it wasn't a HTML-tag after all. */
+/* Decodes the tag or entity at s (pointing at a '<' or '&') into out,
+   which needs room for HTML_DECODE_MAX bytes. Returns the number of bytes
+   of s used up, or 0 if it's not a tag/entity after all and the '<' or
+   '&' should be taken literally. The result is never longer than the
+   input, so this can be used to decode a string in place. */
+size_t html_decode_one(const char *s, char *out, size_t *out_len)
+{
+	const char *cs = s + 1, *end;
+	char name[8];
+	int i;
 
-			cs = in;
+	*out_len = 0;
 
-			while (*in && *in != '>') {
-				in++;
-			}
+	if (*s == '<' && (g_ascii_isalpha(*cs) || *cs == '/')) {
+		/* If in points at a < and in+1 points at a letter or a slash, this is probably
+		   a HTML-tag. Try to find a closing > and continue there. If the > can't be
+		   found (before the next <), assume that it wasn't a HTML-tag after all. */
+		for (end = cs; *end && *end != '>' && *end != '<'; end++) {
+			;
+		}
+		if (*end != '>') {
+			return 0;
+		}
 
-			taglen = in - cs - 1;   /* not <0 because the above loop runs at least once */
-			if (*in) {
-				if (g_strncasecmp(cs + 1, "b", taglen) == 0) {
-					*(s++) = '\x02';
-				} else if (g_strncasecmp(cs + 1, "/b", taglen) == 0) {
-					*(s++) = '\x02';
-				} else if (g_strncasecmp(cs + 1, "i", taglen) == 0) {
-					*(s++) = '\x1f';
-				} else if (g_strncasecmp(cs + 1, "/i", taglen) == 0) {
-					*(s++) = '\x1f';
-				} else if (g_strncasecmp(cs + 1, "br", taglen) == 0) {
-					*(s++) = '\n';
-				} else if (g_strncasecmp(cs + 1, "br/", taglen) == 0) {
-					*(s++) = '\n';
-				} else if (g_strncasecmp(cs + 1, "br /", taglen) == 0) {
-					*(s++) = '\n';
-				}
-				in++;
-			} else {
-				in = cs;
-				*(s++) = *(in++);
+		for (i = 0; i < G_N_ELEMENTS(tags); i++) {
+			if (end - cs == strlen(tags[i].code) &&
+			    g_ascii_strncasecmp(tags[i].code, cs, end - cs) == 0) {
+				*out_len = strlen(tags[i].is);
+				memcpy(out, tags[i].is, *out_len);
+				break;
 			}
-		} else if (*in == '&') {
-			cs = ++in;
+		}
 
-			if (*in == '#') {
-			    	in++;
-			}
+		return end - s + 1;
+	} else if (*s == '&' && *cs == '#') {
+		guint64 c;
+		char *num_end;
 
-			while (*in && g_ascii_isalnum(*in)) {
-				in++;
-			}
+		cs++;
+		if (*cs == 'x' || *cs == 'X') {
+			c = g_ascii_strtoull(++cs, &num_end, 16);
+		} else {
+			c = g_ascii_strtoull(cs, &num_end, 10);
+		}
+		if (num_end == cs || !g_ascii_isxdigit(*cs) ||
+		    c == 0 || c > 0x10FFFF || !g_unichar_validate(c)) {
+			return 0;
+		}
+		if (*num_end == ';') {
+			num_end++;
+		}
 
-			if (*in == ';') {
-				in++;
-			}
-			matched = 0;
+		*out_len = g_unichar_to_utf8(c, out);
+		return num_end - s;
+	} else if (*s == '&') {
+		const htmlentity_t *e;
+
+		for (end = cs; g_ascii_isalnum(*end) && end - cs < sizeof(name) - 1; end++) {
+			;
+		}
+		memcpy(name, cs, end - cs);
+		name[end - cs] = '\0';
+
+		if (!(e = bsearch(name, ent, G_N_ELEMENTS(ent), sizeof(ent[0]), htmlentity_cmp))) {
+			return 0;
+		}
+		if (*end == ';') {
+			end++;
+		}
 
-			for (i = 0; *ent[i].code; i++) {
-				if (g_strncasecmp(ent[i].code, cs, strlen(ent[i].code)) == 0) {
-					int j;
+		*out_len = strlen(e->is);
+		memcpy(out, e->is, *out_len);
+		return end - s;
+	}
 
-					for (j = 0; ent[i].is[j]; j++) {
-						*(s++) = ent[i].is[j];
-					}
+	return 0;
+}
 
-					matched = 1;
-					break;
-				}
-			}
+void strip_html(char *in)
+{
+	char *out = in, *end = in + strlen(in), dec[HTML_DECODE_MAX];
+	const char *s;
+	size_t n, len;
+
+	/* Decoding never makes anything longer, so just do it in place. */
+	while (in < end) {
+		/* Everything up to the next tag or entity stays as it is. */
+		if (!(s = scan_any(in, end - in, "<&"))) {
+			s = end;
+		}
+		if (out != in) {
+			memmove(out, in, s - in);
+		}
+		out += s - in;
+		in = (char *) s;
 
-			/* None of the entities were matched, so return the string */
-			if (!matched) {
-				in = cs - 1;
-				*(s++) = *(in++);
-			}
+		if (in == end) {
+			break;
+		} else if ((n = html_decode_one(in, dec, &len))) {
+			memcpy(out, dec, len);
+			out += len;
+			in += n;
 		} else {
-			*(s++) = *(in++);
+			*(out++) = *(in++);
 		}
 	}
-
-	strcpy(start, out);
+	*out = '\0';
 }
 
 char *escape_html(const char *html)
@@ -330,12 +368,10 @@ void http_encode(char *s)
 /* Strip newlines from a string. Modifies the string passed to it. */
 char *strip_newlines(char *source)
 {
-	int i;
+	char *s = source, *end = source + strlen(source);
 
-	for (i = 0; source[i] != '\0'; i++) {
-		if (source[i] == '\n' || source[i] == '\r') {
-			source[i] = ' ';
-		}
+	while ((s = (char *) scan_any(s, end - s, "\r\n"))) {
+		*(s++) = ' ';
 	}
 
 	return source;
@@ -512,9 +548,10 @@ void srv_free(struct ns_srv_reply **srv)
 
 char *word_wrap(const char *msg, int line_len)
 {
-	GString *ret = g_string_sized_new(strlen(msg) + 16);
+	size_t left = strlen(msg);
+	GString *ret = g_string_sized_new(left + 16);
 
-	while (strlen(msg) > line_len) {
+	while (left > line_len) {
 		int i;
 
 		/* First try to find out if there's a newline already. Don't
@@ -525,6 +562,7 @@ char *word_wrap(const char *msg, int line_len)
 		if (msg[i] == '\n') {
 			g_string_append_len(ret, msg, i + 1);
 			msg += i + 1;
+			left -= i + 1;
 			continue;
 		}
 
@@ -533,11 +571,13 @@ char *word_wrap(const char *msg, int line_len)
 				g_string_append_len(ret, msg, i + 1);
 				g_string_append_c(ret, '\n');
 				msg += i + 1;
+				left -= i + 1;
 				break;
 			} else if (msg[i] == ' ') {
 				g_string_append_len(ret, msg, i);
 				g_string_append_c(ret, '\n');
 				msg += i + 1;
+				left -= i + 1;
 				break;
 			}
 		}
@@ -552,6 +592,7 @@ char *word_wrap(const char *msg, int line_len)
 			g_string_append_len(ret, msg, len);
 			g_string_append_c(ret, '\n');
 			msg += len;
+			left -= len;
 		}
 	}
 	g_string_append(ret, msg);
@@ -745,13 +786,10 @@ gboolean parse_int64(char *string, int base, guint64 *number)
  * For the opposite, use g_strcanon() */
 char *str_reject_chars(char *string, const char *reject, char replacement)
 {
-	char *c = string;
+	char *c = string, *end = string + strlen(string);
 
-	while (*c) {
-		c += strcspn(c, reject);
-		if (*c) {
-			*c = replacement;
-		}
+	while ((c = (char *) scan_any(c, end - c, reject))) {
+		*(c++) = replacement;
 	}
 
 	return string;
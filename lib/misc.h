@@ -125,6 +125,10 @@ G_MODULE_EXPORT time_t get_time(int year, int month, int day, int hour, int min,
 G_MODULE_EXPORT time_t mktime_utc(struct tm *tp);
 double gettime(void);
 
+/* Longest thing html_decode_one() can produce: a UTF-8 character. */
+#define HTML_DECODE_MAX 6
+
+G_MODULE_EXPORT size_t html_decode_one(const char *s, char *out, size_t *out_len);
 G_MODULE_EXPORT void strip_html(char *msg);
 G_MODULE_EXPORT char *escape_html(const char *html);
 G_MODULE_EXPORT void http_decode(char *s);
@@ -0,0 +1,231 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Fast scanning of text for a few special bytes                            *
+*                                                                           *
+*  Copyright 2002-2012 Wilmer van der Gaast and others                      *
+*                                                                           *
+*  This program is free software; you can redistribute it and/or modify     *
+*  it under the terms of the GNU General Public License as published by     *
+*  the Free Software Foundation; either version 2 of the License, or        *
+*  (at your option) any later version.                                      *
+*                                                                           *
+*  This program is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+*  GNU General Public License for more details.                             *
+*                                                                           *
+*  You should have received a copy of the GNU General Public License along  *
+*  with this program; if not, write to the Free Software Foundation, Inc.,  *
+*  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.              *
+*                                                                           *
+****************************************************************************/
+
+#include <string.h>
+#include <glib.h>
+
+#include "scan.h"
+
+/* SSE2 is always there on x86-64 (and -msse2 on 32-bit x86 turns it on),
+   so there's nothing to detect at runtime. Everything else gets the
+   word-at-a-time versions, which any compiler can handle. */
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define SCAN_SSE2
+#endif
+
+#define SCAN_ONES  G_GUINT64_CONSTANT(0x0101010101010101)
+#define SCAN_HIGHS G_GUINT64_CONSTANT(0x8080808080808080)
+
+/* Non-zero if any of the 8 bytes in w is 0. Can be wrong about the bytes
+   after the first 0, but that one is always found. */
+#define SCAN_HAS_ZERO(w) (((w) - SCAN_ONES) & ~(w) & SCAN_HIGHS)
+
+/* Bigger sets: one lookup per byte. */
+static const char *scan_any_table(const char *s, gsize len, const char *bytes, gboolean high)
+{
+	guchar set[256];
+	const guchar *p = (const guchar *) s;
+	gsize i;
+
+	memset(set, 0, sizeof(set));
+	for (; *bytes; bytes++) {
+		set[(guchar) *bytes] = 1;
+	}
+	if (high) {
+		memset(set + 0x80, 1, 0x80);
+	}
+
+	for (i = 0; i < len; i++) {
+		if (set[p[i]]) {
+			return s + i;
+		}
+	}
+
+	return NULL;
+}
+
+static const char *scan_any_real(const char *s, gsize len, const char *bytes, gboolean high)
+{
+	const guchar *p = (const guchar *) s;
+	gsize n = strlen(bytes), i = 0;
+	guchar b[SCAN_SET_MAX];
+	int j;
+
+	if (n > SCAN_SET_MAX) {
+		return scan_any_table(s, len, bytes, high);
+	} else if (n == 1 && !high) {
+		/* libc is good at this one. */
+		return memchr(s, *bytes, len);
+	}
+
+	/* Fill up the set with repeats so there's no need to count. An empty
+	   set only makes sense with high, and 0x80 is found then anyway. */
+	for (j = 0; j < SCAN_SET_MAX; j++) {
+		b[j] = n ? bytes[j % n] : 0x80;
+	}
+
+#ifdef SCAN_SSE2
+	{
+		__m128i b0 = _mm_set1_epi8(b[0]), b1 = _mm_set1_epi8(b[1]);
+		__m128i b2 = _mm_set1_epi8(b[2]), b3 = _mm_set1_epi8(b[3]);
+
+		for (; i + 16 <= len; i += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+			int mask = _mm_movemask_epi8(_mm_or_si128(
+			                     _mm_or_si128(_mm_cmpeq_epi8(v, b0), _mm_cmpeq_epi8(v, b1)),
+			                     _mm_or_si128(_mm_cmpeq_epi8(v, b2), _mm_cmpeq_epi8(v, b3))));
+
+			if (high) {
+				mask |= _mm_movemask_epi8(v);
+			}
+			if (mask) {
+				return s + i + __builtin_ctz(mask);
+			}
+		}
+	}
+#else
+	{
+		guint64 w0 = b[0] * SCAN_ONES, w1 = b[1] * SCAN_ONES;
+		guint64 w2 = b[2] * SCAN_ONES, w3 = b[3] * SCAN_ONES;
+
+		/* Find the first word with a match, the byte loop below
+		   finds out where exactly. */
+		for (; i + 8 <= len; i += 8) {
+			guint64 w;
+
+			memcpy(&w, p + i, 8);
+			if (SCAN_HAS_ZERO(w ^ w0) | SCAN_HAS_ZERO(w ^ w1) |
+			    SCAN_HAS_ZERO(w ^ w2) | SCAN_HAS_ZERO(w ^ w3) |
+			    (high ? w & SCAN_HIGHS : 0)) {
+				break;
+			}
+		}
+	}
+#endif
+
+	for (; i < len; i++) {
+		if (p[i] == b[0] || p[i] == b[1] || p[i] == b[2] || p[i] == b[3] ||
+		    (high && p[i] >= 0x80)) {
+			return s + i;
+		}
+	}
+
+	return NULL;
+}
+
+const char *scan_any(const char *s, gsize len, const char *bytes)
+{
+	if (!*bytes) {
+		return NULL;
+	}
+	return scan_any_real(s, len, bytes, FALSE);
+}
+
+const char *scan_any_8bit(const char *s, gsize len, const char *bytes)
+{
+	return scan_any_real(s, len, bytes, TRUE);
+}
+
+/* Length of the valid UTF-8 character at p, or 0. Same rules as GLib:
+   no overlong forms, surrogates or anything after U+10FFFF. */
+static gsize scan_utf8_char(const guchar *p, gsize len)
+{
+	guint32 c;
+	gsize n, i;
+
+	if (p[0] < 0x80) {
+		return p[0] ? 1 : 0;
+	} else if (p[0] < 0xc2) {
+		/* Continuation byte, or an overlong 2-byte form. */
+		return 0;
+	} else if (p[0] < 0xe0) {
+		n = 2;
+		c = p[0] & 0x1f;
+	} else if (p[0] < 0xf0) {
+		n = 3;
+		c = p[0] & 0x0f;
+	} else if (p[0] < 0xf5) {
+		n = 4;
+		c = p[0] & 0x07;
+	} else {
+		return 0;
+	}
+
+	if (n > len) {
+		return 0;
+	}
+	for (i = 1; i < n; i++) {
+		if ((p[i] & 0xc0) != 0x80) {
+			return 0;
+		}
+		c = (c << 6) | (p[i] & 0x3f);
+	}
+
+	if ((n == 3 && c < 0x800) || (n == 4 && c < 0x10000) ||
+	    c > 0x10ffff || (c >= 0xd800 && c <= 0xdfff)) {
+		return 0;
+	}
+
+	return n;
+}
+
+gboolean scan_utf8_valid(const char *s, gsize len)
+{
+	const guchar *p = (const guchar *) s;
+	gsize i = 0, n;
+
+	while (i < len) {
+		/* Skip plain ASCII quickly, stop at anything else (or a NUL). */
+#ifdef SCAN_SSE2
+		__m128i zero = _mm_setzero_si128();
+
+		for (; i + 16 <= len; i += 16) {
+			__m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+			int mask = _mm_movemask_epi8(v) | _mm_movemask_epi8(_mm_cmpeq_epi8(v, zero));
+
+			if (mask) {
+				i += __builtin_ctz(mask);
+				break;
+			}
+		}
+#else
+		for (; i + 8 <= len; i += 8) {
+			guint64 w;
+
+			memcpy(&w, p + i, 8);
+			if ((w & SCAN_HIGHS) || SCAN_HAS_ZERO(w)) {
+				break;
+			}
+		}
+#endif
+		if (i >= len) {
+			break;
+		} else if (!(n = scan_utf8_char(p + i, len - i))) {
+			return FALSE;
+		}
+		i += n;
+	}
+
+	return TRUE;
+}
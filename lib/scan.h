@@ -0,0 +1,46 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Fast scanning of text for a few special bytes                            *
+*                                                                           *
+*  Copyright 2002-2012 Wilmer van der Gaast and others                      *
+*                                                                           *
+*  This program is free software; you can redistribute it and/or modify     *
+*  it under the terms of the GNU General Public License as published by     *
+*  the Free Software Foundation; either version 2 of the License, or        *
+*  (at your option) any later version.                                      *
+*                                                                           *
+*  This program is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+*  GNU General Public License for more details.                             *
+*                                                                           *
+*  You should have received a copy of the GNU General Public License along  *
+*  with this program; if not, write to the Free Software Foundation, Inc.,  *
+*  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.              *
+*                                                                           *
+****************************************************************************/
+
+#ifndef _SCAN_H
+#define _SCAN_H
+
+#include <gmodule.h>
+
+/* These look at 16 bytes at a time with SSE2, or 8 at a time on other
+   machines, instead of going through text byte by byte. All of them take
+   a length so that the string only has to be measured once, strlen() is
+   fast already. Sets of up to SCAN_SET_MAX bytes take the fast path,
+   bigger ones work but are checked byte by byte. */
+#define SCAN_SET_MAX 4
+
+/* Returns the first byte in s[0..len) that is one of the (NUL-terminated)
+   bytes, or NULL if there isn't any. */
+G_MODULE_EXPORT const char *scan_any(const char *s, gsize len, const char *bytes);
+
+/* Same, but also stops at anything that isn't plain ASCII (>= 0x80). */
+G_MODULE_EXPORT const char *scan_any_8bit(const char *s, gsize len, const char *bytes);
+
+/* Same result as g_utf8_validate(s, len, NULL): NUL bytes are invalid too. */
+G_MODULE_EXPORT gboolean scan_utf8_valid(const char *s, gsize len);
+
+#endif
@@ -30,22 +30,247 @@
 #include "xmltree.h"
 
 #define g_strcasecmp g_ascii_strcasecmp
-#define g_strncasecmp g_ascii_strncasecmp
 
 /* g_memdup() deprecated as of glib 2.68.0 */
 #ifndef GLIB_VERSION_2_68
 #define g_memdup2 g_memdup
 #endif
 
+/* Names come from the network, don't let the atom table grow forever.
+   Anything after this is compared the slow way. */
+#define XT_ATOMS_MAX 4096
+#define XT_ATOMS_SLOTS (XT_ATOMS_MAX * 2)
+
+/* g_ascii_tolower() is a function call, this is on every name we see. */
+#define XT_LOWER(c) ((c) >= 'A' && (c) <= 'Z' ? (c) + 'a' - 'A' : (c))
+
+/* Open addressing, never more than half full so lookups stay short. */
+static struct xt_atom_slot {
+	guint hash;
+	char *atom;
+} *xt_atoms;
+static int xt_atoms_n;
+
+static struct xt_atom_slot *xt_atom_find(const char *name)
+{
+	const char *p;
+	guint h = 5381, i;
+
+	for (p = name; *p; p++) {
+		h = (h << 5) + h + XT_LOWER(*p);
+	}
+
+	if (xt_atoms == NULL) {
+		xt_atoms = g_new0(struct xt_atom_slot, XT_ATOMS_SLOTS);
+	}
+
+	for (i = h;; i++) {
+		struct xt_atom_slot *slot = &xt_atoms[i & (XT_ATOMS_SLOTS - 1)];
+		const char *a = slot->atom;
+
+		if (a == NULL) {
+			slot->hash = h;
+			return slot;
+		} else if (slot->hash == h) {
+			/* Atoms are lowercase already. */
+			for (p = name; *p && XT_LOWER(*p) == *a; p++, a++) {
+				;
+			}
+			if (*p == *a) {
+				return slot;
+			}
+		}
+	}
+}
+
+xt_atom xt_atom_get(const char *name)
+{
+	struct xt_atom_slot *slot = xt_atom_find(name);
+
+	if (slot->atom == NULL && xt_atoms_n < XT_ATOMS_MAX) {
+		slot->atom = g_ascii_strdown(name, -1);
+		xt_atoms_n++;
+	}
+
+	return slot->atom;
+}
+
+/* Same, but doesn't add anything. No atom means no node that has one
+   can have this name. */
+static xt_atom xt_atom_peek(const char *name)
+{
+	return xt_atom_find(name)->atom;
+}
+
+/* atom is what xt_atom_get() or _peek() returned for name. Only parsed
+   nodes have atoms (and only until the table is full), the others are
+   compared the old way. */
+static gboolean xt_node_named(struct xt_node *node, const char *name, xt_atom atom)
+{
+	if (node->atom) {
+		return node->atom == atom;
+	}
+	return g_strcasecmp(node->name, name) == 0;
+}
+
+/* Same, but also matches the name without its namespace prefix. */
+static gboolean xt_node_named_local(struct xt_node *node, const char *name, xt_atom atom)
+{
+	char *colon;
+
+	if (node->atom) {
+		return atom && (node->atom == atom || node->local == atom);
+	}
+	return g_strcasecmp(node->name, name) == 0 ||
+	       ((colon = strchr(node->name, ':')) && g_strcasecmp(colon + 1, name) == 0);
+}
+
+static void xt_node_set_atoms(struct xt_node *node)
+{
+	char *colon;
+
+	node->atom = xt_atom_get(node->name);
+	if ((colon = strchr(node->name, ':'))) {
+		node->local = xt_atom_get(colon + 1);
+	} else {
+		node->local = node->atom;
+	}
+
+	/* Both or neither. */
+	if (!node->local) {
+		node->atom = NULL;
+	}
+}
+
+/* Most stanzas fit in one of these, the rest get more blocks. */
+#define XT_ARENA_BLOCK 2048
+#define XT_ALIGN(n) (((n) + 7) & ~7)
+
+struct xt_arena {
+	struct xt_node *owner;  /* Freeing this node frees the arena */
+	gpointer *more;         /* Blocks after the first one (this one) */
+	char *pos, *end;
+};
+
+static struct xt_arena *xt_arena_new(void)
+{
+	struct xt_arena *a = g_malloc(XT_ARENA_BLOCK);
+
+	a->owner = NULL;
+	a->more = NULL;
+	a->pos = (char *) a + XT_ALIGN(sizeof(struct xt_arena));
+	a->end = (char *) a + XT_ARENA_BLOCK;
+
+	return a;
+}
+
+static gpointer xt_arena_alloc(struct xt_arena *a, size_t size)
+{
+	gpointer ret;
+
+	size = XT_ALIGN(size);
+	if ((size_t) (a->end - a->pos) < size) {
+		size_t bsize = MAX(XT_ARENA_BLOCK, size + XT_ALIGN(sizeof(gpointer)));
+		gpointer *b = g_malloc(bsize);
+
+		/* Just link it, the rest of the current block goes to waste. */
+		*b = a->more;
+		a->more = b;
+		a->pos = (char *) b + XT_ALIGN(sizeof(gpointer));
+		a->end = (char *) b + bsize;
+	}
+
+	ret = a->pos;
+	a->pos += size;
+	return ret;
+}
+
+static void xt_arena_free(struct xt_arena *a)
+{
+	while (a->more) {
+		gpointer *next = *a->more;
+		g_free(a->more);
+		a->more = next;
+	}
+	g_free(a);
+}
+
+/* Allocate from the arena if there is one, otherwise just use the heap. */
+static gpointer xt_alloc0(struct xt_arena *a, size_t size)
+{
+	if (a == NULL) {
+		return g_malloc0(size);
+	}
+	return memset(xt_arena_alloc(a, size), 0, size);
+}
+
+static char *xt_strdup(struct xt_arena *a, const char *s)
+{
+	size_t len;
+
+	if (a == NULL || s == NULL) {
+		return g_strdup(s);
+	}
+
+	len = strlen(s) + 1;
+	return memcpy(xt_arena_alloc(a, len), s, len);
+}
+
+/* Make room for at least n attributes (plus the terminator). Grows in
+   big steps since packets tend to get a few attributes one by one. */
+static void xt_attr_grow(struct xt_node *node, int n)
+{
+	int size = node->attr_size;
+
+	if (n + 1 <= size) {
+		return;
+	}
+
+	size = MAX(4, size * 2);
+	while (size < n + 1) {
+		size *= 2;
+	}
+
+	if (node->arena) {
+		struct xt_attr *attr = xt_alloc0(node->arena, sizeof(struct xt_attr) * size);
+		memcpy(attr, node->attr, sizeof(struct xt_attr) * node->attr_size);
+		node->attr = attr;
+	} else {
+		node->attr = g_renew(struct xt_attr, node->attr, size);
+		memset(node->attr + node->attr_size, 0, sizeof(struct xt_attr) * (size - node->attr_size));
+	}
+	node->attr_size = size;
+}
+
 static void xt_start_element(GMarkupParseContext *ctx, const gchar *element_name, const gchar **attr_names,
                              const gchar **attr_values, gpointer data, GError **error)
 {
 	struct xt_parser *xt = data;
-	struct xt_node *node = g_new0(struct xt_node, 1), *nt;
+	struct xt_arena *arena = NULL;
+	struct xt_node *node, *nt;
 	int i;
 
+	/* Children go into their parent's arena, new arenas start at the
+	   configured depth. */
+	if (xt->cur && xt->cur->arena) {
+		arena = xt->cur->arena;
+	} else if (xt->arena_depth >= 0) {
+		for (i = 0, nt = xt->cur; nt; nt = nt->parent) {
+			i++;
+		}
+		if (i == xt->arena_depth) {
+			arena = xt_arena_new();
+		}
+	}
+
+	node = xt_alloc0(arena, sizeof(struct xt_node));
+	if (arena && arena->owner == NULL) {
+		arena->owner = node;
+	}
+	node->arena = arena;
 	node->parent = xt->cur;
-	node->name = g_strdup(element_name);
+	node->name = xt_strdup(arena, element_name);
+	xt_node_set_atoms(node);
 
 	/* First count the number of attributes */
 	for (i = 0; attr_names[i]; i++) {
@@ -53,12 +278,14 @@ static void xt_start_element(GMarkupParseContext *ctx, const gchar *element_name
 	}
 
 	/* Then allocate a NULL-terminated array. */
-	node->attr = g_new0(struct xt_attr, i + 1);
+	node->attr = xt_alloc0(arena, sizeof(struct xt_attr) * (i + 1));
+	node->attr_size = i + 1;
 
 	/* And fill it, saving one variable by starting at the end. */
 	for (i--; i >= 0; i--) {
-		node->attr[i].key = g_strdup(attr_names[i]);
-		node->attr[i].value = g_strdup(attr_values[i]);
+		node->attr[i].key = xt_strdup(arena, attr_names[i]);
+		node->attr[i].value = xt_strdup(arena, attr_values[i]);
+		node->attr[i].atom = xt_atom_get(attr_names[i]);
 	}
 
 	/* Add it to the linked list of children nodes, if we have a current
@@ -93,8 +320,16 @@ static void xt_text(GMarkupParseContext *ctx, const gchar *text, gsize text_len,
 		return;
 	}
 
-	/* FIXME: Does g_renew also OFFICIALLY accept NULL arguments? */
-	node->text = g_renew(char, node->text, node->text_len + text_len + 1);
+	if (node->arena) {
+		char *s = xt_arena_alloc(node->arena, node->text_len + text_len + 1);
+		if (node->text) {
+			memcpy(s, node->text, node->text_len);
+		}
+		node->text = s;
+	} else {
+		/* FIXME: Does g_renew also OFFICIALLY accept NULL arguments? */
+		node->text = g_renew(char, node->text, node->text_len + text_len + 1);
+	}
 	memcpy(node->text + node->text_len, text, text_len);
 	node->text_len += text_len;
 	/* Zero termination is always nice to have. */
@@ -121,9 +356,26 @@ GMarkupParser xt_parser_funcs =
 struct xt_parser *xt_new(const struct xt_handler_entry *handlers, gpointer data)
 {
 	struct xt_parser *xt = g_new0(struct xt_parser, 1);
+	int i;
 
 	xt->data = data;
 	xt->handlers = handlers;
+
+	/* So that xt_handle() only has to compare pointers. */
+	for (i = 0; handlers && handlers[i].func; i++) {
+		;
+	}
+	xt->handler_atoms = g_new0(xt_atom, i * 2 + 1);
+	for (i--; i >= 0; i--) {
+		if (handlers[i].name) {
+			xt->handler_atoms[i * 2] = xt_atom_get(handlers[i].name);
+		}
+		if (handlers[i].parent) {
+			xt->handler_atoms[i * 2 + 1] = xt_atom_get(handlers[i].parent);
+		}
+	}
+
+	xt->arena_depth = -1;
 	xt_reset(xt);
 
 	return xt;
@@ -184,20 +436,23 @@ int xt_handle(struct xt_parser *xt, struct xt_node *node, int depth)
 
 	if (node->flags & XT_COMPLETE && !(node->flags & XT_SEEN)) {
 		if (xt->handlers) {
-			for (i = 0; xt->handlers[i].func; i++) {
+			const struct xt_handler_entry *h = xt->handlers;
+			xt_atom *ha = xt->handler_atoms;
+
+			for (i = 0; h[i].func; i++) {
 				/* This one is fun! \o/ */
 
 				/* If handler.name == NULL it means it should always match. */
-				if ((xt->handlers[i].name == NULL ||
+				if ((h[i].name == NULL ||
 				     /* If it's not, compare. There should always be a name. */
-				     g_strcasecmp(xt->handlers[i].name, node->name) == 0) &&
+				     xt_node_named(node, h[i].name, ha[i * 2])) &&
 				    /* If handler.parent == NULL, it's a match. */
-				    (xt->handlers[i].parent == NULL ||
+				    (h[i].parent == NULL ||
 				     /* If there's a parent node, see if the name matches. */
-				     (node->parent ? g_strcasecmp(xt->handlers[i].parent, node->parent->name) == 0 :
+				     (node->parent ? xt_node_named(node->parent, h[i].parent, ha[i * 2 + 1]) :
 				      /* If there's no parent, the handler should mention <root> as a parent. */
-				      strcmp(xt->handlers[i].parent, "<root>") == 0))) {
-					st = xt->handlers[i].func(node, xt->data);
+				      strcmp(h[i].parent, "<root>") == 0))) {
+					st = h[i].func(node, xt->data);
 
 					if (st == XT_ABORT) {
 						return 0;
@@ -287,9 +542,56 @@ struct xt_node *xt_from_string(const char *in, int len)
 	return ret;
 }
 
+/* Same as g_markup_escape_text(), but appends to str instead of
+   allocating a new string for every bit of text. */
+static void xt_append_escaped(GString *str, const char *s, int len)
+{
+	const unsigned char *p = (const unsigned char *) s, *end, *run;
+
+	if (len < 0) {
+		len = strlen(s);
+	}
+	end = p + len;
+
+	for (run = p; p < end; p++) {
+		const char *ent;
+		int c = *p;
+
+		switch (c) {
+		case '&': ent = "&amp;"; break;
+		case '<': ent = "&lt;"; break;
+		case '>': ent = "&gt;"; break;
+		case '\'': ent = "&apos;"; break;
+		case '"': ent = "&quot;"; break;
+		default:
+			ent = NULL;
+			if ((c >= 0x1 && c <= 0x8) || c == 0xb || c == 0xc ||
+			    (c >= 0xe && c <= 0x1f) || c == 0x7f) {
+				break;
+			} else if (c == 0xc2 && p + 1 < end && p[1] >= 0x80 && p[1] <= 0x9f && p[1] != 0x85) {
+				/* Same for the C1 control characters (in UTF-8). */
+				c = *++p;
+				g_string_append_len(str, (const char *) run, p - 1 - run);
+				g_string_append_printf(str, "&#x%x;", c);
+				run = p + 1;
+			}
+			continue;
+		}
+
+		g_string_append_len(str, (const char *) run, p - run);
+		if (ent) {
+			g_string_append(str, ent);
+		} else {
+			g_string_append_printf(str, "&#x%x;", c);
+		}
+		run = p + 1;
+	}
+
+	g_string_append_len(str, (const char *) run, p - run);
+}
+
 static void xt_to_string_real(struct xt_node *node, GString *str, int indent)
 {
-	char *buf;
 	struct xt_node *c;
 	int i;
 
@@ -298,12 +600,15 @@ static void xt_to_string_real(struct xt_node *node, GString *str, int indent)
 		                    indent < 8 ? indent : 8);
 	}
 
-	g_string_append_printf(str, "<%s", node->name);
+	g_string_append_c(str, '<');
+	g_string_append(str, node->name);
 
 	for (i = 0; node->attr[i].key; i++) {
-		buf = g_markup_printf_escaped(" %s=\"%s\"", node->attr[i].key, node->attr[i].value);
-		g_string_append(str, buf);
-		g_free(buf);
+		g_string_append_c(str, ' ');
+		xt_append_escaped(str, node->attr[i].key, -1);
+		g_string_append(str, "=\"");
+		xt_append_escaped(str, node->attr[i].value, -1);
+		g_string_append_c(str, '"');
 	}
 
 	if (node->text == NULL && node->children == NULL) {
@@ -313,9 +618,7 @@ static void xt_to_string_real(struct xt_node *node, GString *str, int indent)
 
 	g_string_append(str, ">");
 	if (node->text_len > 0) {
-		buf = g_markup_escape_text(node->text, node->text_len);
-		g_string_append(str, buf);
-		g_free(buf);
+		xt_append_escaped(str, node->text, node->text_len);
 	}
 
 	for (c = node->children; c; c = c->next) {
@@ -327,7 +630,9 @@ static void xt_to_string_real(struct xt_node *node, GString *str, int indent)
 		                    indent < 8 ? indent : 8);
 	}
 
-	g_string_append_printf(str, "</%s>", node->name);
+	g_string_append(str, "</");
+	g_string_append(str, node->name);
+	g_string_append_c(str, '>');
 }
 
 char *xt_to_string(struct xt_node *node)
@@ -366,6 +671,8 @@ struct xt_node *xt_dup(struct xt_node *node)
 	/* Let's NOT copy the parent element here BTW! Only do it for children. */
 
 	dup->name = g_strdup(node->name);
+	dup->atom = node->atom;
+	dup->local = node->local;
 	dup->flags = node->flags;
 	if (node->text) {
 		dup->text = g_memdup2(node->text, node->text_len + 1);
@@ -377,11 +684,13 @@ struct xt_node *xt_dup(struct xt_node *node)
 		;
 	}
 	dup->attr = g_new0(struct xt_attr, i + 1);
+	dup->attr_size = i + 1;
 
 	/* Copy them all! */
 	for (i--; i >= 0; i--) {
 		dup->attr[i].key = g_strdup(node->attr[i].key);
 		dup->attr[i].value = g_strdup(node->attr[i].value);
+		dup->attr[i].atom = node->attr[i].atom;
 	}
 
 	/* This nice mysterious loop takes care of the children. */
@@ -398,7 +707,8 @@ struct xt_node *xt_dup(struct xt_node *node)
 	return dup;
 }
 
-/* Frees a node. This doesn't clean up references to itself from parents! */
+/* Frees a node. This doesn't clean up references to itself from parents!
+   Nodes in an arena only really go away with the node that owns it. */
 void xt_free_node(struct xt_node *node)
 {
 	int i;
@@ -407,15 +717,18 @@ void xt_free_node(struct xt_node *node)
 		return;
 	}
 
-	g_free(node->name);
-	g_free(node->text);
+	if (!node->arena) {
+		g_free(node->name);
+		g_free(node->text);
 
-	for (i = 0; node->attr[i].key; i++) {
-		g_free(node->attr[i].key);
-		g_free(node->attr[i].value);
+		for (i = 0; node->attr[i].key; i++) {
+			g_free(node->attr[i].key);
+			g_free(node->attr[i].value);
+		}
+		g_free(node->attr);
 	}
-	g_free(node->attr);
 
+	/* Even arena nodes can have children added from elsewhere. */
 	while (node->children) {
 		struct xt_node *next = node->children->next;
 
@@ -423,7 +736,11 @@ void xt_free_node(struct xt_node *node)
 		node->children = next;
 	}
 
-	g_free(node);
+	if (!node->arena) {
+		g_free(node);
+	} else if (node->arena->owner == node) {
+		xt_arena_free(node->arena);
+	}
 }
 
 void xt_free(struct xt_parser *xt)
@@ -438,36 +755,34 @@ void xt_free(struct xt_parser *xt)
 
 	g_markup_parse_context_free(xt->parser);
 
+	g_free(xt->handler_atoms);
 	g_free(xt);
 }
 
 /* To find a node's child with a specific name, pass the node's children
    list, not the node itself! The reason you have to do this by hand: So
    that you can also use this function as a find-next. */
-struct xt_node *xt_find_node(struct xt_node *node, const char *name)
+static struct xt_node *xt_find_node_atom(struct xt_node *node, const char *name, xt_atom atom)
 {
-	while (node) {
-		char *colon;
-
-		if (g_strcasecmp(node->name, name) == 0 ||
-		    ((colon = strchr(node->name, ':')) &&
-		     g_strcasecmp(colon + 1, name) == 0)) {
-			break;
-		}
-
+	while (node && !xt_node_named_local(node, name, atom)) {
 		node = node->next;
 	}
 
 	return node;
 }
 
+struct xt_node *xt_find_node(struct xt_node *node, const char *name)
+{
+	return xt_find_node_atom(node, name, xt_atom_peek(name));
+}
+
 /* More advanced than the one above, understands something like
    ../foo/bar to find a subnode bar of a node foo which is a child
    of node's parent. Pass the node directly, not its list of children. */
 struct xt_node *xt_find_path(struct xt_node *node, const char *name)
 {
 	while (name && *name && node) {
-		char *colon, *slash;
+		char *slash;
 		int n;
 
 		if ((slash = strchr(name, '/'))) {
@@ -479,17 +794,10 @@ struct xt_node *xt_find_path(struct xt_node *node, const char *name)
 		if (strncmp(name, "..", n) == 0) {
 			node = node->parent;
 		} else {
-			node = node->children;
+			char *part = g_strndup(name, n);
 
-			while (node) {
-				if (g_strncasecmp(node->name, name, n) == 0 ||
-				    ((colon = strchr(node->name, ':')) &&
-				     g_strncasecmp(colon + 1, name, n) == 0)) {
-					break;
-				}
-
-				node = node->next;
-			}
+			node = xt_find_node_atom(node->children, part, xt_atom_peek(part));
+			g_free(part);
 		}
 
 		name = slash ? slash + 1 : NULL;
@@ -498,9 +806,9 @@ struct xt_node *xt_find_path(struct xt_node *node, const char *name)
 	return node;
 }
 
-char *xt_find_attr(struct xt_node *node, const char *key)
+static char *xt_find_attr_atom(struct xt_node *node, const char *key, xt_atom atom)
 {
-	int i;
+	int i, n;
 	char *colon;
 
 	if (!node) {
@@ -508,7 +816,8 @@ char *xt_find_attr(struct xt_node *node, const char *key)
 	}
 
 	for (i = 0; node->attr[i].key; i++) {
-		if (g_strcasecmp(node->attr[i].key, key) == 0) {
+		if (node->attr[i].atom ? node->attr[i].atom == atom :
+		    g_strcasecmp(node->attr[i].key, key) == 0) {
 			break;
 		}
 	}
@@ -519,26 +828,32 @@ char *xt_find_attr(struct xt_node *node, const char *key)
 	   now and never really missed it): Meh. */
 	if (!node->attr[i].key && strcmp(key, "xmlns") == 0 &&
 	    (colon = strchr(node->name, ':'))) {
-		*colon = '\0';
+		n = colon - node->name;
 		for (i = 0; node->attr[i].key; i++) {
 			if (strncmp(node->attr[i].key, "xmlns:", 6) == 0 &&
-			    strcmp(node->attr[i].key + 6, node->name) == 0) {
+			    strncmp(node->attr[i].key + 6, node->name, n) == 0 &&
+			    node->attr[i].key[6 + n] == '\0') {
 				break;
 			}
 		}
-		*colon = ':';
 	}
 
 	return node->attr[i].value;
 }
 
+char *xt_find_attr(struct xt_node *node, const char *key)
+{
+	return node ? xt_find_attr_atom(node, key, xt_atom_peek(key)) : NULL;
+}
+
 struct xt_node *xt_find_node_by_attr(struct xt_node *xt, const char *tag, const char *key, const char *value)
 {
+	xt_atom tag_atom = xt_atom_peek(tag), key_atom = xt_atom_peek(key);
 	struct xt_node *c;
 	char *s;
 
-	for (c = xt; (c = xt_find_node(c, tag)); c = c->next) {
-		if ((s = xt_find_attr(c, key)) && strcmp(s, value) == 0) {
+	for (c = xt; (c = xt_find_node_atom(c, tag, tag_atom)); c = c->next) {
+		if ((s = xt_find_attr_atom(c, key, key_atom)) && strcmp(s, value) == 0) {
 			return c;
 		}
 	}
@@ -577,6 +892,7 @@ struct xt_node *xt_new_node(char *name, const char *text, struct xt_node *childr
 	node->name = g_strdup(name);
 	node->children = children;
 	node->attr = g_new0(struct xt_attr, 1);
+	node->attr_size = 1;
 
 	if (text) {
 		node->text = g_strdup(text);
@@ -655,16 +971,20 @@ void xt_add_attr(struct xt_node *node, const char *key, const char *value)
 	}
 
 	if (node->attr[i].key == NULL) {
-		/* If not, allocate space for a new attribute. */
-		node->attr = g_renew(struct xt_attr, node->attr, i + 2);
-		node->attr[i].key = g_strdup(key);
+		/* If not, make room for a new attribute. */
+		if (node->attr_size < i + 1) {
+			node->attr_size = i + 1;
+		}
+		xt_attr_grow(node, i + 1);
+		node->attr[i].key = xt_strdup(node->arena, key);
+		node->attr[i].atom = NULL;
 		node->attr[i + 1].key = NULL;
-	} else {
+	} else if (!node->arena) {
 		/* Otherwise, free the old value before setting the new one. */
 		g_free(node->attr[i].value);
 	}
 
-	node->attr[i].value = g_strdup(value);
+	node->attr[i].value = xt_strdup(node->arena, value);
 }
 
 int xt_remove_attr(struct xt_node *node, const char *key)
@@ -682,8 +1002,10 @@ int xt_remove_attr(struct xt_node *node, const char *key)
 		return 0;
 	}
 
-	g_free(node->attr[i].key);
-	g_free(node->attr[i].value);
+	if (!node->arena) {
+		g_free(node->attr[i].key);
+		g_free(node->attr[i].value);
+	}
 
 	/* If it's the last, this is easy: */
 	if (node->attr[i + 1].key == NULL) {
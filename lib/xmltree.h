@@ -35,10 +35,18 @@ typedef enum {
 	XT_NEXT                 /* Try if there's another matching handler */
 } xt_status;
 
+/* Interned, lower-case version of an element or attribute name. Two names
+   are the same (ignoring case) if and only if their atoms are the same
+   pointer. NULL if a name couldn't be interned (too many different ones). */
+typedef const char *xt_atom;
+
 struct xt_attr {
 	char *key, *value;
+	xt_atom atom;
 };
 
+struct xt_arena;
+
 struct xt_node {
 	struct xt_node *parent;
 	struct xt_node *children;
@@ -50,6 +58,12 @@ struct xt_node {
 
 	struct xt_node *next;
 	xt_flags flags;
+
+	int attr_size;          /* Room in attr[], including the terminator */
+	struct xt_arena *arena; /* Everything's allocated in here, if set */
+
+	xt_atom atom;           /* The whole name, like stream:features */
+	xt_atom local;          /* Without the namespace prefix: features */
 };
 
 typedef xt_status (*xt_handler_func) (struct xt_node *node, gpointer data);
@@ -65,11 +79,18 @@ struct xt_parser {
 	struct xt_node *cur;
 
 	const struct xt_handler_entry *handlers;
+	xt_atom *handler_atoms; /* Name and parent of every handler */
 	gpointer data;
 
+	/* Every node at this depth (1 for the stanzas in an XMPP stream) gets
+	   an arena for itself and everything in it, which is freed all at
+	   once with that node. -1 (the default) to not use arenas. */
+	int arena_depth;
+
 	GError *gerr;
 };
 
+xt_atom xt_atom_get(const char *name);
 struct xt_parser *xt_new(const struct xt_handler_entry *handlers, gpointer data);
 void xt_reset(struct xt_parser *xt);
 int xt_feed(struct xt_parser *xt, const char *text, int text_len);
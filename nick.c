@@ -381,9 +381,10 @@ gboolean nick_ok(irc_t *irc, const char *nick)
 	return TRUE;
 }
 
-int nick_lc(irc_t *irc, char *nick)
+/* ASCII case mapping by the rules above, everything else maps to itself. */
+static const guchar *nick_fold_tab(void)
 {
-	static char tab[128] = { 0 };
+	static guchar tab[256] = { 0 };
 	int i;
 
 	if (tab['A'] == 0) {
@@ -397,6 +398,14 @@ int nick_lc(irc_t *irc, char *nick)
 		}
 	}
 
+	return tab;
+}
+
+int nick_lc(irc_t *irc, char *nick)
+{
+	const guchar *tab = nick_fold_tab();
+	guchar *s;
+
 	if (irc && (irc->status & IRC_UTF8_NICKS)) {
 		gchar *down = g_utf8_strdown(nick, -1);
 		if (strlen(down) > strlen(nick)) {
@@ -406,24 +415,81 @@ int nick_lc(irc_t *irc, char *nick)
 		g_free(down);
 	}
 
-	for (i = 0; nick[i]; i++) {
-		if (((guchar) nick[i]) < 0x7f) {
-			nick[i] = tab[(guchar) nick[i]];
-		}
+	for (s = (guchar *) nick; *s; s++) {
+		*s = tab[*s];
 	}
 
 	return nick_ok(irc, nick);
 }
 
+/* Returns the case-folded value of the character at *s and moves *s past
+   it. Plain ASCII goes through the table, anything else is lowercased one
+   Unicode character at a time so nothing needs to be copied. Bytes that
+   aren't valid UTF-8 are returned as they are. */
+static inline guint32 nick_fold_next(const guchar *tab, const guchar **s)
+{
+	const guchar *p = *s;
+	gunichar c;
+
+	if (*p < 0x80) {
+		*s = p + 1;
+		return tab[*p];
+	}
+
+	c = g_utf8_get_char_validated((const gchar *) p, -1);
+	if (c == (gunichar) -1 || c == (gunichar) -2) {
+		*s = p + 1;
+		return *p;
+	}
+
+	*s = (const guchar *) g_utf8_next_char(p);
+	return g_unichar_tolower(c) | 0x80000000;
+}
+
+/* Hash and equality functions for irc->nick_user_hash. Both fold case on
+   the fly, so lookups can be done with the nick exactly as the client sent
+   it, no lowercased copy needed. */
+guint nick_hash(gconstpointer key)
+{
+	const guchar *tab = nick_fold_tab();
+	const guchar *s = key;
+	guint h = 5381;
+
+	while (*s) {
+		h = (h << 5) + h + nick_fold_next(tab, &s);
+	}
+
+	return h;
+}
+
+gboolean nick_equal(gconstpointer a_, gconstpointer b_)
+{
+	const guchar *tab = nick_fold_tab();
+	const guchar *a = a_, *b = b_;
+
+	while (*a && *b) {
+		if (nick_fold_next(tab, &a) != nick_fold_next(tab, &b)) {
+			return FALSE;
+		}
+	}
+
+	return *a == *b;
+}
+
 int nick_cmp(irc_t *irc, const char *a, const char *b)
 {
-	char aa[1024] = "", bb[1024] = "";
+	const guchar *tab = nick_fold_tab();
+	const guchar *aa = (const guchar *) a, *bb = (const guchar *) b;
+	guint32 ca, cb;
 
-	strncpy(aa, a, sizeof(aa) - 1);
-	strncpy(bb, b, sizeof(bb) - 1);
-	if (nick_lc(irc, aa) && nick_lc(irc, bb)) {
-		return(strcmp(aa, bb));
-	} else {
+	if (!nick_ok(irc, a) || !nick_ok(irc, b)) {
 		return(-1);     /* Hmm... Not a clear answer.. :-/ */
 	}
+
+	do {
+		ca = *aa ? nick_fold_next(tab, &aa) : 0;
+		cb = *bb ? nick_fold_next(tab, &bb) : 0;
+	} while (ca && ca == cb);
+
+	return ca < cb ? -1 : ca > cb;
 }
@@ -37,4 +37,6 @@ gboolean nick_ok(irc_t *irc, const char *nick);
 int nick_lc(irc_t *irc, char *nick);
 int nick_uc(irc_t *irc, char *nick);
 int nick_cmp(irc_t *irc, const char *a, const char *b);
+guint nick_hash(gconstpointer key);
+gboolean nick_equal(gconstpointer a, gconstpointer b);
 char *nick_dup(const char *nick);
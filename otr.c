@@ -42,6 +42,7 @@
 #include "bitlbee.h"
 #include "irc.h"
 #include "otr.h"
+#include "ipc.h"
 #include <sys/types.h>
 #include <sys/wait.h>
 #include <unistd.h>
@@ -126,6 +127,16 @@ typedef struct {
 
 static OtrlMessageAppOps otr_ops;   /* collects interface functions required by OTR */
 
+/* keygen jobs of all users in this process, oldest first. they're started
+   in that order, at most OtrKeygenWorkers at once (or one at a time when
+   the ForkDaemon master says so). */
+static GList *keygen_jobs = NULL;
+static int keygen_running = 0;
+
+/* ForkDaemon only: whether we hold a keygen slot, or asked for one */
+static gboolean keygen_granted = FALSE;
+static gboolean keygen_requested = FALSE;
+
 
 /** misc. helpers/subroutines: **/
 
@@ -135,17 +146,32 @@ int keygen_in_progress(irc_t *irc, const char *handle, const char *protocol);
 /* start background process to generate a (new) key for a given account */
 void otr_keygen(irc_t *irc, const char *handle, const char *protocol);
 
-/* main function for the forked keygen slave */
-void keygen_child_main(OtrlUserState us, int infd, int outfd);
+/* main function for a forked keygen process */
+void keygen_child_main(OtrlUserState us, int outfd, const char *accountname, const char *protocol);
 
-/* mainloop handler for when a keygen finishes */
+/* mainloop handler collecting the output of a keygen process */
 gboolean keygen_finish_handler(gpointer data, gint fd, b_input_condition cond);
 
+/* drop (and kill) all keygen jobs of a user */
+static void keygen_cancel(irc_t *irc);
+
+/* start as many queued keygen jobs as we're allowed to */
+static void keygen_pool_run(void);
+
+/* KEYGEN replies from the ForkDaemon master */
+static void keygen_ipc_hook(irc_t *irc, char **cmd);
+
 /* copy the contents of file a to file b, overwriting it if it exists */
 void copyfile(const char *a, const char *b);
 
-/* read one line of input from a stream, excluding trailing newline */
-void myfgets(char *s, int size, FILE *stream);
+/* schedule a background write of fingerprints and/or instags (OTR_SAVE_*) */
+static void otr_save_later(irc_t *irc, int which);
+
+/* cancel a scheduled write and wait for one in progress */
+static void otr_save_sync(irc_t *irc);
+
+/* write fingerprints and/or instags (OTR_SAVE_*), returns an error message or NULL */
+static char *otr_write_files(OtrlUserState us, const char *nick, int which);
 
 /* some yes/no handlers */
 void yes_keygen(void *data);
@@ -265,6 +291,7 @@ void init_plugin(void)
 
 	root_command_add("otr", 1, cmd_otr, 0);
 	register_irc_plugin(&otr_plugin);
+	ipc_child_keygen_hook = keygen_ipc_hook;
 }
 
 #ifndef OTR_BI
@@ -316,27 +343,19 @@ void otr_irc_free(irc_t *irc)
 
 	otr_disconnect_all(irc);
 	b_event_remove(otr->timer);
+
+	/* don't lose changes still waiting to be written */
+	otr_save_sync(irc);
+	if (otr->save_dirty) {
+		g_free(otr_write_files(otr->us, irc->user->nick, otr->save_dirty));
+	}
 	otrl_userstate_free(otr->us);
 
 	s = set_find(&irc->b->set, "otr_policy");
 	g_slist_free(s->eval_data);
 
-	if (otr->keygen) {
-		kill(otr->keygen, SIGTERM);
-		waitpid(otr->keygen, NULL, 0);
-		/* TODO: remove stale keygen tempfiles */
-	}
-	if (otr->to) {
-		fclose(otr->to);
-	}
-	if (otr->from) {
-		fclose(otr->from);
-	}
-	while (otr->todo) {
-		kg_t *p = otr->todo;
-		otr->todo = p->next;
-		g_free(p);
-	}
+	/* TODO: remove stale keygen tempfiles */
+	keygen_cancel(irc);
 	g_free(otr);
 }
 
@@ -381,30 +400,232 @@ void otr_load(irc_t *irc)
 	}
 }
 
-void otr_save(irc_t *irc)
+/* writes fn through a temporary file, so it's never left half-written */
+static gcry_error_t otr_write_file(OtrlUserState us, const char *fn,
+                                   gcry_error_t (*writer)(OtrlUserState us, const char *fn))
+{
+	char *tmp = g_strdup_printf("%s.new", fn);
+	gcry_error_t e;
+
+	e = writer(us, tmp);
+	if (!e) {
+		chmod(tmp, 0600);
+		if (rename(tmp, fn) != 0) {
+			e = gcry_error_from_errno(errno);
+		}
+	}
+	if (e) {
+		unlink(tmp);
+	}
+	g_free(tmp);
+
+	return e;
+}
+
+static char *otr_write_files(OtrlUserState us, const char *nick, int which)
 {
 	char s[512];
 	gcry_error_t e;
 
-	if (strsane(irc->user->nick)) {
-		g_snprintf(s, 511, "%s%s.otr_fprints", global.conf->configdir, irc->user->nick);
-		e = otrl_privkey_write_fingerprints(irc->otr->us, s);
-		if (e) {
-			irc_rootmsg(irc, "otr save: %s: %s", s, gcry_strerror(e));
+	if (!strsane(nick)) {
+		return NULL;
+	}
+
+	if (which & OTR_SAVE_FPRINTS) {
+		g_snprintf(s, 511, "%s%s.otr_fprints", global.conf->configdir, nick);
+		if ((e = otr_write_file(us, s, otrl_privkey_write_fingerprints))) {
+			return g_strdup_printf("otr save: %s: %s", s, gcry_strerror(e));
+		}
+	}
+	if (which & OTR_SAVE_INSTAGS) {
+		g_snprintf(s, 511, "%s%s.otr_instags", global.conf->configdir, nick);
+		if ((e = otr_write_file(us, s, otrl_instag_write))) {
+			return g_strdup_printf("otr save: %s: %s", s, gcry_strerror(e));
+		}
+	}
+
+	return NULL;
+}
+
+/* clean up after a writer process that exited, and show its complaints */
+static void otr_save_reap(irc_t *irc)
+{
+	otr_t *otr = irc->otr;
+	char buf[512];
+	int n;
+
+	while ((n = read(otr->save_fd, buf, sizeof(buf))) > 0 || (n < 0 && errno == EINTR)) {
+		if (n > 0) {
+			g_string_append_len(otr->save_out, buf, n);
+		}
+	}
+	if (otr->save_out->len > 0) {
+		irc_rootmsg(irc, "%s", otr->save_out->str);
+	}
+
+	if (otr->save_inpa) {
+		b_event_remove(otr->save_inpa);
+	}
+	close(otr->save_fd);
+	/* normally a no-op, the kernel already took care of it if SIGCHLD
+	   is ignored */
+	waitpid(otr->save_pid, NULL, WNOHANG);
+	g_string_free(otr->save_out, TRUE);
+	otr->save_out = NULL;
+	otr->save_inpa = 0;
+	otr->save_pid = 0;
+}
+
+static gboolean otr_save_done(gpointer data, gint fd, b_input_condition cond)
+{
+	irc_t *irc = data;
+	otr_t *otr = irc->otr;
+	char buf[512];
+	int n;
+
+	n = read(fd, buf, sizeof(buf));
+	if (n > 0) {
+		g_string_append_len(otr->save_out, buf, n);
+		return TRUE;
+	} else if (n < 0 && sockerr_again()) {
+		return TRUE;
+	}
+
+	/* EOF, the writer is done. returning FALSE unregisters us */
+	otr->save_inpa = 0;
+	otr_save_reap(irc);
+
+	/* more changes came in while it was busy */
+	if (otr->save_dirty) {
+		otr_save_later(irc, 0);
+	}
+
+	return FALSE;
+}
+
+/* hand everything that changed to a forked process, which gets its own copy
+   of the userstate and writes it out while we carry on */
+static gboolean otr_save_timeout(gpointer data, gint fd, b_input_condition cond)
+{
+	irc_t *irc = data;
+	otr_t *otr = irc->otr;
+	int fds[2];
+	char *err;
+	pid_t p;
+
+	otr->save_timer = 0;
+
+	/* still writing the previous batch, otr_save_done() will be back */
+	if (otr->save_pid || !otr->save_dirty) {
+		return FALSE;
+	}
+
+	if (pipe(fds) < 0) {
+		otr_save(irc);
+		return FALSE;
+	}
+
+	p = fork();
+	if (p < 0) {
+		close(fds[0]);
+		close(fds[1]);
+		otr_save(irc);
+		return FALSE;
+	}
+
+	if (!p) {
+		/* child process */
+		close(fds[0]);
+		if ((err = otr_write_files(otr->us, irc->user->nick, otr->save_dirty))) {
+			if (write(fds[1], err, strlen(err)) < 0) {
+				/* nobody to tell */
+			}
 		}
-		chmod(s, 0600);
+		_exit(0);
+	}
+
+	close(fds[1]);
+	sock_make_nonblocking(fds[0]);
+
+	otr->save_dirty = 0;
+	otr->save_pid = p;
+	otr->save_fd = fds[0];
+	otr->save_out = g_string_new("");
+	otr->save_inpa = b_input_add(fds[0], B_EV_IO_READ, otr_save_done, irc);
+
+	return FALSE;
+}
+
+static void otr_save_later(irc_t *irc, int which)
+{
+	otr_t *otr = irc->otr;
+
+	otr->save_dirty |= which;
+	if (!otr->save_timer && !otr->save_pid) {
+		otr->save_timer = b_timeout_add(global.conf->otr_save_delay * 1000,
+		                                otr_save_timeout, irc);
+	}
+}
+
+static void otr_save_sync(irc_t *irc)
+{
+	otr_t *otr = irc->otr;
+
+	if (otr->save_timer) {
+		b_event_remove(otr->save_timer);
+		otr->save_timer = 0;
+	}
+
+	if (otr->save_pid) {
+		/* don't waitpid() for it: with SIGCHLD ignored that waits for
+		   *all* our children (keygens, auth workers) to exit. the writer
+		   closes its end of the pipe when it's done, so a blocking read
+		   up to EOF waits for just this one. it's a small file. */
+		sock_make_blocking(otr->save_fd);
+		otr_save_reap(irc);
+	}
+}
+
+void otr_save(irc_t *irc)
+{
+	otr_t *otr = irc->otr;
+	char *err;
+
+	otr_save_sync(irc);
+
+	/* fingerprints always, instags only if there's something new */
+	err = otr_write_files(otr->us, irc->user->nick, OTR_SAVE_FPRINTS | otr->save_dirty);
+	otr->save_dirty = 0;
+
+	if (err) {
+		irc_rootmsg(irc, "%s", err);
+		g_free(err);
 	}
 }
 
 void otr_remove(const char *nick)
 {
 	char s[512];
+	GSList *l;
+
+	/* make sure a pending write doesn't bring the files back */
+	for (l = irc_connection_list; l; l = l->next) {
+		irc_t *irc = l->data;
+
+		if (irc->otr && irc->user && irc->user->nick &&
+		    nick_cmp(NULL, irc->user->nick, nick) == 0) {
+			otr_save_sync(irc);
+			irc->otr->save_dirty = 0;
+		}
+	}
 
 	if (strsane(nick)) {
 		g_snprintf(s, 511, "%s%s.otr_keys", global.conf->configdir, nick);
 		unlink(s);
 		g_snprintf(s, 511, "%s%s.otr_fprints", global.conf->configdir, nick);
 		unlink(s);
+		g_snprintf(s, 511, "%s%s.otr_instags", global.conf->configdir, nick);
+		unlink(s);
 	}
 }
 
@@ -419,6 +640,9 @@ void otr_rename(const char *onick, const char *nnick)
 		g_snprintf(s, 511, "%s%s.otr_fprints", global.conf->configdir, onick);
 		g_snprintf(t, 511, "%s%s.otr_fprints", global.conf->configdir, nnick);
 		rename(s, t);
+		g_snprintf(s, 511, "%s%s.otr_instags", global.conf->configdir, onick);
+		g_snprintf(t, 511, "%s%s.otr_instags", global.conf->configdir, nnick);
+		rename(s, t);
 	}
 }
 
@@ -532,6 +756,7 @@ static const struct irc_plugin otr_plugin =
 
 static void cmd_otr(irc_t *irc, char **args)
 {
+	static cmdtab_t otr_cmdtab = CMDTAB_INIT;
 	const command_t *cmd;
 
 	if (!args[0]) {
@@ -542,13 +767,11 @@ static void cmd_otr(irc_t *irc, char **args)
 		return;
 	}
 
-	for (cmd = otr_commands; cmd->command; cmd++) {
-		if (strcmp(cmd->command, args[1]) == 0) {
-			break;
-		}
+	if (otr_cmdtab.len == 0) {
+		cmdtab_add_array(&otr_cmdtab, otr_commands, sizeof(command_t));
 	}
 
-	if (!cmd->command) {
+	if (!(cmd = cmdtab_find(&otr_cmdtab, args[1]))) {
 		irc_rootmsg(irc, "%s: unknown subcommand \"%s\", see \x02help otr\x02",
 		            args[0], args[1]);
 		return;
@@ -635,9 +858,10 @@ void op_inject_message(void *opdata, const char *accountname,
 		/* huh? injecting messages to myself? */
 		irc_rootmsg(irc, "note to self: %s", message);
 	} else {
-		/* need to drop some consts here :-( */
+		/* Same queue as everything else, so these don't overtake (or
+		   get overtaken by) messages that are still waiting. */
 		/* TODO: get flags into op_inject_message?! */
-		ic->acc->prpl->buddy_msg(ic, (char *) recipient, (char *) message, 0);
+		bee_queue_msg(ic->acc, recipient, g_strdup(message), 0);
 		/* ignoring return value :-/ */
 	}
 }
@@ -666,7 +890,7 @@ void op_write_fingerprints(void *opdata)
 	struct im_connection *ic = (struct im_connection *) opdata;
 	irc_t *irc = ic->bee->ui_data;
 
-	otr_save(irc);
+	otr_save_later(irc, OTR_SAVE_FPRINTS);
 }
 
 void op_gone_secure(void *opdata, ConnContext *context)
@@ -755,14 +979,23 @@ void op_create_instag(void *opdata, const char *account, const char *protocol)
 	        check_imc(opdata, account, protocol);
 	irc_t *irc = ic->bee->ui_data;
 	gcry_error_t e;
-	char s[512];
+	FILE *f;
+
+	/* libotr wants to write out all instags right away; let it write to
+	   /dev/null and save them with the next batch instead */
+	if (!(f = fopen("/dev/null", "w"))) {
+		irc_rootmsg(irc, "otr: %s/%s: can't open /dev/null: %s",
+		            account, protocol, strerror(errno));
+		return;
+	}
+	e = otrl_instag_generate_FILEp(irc->otr->us, f, account, protocol);
+	fclose(f);
 
-	g_snprintf(s, 511, "%s%s.otr_instags", global.conf->configdir,
-	           irc->user->nick);
-	e = otrl_instag_generate(irc->otr->us, s, account, protocol);
 	if (e) {
 		irc_rootmsg(irc, "otr: %s/%s: otrl_instag_generate failed: %s",
 		            account, protocol, gcry_strerror(e));
+	} else {
+		otr_save_later(irc, OTR_SAVE_INSTAGS);
 	}
 }
 
@@ -1065,12 +1298,8 @@ void cmd_otr_connect(irc_t *irc, char **args)
 
 	/* send the message */
 	if (msg) {
-		u->bu->ic->acc->prpl->buddy_msg(u->bu->ic, u->bu->handle, msg, 0);  /* XXX flags? */
+		bee_queue_msg(u->bu->ic->acc, u->bu->handle, msg == query ? g_strdup(msg) : msg, 0);  /* XXX flags? */
 		/* XXX error message? */
-
-		if (msg != query) {
-			g_free(msg);
-		}
 	}
 }
 
@@ -1527,7 +1756,7 @@ struct im_connection *check_imc(void *opdata, const char *accountname,
 
 irc_user_t *peeruser(irc_t *irc, const char *handle, const char *protocol)
 {
-	GSList *l;
+	GList *l;
 
 	for (l = irc->b->users; l; l = l->next) {
 		bee_user_t *bu = l->data;
@@ -1787,6 +2016,8 @@ void show_general_otr_info(irc_t *irc)
 	OtrlPrivKey *key;
 	char human[45];
 	kg_t *kg;
+	GList *l;
+	int jobs = 0;
 
 	/* list all privkeys (including ones being generated) */
 	irc_rootmsg(irc, "\x1fprivate keys:\x1f");
@@ -1810,18 +2041,16 @@ void show_general_otr_info(irc_t *irc)
 			irc_rootmsg(irc, "    %s", human);
 		}
 	}
-	if (irc->otr->sent_accountname) {
-		irc_rootmsg(irc, "  %s/%s - DSA", irc->otr->sent_accountname,
-		            irc->otr->sent_protocol);
-		irc_rootmsg(irc, "    (being generated)");
-	}
-	for (kg = irc->otr->todo; kg; kg = kg->next) {
+	for (l = keygen_jobs; l; l = l->next) {
+		kg = l->data;
+		if (kg->irc != irc) {
+			continue;
+		}
 		irc_rootmsg(irc, "  %s/%s - DSA", kg->accountname, kg->protocol);
-		irc_rootmsg(irc, "    (queued)");
+		irc_rootmsg(irc, kg->pid ? "    (being generated)" : "    (queued)");
+		jobs++;
 	}
-	if (key == irc->otr->us->privkey_root &&
-	    !irc->otr->sent_accountname &&
-	    kg == irc->otr->todo) {
+	if (key == irc->otr->us->privkey_root && jobs == 0) {
 		irc_rootmsg(irc, "  (none)");
 	}
 
@@ -1917,21 +2146,13 @@ void show_otr_context_info(irc_t *irc, ConnContext *ctx, ConnContext *bestctx)
 
 int keygen_in_progress(irc_t *irc, const char *handle, const char *protocol)
 {
-	kg_t *kg;
+	GList *l;
 
-	if (!irc->otr->sent_accountname || !irc->otr->sent_protocol) {
-		return 0;
-	}
+	for (l = keygen_jobs; l; l = l->next) {
+		kg_t *kg = l->data;
 
-	/* are we currently working on this key? */
-	if (!strcmp(handle, irc->otr->sent_accountname) &&
-	    !strcmp(protocol, irc->otr->sent_protocol)) {
-		return 1;
-	}
-
-	/* do we have it queued for later? */
-	for (kg = irc->otr->todo; kg; kg = kg->next) {
-		if (!strcmp(handle, kg->accountname) &&
+		if (kg->irc == irc &&
+		    !strcmp(handle, kg->accountname) &&
 		    !strcmp(protocol, kg->protocol)) {
 			return 1;
 		}
@@ -1940,117 +2161,258 @@ int keygen_in_progress(irc_t *irc, const char *handle, const char *protocol)
 	return 0;
 }
 
-void otr_keygen(irc_t *irc, const char *handle, const char *protocol)
+static gboolean keygen_user_busy(irc_t *irc)
 {
-	/* do nothing if a key for the requested account is already being generated */
-	if (keygen_in_progress(irc, handle, protocol)) {
-		return;
+	GList *l;
+
+	for (l = keygen_jobs; l; l = l->next) {
+		kg_t *kg = l->data;
+
+		if (kg->irc == irc && kg->pid) {
+			return TRUE;
+		}
 	}
 
-	/* see if we already have a keygen child running. if not, start one and put a
-	   handler on its output. */
-	if (!irc->otr->keygen || waitpid(irc->otr->keygen, NULL, WNOHANG)) {
-		pid_t p;
-		int to[2], from[2];
-		FILE *tof, *fromf;
+	return FALSE;
+}
 
-		if (pipe(to) < 0 || pipe(from) < 0) {
-			irc_rootmsg(irc, "otr keygen: couldn't create pipe: %s", strerror(errno));
-			return;
+/* 1 for the first job that's still waiting, etc. */
+static int keygen_queue_position(kg_t *job)
+{
+	GList *l;
+	int n = 0;
+
+	for (l = keygen_jobs; l; l = l->next) {
+		kg_t *kg = l->data;
+
+		if (!kg->pid) {
+			n++;
 		}
+		if (kg == job) {
+			break;
+		}
+	}
 
-		tof = fdopen(to[1], "w");
-		fromf = fdopen(from[0], "r");
-		if (!tof || !fromf) {
-			irc_rootmsg(irc, "otr keygen: couldn't streamify pipe: %s", strerror(errno));
-			return;
+	return n;
+}
+
+static void keygen_job_free(kg_t *kg)
+{
+	keygen_jobs = g_list_remove(keygen_jobs, kg);
+
+	if (kg->pid) {
+		keygen_running--;
+	}
+	if (kg->inpa) {
+		b_event_remove(kg->inpa);
+	}
+	if (kg->fd >= 0) {
+		close(kg->fd);
+	}
+	if (kg->out) {
+		g_string_free(kg->out, TRUE);
+	}
+	g_free(kg->accountname);
+	g_free(kg->protocol);
+	g_free(kg);
+}
+
+static void keygen_cancel(irc_t *irc)
+{
+	GList *l, *next;
+
+	for (l = keygen_jobs; l; l = next) {
+		kg_t *kg = l->data;
+
+		next = l->next;
+		if (kg->irc != irc) {
+			continue;
 		}
+		if (kg->pid) {
+			kill(kg->pid, SIGTERM);
+		}
+		keygen_job_free(kg);
+	}
 
-		p = fork();
-		if (p < 0) {
-			irc_rootmsg(irc, "otr keygen: couldn't fork: %s", strerror(errno));
-			return;
+	keygen_pool_run();
+}
+
+static gboolean keygen_start(kg_t *kg)
+{
+	irc_t *irc = kg->irc;
+	int from[2];
+	pid_t p;
+
+	if (pipe(from) < 0) {
+		irc_rootmsg(irc, "otr keygen: couldn't create pipe: %s", strerror(errno));
+		return FALSE;
+	}
+
+	p = fork();
+	if (p < 0) {
+		irc_rootmsg(irc, "otr keygen: couldn't fork: %s", strerror(errno));
+		close(from[0]);
+		close(from[1]);
+		return FALSE;
+	}
+
+	if (!p) {
+		/* child process */
+		signal(SIGTERM, exit);
+		close(from[0]);
+		keygen_child_main(irc->otr->us, from[1], kg->accountname, kg->protocol);
+		exit(0);
+	}
+
+	close(from[1]);
+	sock_make_nonblocking(from[0]);
+
+	kg->pid = p;
+	kg->fd = from[0];
+	kg->out = g_string_new("");
+	kg->inpa = b_input_add(kg->fd, B_EV_IO_READ, keygen_finish_handler, kg);
+	keygen_running++;
+
+	return TRUE;
+}
+
+static void keygen_pool_run(void)
+{
+	gboolean forked = global.conf->runmode == RUNMODE_FORKDAEMON &&
+	                  global.listen_socket >= 0;
+	GList *l, *next;
+
+	for (l = keygen_jobs; l; l = next) {
+		kg_t *kg = l->data;
+
+		next = l->next;
+
+		/* one at a time per user: every result replaces the whole
+		   key file, generated from the keys we had when it started */
+		if (kg->pid || keygen_user_busy(kg->irc)) {
+			continue;
 		}
 
-		if (!p) {
-			/* child process */
-			signal(SIGTERM, exit);
-			keygen_child_main(irc->otr->us, to[0], from[1]);
-			exit(0);
-		}
-
-		irc->otr->keygen = p;
-		irc->otr->to = tof;
-		irc->otr->from = fromf;
-		irc->otr->sent_accountname = NULL;
-		irc->otr->sent_protocol = NULL;
-		irc->otr->todo = NULL;
-		b_input_add(from[0], B_EV_IO_READ, keygen_finish_handler, irc);
-	}
-
-	/* is the keygen slave currently working? */
-	if (irc->otr->sent_accountname) {
-		/* enqueue our job for later transmission */
-		kg_t **kg = &irc->otr->todo;
-		while (*kg) {
-			kg = &((*kg)->next);
-		}
-		*kg = g_new0(kg_t, 1);
-		(*kg)->accountname = g_strdup(handle);
-		(*kg)->protocol = g_strdup(protocol);
-	} else {
-		/* send our job over and remember it */
-		fprintf(irc->otr->to, "%s\n%s\n", handle, protocol);
-		fflush(irc->otr->to);
-		irc->otr->sent_accountname = g_strdup(handle);
-		irc->otr->sent_protocol = g_strdup(protocol);
+		if (forked) {
+			/* the master counts for all processes, we only get to run
+			   one job at a time when it says so */
+			if (!keygen_granted) {
+				if (!keygen_requested) {
+					keygen_requested = TRUE;
+					ipc_to_master_str("KEYGEN REQUEST\r\n");
+				}
+				break;
+			}
+			if (keygen_running > 0) {
+				break;
+			}
+		} else if (keygen_running >= global.conf->otr_keygen_workers) {
+			break;
+		}
+
+		if (!keygen_start(kg)) {
+			keygen_job_free(kg);
+		}
+	}
+
+	/* give back a slot we turned out not to need */
+	if (forked && keygen_granted && keygen_running == 0) {
+		keygen_granted = FALSE;
+		ipc_to_master_str("KEYGEN DONE\r\n");
+	}
+}
+
+static void keygen_ipc_hook(irc_t *irc, char **cmd)
+{
+	if (g_strcasecmp(cmd[1], "GO") == 0) {
+		keygen_requested = FALSE;
+		keygen_granted = TRUE;
+		keygen_pool_run();
+	} else if (g_strcasecmp(cmd[1], "WAIT") == 0 && cmd[2] && irc &&
+	           (irc->status & USTATUS_LOGGED_IN)) {
+		irc_rootmsg(irc, "otr keygen: server busy, you're number %s in line", cmd[2]);
+	}
+}
+
+void otr_keygen(irc_t *irc, const char *handle, const char *protocol)
+{
+	kg_t *kg;
+
+	/* do nothing if a key for the requested account is already being generated */
+	if (keygen_in_progress(irc, handle, protocol)) {
+		return;
+	}
+
+	kg = g_new0(kg_t, 1);
+	kg->irc = irc;
+	kg->accountname = g_strdup(handle);
+	kg->protocol = g_strdup(protocol);
+	kg->fd = -1;
+	keygen_jobs = g_list_append(keygen_jobs, kg);
+
+	keygen_pool_run();
+
+	/* in ForkDaemon mode the master tells us where we are in line */
+	if (g_list_find(keygen_jobs, kg) && !kg->pid &&
+	    (global.conf->runmode != RUNMODE_FORKDAEMON || keygen_running > 0)) {
+		irc_rootmsg(irc, "otr keygen for %s/%s queued, position %d",
+		            handle, protocol, keygen_queue_position(kg));
 	}
 }
 
-void keygen_child_main(OtrlUserState us, int infd, int outfd)
+void keygen_child_main(OtrlUserState us, int outfd, const char *accountname, const char *protocol)
 {
-	FILE *input, *output;
-	char filename[128], accountname[512], protocol[512];
+	FILE *output;
+	char filename[128];
 	gcry_error_t e;
 	int tempfd;
 
-	input = fdopen(infd, "r");
 	output = fdopen(outfd, "w");
 
-	while (!feof(input) && !ferror(input) && !feof(output) && !ferror(output)) {
-		myfgets(accountname, 512, input);
-		myfgets(protocol, 512, input);
-
-		strncpy(filename, "/tmp/bitlbee-XXXXXX", 128);
-		tempfd = mkstemp(filename);
-		close(tempfd);
+	strncpy(filename, "/tmp/bitlbee-XXXXXX", 128);
+	tempfd = mkstemp(filename);
+	close(tempfd);
 
-		e = otrl_privkey_generate(us, filename, accountname, protocol);
-		if (e) {
-			fprintf(output, "\n");  /* this means failure */
-			fprintf(output, "otr keygen: %s\n", gcry_strerror(e));
-			unlink(filename);
-		} else {
-			fprintf(output, "%s\n", filename);
-			fprintf(output, "otr keygen for %s/%s complete\n", accountname, protocol);
-		}
-		fflush(output);
+	e = otrl_privkey_generate(us, filename, accountname, protocol);
+	if (e) {
+		fprintf(output, "\n");  /* this means failure */
+		fprintf(output, "otr keygen: %s\n", gcry_strerror(e));
+		unlink(filename);
+	} else {
+		fprintf(output, "%s\n", filename);
+		fprintf(output, "otr keygen for %s/%s complete\n", accountname, protocol);
 	}
 
-	fclose(input);
 	fclose(output);
 }
 
 gboolean keygen_finish_handler(gpointer data, gint fd, b_input_condition cond)
 {
-	irc_t *irc = (irc_t *) data;
-	char filename[512], msg[512];
+	kg_t *kg = data;
+	irc_t *irc = kg->irc;
+	char buf[512], **lines;
+	int n;
 
-	myfgets(filename, 512, irc->otr->from);
-	myfgets(msg, 512, irc->otr->from);
+	/* collect everything until the keygen process exits and closes
+	   its end of the pipe */
+	n = read(fd, buf, sizeof(buf));
+	if (n > 0) {
+		g_string_append_len(kg->out, buf, n);
+		return TRUE;
+	} else if (n < 0 && sockerr_again()) {
+		return TRUE;
+	}
+
+	lines = g_strsplit(kg->out->str, "\n", 3);
+	if (lines[0] && lines[1]) {
+		irc_rootmsg(irc, "%s", lines[1]);
+	} else {
+		irc_rootmsg(irc, "otr keygen for %s/%s failed", kg->accountname, kg->protocol);
+	}
+
+	if (lines[0] && lines[0][0] && lines[1]) {
+		char *filename = lines[0];
 
-	irc_rootmsg(irc, "%s", msg);
-	if (filename[0]) {
 		if (strsane(irc->user->nick)) {
 			char *kf = g_strdup_printf("%s%s.otr_keys", global.conf->configdir, irc->user->nick);
 			char *tmp = g_strdup_printf("%s.new", kf);
@@ -2065,34 +2427,20 @@ gboolean keygen_finish_handler(gpointer data, gint fd, b_input_condition cond)
 			unlink(filename);
 		}
 	}
+	g_strfreev(lines);
 
-	/* forget this job */
-	g_free(irc->otr->sent_accountname);
-	g_free(irc->otr->sent_protocol);
-	irc->otr->sent_accountname = NULL;
-	irc->otr->sent_protocol = NULL;
-
-	/* see if there are any more in the queue */
-	if (irc->otr->todo) {
-		kg_t *p = irc->otr->todo;
-		/* send the next one over */
-		fprintf(irc->otr->to, "%s\n%s\n", p->accountname, p->protocol);
-		fflush(irc->otr->to);
-		irc->otr->sent_accountname = p->accountname;
-		irc->otr->sent_protocol = p->protocol;
-		irc->otr->todo = p->next;
-		g_free(p);
-		return TRUE;   /* keep watching */
-	} else {
-		/* okay, the slave is idle now, so kill him */
-		fclose(irc->otr->from);
-		fclose(irc->otr->to);
-		irc->otr->from = irc->otr->to = NULL;
-		kill(irc->otr->keygen, SIGTERM);
-		waitpid(irc->otr->keygen, NULL, 0);
-		irc->otr->keygen = 0;
-		return FALSE;  /* unregister ourselves */
+	/* forget this job; returning FALSE unregisters us */
+	kg->inpa = 0;
+	keygen_job_free(kg);
+
+	/* in ForkDaemon mode, let others have a go before our next job */
+	if (keygen_granted) {
+		keygen_granted = FALSE;
+		ipc_to_master_str("KEYGEN DONE\r\n");
 	}
+	keygen_pool_run();
+
+	return FALSE;
 }
 
 void copyfile(const char *a, const char *b)
@@ -2112,18 +2460,6 @@ void copyfile(const char *a, const char *b)
 	close(fdb);
 }
 
-void myfgets(char *s, int size, FILE *stream)
-{
-	if (!fgets(s, size, stream)) {
-		s[0] = '\0';
-	} else {
-		int n = strlen(s);
-		if (n > 0 && s[n - 1] == '\n') {
-			s[n - 1] = '\0';
-		}
-	}
-}
-
 void yes_keygen(void *data)
 {
 	account_t *acc = (account_t *) data;
@@ -44,32 +44,39 @@ struct account;
 #include <libotr/message.h>
 #include <libotr/privkey.h>
 
-/* representing a keygen job */
+/* representing a keygen job, queued process-wide (see otr.c) */
 typedef struct kg {
+	struct irc *irc;
 	char *accountname;
 	char *protocol;
 
-	struct kg *next;
+	pid_t pid;       /* pid of keygen process (0 while still queued) */
+	int fd;          /* pipe from keygen process */
+	gint inpa;
+	GString *out;    /* what the keygen process wrote so far */
 } kg_t;
 
 /* struct to encapsulate our book keeping stuff */
 typedef struct otr {
 	OtrlUserState us;
-	pid_t keygen;    /* pid of keygen slave (0 if none) */
-	FILE *to;        /* pipe to keygen slave */
-	FILE *from;      /* pipe from keygen slave */
-
-	/* active keygen job (NULL if none) */
-	char *sent_accountname;
-	char *sent_protocol;
-
-	/* keygen jobs waiting to be sent to slave */
-	kg_t *todo;
 
 	/* event timer for otrl_message_poll */
 	gint timer;
+
+	/* fingerprints/instags changed but not written yet (OTR_SAVE_*) */
+	int save_dirty;
+	gint save_timer;
+
+	/* background process writing them (0 if none) */
+	pid_t save_pid;
+	int save_fd;
+	gint save_inpa;
+	GString *save_out;
 } otr_t;
 
+#define OTR_SAVE_FPRINTS 1
+#define OTR_SAVE_INSTAGS 2
+
 /* called from main() */
 void otr_init(void);
 
@@ -68,6 +68,11 @@ account_t *account_add(bee_t *bee, struct prpl *prpl, char *user, char *pass)
 	s = set_add(&a->set, "nick_source", "handle", set_eval_nick_source, a);
 	s->flags |= SET_NOSAVE; /* Just for bw compatibility! */
 
+	s = set_add(&a->set, "send_burst", "10", set_eval_int, a);
+
+	/* Off unless the user (or protocol) asks for it. */
+	s = set_add(&a->set, "send_rate", "0", set_eval_send_rate, a);
+
 	s = set_add(&a->set, "password", NULL, set_eval_account, a);
 	s->flags |= SET_NOSAVE | SET_NULL_OK | SET_PASSWORD | ACC_SET_LOCKABLE;
 
@@ -324,6 +329,8 @@ void account_del(bee_t *bee, account_t *acc)
 			}
 
 			g_hash_table_destroy(a->nicks);
+			bee_queue_free(a);
+			account_login_done(a);
 
 			g_free(a->tag);
 			g_free(a->user);
@@ -474,3 +481,83 @@ int protocol_account_islocal(const char* protocol)
 	} while (*(++p));
 	return 0;
 }
+
+/* Protocols that keep a cache file per account (<nick>.<tag>.<name>, next
+   to the user's own .xml) list its name here so it gets cleaned up along
+   with the account. Only identified users have one: anyone else could be
+   using a registered user's nick. */
+static const char *account_cache_names[] = { "roster", NULL };
+
+char *account_cache_path(account_t *a, const char *tag, const char *name)
+{
+	irc_t *irc = a->bee->ui_data;
+	char *nick, *s, *path;
+
+	if (!irc || !(irc->status & USTATUS_IDENTIFIED) ||
+	    !irc->user || !irc->user->nick || !tag) {
+		return NULL;
+	}
+
+	nick = g_strdup(irc->user->nick);
+	nick_lc(NULL, nick);
+	path = g_strdup_printf("%s%s.%s.%s", global.conf->configdir, nick, tag, name);
+	g_free(nick);
+
+	/* Tags can't contain slashes, but let's not find out the hard way. */
+	for (s = path + strlen(global.conf->configdir); *s; s++) {
+		if (*s == '/') {
+			*s = '_';
+		}
+	}
+
+	return path;
+}
+
+/* For "account del", and with the old tag when it's renamed. */
+void account_cache_remove(account_t *a, const char *tag)
+{
+	const char **name;
+
+	for (name = account_cache_names; *name; name++) {
+		char *path = account_cache_path(a, tag, *name);
+
+		if (path) {
+			unlink(path);
+			g_free(path);
+		}
+	}
+}
+
+/* The same for all accounts of a user, who is being dropped. nick is
+   lowercased already. */
+void account_cache_remove_nick(const char *nick)
+{
+	const char **name, *file;
+	size_t len = strlen(nick);
+	GDir *dir;
+
+	if (!(dir = g_dir_open(global.conf->configdir, 0, NULL))) {
+		return;
+	}
+
+	while ((file = g_dir_read_name(dir))) {
+		if (strncmp(file, nick, len) != 0 || file[len] != '.') {
+			continue;
+		}
+
+		for (name = account_cache_names; *name; name++) {
+			/* At least one character for the tag. */
+			const char *s = file + strlen(file) - strlen(*name);
+
+			if (strlen(file) > len + strlen(*name) + 2 && s[-1] == '.' && strcmp(s, *name) == 0) {
+				char *path = g_strconcat(global.conf->configdir, file, NULL);
+
+				unlink(path);
+				g_free(path);
+				break;
+			}
+		}
+	}
+
+	g_dir_close(dir);
+}
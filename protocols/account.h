@@ -26,6 +26,52 @@
 #ifndef _ACCOUNT_H
 #define _ACCOUNT_H
 
+/* Outgoing messages held back by the send_rate/send_burst token bucket. */
+typedef struct bee_queue {
+	GQueue msgs;    /* struct bee_queue_msg */
+	double tokens;
+	gint64 last_refill;
+	gint timer;
+
+	/* Statistics, shown by "account <acc> queue". */
+	guint max_depth;
+	guint64 sent;
+	guint64 queued;
+	guint64 coalesced;
+	guint64 dropped;
+} bee_queue_t;
+
+/* Logins wait for a slot, see LoginsPerProtocol and LoginsPerHost. Lower
+   numbers go first. */
+typedef enum {
+	LOGIN_PRIO_USER = 0,    /* "account on" typed by the user */
+	LOGIN_PRIO_CONNECT,     /* auto_connect after identify */
+	LOGIN_PRIO_RECONNECT,   /* auto_reconnect */
+} login_prio_t;
+
+typedef enum {
+	LOGIN_WAITING,
+	LOGIN_RUNNING,
+	LOGIN_EXPIRED,          /* Took too long, not counted anymore. */
+} login_state_t;
+
+typedef void (*login_go_t)(gpointer data);
+typedef void (*login_wait_t)(gpointer data, int pos);
+
+typedef struct login_req {
+	char *protocol, *host;
+	char *label;            /* nick/account, for the LOGINS command */
+	login_prio_t prio;
+	login_state_t state;
+	time_t queued, started;
+	gboolean told;
+	gint timeout;
+
+	login_go_t go;
+	login_wait_t wait;
+	gpointer data;
+} login_req_t;
+
 typedef struct account {
 	struct prpl *prpl;
 	char *user;
@@ -44,6 +90,15 @@ typedef struct account {
 	struct bee *bee;
 	struct im_connection *ic;
 	struct account *next;
+
+	bee_queue_t *sendq;
+
+	/* Queued login (see bee_login.c). In ForkDaemon mode the master has
+	   the request, and only the id is known here. */
+	login_req_t *login;
+	int login_id;
+	login_prio_t login_prio;
+	gboolean login_waiting;
 } account_t;
 
 account_t *account_add(bee_t *bee, struct prpl *prpl, char *user, char *pass);
@@ -59,6 +114,29 @@ int account_reconnect_delay(account_t *a);
 
 int protocol_account_islocal(const char* protocol);
 
+char *account_cache_path(account_t *a, const char *tag, const char *name);
+void account_cache_remove(account_t *a, const char *tag);
+void account_cache_remove_nick(const char *nick);
+
+/* bee_queue.c */
+int bee_queue_msg(account_t *a, const char *handle, char *msg, int flags);
+void bee_queue_clear(account_t *a);
+void bee_queue_free(account_t *a);
+char *set_eval_send_rate(set_t *set, char *value);
+
+/* bee_login.c */
+login_req_t *login_sched_add(const char *protocol, const char *host, const char *label,
+                             login_prio_t prio, login_go_t go, login_wait_t wait,
+                             gpointer data);
+void login_sched_done(login_req_t *req);
+void login_sched_foreach(void (*func)(login_req_t *req, int pos, gpointer data), gpointer data);
+void account_login(account_t *a, login_prio_t prio);
+void account_login_go(account_t *a);
+void account_login_wait(account_t *a, int pos);
+void account_login_done(account_t *a);
+account_t *account_by_login_id(bee_t *bee, int id);
+void account_login_resend(bee_t *bee);
+
 typedef enum {
 	ACC_SET_OFFLINE_ONLY = 0x02,    /* Allow changes only if the acct is offline. */
 	ACC_SET_ONLINE_ONLY = 0x04,     /* Allow changes only if the acct is online. */
@@ -26,6 +26,24 @@
 #define BITLBEE_CORE
 #include "bitlbee.h"
 
+/* Lets protocols that care (XEP-0352 for example) know that nobody's
+   looking, so the server can hold back unimportant traffic. */
+void bee_set_idle(bee_t *bee, gboolean idle)
+{
+	account_t *a;
+
+	if (bee->idle == idle) {
+		return;
+	}
+
+	bee->idle = idle;
+	for (a = bee->accounts; a; a = a->next) {
+		if (a->ic && a->ic->flags & OPT_LOGGED_IN) {
+			imc_inactive_send_update(a->ic);
+		}
+	}
+}
+
 static char *set_eval_away_status(set_t *set, char *value);
 
 bee_t *bee_new()
@@ -34,7 +34,7 @@ typedef struct bee {
 	   own settings here. */
 	struct set *set;
 
-	GSList *users;  /* struct bee_user */
+	GList *users;   /* struct bee_user */
 	GSList *groups; /* struct bee_group */
 	struct account *accounts; /* TODO(wilmer): Use GSList here too? */
 
@@ -49,10 +49,15 @@ typedef struct bee {
 	/* And this one will be passed to every callback for any state the
 	   UI may want to keep. */
 	void *ui_data;
+
+	/* Set by the UI (using bee_set_idle()) when the user hasn't done
+	   anything for a while. */
+	gboolean idle;
 } bee_t;
 
 bee_t *bee_new();
 void bee_free(bee_t *b);
+void bee_set_idle(bee_t *bee, gboolean idle);
 
 /* TODO(wilmer): Kill at least the OPT_ flags that have an equivalent here. */
 typedef enum {
@@ -81,6 +86,11 @@ typedef struct bee_user {
 	bee_t *bee;
 	void *ui_data;
 	void *data; /* Can be used by the IM module. */
+
+	/* Our own nodes in bee->users and ic->users, so removing a user
+	   doesn't need a walk over either list. */
+	GList *bee_link;
+	GList *ic_link;
 } bee_user_t;
 
 typedef struct bee_chat_info {
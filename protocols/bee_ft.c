@@ -24,6 +24,11 @@
 #define BITLBEE_CORE
 #include "bitlbee.h"
 #include "ft.h"
+#include <sys/uio.h>
+
+#if defined(__linux__) && defined(SPLICE_F_MOVE)
+#define FT_RELAY_SPLICE
+#endif
 
 file_transfer_t *imcb_file_send_start(struct im_connection *ic, char *handle, char *file_name, size_t file_size)
 {
@@ -69,3 +74,362 @@ void imcb_file_finished(struct im_connection *ic, file_transfer_t *file)
 		bee->ui->ft_finished(ic, file);
 	}
 }
+
+struct ft_relay {
+	file_transfer_t *ft;
+	int fd;
+	void (*sent)(file_transfer_t *ft, unsigned int len);
+	void (*error)(file_transfer_t *ft, const char *msg);
+
+	/* Ring buffer of FT_RELAY_SIZE bytes, filled by ft_relay_write(). */
+	char *buf;
+	gsize head, len;
+	size_t in;              /* everything received so far */
+
+	/* Data spliced from ft->read_fd that wasn't written out yet. */
+	int pipe[2];
+	gsize piped, pipe_size;
+	gboolean splicing, no_splice, eof;
+
+	gint watch_out, watch_in;
+	gboolean requested;     /* waiting for the receiver to call write() */
+	gboolean failed;
+	int busy;               /* inside one of our functions, don't free yet */
+	gboolean dead;
+};
+
+static gboolean ft_relay_can_write(gpointer data, gint fd, b_input_condition cond);
+static gboolean ft_relay_can_read(gpointer data, gint fd, b_input_condition cond);
+
+ft_relay_t *ft_relay_new(file_transfer_t *ft, int fd,
+                         void (*sent)(file_transfer_t *ft, unsigned int len),
+                         void (*error)(file_transfer_t *ft, const char *msg))
+{
+	ft_relay_t *r = g_new0(ft_relay_t, 1);
+
+	r->ft = ft;
+	r->fd = fd;
+	r->sent = sent;
+	r->error = error;
+	r->pipe[0] = r->pipe[1] = -1;
+
+	return r;
+}
+
+static void ft_relay_unwatch(ft_relay_t *r)
+{
+	if (r->watch_out) {
+		b_event_remove(r->watch_out);
+		r->watch_out = 0;
+	}
+	if (r->watch_in) {
+		b_event_remove(r->watch_in);
+		r->watch_in = 0;
+	}
+}
+
+static void ft_relay_close_pipe(ft_relay_t *r)
+{
+	if (r->pipe[0] >= 0) {
+		close(r->pipe[0]);
+		close(r->pipe[1]);
+		r->pipe[0] = r->pipe[1] = -1;
+	}
+}
+
+static gboolean ft_relay_fail(ft_relay_t *r, const char *what, int err)
+{
+	char *msg = err ? g_strdup_printf("%s: %s", what, strerror(err)) : g_strdup(what);
+
+	r->failed = TRUE;
+	ft_relay_unwatch(r);
+	r->error(r->ft, msg);
+	g_free(msg);
+
+	return FALSE;
+}
+
+/* Keeps exactly the watches we need: writable while anything is queued,
+   readable while splicing and there's room in the pipe. */
+static void ft_relay_watch(ft_relay_t *r)
+{
+	gboolean out = r->len > 0 || r->piped > 0;
+	gboolean in = r->splicing && !r->eof && r->piped < r->pipe_size;
+
+	if (out && !r->watch_out) {
+		r->watch_out = b_input_add(r->fd, B_EV_IO_WRITE, ft_relay_can_write, r);
+	} else if (!out && r->watch_out) {
+		b_event_remove(r->watch_out);
+		r->watch_out = 0;
+	}
+
+	if (in && !r->watch_in) {
+		r->watch_in = b_input_add(r->ft->read_fd, B_EV_IO_READ, ft_relay_can_read, r);
+	} else if (!in && r->watch_in) {
+		b_event_remove(r->watch_in);
+		r->watch_in = 0;
+	}
+}
+
+/* Writes out as much as the socket takes, partial writes are fine.
+   Returns FALSE if the transfer failed or was freed in the meantime. */
+static gboolean ft_relay_flush(ft_relay_t *r)
+{
+	ssize_t st;
+
+	while (r->len > 0) {
+		struct iovec iov[2];
+		int n = 1;
+
+		iov[0].iov_base = r->buf + r->head;
+		iov[0].iov_len = MIN(r->len, FT_RELAY_SIZE - r->head);
+		if (iov[0].iov_len < r->len) {
+			iov[1].iov_base = r->buf;
+			iov[1].iov_len = r->len - iov[0].iov_len;
+			n = 2;
+		}
+
+		if ((st = writev(r->fd, iov, n)) < 0 && sockerr_again()) {
+			return TRUE;
+		} else if (st <= 0) {
+			return ft_relay_fail(r, "Sending", st < 0 ? errno : EPIPE);
+		}
+
+		r->len -= st;
+		r->head = r->len ? (r->head + st) % FT_RELAY_SIZE : 0;
+
+		r->sent(r->ft, st);
+		if (r->dead) {
+			return FALSE;
+		}
+	}
+
+#ifdef FT_RELAY_SPLICE
+	while (r->piped > 0) {
+		if ((st = splice(r->pipe[0], NULL, r->fd, NULL, r->piped,
+		                 SPLICE_F_MOVE | SPLICE_F_NONBLOCK)) < 0 && sockerr_again()) {
+			return TRUE;
+		} else if (st <= 0) {
+			return ft_relay_fail(r, "Sending", st < 0 ? errno : EPIPE);
+		}
+
+		r->piped -= st;
+
+		r->sent(r->ft, st);
+		if (r->dead) {
+			return FALSE;
+		}
+	}
+#endif
+
+	return TRUE;
+}
+
+#ifdef FT_RELAY_SPLICE
+/* When the receiver gives us its socket, the data can go from one socket
+   to the other through a pipe without ever being copied to user space. */
+static gboolean ft_relay_splice_start(ft_relay_t *r)
+{
+	int size = 0;
+
+	if (r->no_splice || !r->ft->read_done ||
+	    pipe2(r->pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+		return FALSE;
+	}
+
+#ifdef F_SETPIPE_SZ
+	/* The default is usually 64K, get a bit more if we're allowed to. */
+	fcntl(r->pipe[1], F_SETPIPE_SZ, FT_RELAY_SIZE);
+	size = fcntl(r->pipe[1], F_GETPIPE_SZ);
+#endif
+	r->pipe_size = size > 0 ? size : FT_RELAY_LOW;
+	r->splicing = TRUE;
+
+	return TRUE;
+}
+
+/* Reads into the pipe until it's full or the receiver's socket is empty.
+   Only ever asks for as much as fits, so EAGAIN always means the latter. */
+static gboolean ft_relay_fill(ft_relay_t *r)
+{
+	file_transfer_t *ft = r->ft;
+	ssize_t st;
+
+	while (!r->eof && r->piped < r->pipe_size && r->in < ft->file_size) {
+		st = splice(ft->read_fd, NULL, r->pipe[1], NULL,
+		            MIN(r->pipe_size - r->piped, ft->file_size - r->in),
+		            SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+
+		if (st < 0 && sockerr_again()) {
+			return TRUE;
+		} else if (st < 0 && (errno == EINVAL || errno == ENOSYS) && r->piped == 0) {
+			/* Not supported for these sockets, use write_request. */
+			ft_relay_close_pipe(r);
+			r->splicing = FALSE;
+			r->no_splice = TRUE;
+			return TRUE;
+		} else if (st <= 0) {
+			return ft_relay_fail(r, st == 0 ? "Remote end closed connection" : "Receiving",
+			                     st < 0 ? errno : 0);
+		}
+
+		r->piped += st;
+		r->in += st;
+
+		if (!ft->read_done(ft, st)) {
+			r->eof = TRUE;
+		}
+		if (r->dead || r->failed) {
+			return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+#else
+#define ft_relay_splice_start(r) FALSE
+#endif
+
+/* Sends what we have and gets more from the receiver once the buffer has
+   drained below the low watermark. */
+static void ft_relay_step(ft_relay_t *r)
+{
+	while (ft_relay_flush(r)) {
+#ifdef FT_RELAY_SPLICE
+		if (r->splicing) {
+			if (!ft_relay_fill(r)) {
+				return;
+			} else if (r->splicing) {
+				if (ft_relay_flush(r)) {
+					ft_relay_watch(r);
+				}
+				return;
+			}
+			/* Fell back to write_request, try that. */
+			continue;
+		}
+#endif
+		if (r->requested || r->len > FT_RELAY_LOW || r->in >= r->ft->file_size) {
+			ft_relay_watch(r);
+			return;
+		}
+
+		if (!ft_relay_splice_start(r)) {
+			/* The receiver may write() right away, and then we just
+			   go round again. */
+			r->requested = TRUE;
+			r->ft->write_request(r->ft);
+			if (r->dead || r->failed) {
+				return;
+			}
+		}
+	}
+}
+
+static gboolean ft_relay_leave(ft_relay_t *r)
+{
+	gboolean alive = !r->dead && !r->failed;
+
+	if (--r->busy == 0 && r->dead) {
+		g_free(r->buf);
+		g_free(r);
+	}
+
+	return alive;
+}
+
+static gboolean ft_relay_can_write(gpointer data, gint fd, b_input_condition cond)
+{
+	ft_relay_t *r = data;
+	gint id = r->watch_out;
+	gboolean again;
+
+	r->busy++;
+	ft_relay_step(r);
+	again = !r->dead && r->watch_out == id;
+	ft_relay_leave(r);
+
+	return again;
+}
+
+static gboolean ft_relay_can_read(gpointer data, gint fd, b_input_condition cond)
+{
+	ft_relay_t *r = data;
+	gint id = r->watch_in;
+	gboolean again;
+
+	r->busy++;
+	ft_relay_step(r);
+	again = !r->dead && r->watch_in == id;
+	ft_relay_leave(r);
+
+	return again;
+}
+
+/* Called by the receiver, normally once per write_request. Never blocks,
+   whatever doesn't fit in the socket right now is kept for later. */
+gboolean ft_relay_write(ft_relay_t *r, char *data, unsigned int len)
+{
+	gsize tail, n;
+
+	r->busy++;
+
+	if (r->failed) {
+		/* Already reported. */
+	} else if (len > FT_RELAY_SIZE - r->len) {
+		ft_relay_fail(r, "BUG: write() called with a full buffer", 0);
+	} else {
+		if (r->buf == NULL) {
+			r->buf = g_malloc(FT_RELAY_SIZE);
+		}
+
+		tail = (r->head + r->len) % FT_RELAY_SIZE;
+		n = MIN(len, FT_RELAY_SIZE - tail);
+		memcpy(r->buf + tail, data, n);
+		memcpy(r->buf, data + n, len - n);
+
+		r->len += len;
+		r->in += len;
+		r->requested = FALSE;
+
+		if (r->busy > 1) {
+			/* Called from write_request inside ft_relay_step(), which
+			   goes round again by itself. */
+			if (ft_relay_flush(r)) {
+				ft_relay_watch(r);
+			}
+		} else {
+			/* If this all goes out right away there won't be a write
+			   watch to ask for more later, so do that now. */
+			ft_relay_step(r);
+		}
+	}
+
+	return ft_relay_leave(r);
+}
+
+/* For senders that have to get the receiver going themselves. */
+void ft_relay_start(ft_relay_t *r)
+{
+	r->busy++;
+	if (!r->failed) {
+		ft_relay_step(r);
+	}
+	ft_relay_leave(r);
+}
+
+void ft_relay_free(ft_relay_t *r)
+{
+	if (r == NULL) {
+		return;
+	}
+
+	ft_relay_unwatch(r);
+	ft_relay_close_pipe(r);
+	r->dead = TRUE;
+
+	if (r->busy == 0) {
+		g_free(r->buf);
+		g_free(r);
+	}
+}
@@ -0,0 +1,326 @@
+/********************************************************************\
+  * BitlBee -- An IRC to other IM-networks gateway                     *
+  *                                                                    *
+  * Copyright 2002-2010 Wilmer van der Gaast and others                *
+  \********************************************************************/
+
+/* Login scheduler: limits concurrent IM logins per protocol and server */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License with
+  the Debian GNU/Linux distribution in /usr/share/common-licenses/GPL;
+  if not, write to the Free Software Foundation, Inc., 51 Franklin St.,
+  Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#define BITLBEE_CORE
+#include "bitlbee.h"
+#include "ipc.h"
+
+/* A slot is given back once the login succeeds or fails, or after this
+   many seconds if the protocol takes longer than that. */
+#define LOGIN_TIMEOUT 120
+
+/* Logins of everyone in this process (in ForkDaemon mode, the master has
+   the only scheduler that matters). The queue is ordered by priority,
+   then by age. */
+static GQueue login_waiting = G_QUEUE_INIT;
+static GList *login_running;
+static gint login_run_id;
+static int login_last_id;
+
+static void login_sched_kick(void);
+
+static gboolean login_sched_allowed(login_req_t *req)
+{
+	int per_protocol = global.conf->logins_per_protocol;
+	int per_host = global.conf->logins_per_host;
+	int np = 0, nh = 0;
+	GList *l;
+
+	for (l = login_running; l; l = l->next) {
+		login_req_t *r = l->data;
+
+		np += g_strcasecmp(r->protocol, req->protocol) == 0;
+		nh += g_strcasecmp(r->host, req->host) == 0;
+	}
+
+	return (per_protocol <= 0 || np < per_protocol) &&
+	       (per_host <= 0 || nh < per_host);
+}
+
+static gboolean login_sched_timeout(gpointer data, gint fd, b_input_condition cond)
+{
+	login_req_t *req = data;
+
+	/* Stop counting it, the owner still has to call login_sched_done(). */
+	req->timeout = 0;
+	req->state = LOGIN_EXPIRED;
+	login_running = g_list_remove(login_running, req);
+	login_sched_kick();
+
+	return FALSE;
+}
+
+static gint login_sched_cmp(gconstpointer a, gconstpointer b, gpointer data)
+{
+	const login_req_t *queued = a, *req = b;
+
+	return queued->prio <= req->prio ? -1 : 1;
+}
+
+static gboolean login_sched_run(gpointer data, gint fd, b_input_condition cond)
+{
+	login_req_t *req;
+	GList *l;
+	int pos;
+
+	login_run_id = 0;
+
+	/* Callbacks can add and remove requests (even their own), so start
+	   over after every one of them. */
+	l = login_waiting.head;
+	while (l) {
+		req = l->data;
+		if (!login_sched_allowed(req)) {
+			l = l->next;
+			continue;
+		}
+
+		g_queue_delete_link(&login_waiting, l);
+		login_running = g_list_prepend(login_running, req);
+		req->state = LOGIN_RUNNING;
+		req->started = time(NULL);
+		req->timeout = b_timeout_add(LOGIN_TIMEOUT * 1000, login_sched_timeout, req);
+		req->go(req->data);
+
+		l = login_waiting.head;
+	}
+
+	/* Tell whoever has to wait, once. */
+	l = login_waiting.head;
+	pos = 1;
+	while (l) {
+		req = l->data;
+		if (req->told) {
+			l = l->next;
+			pos++;
+			continue;
+		}
+
+		req->told = TRUE;
+		if (req->wait) {
+			req->wait(req->data, pos);
+		}
+
+		l = login_waiting.head;
+		pos = 1;
+	}
+
+	return FALSE;
+}
+
+static void login_sched_kick(void)
+{
+	if (login_run_id == 0) {
+		login_run_id = b_timeout_add(0, login_sched_run, NULL);
+	}
+}
+
+/* go is called (from the main loop, never right away) once the login can
+   start. Give the slot back with login_sched_done(), before or after. */
+login_req_t *login_sched_add(const char *protocol, const char *host, const char *label,
+                             login_prio_t prio, login_go_t go, login_wait_t wait,
+                             gpointer data)
+{
+	login_req_t *req = g_new0(login_req_t, 1);
+
+	req->protocol = g_strdup(protocol);
+	req->host = g_strdup(host);
+	req->label = g_strdup(label);
+	req->prio = prio;
+	req->state = LOGIN_WAITING;
+	req->queued = time(NULL);
+	req->go = go;
+	req->wait = wait;
+	req->data = data;
+
+	g_queue_insert_sorted(&login_waiting, req, login_sched_cmp, NULL);
+	login_sched_kick();
+
+	return req;
+}
+
+void login_sched_done(login_req_t *req)
+{
+	if (req->state == LOGIN_WAITING) {
+		g_queue_remove(&login_waiting, req);
+	} else if (req->state == LOGIN_RUNNING) {
+		login_running = g_list_remove(login_running, req);
+		login_sched_kick();
+	}
+
+	b_event_remove(req->timeout);
+	g_free(req->protocol);
+	g_free(req->host);
+	g_free(req->label);
+	g_free(req);
+}
+
+/* Running logins first (with position 0), then the queue. */
+void login_sched_foreach(void (*func)(login_req_t *req, int pos, gpointer data), gpointer data)
+{
+	GList *l;
+	int pos = 1;
+
+	for (l = login_running; l; l = l->next) {
+		func(l->data, 0, data);
+	}
+	for (l = login_waiting.head; l; l = l->next) {
+		func(l->data, pos++, data);
+	}
+}
+
+/* Connections to the same server share a limit. Most protocols have a
+   server setting, the domain part of the username is the next best guess. */
+static const char *account_login_host(account_t *a)
+{
+	const char *s;
+
+	if ((s = set_getstr(&a->set, "server")) && *s) {
+		return s;
+	} else if (a->server && *a->server) {
+		return a->server;
+	} else if ((s = strchr(a->user, '@')) && s[1]) {
+		return s + 1;
+	}
+
+	return a->prpl->name;
+}
+
+static void account_login_go_cb(gpointer data)
+{
+	account_login_go(data);
+}
+
+static void account_login_wait_cb(gpointer data, int pos)
+{
+	account_login_wait(data, pos);
+}
+
+static gboolean account_login_forked(void)
+{
+	return global.conf->runmode == RUNMODE_FORKDAEMON && global.listen_socket >= 0;
+}
+
+static void account_login_request(account_t *a)
+{
+	const char *host = account_login_host(a);
+
+	if (account_login_forked()) {
+		/* The master has the queue, it'll send a LOGIN GO. */
+		ipc_to_master_str("LOGIN REQUEST %d %d %s %s :%s\r\n", a->login_id,
+		                  a->login_prio, a->prpl->name, host, a->tag);
+	} else {
+		irc_t *irc = a->bee->ui_data;
+		char *label = g_strdup_printf("%s/%s", irc && irc->user ? irc->user->nick : "?", a->tag);
+
+		a->login = login_sched_add(a->prpl->name, host, label, a->login_prio,
+		                           account_login_go_cb, account_login_wait_cb, a);
+		g_free(label);
+	}
+}
+
+/* Queues a login for this account, instead of account_on() which logs in
+   right away. */
+void account_login(account_t *a, login_prio_t prio)
+{
+	if (a->ic) {
+		return;
+	} else if (a->login_waiting && prio >= a->login_prio) {
+		return;
+	}
+
+	/* Also drops the old request if this one is more urgent. */
+	cancel_auto_reconnect(a);
+
+	a->login_id = ++login_last_id;
+	a->login_prio = prio;
+	a->login_waiting = TRUE;
+	account_login_request(a);
+}
+
+void account_login_go(account_t *a)
+{
+	a->login_waiting = FALSE;
+	account_on(a->bee, a);
+
+	/* Failed right away, or nothing to wait for. */
+	if (!a->ic || (a->ic->flags & OPT_LOGGED_IN)) {
+		account_login_done(a);
+	}
+}
+
+void account_login_wait(account_t *a, int pos)
+{
+	if (a->bee->ui->log) {
+		char *msg = g_strdup_printf("Server busy, waiting to log in "
+		                            "(number %d in line)", pos);
+		a->bee->ui->log(a->bee, a->tag, msg);
+		g_free(msg);
+	}
+}
+
+/* Gives back the slot, or the place in the queue. */
+void account_login_done(account_t *a)
+{
+	if (a->login) {
+		login_sched_done(a->login);
+		a->login = NULL;
+	} else if (a->login_id && account_login_forked()) {
+		ipc_to_master_str("LOGIN DONE %d\r\n", a->login_id);
+	}
+
+	a->login_id = 0;
+	a->login_waiting = FALSE;
+}
+
+account_t *account_by_login_id(bee_t *bee, int id)
+{
+	account_t *a;
+
+	for (a = bee->accounts; a; a = a->next) {
+		if (a->login_id == id) {
+			return a;
+		}
+	}
+
+	return NULL;
+}
+
+/* A new master doesn't know about our requests yet, or there's no master
+   anymore and we have to do our own scheduling. */
+void account_login_resend(bee_t *bee)
+{
+	account_t *a;
+
+	for (a = bee->accounts; a; a = a->next) {
+		if (a->login || !a->login_id) {
+			continue;
+		} else if (a->login_waiting) {
+			account_login_request(a);
+		} else if (!account_login_forked()) {
+			a->login_id = 0;
+		}
+	}
+}
@@ -0,0 +1,231 @@
+/********************************************************************\
+  * BitlBee -- An IRC to other IM-networks gateway                     *
+  *                                                                    *
+  * Copyright 2002-2010 Wilmer van der Gaast and others                *
+  \********************************************************************/
+
+/* Per-account outgoing message queue with token bucket rate limiting   */
+
+/*
+  This program is free software; you can redistribute it and/or modify
+  it under the terms of the GNU General Public License as published by
+  the Free Software Foundation; either version 2 of the License, or
+  (at your option) any later version.
+
+  This program is distributed in the hope that it will be useful,
+  but WITHOUT ANY WARRANTY; without even the implied warranty of
+  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+  GNU General Public License for more details.
+
+  You should have received a copy of the GNU General Public License with
+  the Debian GNU/Linux distribution in /usr/share/common-licenses/GPL;
+  if not, write to the Free Software Foundation, Inc., 51 Franklin St.,
+  Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#define BITLBEE_CORE
+#include "bitlbee.h"
+
+typedef struct bee_queue_msg {
+	char *handle;
+	char *msg;
+	int flags;
+} bee_queue_msg_t;
+
+static gboolean bee_queue_run(gpointer data, gint fd, b_input_condition cond);
+
+/* OTR data messages and fragments are only valid as a whole, and the
+   whitespace tag that starts OTR only works at the end of a message, so
+   none of those may be glued to something else. */
+#define BEE_QUEUE_OTR_TAG " \t  \t\t\t\t \t \t \t  "
+
+static gboolean bee_queue_is_otr(const char *msg)
+{
+	return strstr(msg, "?OTR") || strstr(msg, BEE_QUEUE_OTR_TAG);
+}
+
+static void bee_queue_msg_free(bee_queue_msg_t *m)
+{
+	g_free(m->handle);
+	g_free(m->msg);
+	g_free(m);
+}
+
+/* Top up the bucket for the time passed since the last call. Returns FALSE
+   if rate limiting is turned off for this account. */
+static gboolean bee_queue_refill(account_t *a)
+{
+	bee_queue_t *q = a->sendq;
+	int rate = set_getint(&a->set, "send_rate");
+	int burst = set_getint(&a->set, "send_burst");
+	gint64 now = g_get_monotonic_time();
+
+	if (rate <= 0) {
+		return FALSE;
+	}
+
+	q->tokens += (double) (now - q->last_refill) * rate / (60 * G_USEC_PER_SEC);
+	q->tokens = MIN(q->tokens, MAX(burst, 1));
+	q->last_refill = now;
+
+	return TRUE;
+}
+
+static void bee_queue_schedule(account_t *a)
+{
+	bee_queue_t *q = a->sendq;
+	int rate = set_getint(&a->set, "send_rate");
+	int delay;
+
+	if (q->timer || g_queue_is_empty(&q->msgs)) {
+		return;
+	}
+
+	if (rate <= 0 || q->tokens >= 1) {
+		delay = 0;
+	} else {
+		delay = (int) ((1 - q->tokens) * 60000 / rate) + 1;
+	}
+
+	q->timer = b_timeout_add(delay, bee_queue_run, a);
+}
+
+static int bee_queue_send(account_t *a, const char *handle, char *msg, int flags)
+{
+	a->sendq->sent++;
+	return a->prpl->buddy_msg(a->ic, (char *) handle, msg, flags);
+}
+
+static gboolean bee_queue_run(gpointer data, gint fd, b_input_condition cond)
+{
+	account_t *a = data;
+	bee_queue_t *q = a->sendq;
+	gboolean limited;
+	bee_queue_msg_t *m;
+
+	q->timer = 0;
+	limited = bee_queue_refill(a);
+
+	while (a->ic && (!limited || q->tokens >= 1) &&
+	       (m = g_queue_pop_head(&q->msgs))) {
+		if (limited) {
+			q->tokens -= 1;
+		}
+		bee_queue_send(a, m->handle, m->msg, m->flags);
+		bee_queue_msg_free(m);
+	}
+
+	bee_queue_schedule(a);
+
+	return FALSE;
+}
+
+/* Either sends msg right away or queues it if the account is over its
+   rate limit. Takes ownership of msg. */
+int bee_queue_msg(account_t *a, const char *handle, char *msg, int flags)
+{
+	bee_queue_t *q;
+	bee_queue_msg_t *m;
+	gboolean limited;
+	int st;
+
+	if (a->sendq == NULL) {
+		if (set_getint(&a->set, "send_rate") <= 0) {
+			st = a->prpl->buddy_msg(a->ic, (char *) handle, msg, flags);
+			g_free(msg);
+			return st;
+		}
+
+		a->sendq = q = g_new0(bee_queue_t, 1);
+		q->tokens = MAX(set_getint(&a->set, "send_burst"), 1);
+		q->last_refill = g_get_monotonic_time();
+	}
+	q = a->sendq;
+
+	limited = bee_queue_refill(a);
+	if (g_queue_is_empty(&q->msgs) && (!limited || q->tokens >= 1)) {
+		if (limited) {
+			q->tokens -= 1;
+		}
+		st = bee_queue_send(a, handle, msg, flags);
+		g_free(msg);
+		return st;
+	}
+
+	/* Protocols that keep newlines intact get consecutive messages to the
+	   same contact merged, that's one request instead of several. */
+	m = g_queue_peek_tail(&q->msgs);
+	if (m && (a->prpl->options & PRPL_OPT_MULTILINE_MSG) &&
+	    m->flags == flags && a->prpl->handle_cmp(m->handle, handle) == 0 &&
+	    !bee_queue_is_otr(m->msg) && !bee_queue_is_otr(msg)) {
+		char *s = g_strconcat(m->msg, "\n", msg, NULL);
+
+		g_free(m->msg);
+		m->msg = s;
+		g_free(msg);
+		q->coalesced++;
+		return 1;
+	}
+
+	m = g_new0(bee_queue_msg_t, 1);
+	m->handle = g_strdup(handle);
+	m->msg = msg;
+	m->flags = flags;
+	g_queue_push_tail(&q->msgs, m);
+	q->queued++;
+	q->max_depth = MAX(q->max_depth, g_queue_get_length(&q->msgs));
+
+	bee_queue_schedule(a);
+
+	return 1;
+}
+
+/* Drops everything still waiting, for example because the connection
+   went away. Statistics are kept. */
+void bee_queue_clear(account_t *a)
+{
+	bee_queue_t *q = a->sendq;
+	bee_queue_msg_t *m;
+
+	if (q == NULL) {
+		return;
+	}
+
+	while ((m = g_queue_pop_head(&q->msgs))) {
+		bee_queue_msg_free(m);
+		q->dropped++;
+	}
+
+	b_event_remove(q->timer);
+	q->timer = 0;
+}
+
+void bee_queue_free(account_t *a)
+{
+	bee_queue_clear(a);
+	g_free(a->sendq);
+	a->sendq = NULL;
+}
+
+char *set_eval_send_rate(set_t *set, char *value)
+{
+	account_t *a = set->data;
+
+	if (set_eval_int(set, value) == SET_INVALID) {
+		return SET_INVALID;
+	}
+
+	/* Flush the backlog at the new rate, or right away if the limit
+	   was switched off. */
+	if (a->sendq && a->sendq->timer) {
+		g_free(set->value);
+		set->value = g_strdup(value);
+
+		b_event_remove(a->sendq->timer);
+		a->sendq->timer = 0;
+		bee_queue_refill(a);
+		bee_queue_schedule(a);
+	}
+
+	return value;
+}
@@ -39,7 +39,10 @@ bee_user_t *bee_user_new(bee_t *bee, struct im_connection *ic, const char *handl
 	bu->ic = ic;
 	bu->flags = flags;
 	bu->handle = g_strdup(handle);
-	bee->users = g_slist_prepend(bee->users, bu);
+	bee->users = g_list_prepend(bee->users, bu);
+	bu->bee_link = bee->users;
+	ic->users = g_list_prepend(ic->users, bu);
+	bu->ic_link = ic->users;
 
 	if (ic->bee_users) {
 		g_hash_table_insert(ic->bee_users, bu->handle, bu);
@@ -72,7 +75,8 @@ int bee_user_free(bee_t *bee, bee_user_t *bu)
 	if (bu->ic->bee_users) {
 		g_hash_table_remove(bu->ic->bee_users, bu->handle);
 	}
-	bee->users = g_slist_remove(bee->users, bu);
+	bee->users = g_list_delete_link(bee->users, bu->bee_link);
+	bu->ic->users = g_list_delete_link(bu->ic->users, bu->ic_link);
 
 	g_free(bu->handle);
 	g_free(bu->fullname);
@@ -86,12 +90,12 @@ int bee_user_free(bee_t *bee, bee_user_t *bu)
 
 bee_user_t *bee_user_by_handle_slow(bee_t *bee, struct im_connection *ic, const char *handle)
 {
-	GSList *l;
+	GList *l;
 
-	for (l = bee->users; l; l = l->next) {
+	for (l = ic->users; l; l = l->next) {
 		bee_user_t *bu = l->data;
 
-		if (bu->ic == ic && ic->acc->prpl->handle_cmp(bu->handle, handle) == 0) {
+		if (ic->acc->prpl->handle_cmp(bu->handle, handle) == 0) {
 			return bu;
 		}
 	}
@@ -111,19 +115,14 @@ bee_user_t *bee_user_by_handle(bee_t *bee, struct im_connection *ic, const char
 int bee_user_msg(bee_t *bee, bee_user_t *bu, const char *msg, int flags)
 {
 	char *buf = NULL;
-	int st;
 
 	if ((bu->ic->flags & OPT_DOES_HTML) && (g_strncasecmp(msg, "<html>", 6) != 0)) {
 		buf = escape_html(msg);
-		msg = buf;
 	} else {
 		buf = g_strdup(msg);
 	}
 
-	st = bu->ic->acc->prpl->buddy_msg(bu->ic, bu->handle, buf, flags);
-	g_free(buf);
-
-	return st;
+	return bee_queue_msg(bu->ic->acc, bu->handle, buf, flags);
 }
 
 
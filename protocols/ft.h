@@ -28,10 +28,14 @@
 
 /*
  * One buffer is needed for each transfer. The receiver stores a message
- * in it and gives it to the sender. The sender will stall the receiver
- * till the buffer has been sent out.
+ * in it and gives it to the sender, which copies it into its relay (see
+ * ft_relay_new()) and asks for more once that has drained below
+ * FT_RELAY_LOW bytes. Nothing more is read while it's above that, so
+ * a slow side stalls the other one without unbounded buffering.
  */
-#define FT_BUFFER_SIZE 2048
+#define FT_BUFFER_SIZE 16384
+#define FT_RELAY_SIZE 262144
+#define FT_RELAY_LOW 65536
 
 typedef enum {
 	FT_STATUS_LISTENING     = 1,
@@ -152,6 +156,16 @@ typedef struct file_transfer {
 	 */
 	gboolean (*write)(struct file_transfer *file, char *buffer, unsigned int len);
 
+	/*
+	 * Optional, for receivers that read from a plain socket: the sender
+	 * may then move data from read_fd straight to its own socket (with
+	 * splice() where available) instead of calling write_request. It
+	 * reports every chunk it took to read_done, which returns FALSE if
+	 * nothing more should be read.
+	 */
+	int read_fd;
+	gboolean (*read_done)(struct file_transfer *file, unsigned int len);
+
 	/* The send buffer associated with this transfer.
 	 * Since receivers always wait for a write_request call one is enough.
 	 */
@@ -173,4 +187,20 @@ void imcb_file_canceled(struct im_connection *ic, file_transfer_t *file, char *r
 gboolean imcb_file_recv_start(struct im_connection *ic, file_transfer_t *ft);
 
 void imcb_file_finished(struct im_connection *ic, file_transfer_t *file);
+
+/*
+ * Buffered sending side of a transfer, used by the write() functions of
+ * DCC and SOCKS5 bytestreams. Data is written to fd as fast as it drains,
+ * partial writes are fine. sent is called for everything that made it
+ * out, error when the transfer can't continue (it should cancel it).
+ * Only free the relay from the transfer's free/close function.
+ */
+typedef struct ft_relay ft_relay_t;
+
+ft_relay_t *ft_relay_new(file_transfer_t *ft, int fd,
+                         void (*sent)(file_transfer_t *ft, unsigned int len),
+                         void (*error)(file_transfer_t *ft, const char *msg));
+gboolean ft_relay_write(ft_relay_t *r, char *data, unsigned int len);
+void ft_relay_start(ft_relay_t *r);
+void ft_relay_free(ft_relay_t *r);
 #endif
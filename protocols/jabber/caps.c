@@ -0,0 +1,300 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Jabber module - Entity capabilities (XEP-0115) cache                     *
+*                                                                           *
+*  Copyright 2006-2012 Wilmer van der Gaast <wilmer@gaast.net>              *
+*                                                                           *
+*  This program is free software; you can redistribute it and/or modify     *
+*  it under the terms of the GNU General Public License as published by     *
+*  the Free Software Foundation; either version 2 of the License, or        *
+*  (at your option) any later version.                                      *
+*                                                                           *
+*  This program is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+*  GNU General Public License for more details.                             *
+*                                                                           *
+*  You should have received a copy of the GNU General Public License along  *
+*  with this program; if not, write to the Free Software Foundation, Inc.,  *
+*  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301  USA.             *
+*                                                                           *
+\***************************************************************************/
+
+#include "jabber.h"
+
+/* Clients advertise a hash of their disco#info reply in every <presence/>.
+   Most contacts run one of only a handful of client versions, so the
+   feature lists are kept here, keyed by that hash, and shared by all
+   accounts in this process. Only verified SHA-1 hashes are stored so one
+   contact can't poison the cache for everyone else. The cache is saved in
+   the config directory to survive restarts, under a name that can't be
+   <nick>.xml of any user since nicks never start with a dot.
+
+   Anyone can make up new hashes that verify, so the cache only takes
+   JABBER_CAPS_MAX of them, with at most JABBER_CAPS_MAX_FEATURES each.
+   Entries are never evicted since buddies point at their lists; clients
+   that don't fit just get their own copy, like before this cache. */
+
+#define JABBER_CAPS_FILE ".jabber-caps.xml"
+#define JABBER_CAPS_SAVE_DELAY 10000
+#define JABBER_CAPS_MAX 1000
+#define JABBER_CAPS_MAX_FEATURES 256
+
+static GHashTable *jabber_caps_cache;
+static gint jabber_caps_save_id;
+
+static void jabber_caps_load(void)
+{
+	struct xt_node *tree, *c, *f;
+	char *path, *xml = NULL;
+	gsize len;
+
+	jabber_caps_cache = g_hash_table_new(g_str_hash, g_str_equal);
+
+	path = g_build_filename(global.conf->configdir, JABBER_CAPS_FILE, NULL);
+	if (g_file_get_contents(path, &xml, &len, NULL) &&
+	    (tree = xt_from_string(xml, len))) {
+		for (c = tree->children; (c = xt_find_node(c, "client")); c = c->next) {
+			char *ver = xt_find_attr(c, "ver");
+			GSList *features = NULL;
+			int n = 0;
+
+			if (g_hash_table_size(jabber_caps_cache) >= JABBER_CAPS_MAX) {
+				break;
+			}
+			if (!ver || g_hash_table_lookup(jabber_caps_cache, ver)) {
+				continue;
+			}
+
+			for (f = c->children; (f = xt_find_node(f, "feature")); f = f->next) {
+				char *var = xt_find_attr(f, "var");
+				if (var) {
+					features = g_slist_prepend(features, g_strdup(var));
+					n++;
+				}
+			}
+
+			if (n > JABBER_CAPS_MAX_FEATURES) {
+				g_slist_free_full(features, g_free);
+				continue;
+			}
+
+			g_hash_table_insert(jabber_caps_cache, g_strdup(ver),
+			                    g_slist_reverse(features));
+		}
+
+		xt_free_node(tree);
+	}
+
+	g_free(xml);
+	g_free(path);
+}
+
+static gboolean jabber_caps_save(gpointer data, gint fd, b_input_condition cond)
+{
+	struct xt_node *tree, *c;
+	GHashTableIter iter;
+	gpointer ver, features;
+	char *path, *xml;
+	GSList *l;
+
+	jabber_caps_save_id = 0;
+
+	tree = xt_new_node("caps", NULL, NULL);
+	g_hash_table_iter_init(&iter, jabber_caps_cache);
+	while (g_hash_table_iter_next(&iter, &ver, &features)) {
+		c = xt_new_node("client", NULL, NULL);
+		xt_add_attr(c, "ver", ver);
+		for (l = features; l; l = l->next) {
+			struct xt_node *f = xt_new_node("feature", NULL, NULL);
+			xt_add_attr(f, "var", l->data);
+			xt_add_child(c, f);
+		}
+		xt_insert_child(tree, c);
+	}
+
+	path = g_build_filename(global.conf->configdir, JABBER_CAPS_FILE, NULL);
+	xml = xt_to_string_i(tree);
+	g_file_set_contents(path, xml, -1, NULL);
+
+	g_free(xml);
+	g_free(path);
+	xt_free_node(tree);
+
+	return FALSE;
+}
+
+/* Returns the feature list for this hash if we know it. The list belongs
+   to the cache, don't modify or free it. */
+GSList *jabber_caps_lookup(const char *ver)
+{
+	if (!jabber_caps_cache) {
+		jabber_caps_load();
+	}
+
+	return ver ? g_hash_table_lookup(jabber_caps_cache, ver) : NULL;
+}
+
+static gint jabber_caps_strcmp(gconstpointer a, gconstpointer b)
+{
+	return strcmp(a, b);
+}
+
+/* Appends the sorted list to s, every item followed by a '<', and frees
+   the list. */
+static void jabber_caps_append_sorted(GString *s, GSList *l)
+{
+	GSList *i;
+
+	l = g_slist_sort(l, jabber_caps_strcmp);
+	for (i = l; i; i = i->next) {
+		g_string_append(s, i->data);
+		g_string_append_c(s, '<');
+		g_free(i->data);
+	}
+	g_slist_free(l);
+}
+
+/* Builds the verification string from a disco#info <query/> as described
+   in XEP-0115 section 5.1 and returns its base64-encoded SHA-1 hash. */
+static char *jabber_caps_hash(struct xt_node *query)
+{
+	GString *s = g_string_new("");
+	GSList *items = NULL, *forms = NULL;
+	struct xt_node *c, *field, *v;
+	GChecksum *sha1;
+	guint8 digest[20];
+	gsize digest_len = sizeof(digest);
+	char *xmlns;
+
+	for (c = query->children; (c = xt_find_node(c, "identity")); c = c->next) {
+		items = g_slist_prepend(items, g_strdup_printf("%s/%s/%s/%s",
+		                        xt_find_attr(c, "category") ? : "",
+		                        xt_find_attr(c, "type") ? : "",
+		                        xt_find_attr(c, "xml:lang") ? : "",
+		                        xt_find_attr(c, "name") ? : ""));
+	}
+	jabber_caps_append_sorted(s, items);
+
+	items = NULL;
+	for (c = query->children; (c = xt_find_node(c, "feature")); c = c->next) {
+		if (xt_find_attr(c, "var")) {
+			items = g_slist_prepend(items, g_strdup(xt_find_attr(c, "var")));
+		}
+	}
+	jabber_caps_append_sorted(s, items);
+
+	/* Extended info: every form is FORM_TYPE< followed by its fields
+	   sorted by var, each one as var<value<value<... Sorting the
+	   already-formatted strings gives the right order. */
+	for (c = query->children; (c = xt_find_node(c, "x")); c = c->next) {
+		GString *form;
+		char *form_type = NULL;
+
+		if (!(xmlns = xt_find_attr(c, "xmlns")) || strcmp(xmlns, XMLNS_XDATA) != 0) {
+			continue;
+		}
+
+		items = NULL;
+		for (field = c->children; (field = xt_find_node(field, "field")); field = field->next) {
+			char *var = xt_find_attr(field, "var");
+			GString *f;
+			GSList *values = NULL;
+
+			if (!var) {
+				continue;
+			}
+
+			for (v = field->children; (v = xt_find_node(v, "value")); v = v->next) {
+				values = g_slist_prepend(values, g_strdup(v->text ? : ""));
+			}
+
+			if (strcmp(var, "FORM_TYPE") == 0) {
+				g_free(form_type);
+				form_type = g_strdup(values ? values->data : "");
+				g_slist_free_full(values, g_free);
+				continue;
+			}
+
+			f = g_string_new(var);
+			g_string_append_c(f, '<');
+			jabber_caps_append_sorted(f, values);
+			items = g_slist_prepend(items, g_string_free(f, FALSE));
+		}
+
+		form = g_string_new(form_type ? : "");
+		g_string_append_c(form, '<');
+		/* Field strings already end in '<', don't add another one. */
+		items = g_slist_sort(items, jabber_caps_strcmp);
+		while (items) {
+			g_string_append(form, items->data);
+			g_free(items->data);
+			items = g_slist_delete_link(items, items);
+		}
+		forms = g_slist_prepend(forms, g_string_free(form, FALSE));
+		g_free(form_type);
+	}
+
+	forms = g_slist_sort(forms, jabber_caps_strcmp);
+	while (forms) {
+		g_string_append(s, forms->data);
+		g_free(forms->data);
+		forms = g_slist_delete_link(forms, forms);
+	}
+
+	sha1 = g_checksum_new(G_CHECKSUM_SHA1);
+	g_checksum_update(sha1, (guint8 *) s->str, s->len);
+	g_checksum_get_digest(sha1, digest, &digest_len);
+	g_checksum_free(sha1);
+	g_string_free(s, TRUE);
+
+	return g_base64_encode(digest, digest_len);
+}
+
+/* Adds the features in a disco#info reply to the cache if they really
+   hash to ver. Returns the cached list, or NULL if it didn't match or
+   there's no room for it. */
+GSList *jabber_caps_add(const char *ver, struct xt_node *query)
+{
+	GSList *features = NULL;
+	struct xt_node *c;
+	char *hash;
+	int n = 0;
+
+	if ((features = jabber_caps_lookup(ver))) {
+		return features;
+	}
+
+	if (g_hash_table_size(jabber_caps_cache) >= JABBER_CAPS_MAX) {
+		return NULL;
+	}
+	for (c = query->children; (c = xt_find_node(c, "feature")); c = c->next) {
+		if (++n > JABBER_CAPS_MAX_FEATURES) {
+			return NULL;
+		}
+	}
+
+	hash = jabber_caps_hash(query);
+	if (strcmp(hash, ver) != 0) {
+		g_free(hash);
+		return NULL;
+	}
+	g_free(hash);
+
+	for (c = query->children; (c = xt_find_node(c, "feature")); c = c->next) {
+		char *var = xt_find_attr(c, "var");
+		if (var) {
+			features = g_slist_prepend(features, g_strdup(var));
+		}
+	}
+	features = g_slist_reverse(features);
+
+	g_hash_table_insert(jabber_caps_cache, g_strdup(ver), features);
+
+	if (jabber_caps_save_id == 0) {
+		jabber_caps_save_id = b_timeout_add(JABBER_CAPS_SAVE_DELAY, jabber_caps_save, NULL);
+	}
+
+	return features;
+}
@@ -0,0 +1,261 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Jabber module - Stream compression (XEP-0138)                            *
+*                                                                           *
+*  Copyright 2006-2012 Wilmer van der Gaast <wilmer@gaast.net>              *
+*                                                                           *
+*  This program is free software; you can redistribute it and/or modify     *
+*  it under the terms of the GNU General Public License as published by     *
+*  the Free Software Foundation; either version 2 of the License, or        *
+*  (at your option) any later version.                                      *
+*                                                                           *
+*  This program is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+*  GNU General Public License for more details.                             *
+*                                                                           *
+*  You should have received a copy of the GNU General Public License along  *
+*  with this program; if not, write to the Free Software Foundation, Inc.,  *
+*  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.              *
+*                                                                           *
+\***************************************************************************/
+
+#include "jabber.h"
+
+/* Compression is negotiated right after authentication. Once the server
+   says <compressed/>, both sides restart the stream and everything after
+   that goes through zlib: jabber_write() deflates just before queueing,
+   jabber_read_callback() inflates before feeding the XML parser. Every
+   write is flushed with Z_SYNC_FLUSH so the server can always parse
+   complete stanzas. */
+
+#ifdef WITH_ZLIB
+
+#include <zlib.h>
+
+#define JABBER_ZLIB_CHUNK 4096
+
+struct jabber_zlib {
+	z_stream tx, rx;
+
+	/* Bytes before/after compression and time spent in zlib, so it's
+	   possible to tell whether it's worth it. */
+	guint64 tx_plain, tx_zlib, rx_plain, rx_zlib;
+	gint64 usec;
+};
+
+struct jabber_zlib *jabber_zlib_new(void)
+{
+	struct jabber_zlib *z = g_new0(struct jabber_zlib, 1);
+
+	if (deflateInit(&z->tx, Z_DEFAULT_COMPRESSION) != Z_OK) {
+		g_free(z);
+		return NULL;
+	}
+	if (inflateInit(&z->rx) != Z_OK) {
+		deflateEnd(&z->tx);
+		g_free(z);
+		return NULL;
+	}
+
+	return z;
+}
+
+/* Returns a newly allocated buffer with everything needed to decompress
+   buf on the other side, or NULL if zlib failed. */
+char *jabber_zlib_deflate(struct jabber_zlib *z, const char *buf, int len, int *out_len)
+{
+	gint64 start = g_get_monotonic_time();
+	char *out = NULL;
+	int st, n = 0;
+
+	z->tx.next_in = (Bytef *) buf;
+	z->tx.avail_in = len;
+
+	do {
+		out = g_realloc(out, n + JABBER_ZLIB_CHUNK);
+		z->tx.next_out = (Bytef *) out + n;
+		z->tx.avail_out = JABBER_ZLIB_CHUNK;
+		st = deflate(&z->tx, Z_SYNC_FLUSH);
+		n += JABBER_ZLIB_CHUNK - z->tx.avail_out;
+	} while (st == Z_OK && z->tx.avail_out == 0);
+
+	z->usec += g_get_monotonic_time() - start;
+
+	/* Z_BUF_ERROR only means there was nothing left to flush. */
+	if (st != Z_OK && st != Z_BUF_ERROR) {
+		g_free(out);
+		return NULL;
+	}
+
+	z->tx_plain += len;
+	z->tx_zlib += n;
+	*out_len = n;
+
+	return out;
+}
+
+/* Returns whatever buf decompresses to (possibly nothing, *out_len may be
+   0), or NULL if it's not valid zlib data. */
+char *jabber_zlib_inflate(struct jabber_zlib *z, const char *buf, int len, int *out_len)
+{
+	gint64 start = g_get_monotonic_time();
+	char *out = NULL;
+	int st, n = 0;
+
+	z->rx.next_in = (Bytef *) buf;
+	z->rx.avail_in = len;
+
+	do {
+		out = g_realloc(out, n + JABBER_ZLIB_CHUNK);
+		z->rx.next_out = (Bytef *) out + n;
+		z->rx.avail_out = JABBER_ZLIB_CHUNK;
+		st = inflate(&z->rx, Z_SYNC_FLUSH);
+		n += JABBER_ZLIB_CHUNK - z->rx.avail_out;
+	} while (st == Z_OK && z->rx.avail_out == 0);
+
+	z->usec += g_get_monotonic_time() - start;
+
+	if (st != Z_OK && st != Z_BUF_ERROR && st != Z_STREAM_END) {
+		g_free(out);
+		return NULL;
+	}
+
+	z->rx_plain += n;
+	z->rx_zlib += len;
+	*out_len = n;
+
+	return out;
+}
+
+static void jabber_zlib_log_stats(struct im_connection *ic, struct jabber_zlib *z)
+{
+	imcb_log(ic, "Stream compression: sent %" G_GUINT64_FORMAT " bytes as %" G_GUINT64_FORMAT
+	         " (%d%%), received %" G_GUINT64_FORMAT " bytes as %" G_GUINT64_FORMAT
+	         " (%d%%), %" G_GINT64_FORMAT "ms spent in zlib",
+	         z->tx_plain, z->tx_zlib, z->tx_plain ? (int) (100 * z->tx_zlib / z->tx_plain) : 100,
+	         z->rx_plain, z->rx_zlib, z->rx_plain ? (int) (100 * z->rx_zlib / z->rx_plain) : 100,
+	         z->usec / 1000);
+}
+
+void jabber_zlib_free(struct jabber_zlib *z)
+{
+	if (z == NULL) {
+		return;
+	}
+
+	deflateEnd(&z->tx);
+	inflateEnd(&z->rx);
+	g_free(z);
+}
+
+#else
+
+struct jabber_zlib *jabber_zlib_new(void)
+{
+	return NULL;
+}
+
+char *jabber_zlib_deflate(struct jabber_zlib *z, const char *buf, int len, int *out_len)
+{
+	return NULL;
+}
+
+char *jabber_zlib_inflate(struct jabber_zlib *z, const char *buf, int len, int *out_len)
+{
+	return NULL;
+}
+
+static void jabber_zlib_log_stats(struct im_connection *ic, struct jabber_zlib *z)
+{
+}
+
+void jabber_zlib_free(struct jabber_zlib *z)
+{
+}
+
+#endif
+
+/* Called with the <stream:features/> we got after authenticating. Returns
+   XT_NEXT if compression isn't going to happen, the caller should carry on
+   with binding a resource in that case. */
+xt_status jabber_compress_offer(struct im_connection *ic, struct xt_node *features)
+{
+	struct jabber_data *jd = ic->proto_data;
+	struct xt_node *c, *method;
+	char *s;
+	int st;
+
+	/* The setting only exists if we have zlib. */
+	if (jd->zlib || !set_getbool(&ic->acc->set, "compression") ||
+	    !(c = xt_find_node(features->children, "compression")) ||
+	    !(s = xt_find_attr(c, "xmlns")) || strcmp(s, XMLNS_COMPRESS_FEATURE) != 0) {
+		return XT_NEXT;
+	}
+
+	for (method = c->children; (method = xt_find_node(method, "method")); method = method->next) {
+		if (method->text && strcmp(method->text, "zlib") == 0) {
+			break;
+		}
+	}
+	if (method == NULL) {
+		return XT_NEXT;
+	}
+
+	c = xt_new_node("compress", NULL, xt_new_node("method", "zlib", NULL));
+	xt_add_attr(c, "xmlns", XMLNS_COMPRESS);
+	st = jabber_write_packet(ic, c);
+	xt_free_node(c);
+
+	if (!st) {
+		return XT_ABORT;
+	}
+
+	jd->flags |= JFLAG_COMPRESS_OFFERED;
+	return XT_HANDLED;
+}
+
+/* <compressed/> or <failure/>, the latter may also be a SASL failure. */
+xt_status jabber_compress_pkt(struct xt_node *node, gpointer data)
+{
+	struct im_connection *ic = data;
+	struct jabber_data *jd = ic->proto_data;
+	char *s;
+
+	if (!(s = xt_find_attr(node, "xmlns")) || strcmp(s, XMLNS_COMPRESS) != 0 ||
+	    !(jd->flags & JFLAG_COMPRESS_OFFERED)) {
+		return XT_NEXT;
+	}
+
+	jd->flags &= ~JFLAG_COMPRESS_OFFERED;
+
+	if (strcmp(node->name, "compressed") == 0) {
+		if (!(jd->zlib = jabber_zlib_new())) {
+			imcb_error(ic, "Could not initialize stream compression");
+			imc_logout(ic, TRUE);
+			return XT_ABORT;
+		}
+
+		imcb_log(ic, "Stream compression enabled");
+		jd->flags |= JFLAG_STREAM_RESTART;
+		return XT_HANDLED;
+	}
+
+	/* Not fatal, just continue uncompressed on the same stream. */
+	imcb_log(ic, "Stream compression not available");
+	return jabber_stream_ready(ic);
+}
+
+void jabber_compress_free(struct im_connection *ic)
+{
+	struct jabber_data *jd = ic->proto_data;
+
+	if (jd->zlib && set_getbool(&ic->bee->set, "debug")) {
+		jabber_zlib_log_stats(ic, jd->zlib);
+	}
+
+	jabber_zlib_free(jd->zlib);
+	jd->zlib = NULL;
+	jd->flags &= ~JFLAG_COMPRESS_OFFERED;
+}
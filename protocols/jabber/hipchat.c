@@ -47,8 +47,7 @@ xt_status hipchat_handle_success(struct im_connection *ic, struct xt_node *node)
 	/* Hipchat's auth doesn't expect a restart here */
 	jd->flags &= ~JFLAG_STREAM_RESTART;
 
-	if (!jabber_get_roster(ic) ||
-	    !jabber_iq_disco_server(ic) ||
+	if (!jabber_login_pipeline(ic) ||
 	    !jabber_get_hipchat_profile(ic)) {
 		return XT_ABORT;
 	}
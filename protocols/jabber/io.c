@@ -33,7 +33,12 @@ int jabber_write_packet(struct im_connection *ic, struct xt_node *node)
 	int st;
 
 	buf = xt_to_string(node);
-	st = jabber_write(ic, buf, strlen(buf));
+	if (jabber_sm_outgoing(ic, node, buf)) {
+		st = jabber_write(ic, buf, strlen(buf));
+		jabber_sm_written(ic);
+	} else {
+		st = 1;
+	}
 	g_free(buf);
 
 	return st;
@@ -42,6 +47,7 @@ int jabber_write_packet(struct im_connection *ic, struct xt_node *node)
 int jabber_write(struct im_connection *ic, char *buf, int len)
 {
 	struct jabber_data *jd = ic->proto_data;
+	char *zbuf = NULL;
 	gboolean ret;
 
 	if (jd->flags & JFLAG_XMLCONSOLE && !(ic->flags & OPT_LOGGING_OUT)) {
@@ -59,6 +65,21 @@ int jabber_write(struct im_connection *ic, char *buf, int len)
 		g_free(msg);
 	}
 
+	if (jd->fd == -1 && (jd->flags & JFLAG_SM_RESUMING)) {
+		/* Still reconnecting. Stanzas are kept by the stream
+		   management code, anything else can be dropped. */
+		return TRUE;
+	}
+
+	if (jd->zlib) {
+		if (!(zbuf = jabber_zlib_deflate(jd->zlib, buf, len, &len))) {
+			imcb_error(ic, "Error while compressing stream");
+			imc_logout(ic, TRUE);
+			return FALSE;
+		}
+		buf = zbuf;
+	}
+
 	if (jd->tx_len == 0) {
 		/* If the queue is empty, allocate a new buffer. */
 		jd->tx_len = len;
@@ -84,6 +105,8 @@ int jabber_write(struct im_connection *ic, char *buf, int len)
 		ret = TRUE;
 	}
 
+	g_free(zbuf);
+
 	return ret;
 }
 
@@ -123,6 +146,10 @@ static gboolean jabber_write_queue(struct im_connection *ic)
 
 		return TRUE;
 	} else if (st == 0 || (st < 0 && !ssl_sockerr_again(jd->ssl))) {
+		if (jabber_sm_connection_lost(ic)) {
+			return TRUE;
+		}
+
 		/* Set fd to -1 to make sure we won't write to it anymore. */
 		closesocket(jd->fd);    /* Shouldn't be necessary after errors? */
 		jd->fd = -1;
@@ -234,10 +261,26 @@ static gboolean jabber_read_callback(gpointer data, gint fd, b_input_condition c
 	}
 
 	if (st > 0) {
-		if (!jabber_feed_input(ic, buf, st)) {
+		char *in = buf, *plain = NULL;
+		gboolean ok;
+
+		if (jd->zlib && !(in = plain = jabber_zlib_inflate(jd->zlib, buf, st, &st))) {
+			imcb_error(ic, "Error while decompressing stream");
+			imc_logout(ic, TRUE);
+			return FALSE;
+		}
+
+		/* Compressed input doesn't always inflate to anything yet. */
+		ok = st == 0 || jabber_feed_input(ic, in, st);
+		g_free(plain);
+		if (!ok) {
 			return FALSE;
 		}
 	} else if (st == 0 || (st < 0 && !ssl_sockerr_again(jd->ssl))) {
+		if (jabber_sm_connection_lost(ic)) {
+			return FALSE;
+		}
+
 		closesocket(jd->fd);
 		jd->fd = -1;
 
@@ -258,9 +301,9 @@ static gboolean jabber_read_callback(gpointer data, gint fd, b_input_condition c
 
 gboolean jabber_connected_plain(gpointer data, gint source, b_input_condition cond)
 {
-	struct im_connection *ic = data;
+	struct im_connection *ic = imc_by_handle(data);
 
-	if (g_slist_find(jabber_connections, ic) == NULL) {
+	if (ic == NULL) {
 		return FALSE;
 	}
 
@@ -277,10 +320,10 @@ gboolean jabber_connected_plain(gpointer data, gint source, b_input_condition co
 
 gboolean jabber_connected_ssl(gpointer data, int returncode, void *source, b_input_condition cond)
 {
-	struct im_connection *ic = data;
+	struct im_connection *ic = imc_by_handle(data);
 	struct jabber_data *jd;
 
-	if (g_slist_find(jabber_connections, ic) == NULL) {
+	if (ic == NULL) {
 		return FALSE;
 	}
 
@@ -321,6 +364,8 @@ static xt_status jabber_pkt_features(struct xt_node *node, gpointer data)
 	struct im_connection *ic = data;
 	struct jabber_data *jd = ic->proto_data;
 	struct xt_node *c, *reply;
+	xt_status st;
+	char *s;
 	int trytls;
 
 	trytls = g_strcasecmp(set_getstr(&ic->acc->set, "tls"), "try") == 0;
@@ -364,6 +409,13 @@ static xt_status jabber_pkt_features(struct xt_node *node, gpointer data)
 		}
 	}
 
+	/* SASL2 can authenticate and bind in one go, so prefer it. */
+	if (!(jd->flags & JFLAG_AUTHENTICATED) &&
+	    (c = xt_find_node(node->children, "authentication")) &&
+	    (st = sasl2_authenticate(ic, c)) != XT_NEXT) {
+		return st;
+	}
+
 	/* This one used to be in jabber_handlers[], but it has to be done
 	   from here to make sure the TLS session will be initialized
 	   properly before we attempt SASL authentication. */
@@ -386,15 +438,59 @@ static xt_status jabber_pkt_features(struct xt_node *node, gpointer data)
 		jd->flags |= JFLAG_WANT_BIND;
 	}
 
-	if ((c = xt_find_node(node->children, "session"))) {
+	/* Sessions are a no-op these days, servers that still list it
+	   usually mark it <optional/>. One request less. */
+	if ((c = xt_find_node(node->children, "session")) &&
+	    !xt_find_node(c->children, "optional")) {
 		jd->flags |= JFLAG_WANT_SESSION;
 	}
 
-	if (jd->flags & JFLAG_AUTHENTICATED) {
-		return jabber_pkt_bind_sess(ic, NULL, NULL);
+	if ((c = xt_find_node(node->children, "ver")) &&
+	    (s = xt_find_attr(c, "xmlns")) && strcmp(s, XMLNS_ROSTERVER) == 0) {
+		jd->flags |= JFLAG_ROSTER_VER;
 	}
 
-	return XT_HANDLED;
+	if ((c = xt_find_node(node->children, "sm")) &&
+	    (s = xt_find_attr(c, "xmlns")) && strcmp(s, XMLNS_SM) == 0) {
+		jd->flags |= JFLAG_SM_SUPPORTED;
+	}
+
+	if ((c = xt_find_node(node->children, "csi")) &&
+	    (s = xt_find_attr(c, "xmlns")) && strcmp(s, XMLNS_CSI) == 0 &&
+	    !(jd->flags & JFLAG_CSI)) {
+		jd->flags |= JFLAG_CSI;
+		jd->csi_since = time(NULL);
+	}
+
+	if (!(jd->flags & JFLAG_AUTHENTICATED)) {
+		return XT_HANDLED;
+	}
+
+	/* Compression comes first, the stream is restarted once it's on and
+	   the rest happens after the next <stream:features/>. */
+	if ((st = jabber_compress_offer(ic, node)) != XT_NEXT) {
+		return st;
+	}
+
+	return jabber_stream_ready(ic);
+}
+
+/* Authenticated and done with stream features, resume the old session or
+   bind a new one. */
+xt_status jabber_stream_ready(struct im_connection *ic)
+{
+	struct jabber_data *jd = ic->proto_data;
+
+	if (jd->flags & JFLAG_SM_RESUMING) {
+		if (!jabber_sm_resume(ic)) {
+			imcb_error(ic, "Server doesn't support resuming sessions anymore");
+			imc_logout(ic, TRUE);
+			return XT_ABORT;
+		}
+		return XT_HANDLED;
+	}
+
+	return jabber_pkt_bind_sess(ic, NULL, NULL);
 }
 
 static xt_status jabber_pkt_proceed_tls(struct xt_node *node, gpointer data)
@@ -438,7 +534,7 @@ static xt_status jabber_pkt_proceed_tls(struct xt_node *node, gpointer data)
 	}
 
 	jd->ssl = ssl_starttls(jd->fd, tlsname, set_getbool(&ic->acc->set, "tls_verify"),
-	                       jabber_connected_ssl, ic);
+	                       jabber_connected_ssl, IMC_HANDLE(ic));
 
 	return XT_HANDLED;
 }
@@ -476,7 +572,7 @@ static xt_status jabber_pkt_stream_error(struct xt_node *node, gpointer data)
 		}
 
 		imcb_log(ic, "Redirected to %s", host->text);
-		jd->fd = proxy_connect(host->text, port, jabber_connected_plain, ic);
+		jd->fd = proxy_connect(host->text, port, jabber_connected_plain, IMC_HANDLE(ic));
 
 		return XT_ABORT;
 	}
@@ -529,8 +625,21 @@ static xt_status jabber_xmlconsole(struct xt_node *node, gpointer data)
 	return XT_NEXT;
 }
 
+/* Sees every top-level element before the real handlers do. */
+static xt_status jabber_pkt_count(struct xt_node *node, gpointer data)
+{
+	struct im_connection *ic = data;
+	struct jabber_data *jd = ic->proto_data;
+
+	jabber_sm_count_in(ic, node);
+	jd->csi_stanzas[(jd->flags & JFLAG_CSI_INACTIVE) ? 1 : 0]++;
+
+	return XT_NEXT;
+}
+
 static const struct xt_handler_entry jabber_handlers[] = {
 	{ NULL,                 "stream:stream",        jabber_xmlconsole },
+	{ NULL,                 "stream:stream",        jabber_pkt_count },
 	{ "stream:stream",      "<root>",               jabber_end_of_stream },
 	{ "message",            "stream:stream",        jabber_pkt_message },
 	{ "presence",           "stream:stream",        jabber_pkt_presence },
@@ -540,7 +649,14 @@ static const struct xt_handler_entry jabber_handlers[] = {
 	{ "proceed",            "stream:stream",        jabber_pkt_proceed_tls },
 	{ "challenge",          "stream:stream",        sasl_pkt_challenge },
 	{ "success",            "stream:stream",        sasl_pkt_result },
+	{ "compressed",         "stream:stream",        jabber_compress_pkt },
+	{ "failure",            "stream:stream",        jabber_compress_pkt },
 	{ "failure",            "stream:stream",        sasl_pkt_result },
+	{ "r",                  "stream:stream",        jabber_sm_pkt },
+	{ "a",                  "stream:stream",        jabber_sm_pkt },
+	{ "enabled",            "stream:stream",        jabber_sm_pkt },
+	{ "resumed",            "stream:stream",        jabber_sm_pkt },
+	{ "failed",             "stream:stream",        jabber_sm_pkt },
 	{ NULL,                 NULL,                   NULL }
 };
 
@@ -554,6 +670,7 @@ gboolean jabber_start_stream(struct im_connection *ic)
 	   from the server too. */
 	xt_free(jd->xt);        /* In case we're RE-starting. */
 	jd->xt = xt_new(jabber_handlers, ic);
+	jd->xt->arena_depth = 1;        /* One arena per stanza */
 
 	if (jd->r_inpa <= 0) {
 		jd->r_inpa = b_input_add(jd->fd, B_EV_IO_READ, jabber_read_callback, ic);
@@ -27,6 +27,7 @@ static xt_status jabber_parse_roster(struct im_connection *ic, struct xt_node *n
 static xt_status jabber_iq_display_vcard(struct im_connection *ic, struct xt_node *node, struct xt_node *orig);
 static xt_status jabber_gmail_handle_new(struct im_connection *ic, struct xt_node *node);
 static xt_status jabber_iq_carbons_response(struct im_connection *ic, struct xt_node *node, struct xt_node *orig);
+static int jabber_iq_enable_carbons(struct im_connection *ic);
 
 xt_status jabber_pkt_iq(struct xt_node *node, gpointer data)
 {
@@ -297,10 +298,7 @@ static xt_status jabber_finish_iq_auth(struct im_connection *ic, struct xt_node
 		/* This happens when we just successfully authenticated the
 		   old (non-SASL) way. */
 		jd->flags |= JFLAG_AUTHENTICATED;
-		if (!jabber_get_roster(ic)) {
-			return XT_ABORT;
-		}
-		if (!jabber_iq_disco_server(ic)) {
+		if (!jabber_login_pipeline(ic)) {
 			return XT_ABORT;
 		}
 	}
@@ -333,40 +331,66 @@ xt_status jabber_pkt_bind_sess(struct im_connection *ic, struct xt_node *node, s
 		}
 	}
 
+	/* Binding is the only step we really have to wait for. */
 	if (jd->flags & JFLAG_WANT_BIND) {
 		reply = xt_new_node("bind", NULL, xt_new_node("resource", set_getstr(&ic->acc->set, "resource"), NULL));
 		xt_add_attr(reply, "xmlns", XMLNS_BIND);
+		reply = jabber_make_packet("iq", "set", NULL, reply);
+		jabber_cache_add(ic, reply, jabber_pkt_bind_sess);
 		jd->flags &= ~JFLAG_WANT_BIND;
-	} else if (jd->flags & JFLAG_WANT_SESSION) {
-		reply = xt_new_node("session", NULL, NULL);
-		xt_add_attr(reply, "xmlns", XMLNS_SESSION);
-		jd->flags &= ~JFLAG_WANT_SESSION;
+
+		return jabber_write_packet(ic, reply) ? XT_HANDLED : XT_ABORT;
 	}
 
-	if (reply != NULL) {
+	/* The server handles stanzas in order, so the rest can go out
+	   right behind the <session/> without waiting for its result. */
+	if (jd->flags & JFLAG_WANT_SESSION) {
+		reply = xt_new_node("session", NULL, NULL);
+		xt_add_attr(reply, "xmlns", XMLNS_SESSION);
 		reply = jabber_make_packet("iq", "set", NULL, reply);
-		jabber_cache_add(ic, reply, jabber_pkt_bind_sess);
+		jabber_cache_add(ic, reply, NULL);
+		jd->flags &= ~JFLAG_WANT_SESSION;
 
 		if (!jabber_write_packet(ic, reply)) {
 			return XT_ABORT;
 		}
-		if (jd->flags & JFLAG_GMAILNOTIFY && node == NULL) {
-			jabber_iq_query_server(ic, jd->server, XMLNS_DISCO_INFO);
-		}
-	} else if ((jd->flags & (JFLAG_WANT_BIND | JFLAG_WANT_SESSION)) == 0) {
-		if (!jabber_get_roster(ic)) {
-			return XT_ABORT;
-		}
-		if (!jabber_iq_disco_server(ic)) {
-			return XT_ABORT;
-		}
 	}
 
-	return XT_HANDLED;
+	return jabber_login_pipeline(ic) ? XT_HANDLED : XT_ABORT;
+}
+
+/* Everything that has to happen once we have a resource. None of these
+   requests depend on each other's results, so they all go out at once
+   instead of one round trip each. The roster request goes first, that's
+   all RFC 6121 asks for before sending the initial presence. */
+int jabber_login_pipeline(struct im_connection *ic)
+{
+	struct jabber_data *jd = ic->proto_data;
+
+	if (!jabber_sm_enable(ic) ||
+	    !jabber_get_roster(ic) ||
+	    !jabber_iq_disco_server(ic)) {
+		return 0;
+	}
+
+	/* Just try, an error reply is harmless and it saves waiting for
+	   the disco reply first. */
+	if (!(jd->flags & JFLAG_CARBONS) && set_getbool(&ic->acc->set, "carbons") &&
+	    !jabber_iq_enable_carbons(ic)) {
+		return 0;
+	}
+
+	/* imcb_connected() will try to send it again once the roster is in,
+	   jabber_set_away() skips that if nothing changed. */
+	jd->flags |= JFLAG_PRESENCE_SENT;
+	imc_away_send_update(ic);
+
+	return 1;
 }
 
 int jabber_get_roster(struct im_connection *ic)
 {
+	struct jabber_data *jd = ic->proto_data;
 	struct xt_node *node;
 	int st;
 
@@ -374,6 +398,9 @@ int jabber_get_roster(struct im_connection *ic)
 
 	node = xt_new_node("query", NULL, NULL);
 	xt_add_attr(node, "xmlns", XMLNS_ROSTER);
+	if (jd->flags & JFLAG_ROSTER_VER) {
+		xt_add_attr(node, "ver", jabber_roster_cache_load(ic));
+	}
 	node = jabber_make_packet("iq", "get", NULL, node);
 
 	jabber_cache_add(ic, node, jabber_parse_roster);
@@ -401,16 +428,10 @@ static xt_status jabber_gmail_handle_new(struct im_connection *ic, struct xt_nod
 	return XT_HANDLED;
 }
 
-static xt_status jabber_parse_roster(struct im_connection *ic, struct xt_node *node, struct xt_node *orig)
+static void jabber_roster_apply(struct im_connection *ic, struct xt_node *query)
 {
 	struct jabber_data *jd = ic->proto_data;
-	struct xt_node *query, *c;
-	int initial = (orig != NULL);
-
-	if (!(query = xt_find_node(node->children, "query"))) {
-		imcb_log(ic, "Warning: Received NULL roster packet");
-		return XT_HANDLED;
-	}
+	struct xt_node *c;
 
 	c = query->children;
 	while ((c = xt_find_node(c, "item"))) {
@@ -442,6 +463,26 @@ static xt_status jabber_parse_roster(struct im_connection *ic, struct xt_node *n
 
 		c = c->next;
 	}
+}
+
+static xt_status jabber_parse_roster(struct im_connection *ic, struct xt_node *node, struct xt_node *orig)
+{
+	struct jabber_data *jd = ic->proto_data;
+	struct xt_node *query;
+	int initial = (orig != NULL);
+	char *type = xt_find_attr(node, "type");
+
+	if ((query = xt_find_node(node->children, "query"))) {
+		jabber_roster_apply(ic, query);
+		jabber_roster_cache_update(ic, query, initial);
+	} else if (initial && jd->roster && type && strcmp(type, "result") == 0) {
+		/* XEP-0237: An empty result means our copy is still current,
+		   changes (if any) will follow as roster pushes. */
+		jabber_roster_apply(ic, jd->roster);
+	} else {
+		imcb_log(ic, "Warning: Received NULL roster packet");
+		return XT_HANDLED;
+	}
 
 	if (initial) {
 		imcb_connected(ic);
@@ -684,6 +725,7 @@ xt_status jabber_iq_query_features(struct im_connection *ic, char *bare_jid)
 {
 	struct xt_node *node, *query;
 	struct jabber_buddy *bud;
+	char *s;
 
 	if ((bud = jabber_buddy_by_jid(ic, bare_jid, 0)) == NULL) {
 		/* Who cares about the unknown... */
@@ -695,8 +737,17 @@ xt_status jabber_iq_query_features(struct im_connection *ic, char *bare_jid)
 		return XT_HANDLED;
 	}
 
+	if (bud->caps_node && (s = strchr(bud->caps_node, '#')) &&
+	    (bud->features = jabber_caps_lookup(s + 1))) {
+		bud->flags |= JBFLAG_SHARED_FEATURES;
+		return XT_HANDLED;
+	}
+
 	node = xt_new_node("query", NULL, NULL);
 	xt_add_attr(node, "xmlns", XMLNS_DISCO_INFO);
+	if (bud->caps_node) {
+		xt_add_attr(node, "node", bud->caps_node);
+	}
 
 	if (!(query = jabber_make_packet("iq", "get", bare_jid, node))) {
 		imcb_log(ic, "WARNING: Couldn't generate feature query");
@@ -713,7 +764,7 @@ xt_status jabber_iq_parse_features(struct im_connection *ic, struct xt_node *nod
 {
 	struct xt_node *c;
 	struct jabber_buddy *bud;
-	char *feature, *xmlns, *from;
+	char *feature, *xmlns, *from, *s;
 
 	if (!(from = xt_find_attr(node, "from")) ||
 	    !(c = xt_find_node(node->children, "query")) ||
@@ -728,6 +779,17 @@ xt_status jabber_iq_parse_features(struct im_connection *ic, struct xt_node *nod
 		return XT_HANDLED;
 	}
 
+	if (bud->features) {
+		/* Got them from the caps cache in the meantime. */
+		return XT_HANDLED;
+	}
+
+	if ((s = xt_find_attr(c, "node")) && (s = strchr(s, '#')) &&
+	    (bud->features = jabber_caps_add(s + 1, c))) {
+		bud->flags |= JBFLAG_SHARED_FEATURES;
+		return XT_HANDLED;
+	}
+
 	c = c->children;
 	while ((c = xt_find_node(c, "feature"))) {
 		feature = xt_find_attr(c, "var");
@@ -1013,17 +1075,9 @@ static xt_status jabber_iq_disco_server_response(struct im_connection *ic,
 		return XT_HANDLED;
 	}
 
-	if (xt_find_node_by_attr(query->children, "feature", "var", XMLNS_CARBONS) &&
-	    set_getbool(&ic->acc->set, "carbons")) {
-
-		struct xt_node *enable, *iq;
-
-		enable = xt_new_node("enable", NULL, NULL);
-		xt_add_attr(enable, "xmlns", XMLNS_CARBONS);
-		iq = jabber_make_packet("iq", "set", NULL, enable);
-
-		jabber_cache_add(ic, iq, jabber_iq_carbons_response);
-		jabber_write_packet(ic, iq);
+	if ((jd->flags & JFLAG_GMAILNOTIFY) &&
+	    xt_find_node_by_attr(query->children, "feature", "var", XMLNS_GMAILNOTIFY)) {
+		jabber_iq_query_gmail(ic);
 	}
 
 	if ((id = xt_find_node(query->children, "identity"))) {
@@ -1044,14 +1098,31 @@ static xt_status jabber_iq_disco_server_response(struct im_connection *ic,
 	return XT_HANDLED;
 }
 
+static int jabber_iq_enable_carbons(struct im_connection *ic)
+{
+	struct xt_node *enable, *iq;
+
+	enable = xt_new_node("enable", NULL, NULL);
+	xt_add_attr(enable, "xmlns", XMLNS_CARBONS);
+	iq = jabber_make_packet("iq", "set", NULL, enable);
+
+	jabber_cache_add(ic, iq, jabber_iq_carbons_response);
+	return jabber_write_packet(ic, iq);
+}
+
 static xt_status jabber_iq_carbons_response(struct im_connection *ic,
                                             struct xt_node *node, struct xt_node *orig)
 {
 	struct jabber_error *err;
 
 	if ((err = jabber_error_parse(xt_find_node(node->children, "error"), XMLNS_STANZA_ERROR))) {
-		imcb_error(ic, "Error enabling carbons: %s%s%s",
-		           err->code, err->text ? ": " : "", err->text ? err->text : "");
+		/* We ask without checking disco first, so this just means
+		   the server doesn't do carbons. */
+		if (g_strcmp0(err->code, "feature-not-implemented") != 0 &&
+		    g_strcmp0(err->code, "service-unavailable") != 0) {
+			imcb_error(ic, "Error enabling carbons: %s%s%s",
+			           err->code, err->text ? ": " : "", err->text ? err->text : "");
+		}
 		jabber_error_free(err);
 	} else {
 		imcb_log(ic, "Carbons enabled");
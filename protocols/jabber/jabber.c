@@ -33,7 +33,6 @@
 #include "jabber.h"
 #include "oauth.h"
 
-GSList *jabber_connections;
 
 /* First enty is the default */
 static const int jabber_port_list[] = {
@@ -59,6 +58,11 @@ static void jabber_init(account_t *acc)
 
 	s = set_add(&acc->set, "activity_timeout", "600", set_eval_int, acc);
 
+#ifdef WITH_ZLIB
+	s = set_add(&acc->set, "compression", "false", set_eval_bool, acc);
+	s->flags |= ACC_SET_OFFLINE_ONLY;
+#endif
+
 	s = set_add(&acc->set, "display_name", NULL, NULL, acc);
 
 	g_snprintf(str, sizeof(str), "%d", jabber_port_list[0]);
@@ -92,6 +96,9 @@ static void jabber_init(account_t *acc)
 	s = set_add(&acc->set, "ssl", "false", set_eval_bool, acc);
 	s->flags |= ACC_SET_OFFLINE_ONLY;
 
+	s = set_add(&acc->set, "stream_management", "true", set_eval_bool, acc);
+	s->flags |= ACC_SET_OFFLINE_ONLY;
+
 	s = set_add(&acc->set, "tls", "true", set_eval_tls, acc);
 	s->flags |= ACC_SET_OFFLINE_ONLY;
 
@@ -127,11 +134,6 @@ static void jabber_login(account_t *acc)
 	struct jabber_data *jd = g_new0(struct jabber_data, 1);
 	char *s;
 
-	/* For now this is needed in the _connected() handlers if using
-	   GLib event handling, to make sure we're not handling events
-	   on dead connections. */
-	jabber_connections = g_slist_prepend(jabber_connections, ic);
-
 	jd->ic = ic;
 	ic->proto_data = jd;
 
@@ -269,11 +271,11 @@ void jabber_connect(struct im_connection *ic)
 	if (set_getbool(&acc->set, "ssl")) {
 		jd->ssl = ssl_connect(connect_to, set_getint(&acc->set, "port"), set_getbool(&acc->set,
 		                                                                             "tls_verify"), jabber_connected_ssl,
-		                      ic);
+		                      IMC_HANDLE(ic));
 		jd->fd = jd->ssl ? ssl_getfd(jd->ssl) : -1;
 	} else {
 		jd->fd = proxy_connect(connect_to, srv ? srv->port : set_getint(&acc->set,
-		                                                                "port"), jabber_connected_plain, ic);
+		                                                                "port"), jabber_connected_plain, IMC_HANDLE(ic));
 	}
 	srv_free(srvl);
 
@@ -306,6 +308,11 @@ static void jabber_generate_id_hash(struct jabber_data *jd)
 	guint8 binbuf[4];
 	char *s;
 
+	if (jd->cached_id_prefix) {
+		/* Reconnecting to resume a session. */
+		g_checksum_free(jd->cached_id_prefix);
+	}
+
 	jd->cached_id_prefix = g_checksum_new(G_CHECKSUM_MD5);
 	g_checksum_update(jd->cached_id_prefix, jd->username, strlen(jd->username));
 	g_checksum_update(jd->cached_id_prefix, jd->server, strlen(jd->server));
@@ -367,6 +374,10 @@ static void jabber_logout(struct im_connection *ic)
 		jabber_buddy_remove_all(ic);
 	}
 
+	jabber_roster_cache_free(ic);
+	jabber_sm_free(ic);
+	jabber_compress_free(ic);
+
 	xt_free(jd->xt);
 
 	g_checksum_free(jd->cached_id_prefix);
@@ -379,8 +390,6 @@ static void jabber_logout(struct im_connection *ic)
 	g_free(jd->username);
 	g_free(jd->me);
 	g_free(jd);
-
-	jabber_connections = g_slist_remove(jabber_connections, ic);
 }
 
 static int jabber_buddy_msg(struct im_connection *ic, char *who, char *message, int flags)
@@ -399,7 +408,7 @@ static int jabber_buddy_msg(struct im_connection *ic, char *who, char *message,
 	    !(jd->flags & OPT_LOGGED_IN) && jd->fd == -1) {
 
 		if (jd->flags & JFLAG_HIPCHAT) {
-			sasl_oauth2_got_token(ic, message, NULL, NULL);
+			sasl_oauth2_got_token(IMC_HANDLE(ic), message, NULL, NULL);
 			return 1;
 		} else if (sasl_oauth2_get_refresh_token(ic, message)) {
 			return 1;
@@ -501,6 +510,8 @@ static void jabber_get_info(struct im_connection *ic, char *who)
 static void jabber_set_away(struct im_connection *ic, char *state_txt, char *message)
 {
 	struct jabber_data *jd = ic->proto_data;
+	const struct jabber_away_state *old_state = jd->away_state;
+	char *old_message = jd->away_message;
 
 	/* state_txt == NULL -> Not away.
 	   Unknown state -> fall back to the first defined away state. */
@@ -510,12 +521,57 @@ static void jabber_set_away(struct im_connection *ic, char *state_txt, char *mes
 		jd->away_state = jabber_away_state_list;
 	}
 
-	g_free(jd->away_message);
 	jd->away_message = (message && *message) ? g_strdup(message) : NULL;
 
+	/* The initial presence was sent along with the roster request, this
+	   is imcb_connected() sending it again. */
+	if ((jd->flags & JFLAG_PRESENCE_SENT) && (ic->flags & OPT_LOGGED_IN)) {
+		jd->flags &= ~JFLAG_PRESENCE_SENT;
+		if (jd->away_state == old_state &&
+		    g_strcmp0(jd->away_message, old_message) == 0) {
+			g_free(old_message);
+			return;
+		}
+	}
+
+	g_free(old_message);
 	presence_send_update(ic);
 }
 
+/* XEP-0352: Tell the server whether anyone's looking. An inactive client
+   may get presence updates and the like batched or dropped. */
+static void jabber_set_inactive(struct im_connection *ic, gboolean inactive)
+{
+	struct jabber_data *jd = ic->proto_data;
+	int was = (jd->flags & JFLAG_CSI_INACTIVE) ? 1 : 0;
+	time_t now = time(NULL);
+	char *s;
+
+	if (!(jd->flags & JFLAG_CSI) || inactive == was) {
+		return;
+	}
+
+	jd->csi_seconds[was] += now - jd->csi_since;
+	jd->csi_since = now;
+
+	s = g_strdup_printf("<%s xmlns='%s'/>", inactive ? "inactive" : "active", XMLNS_CSI);
+	jabber_write(ic, s, strlen(s));
+	g_free(s);
+
+	if (inactive) {
+		jd->flags |= JFLAG_CSI_INACTIVE;
+	} else {
+		jd->flags &= ~JFLAG_CSI_INACTIVE;
+	}
+
+	if (!inactive && set_getbool(&ic->bee->set, "debug")) {
+		imcb_log(ic, "Client state active again. Received %u stanzas in %lds "
+		         "while inactive, %u in %lds while active",
+		         jd->csi_stanzas[1], (long) jd->csi_seconds[1],
+		         jd->csi_stanzas[0], (long) jd->csi_seconds[0]);
+	}
+}
+
 static void jabber_add_buddy(struct im_connection *ic, char *who, char *group)
 {
 	if (g_strcasecmp(who, JABBER_XMLCONSOLE_HANDLE) == 0) {
@@ -653,11 +709,19 @@ static void jabber_chat_invite_(struct groupchat *c, char *who, char *msg)
 
 static void jabber_keepalive(struct im_connection *ic)
 {
+	struct jabber_data *jd = ic->proto_data;
+
+	if (jd->flags & JFLAG_SM_RESUMING) {
+		return;
+	}
+
 	/* Just any whitespace character is enough as a keepalive for XMPP sessions. */
 	if (!jabber_write(ic, "\n", 1)) {
 		return;
 	}
 
+	jabber_sm_keepalive(ic);
+
 	/* This runs the garbage collection every minute, which means every packet
 	   is in the cache for about a minute (which should be enough AFAIK). */
 	jabber_cache_clean(ic);
@@ -772,12 +836,14 @@ void jabber_initmodule()
 
 	ret->name = "jabber";
 	ret->mms = 0;                        /* no limit */
+	ret->options = PRPL_OPT_MULTILINE_MSG;
 	ret->login = jabber_login;
 	ret->init = jabber_init;
 	ret->logout = jabber_logout;
 	ret->buddy_msg = jabber_buddy_msg;
 	ret->away_states = jabber_away_states;
 	ret->set_away = jabber_set_away;
+	ret->set_inactive = jabber_set_inactive;
 //	ret->set_info = jabber_set_info;
 	ret->get_info = jabber_get_info;
 	ret->add_buddy = jabber_add_buddy;
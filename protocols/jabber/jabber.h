@@ -29,8 +29,6 @@
 #include "bitlbee.h"
 #include "xmltree.h"
 
-extern GSList *jabber_connections;
-
 typedef enum {
 	JFLAG_STREAM_STARTED = 1,       /* Set when we detected the beginning of the stream
 	                                   and want to do auth. */
@@ -45,6 +43,16 @@ typedef enum {
 	JFLAG_XMLCONSOLE = 64,          /* If the user added an xmlconsole buddy. */
 	JFLAG_STARTTLS_DONE = 128,      /* If a plaintext session was converted to TLS. */
 	JFLAG_GMAILNOTIFY = 256,        /* If gmail notification is enabled */
+	JFLAG_ROSTER_VER = 512,         /* Server supports roster versioning (XEP-0237) */
+	JFLAG_SM_SUPPORTED = 1024,      /* Server supports stream management (XEP-0198) */
+	JFLAG_SM_ENABLED = 2048,        /* Stream management is on, count stanzas. */
+	JFLAG_SM_RESUMING = 4096,       /* Reconnecting to resume the previous session. */
+	JFLAG_SM_WANT_ACK = 8192,       /* Send <r/> after the current stanza. */
+	JFLAG_CSI = 16384,              /* Server supports client state indication (XEP-0352) */
+	JFLAG_CSI_INACTIVE = 32768,     /* We told the server we're inactive. */
+	JFLAG_COMPRESS_OFFERED = 65536, /* Waiting for the answer to <compress/> (XEP-0138) */
+	JFLAG_PRESENCE_SENT = 0x20000,  /* Initial presence went out before the roster came in. */
+	JFLAG_CARBONS = 0x40000,        /* Carbons were enabled while binding (XEP-0386) */
 
 	JFLAG_GTALK =  0x100000,        /* Is Google Talk, as confirmed by iq discovery */
 	JFLAG_HIPCHAT = 0x200000,       /* Is hipchat, because prpl->name says so */
@@ -61,6 +69,8 @@ typedef enum {
 	                                   have a real JID. */
 	JBFLAG_HIDE_SUBJECT = 16,       /* Hide the subject field since we probably
 	                                   showed it already. */
+	JBFLAG_SHARED_FEATURES = 32,    /* features belongs to the caps cache, don't
+	                                   modify or free it. */
 } jabber_buddy_flags_t;
 
 /* Stores a streamhost's (a.k.a. proxy) data */
@@ -112,6 +122,23 @@ struct jabber_data {
 	int have_streamhosts;
 
 	char *muc_host;
+
+	struct xt_node *roster; /* Local copy of the roster if the server does versioning */
+	gint roster_save_id;
+
+	/* XEP-0198 state: stanzas received/sent since <enable/>, what the
+	   server didn't acknowledge yet, and the id to resume with. */
+	guint32 sm_in, sm_out;
+	GQueue sm_unacked;
+	char *sm_id;
+	gint sm_resume_id;
+
+	/* XEP-0352 statistics, [0] while active and [1] while inactive. */
+	guint csi_stanzas[2];
+	time_t csi_seconds[2];
+	time_t csi_since;
+
+	struct jabber_zlib *zlib; /* Set once the stream is compressed (XEP-0138) */
 };
 
 struct jabber_away_state {
@@ -146,6 +173,7 @@ struct jabber_buddy {
 	struct jabber_away_state *away_state;
 	char *away_message;
 	GSList *features;
+	char *caps_node; /* node#ver from XEP-0115 <c/>, if any */
 
 	time_t last_msg;
 	jabber_buddy_flags_t flags;
@@ -215,6 +243,13 @@ struct jabber_transfer {
 #define XMLNS_STANZA_ERROR "urn:ietf:params:xml:ns:xmpp-stanzas"
 #define XMLNS_STREAM_ERROR "urn:ietf:params:xml:ns:xmpp-streams"
 #define XMLNS_ROSTER       "jabber:iq:roster"
+#define XMLNS_ROSTERVER    "urn:xmpp:features:rosterver"
+#define XMLNS_SM           "urn:xmpp:sm:3"                                       /* XEP-0198 */
+#define XMLNS_CSI          "urn:xmpp:csi:0"                                      /* XEP-0352 */
+#define XMLNS_COMPRESS     "http://jabber.org/protocol/compress"                 /* XEP-0138 */
+#define XMLNS_COMPRESS_FEATURE "http://jabber.org/features/compress"             /* XEP-0138 */
+#define XMLNS_SASL2        "urn:xmpp:sasl:2"                                     /* XEP-0388 */
+#define XMLNS_BIND2        "urn:xmpp:bind:0"                                     /* XEP-0386 */
 
 /* Some supported extensions/legacy stuff */
 #define XMLNS_AUTH         "jabber:iq:auth"                                      /* XEP-0078 */
@@ -254,6 +289,7 @@ void jabber_connect(struct im_connection *ic);
 xt_status jabber_pkt_iq(struct xt_node *node, gpointer data);
 int jabber_init_iq_auth(struct im_connection *ic);
 xt_status jabber_pkt_bind_sess(struct im_connection *ic, struct xt_node *node, struct xt_node *orig);
+int jabber_login_pipeline(struct im_connection *ic);
 int jabber_get_roster(struct im_connection *ic);
 int jabber_get_vcard(struct im_connection *ic, char *bare_jid);
 int jabber_add_to_roster(struct im_connection *ic, const char *handle, const char *name, const char *group);
@@ -264,6 +300,37 @@ void jabber_iq_version_send(struct im_connection *ic, struct jabber_buddy *bud,
 int jabber_iq_disco_server(struct im_connection *ic);
 int jabber_iq_disco_muc(struct im_connection *ic, const char *muc_server);
 
+/* caps.c */
+GSList *jabber_caps_lookup(const char *ver);
+GSList *jabber_caps_add(const char *ver, struct xt_node *query);
+
+/* roster.c */
+char *jabber_roster_cache_load(struct im_connection *ic);
+void jabber_roster_cache_update(struct im_connection *ic, struct xt_node *query, gboolean full);
+void jabber_roster_cache_free(struct im_connection *ic);
+
+/* sm.c */
+int jabber_sm_enable(struct im_connection *ic);
+gboolean jabber_sm_outgoing(struct im_connection *ic, struct xt_node *node, const char *buf);
+void jabber_sm_written(struct im_connection *ic);
+void jabber_sm_keepalive(struct im_connection *ic);
+void jabber_sm_count_in(struct im_connection *ic, struct xt_node *node);
+xt_status jabber_sm_pkt(struct xt_node *node, gpointer data);
+void jabber_sm_enabled_inline(struct im_connection *ic, struct xt_node *enabled);
+struct xt_node *jabber_sm_resume_node(struct im_connection *ic);
+gboolean jabber_sm_resume(struct im_connection *ic);
+gboolean jabber_sm_connection_lost(struct im_connection *ic);
+void jabber_sm_free(struct im_connection *ic);
+
+/* compress.c */
+struct jabber_zlib *jabber_zlib_new(void);
+char *jabber_zlib_deflate(struct jabber_zlib *z, const char *buf, int len, int *out_len);
+char *jabber_zlib_inflate(struct jabber_zlib *z, const char *buf, int len, int *out_len);
+void jabber_zlib_free(struct jabber_zlib *z);
+xt_status jabber_compress_offer(struct im_connection *ic, struct xt_node *features);
+xt_status jabber_compress_pkt(struct xt_node *node, gpointer data);
+void jabber_compress_free(struct im_connection *ic);
+
 /* si.c */
 int jabber_si_handle_request(struct im_connection *ic, struct xt_node *node, struct xt_node *sinode);
 void jabber_si_transfer_request(struct im_connection *ic, file_transfer_t *ft, char *who);
@@ -330,12 +397,14 @@ int jabber_write(struct im_connection *ic, char *buf, int len);
 gboolean jabber_connected_plain(gpointer data, gint source, b_input_condition cond);
 gboolean jabber_connected_ssl(gpointer data, int returncode, void *source, b_input_condition cond);
 gboolean jabber_start_stream(struct im_connection *ic);
+xt_status jabber_stream_ready(struct im_connection *ic);
 void jabber_end_stream(struct im_connection *ic);
 
 /* sasl.c */
 xt_status sasl_pkt_mechanisms(struct xt_node *node, gpointer data);
 xt_status sasl_pkt_challenge(struct xt_node *node, gpointer data);
 xt_status sasl_pkt_result(struct xt_node *node, gpointer data);
+xt_status sasl2_authenticate(struct im_connection *ic, struct xt_node *auth);
 gboolean sasl_supported(struct im_connection *ic);
 void sasl_oauth2_init(struct im_connection *ic);
 int sasl_oauth2_get_refresh_token(struct im_connection *ic, const char *msg);
@@ -651,6 +651,7 @@ int jabber_buddy_remove(struct im_connection *ic, char *full_jid_)
 				g_free(bi->ext_jid);
 				g_free(bi->full_jid);
 				g_free(bi->away_message);
+				g_free(bi->caps_node);
 				g_free(bi);
 
 				return 1;
@@ -696,6 +697,7 @@ int jabber_buddy_remove_bare(struct im_connection *ic, char *bare_jid)
 			g_free(bud->ext_jid);
 			g_free(bud->full_jid);
 			g_free(bud->away_message);
+			g_free(bud->caps_node);
 			g_free(bud);
 			bud = next;
 		}
@@ -719,6 +721,7 @@ static gboolean jabber_buddy_remove_all_cb(gpointer key, gpointer value, gpointe
 		g_free(bud->ext_jid);
 		g_free(bud->full_jid);
 		g_free(bud->away_message);
+		g_free(bud->caps_node);
 		g_free(bud);
 		bud = next;
 	}
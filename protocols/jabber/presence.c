@@ -77,11 +77,42 @@ xt_status jabber_pkt_presence(struct xt_node *node, gpointer data)
 			/* This <presence> stanza includes an XEP-0115
 			   capabilities part. Not too interesting, but we can
 			   see if it has an ext= attribute. */
+			char *ver = xt_find_attr(cap, "ver");
+			char *hash = xt_find_attr(cap, "hash");
+			char *capnode = xt_find_attr(cap, "node");
+			GSList *features;
+
 			s = xt_find_attr(cap, "ext");
 			if (s && (strstr(s, "cstates") || strstr(s, "chatstate"))) {
 				bud->flags |= JBFLAG_DOES_XEP85;
 			}
 
+			/* Modern clients send a hash of their feature list
+			   instead, which may well be in the cache already. */
+			if (ver && capnode && hash && strcmp(hash, "sha-1") == 0) {
+				char *node = g_strdup_printf("%s#%s", capnode, ver);
+
+				/* Different client (version), so whatever we knew
+				   about its features may be wrong now. */
+				if (bud->caps_node && strcmp(bud->caps_node, node) != 0 && bud->features) {
+					if (!(bud->flags & JBFLAG_SHARED_FEATURES)) {
+						g_slist_free_full(bud->features, g_free);
+					}
+					bud->features = NULL;
+					bud->flags &= ~JBFLAG_SHARED_FEATURES;
+				}
+				g_free(bud->caps_node);
+				bud->caps_node = node;
+
+				if (!bud->features && (features = jabber_caps_lookup(ver))) {
+					bud->features = features;
+					bud->flags |= JBFLAG_SHARED_FEATURES;
+					if (g_slist_find_custom(features, XMLNS_CHATSTATES, (GCompareFunc) strcmp)) {
+						bud->flags |= JBFLAG_DOES_XEP85;
+					}
+				}
+			}
+
 			/* This field can contain more information like xhtml
 			   support, but we don't support that ourselves.
 			   Officially the ext= tag was deprecated, but enough
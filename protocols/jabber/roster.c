@@ -0,0 +1,184 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Jabber module - Roster versioning (XEP-0237) and local roster cache     *
+*                                                                           *
+*  Copyright 2006-2012 Wilmer van der Gaast <wilmer@gaast.net>              *
+*                                                                           *
+*  This program is free software; you can redistribute it and/or modify     *
+*  it under the terms of the GNU General Public License as published by     *
+*  the Free Software Foundation; either version 2 of the License, or        *
+*  (at your option) any later version.                                      *
+*                                                                           *
+*  This program is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+*  GNU General Public License for more details.                             *
+*                                                                           *
+*  You should have received a copy of the GNU General Public License along  *
+*  with this program; if not, write to the Free Software Foundation, Inc.,  *
+*  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.              *
+*                                                                           *
+\***************************************************************************/
+
+#include "jabber.h"
+
+/* The cache is a copy of the last complete roster we saw plus all pushes
+   received since, stored as <roster jid="..." ver="..."><item/>...</roster>
+   next to the user's own .xml file. On login we send its version to the
+   server, which then either sends the whole roster again or nothing at all
+   followed by pushes for whatever changed in the meantime. */
+
+/* Don't write the file for every single push, a reconnect can easily
+   bring in a few dozen of them. */
+#define JABBER_ROSTER_SAVE_DELAY 2000
+
+static char *jabber_roster_cache_path(struct im_connection *ic)
+{
+	return account_cache_path(ic->acc, ic->acc->tag, "roster");
+}
+
+/* Reads the cached roster from disk (once per connection). Returns the
+   version string to send to the server, "" if we don't have anything
+   usable. */
+char *jabber_roster_cache_load(struct im_connection *ic)
+{
+	struct jabber_data *jd = ic->proto_data;
+	struct xt_node *roster;
+	char *path, *xml = NULL, *s;
+	gsize len;
+
+	if (jd->roster) {
+		return xt_find_attr(jd->roster, "ver") ? : "";
+	}
+
+	if (!(path = jabber_roster_cache_path(ic))) {
+		return "";
+	}
+
+	if (g_file_get_contents(path, &xml, &len, NULL) &&
+	    (roster = xt_from_string(xml, len))) {
+		/* Make sure it's really ours, the account might've been
+		   pointed at another JID since. */
+		if (strcmp(roster->name, "roster") == 0 &&
+		    (s = xt_find_attr(roster, "jid")) &&
+		    jabber_compare_jid(s, jd->me) == 0 &&
+		    xt_find_attr(roster, "ver")) {
+			jd->roster = roster;
+		} else {
+			xt_free_node(roster);
+		}
+	}
+
+	g_free(xml);
+	g_free(path);
+
+	return jd->roster ? xt_find_attr(jd->roster, "ver") : "";
+}
+
+static gboolean jabber_roster_cache_save_cb(gpointer data, gint fd, b_input_condition cond)
+{
+	struct im_connection *ic = data;
+	struct jabber_data *jd = ic->proto_data;
+	char *path, *tmp, *xml;
+	size_t len;
+	int out, ok = 0;
+
+	jd->roster_save_id = 0;
+
+	if (!jd->roster || !(path = jabber_roster_cache_path(ic))) {
+		return FALSE;
+	}
+
+	/* Same as storage_xml: mkstemp() makes it 0600, the roster is
+	   nobody else's business. */
+	xml = xt_to_string(jd->roster);
+	len = strlen(xml);
+	tmp = g_strconcat(path, ".XXXXXX", NULL);
+	if ((out = mkstemp(tmp)) >= 0) {
+		ok = write(out, xml, len) == len;
+		ok = close(out) == 0 && ok;
+		ok = ok && rename(tmp, path) == 0;
+		if (!ok) {
+			unlink(tmp);
+		}
+	}
+	if (!ok) {
+		imcb_log(ic, "Warning: Could not write roster cache to %s", path);
+	}
+
+	g_free(tmp);
+	g_free(xml);
+	g_free(path);
+
+	return FALSE;
+}
+
+static void jabber_roster_cache_save(struct im_connection *ic)
+{
+	struct jabber_data *jd = ic->proto_data;
+
+	if (jd->roster_save_id == 0) {
+		jd->roster_save_id = b_timeout_add(JABBER_ROSTER_SAVE_DELAY,
+		                                   jabber_roster_cache_save_cb, ic);
+	}
+}
+
+/* Called for every roster result or push, query is the <query/> node. A
+   result replaces the whole cache, pushes are merged into it. */
+void jabber_roster_cache_update(struct im_connection *ic, struct xt_node *query, gboolean full)
+{
+	struct jabber_data *jd = ic->proto_data;
+	struct xt_node *c, *old, **p;
+	char *ver, *jid;
+
+	if (!(jd->flags & JFLAG_ROSTER_VER) || !(ver = xt_find_attr(query, "ver"))) {
+		return;
+	}
+
+	if (full || !jd->roster) {
+		xt_free_node(jd->roster);
+		jd->roster = xt_new_node("roster", NULL, NULL);
+		xt_add_attr(jd->roster, "jid", jd->me);
+	}
+
+	for (c = query->children; (c = xt_find_node(c, "item")); c = c->next) {
+		char *sub = xt_find_attr(c, "subscription");
+
+		if (!(jid = xt_find_attr(c, "jid"))) {
+			continue;
+		}
+
+		if (!full) {
+			for (p = &jd->roster->children; (old = *p); p = &old->next) {
+				if (g_strcasecmp(xt_find_attr(old, "jid") ? : "", jid) == 0) {
+					*p = old->next;
+					old->next = NULL;
+					xt_free_node(old);
+					break;
+				}
+			}
+		}
+
+		if (!sub || strcmp(sub, "remove") != 0) {
+			xt_insert_child(jd->roster, xt_dup(c));
+		}
+	}
+
+	xt_add_attr(jd->roster, "ver", ver);
+	jabber_roster_cache_save(ic);
+}
+
+/* Flushes pending changes and drops the in-memory copy. */
+void jabber_roster_cache_free(struct im_connection *ic)
+{
+	struct jabber_data *jd = ic->proto_data;
+
+	if (jd->roster_save_id) {
+		b_event_remove(jd->roster_save_id);
+		jabber_roster_cache_save_cb(ic, 0, 0);
+	}
+
+	xt_free_node(jd->roster);
+	jd->roster = NULL;
+}
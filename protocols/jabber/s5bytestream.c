@@ -46,6 +46,9 @@ struct bs_transfer {
 
 	char peek_buf[64];
 	int peek_buf_len;
+
+	/* sending side only */
+	ft_relay_t *relay;
 };
 
 struct socks5_message {
@@ -94,6 +97,7 @@ gboolean jabber_bs_peek(struct bs_transfer *bt, void *buffer, int buflen);
 void jabber_bs_recv_answer_request(struct bs_transfer *bt);
 gboolean jabber_bs_recv_read(gpointer data, gint fd, b_input_condition cond);
 gboolean jabber_bs_recv_write_request(file_transfer_t *ft);
+gboolean jabber_bs_recv_done(file_transfer_t *ft, unsigned int len);
 gboolean jabber_bs_recv_handshake(gpointer data, gint fd, b_input_condition cond);
 gboolean jabber_bs_recv_handshake_abort(struct bs_transfer *bt, char *error);
 int jabber_bs_recv_request(struct im_connection *ic, struct xt_node *node, struct xt_node *qnode);
@@ -103,6 +107,7 @@ gboolean jabber_bs_send_request(struct jabber_transfer *tf, GSList *streamhosts)
 gboolean jabber_bs_send_handshake(gpointer data, gint fd, b_input_condition cond);
 static xt_status jabber_bs_send_handle_activate(struct im_connection *ic, struct xt_node *node, struct xt_node *orig);
 void jabber_bs_send_activate(struct bs_transfer *bt);
+void jabber_bs_send_start_relay(struct bs_transfer *bt);
 
 /*
  * Frees a bs_transfer struct and calls the SI free function
@@ -128,6 +133,7 @@ void jabber_bs_free_transfer(file_transfer_t *ft)
 		tf->watch_out = 0;
 	}
 
+	ft_relay_free(bt->relay);
 	g_free(bt->pseudoaddr);
 
 	while (bt->streamhosts) {
@@ -621,6 +627,8 @@ void jabber_bs_recv_answer_request(struct bs_transfer *bt)
 	tf->ft->data = tf;
 	tf->watch_in = b_input_add(tf->fd, B_EV_IO_READ, jabber_bs_recv_read, bt);
 	tf->ft->write_request = jabber_bs_recv_write_request;
+	tf->ft->read_fd = tf->fd;
+	tf->ft->read_done = jabber_bs_recv_done;
 
 	reply = xt_new_node("streamhost-used", NULL, NULL);
 	xt_add_attr(reply, "jid", bt->sh->jid);
@@ -669,17 +677,31 @@ gboolean jabber_bs_recv_read(gpointer data, gint fd, b_input_condition cond)
 		return jabber_bs_abort(bt, "Remote end closed connection");
 	}
 
-	tf->bytesread += ret;
-
-	if (tf->bytesread >= tf->ft->file_size) {
-		imcb_file_finished(tf->ic, tf->ft);
-	}
+	jabber_bs_recv_done(tf->ft, ret);
 
 	tf->ft->write(tf->ft, tf->ft->buffer, ret);
 
 	return FALSE;
 }
 
+/*
+ * Bookkeeping for received data, also called by the other side's relay when
+ * it spliced the data from our socket itself.
+ */
+gboolean jabber_bs_recv_done(file_transfer_t *ft, unsigned int len)
+{
+	struct jabber_transfer *tf = ft->data;
+
+	tf->bytesread += len;
+
+	if (tf->bytesread >= ft->file_size) {
+		imcb_file_finished(tf->ic, ft);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
 /*
  * imc callback that is invoked when it is ready to receive some data.
  */
@@ -698,51 +720,52 @@ gboolean jabber_bs_recv_write_request(file_transfer_t *ft)
 	return TRUE;
 }
 
-/*
- * Issues a write_request to imc.
- * */
-gboolean jabber_bs_send_can_write(gpointer data, gint fd, b_input_condition cond)
+static void jabber_bs_send_sent(file_transfer_t *ft, unsigned int len)
 {
-	struct bs_transfer *bt = data;
+	struct jabber_transfer *tf = ft->data;
+
+	tf->byteswritten += len;
 
-	bt->tf->watch_out = 0;
+	if (tf->byteswritten >= ft->file_size) {
+		imcb_file_finished(tf->ic, ft);
+	}
+}
 
-	bt->tf->ft->write_request(bt->tf->ft);
+static void jabber_bs_send_error(file_transfer_t *ft, const char *msg)
+{
+	struct jabber_transfer *tf = ft->data;
 
-	return FALSE;
+	jabber_bs_abort(tf->streamhandle, "%s", msg);
 }
 
 /*
- * This should only be called if we can write, so just do it.
- * Add a write watch so we can write more during the next cycle (if possible).
+ * The bytestream is up, the relay takes it from here and asks imc for data
+ * whenever it's running low.
  */
-gboolean jabber_bs_send_write(file_transfer_t *ft, char *buffer, unsigned int len)
+void jabber_bs_send_start_relay(struct bs_transfer *bt)
 {
-	struct jabber_transfer *tf = ft->data;
-	struct bs_transfer *bt = tf->streamhandle;
-	int ret;
+	struct jabber_transfer *tf = bt->tf;
 
-	if (tf->watch_out) {
-		return jabber_bs_abort(bt, "BUG: write() called while watching ");
+	if (bt->relay == NULL) {
+		bt->relay = ft_relay_new(tf->ft, tf->fd, jabber_bs_send_sent, jabber_bs_send_error);
 	}
 
-	/* TODO: catch broken pipe */
-	ASSERTSOCKOP(ret = send(tf->fd, buffer, len, 0), "Sending");
-
-	tf->byteswritten += ret;
+	ft_relay_start(bt->relay);
+}
 
-	/* TODO: this should really not be fatal */
-	if (ret < len) {
-		return jabber_bs_abort(bt, "send() sent %d instead of %d (send buffer too big!)", ret, len);
-	}
+/*
+ * Called by imc with more data, which goes out as fast as the socket takes it.
+ */
+gboolean jabber_bs_send_write(file_transfer_t *ft, char *buffer, unsigned int len)
+{
+	struct jabber_transfer *tf = ft->data;
+	struct bs_transfer *bt = tf->streamhandle;
 
-	if (tf->byteswritten >= ft->file_size) {
-		imcb_file_finished(tf->ic, ft);
-	} else {
-		bt->tf->watch_out = b_input_add(tf->fd, B_EV_IO_WRITE, jabber_bs_send_can_write, bt);
+	if (bt->relay == NULL) {
+		return jabber_bs_abort(bt, "BUG: write() called before the bytestream was established");
 	}
 
-	return TRUE;
+	return ft_relay_write(bt->relay, buffer, len);
 }
 
 /*
@@ -784,7 +807,7 @@ static xt_status jabber_bs_send_handle_reply(struct im_connection *ic, struct xt
 		/* we're streamhost and target */
 		if (bt->phase == BS_PHASE_REPLY) {
 			/* handshake went through, let's start transferring */
-			tf->ft->write_request(tf->ft);
+			jabber_bs_send_start_relay(bt);
 		}
 	} else {
 		/* using a proxy, abort listen */
@@ -854,7 +877,7 @@ static xt_status jabber_bs_send_handle_activate(struct im_connection *ic, struct
 	         tf->ft->file_name);
 
 	/* handshake went through, let's start transferring */
-	tf->ft->write_request(tf->ft);
+	jabber_bs_send_start_relay(tf->streamhandle);
 
 	return XT_HANDLED;
 }
@@ -1125,7 +1148,7 @@ gboolean jabber_bs_send_handshake(gpointer data, gint fd, b_input_condition cond
 
 		if (tf->accepted) {
 			/* streamhost-used message came already in(possible?), let's start sending */
-			tf->ft->write_request(tf->ft);
+			jabber_bs_send_start_relay(bt);
 		}
 
 		tf->watch_in = 0;
@@ -407,6 +407,136 @@ silent_error:
 	return ret;
 }
 
+/* XEP-0388 + XEP-0386: Authenticate and bind a resource (or resume the
+   old session) in a single round trip, without restarting the stream.
+   Only done with PLAIN over TLS, the other mechanisms are either weak or
+   server-specific and still go the old way. Returns XT_NEXT if the
+   server doesn't offer what we need. */
+xt_status sasl2_authenticate(struct im_connection *ic, struct xt_node *auth)
+{
+	struct jabber_data *jd = ic->proto_data;
+	struct xt_node *c, *inl, *bind, *sm, *reply;
+	gboolean plain = FALSE;
+	GString *gs;
+	char *s;
+	int st;
+
+	if (!(s = xt_find_attr(auth, "xmlns")) || strcmp(s, XMLNS_SASL2) != 0 ||
+	    !jd->ssl || (jd->flags & JFLAG_HIPCHAT) ||
+	    !set_getbool(&ic->acc->set, "sasl") || !sasl_supported(ic) ||
+	    set_getbool(&ic->acc->set, "oauth") || set_getbool(&ic->acc->set, "anonymous")) {
+		return XT_NEXT;
+	}
+
+	for (c = auth->children; (c = xt_find_node(c, "mechanism")); c = c->next) {
+		if (c->text && g_strcasecmp(c->text, "PLAIN") == 0) {
+			plain = TRUE;
+		}
+	}
+
+	inl = xt_find_node(auth->children, "inline");
+	bind = inl ? xt_find_node_by_attr(inl->children, "bind", "xmlns", XMLNS_BIND2) : NULL;
+	sm = inl ? xt_find_node_by_attr(inl->children, "sm", "xmlns", XMLNS_SM) : NULL;
+
+	/* Without Bind2 we'd have to fall back to a regular <bind/> anyway,
+	   so there's nothing to gain. */
+	if (!plain || ((jd->flags & JFLAG_SM_RESUMING) ? !sm : !bind)) {
+		return XT_NEXT;
+	}
+
+	reply = xt_new_node("authenticate", NULL, NULL);
+	xt_add_attr(reply, "xmlns", XMLNS_SASL2);
+	xt_add_attr(reply, "mechanism", "PLAIN");
+
+	gs = g_string_sized_new(128);
+	g_string_append_c(gs, '\0');
+	g_string_append(gs, jd->username);
+	g_string_append_c(gs, '\0');
+	g_string_append(gs, ic->acc->pass);
+	c = xt_new_node("initial-response", NULL, NULL);
+	c->text = base64_encode((unsigned char *) gs->str, gs->len);
+	c->text_len = strlen(c->text);
+	xt_add_child(reply, c);
+	g_string_free(gs, TRUE);
+
+	if (jd->flags & JFLAG_SM_RESUMING) {
+		xt_add_child(reply, jabber_sm_resume_node(ic));
+	} else {
+		struct xt_node *features = xt_find_node(bind->children, "inline"), *enable;
+
+		/* The server picks the actual resource, this is just a
+		   prefix for it. */
+		c = xt_new_node("bind", NULL, xt_new_node("tag", set_getstr(&ic->acc->set, "resource"), NULL));
+		xt_add_attr(c, "xmlns", XMLNS_BIND2);
+
+		if (features && set_getbool(&ic->acc->set, "carbons") &&
+		    xt_find_node_by_attr(features->children, "feature", "var", XMLNS_CARBONS)) {
+			enable = xt_new_node("enable", NULL, NULL);
+			xt_add_attr(enable, "xmlns", XMLNS_CARBONS);
+			xt_add_child(c, enable);
+			jd->flags |= JFLAG_CARBONS;
+		}
+
+		if (features && set_getbool(&ic->acc->set, "stream_management") &&
+		    xt_find_node_by_attr(features->children, "feature", "var", XMLNS_SM)) {
+			enable = xt_new_node("enable", NULL, NULL);
+			xt_add_attr(enable, "xmlns", XMLNS_SM);
+			xt_add_attr(enable, "resume", "true");
+			xt_add_child(c, enable);
+		}
+
+		xt_add_child(reply, c);
+	}
+
+	st = jabber_write_packet(ic, reply);
+	xt_free_node(reply);
+	if (!st) {
+		return XT_ABORT;
+	}
+
+	/* To prevent classic authentication from happening. */
+	jd->flags |= JFLAG_STREAM_STARTED;
+
+	return XT_HANDLED;
+}
+
+static xt_status sasl2_pkt_result(struct im_connection *ic, struct xt_node *node)
+{
+	struct jabber_data *jd = ic->proto_data;
+	struct xt_node *c;
+
+	if (strcmp(node->name, "failure") == 0) {
+		c = xt_find_node(node->children, "text");
+		imcb_error(ic, "Authentication failure%s%s", c && c->text ? ": " : "",
+		           c && c->text ? c->text : "");
+		imc_logout(ic, FALSE);
+		return XT_ABORT;
+	} else if (strcmp(node->name, "success") != 0) {
+		return XT_HANDLED;
+	}
+
+	/* No stream restart this time, we're good to go. */
+	imcb_log(ic, "Authentication finished");
+	jd->flags |= JFLAG_AUTHENTICATED;
+
+	if ((c = xt_find_node_by_attr(node->children, "resumed", "xmlns", XMLNS_SM)) ||
+	    (c = xt_find_node_by_attr(node->children, "failed", "xmlns", XMLNS_SM))) {
+		return jabber_sm_pkt(c, ic);
+	}
+
+	if (!(c = xt_find_node_by_attr(node->children, "bound", "xmlns", XMLNS_BIND2))) {
+		imcb_error(ic, "Server did not bind a resource");
+		imc_logout(ic, TRUE);
+		return XT_ABORT;
+	}
+
+	if ((c = xt_find_node_by_attr(c->children, "enabled", "xmlns", XMLNS_SM))) {
+		jabber_sm_enabled_inline(ic, c);
+	}
+
+	return jabber_login_pipeline(ic) ? XT_HANDLED : XT_ABORT;
+}
+
 xt_status sasl_pkt_result(struct xt_node *node, gpointer data)
 {
 	struct im_connection *ic = data;
@@ -414,7 +544,9 @@ xt_status sasl_pkt_result(struct xt_node *node, gpointer data)
 	char *s;
 
 	s = xt_find_attr(node, "xmlns");
-	if (!s || strcmp(s, XMLNS_SASL) != 0) {
+	if (s && strcmp(s, XMLNS_SASL2) == 0) {
+		return sasl2_pkt_result(ic, node);
+	} else if (!s || strcmp(s, XMLNS_SASL) != 0) {
 		imcb_log(ic, "Stream error while authenticating");
 		imc_logout(ic, FALSE);
 		return XT_ABORT;
@@ -476,9 +608,9 @@ void sasl_oauth2_init(struct im_connection *ic)
 
 static gboolean sasl_oauth2_remove_contact(gpointer data, gint fd, b_input_condition cond)
 {
-	struct im_connection *ic = data;
+	struct im_connection *ic = imc_by_handle(data);
 
-	if (g_slist_find(jabber_connections, ic)) {
+	if (ic) {
 		imcb_remove_buddy(ic, JABBER_OAUTH_HANDLE, NULL);
 	}
 	return FALSE;
@@ -494,12 +626,12 @@ int sasl_oauth2_get_refresh_token(struct im_connection *ic, const char *msg)
 
 	/* Don't do it here because the caller may get confused if the contact
 	   we're currently sending a message to is deleted. */
-	b_timeout_add(1, sasl_oauth2_remove_contact, ic);
+	b_timeout_add(1, sasl_oauth2_remove_contact, IMC_HANDLE(ic));
 
 	code = g_strdup(msg);
 	g_strstrip(code);
 	ret = oauth2_access_token(jd->oauth2_service, OAUTH2_AUTH_CODE,
-	                          code, sasl_oauth2_got_token, ic);
+	                          code, sasl_oauth2_got_token, IMC_HANDLE(ic));
 
 	g_free(code);
 	return ret;
@@ -510,16 +642,16 @@ int sasl_oauth2_refresh(struct im_connection *ic, const char *refresh_token)
 	struct jabber_data *jd = ic->proto_data;
 
 	return oauth2_access_token(jd->oauth2_service, OAUTH2_AUTH_REFRESH,
-	                           refresh_token, sasl_oauth2_got_token, ic);
+	                           refresh_token, sasl_oauth2_got_token, IMC_HANDLE(ic));
 }
 
 void sasl_oauth2_got_token(gpointer data, const char *access_token, const char *refresh_token, const char *error)
 {
-	struct im_connection *ic = data;
+	struct im_connection *ic = imc_by_handle(data);
 	struct jabber_data *jd;
 	GSList *auth = NULL;
 
-	if (g_slist_find(jabber_connections, ic) == NULL) {
+	if (ic == NULL) {
 		return;
 	}
 
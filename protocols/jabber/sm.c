@@ -0,0 +1,378 @@
+/***************************************************************************\
+*                                                                           *
+*  BitlBee - An IRC to IM gateway                                           *
+*  Jabber module - Stream management and resumption (XEP-0198)              *
+*                                                                           *
+*  Copyright 2006-2012 Wilmer van der Gaast <wilmer@gaast.net>              *
+*                                                                           *
+*  This program is free software; you can redistribute it and/or modify     *
+*  it under the terms of the GNU General Public License as published by     *
+*  the Free Software Foundation; either version 2 of the License, or        *
+*  (at your option) any later version.                                      *
+*                                                                           *
+*  This program is distributed in the hope that it will be useful,          *
+*  but WITHOUT ANY WARRANTY; without even the implied warranty of           *
+*  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the            *
+*  GNU General Public License for more details.                             *
+*                                                                           *
+*  You should have received a copy of the GNU General Public License along  *
+*  with this program; if not, write to the Free Software Foundation, Inc.,  *
+*  51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.              *
+*                                                                           *
+\***************************************************************************/
+
+#include "jabber.h"
+
+/* Outgoing stanzas are kept (as strings) until the server acknowledges
+   them. If the TCP connection drops, we reconnect, authenticate and ask
+   the server to resume the old session instead of binding a new one. If
+   that works, only the unacknowledged stanzas are sent again and all the
+   buddy/user state stays where it is. If not, we log out the usual way. */
+
+/* Ask for an ack after this many unacknowledged stanzas. */
+#define JABBER_SM_ACK_EVERY 5
+
+/* Give up on resuming if it takes longer than this (in ms). */
+#define JABBER_SM_RESUME_TIMEOUT 60000
+
+static gboolean jabber_sm_is_stanza(const char *name)
+{
+	return strcmp(name, "message") == 0 ||
+	       strcmp(name, "presence") == 0 ||
+	       strcmp(name, "iq") == 0;
+}
+
+static void jabber_sm_queue_clear(struct jabber_data *jd)
+{
+	char *s;
+
+	while ((s = g_queue_pop_head(&jd->sm_unacked))) {
+		g_free(s);
+	}
+}
+
+/* Called once bind/session are done. */
+int jabber_sm_enable(struct im_connection *ic)
+{
+	struct jabber_data *jd = ic->proto_data;
+	struct xt_node *node;
+	int st;
+
+	if (!(jd->flags & JFLAG_SM_SUPPORTED) || (jd->flags & JFLAG_SM_ENABLED) ||
+	    !set_getbool(&ic->acc->set, "stream_management")) {
+		return 1;
+	}
+
+	node = xt_new_node("enable", NULL, NULL);
+	xt_add_attr(node, "xmlns", XMLNS_SM);
+	xt_add_attr(node, "resume", "true");
+	st = jabber_write_packet(ic, node);
+	xt_free_node(node);
+
+	/* Our count starts right after <enable/>. The server's starts when
+	   it sends <enabled/>, jabber_sm_pkt() resets sm_in again then, as
+	   replies to the pipelined login requests may come in before it. */
+	jd->flags |= JFLAG_SM_ENABLED;
+	jd->sm_in = jd->sm_out = 0;
+	jabber_sm_queue_clear(jd);
+
+	return st;
+}
+
+/* Bind2 (XEP-0386) already enabled it while authenticating, enabled is
+   the <enabled/> that came with the <success/>. */
+void jabber_sm_enabled_inline(struct im_connection *ic, struct xt_node *enabled)
+{
+	struct jabber_data *jd = ic->proto_data;
+
+	jd->flags |= JFLAG_SM_SUPPORTED | JFLAG_SM_ENABLED;
+	jd->sm_in = jd->sm_out = 0;
+	jabber_sm_queue_clear(jd);
+
+	jabber_sm_pkt(enabled, ic);
+}
+
+static int jabber_sm_request_ack(struct im_connection *ic)
+{
+	char r[] = "<r xmlns='" XMLNS_SM "'/>";
+
+	return jabber_write(ic, r, strlen(r));
+}
+
+/* Called by jabber_write_packet() for everything we send. Returns FALSE if
+   the stanza shouldn't be written right now because we're still waiting
+   to resume the session, it'll be sent once that's done. */
+gboolean jabber_sm_outgoing(struct im_connection *ic, struct xt_node *node, const char *buf)
+{
+	struct jabber_data *jd = ic->proto_data;
+
+	if (!(jd->flags & JFLAG_SM_ENABLED) || !jabber_sm_is_stanza(node->name)) {
+		return TRUE;
+	}
+
+	jd->sm_out++;
+	g_queue_push_tail(&jd->sm_unacked, g_strdup(buf));
+
+	if (jd->flags & JFLAG_SM_RESUMING) {
+		return FALSE;
+	}
+
+	if (g_queue_get_length(&jd->sm_unacked) % JABBER_SM_ACK_EVERY == 0) {
+		/* Write the stanza itself first. */
+		jd->flags |= JFLAG_SM_WANT_ACK;
+	}
+
+	return TRUE;
+}
+
+void jabber_sm_written(struct im_connection *ic)
+{
+	struct jabber_data *jd = ic->proto_data;
+
+	if (jd->flags & JFLAG_SM_WANT_ACK) {
+		jd->flags &= ~JFLAG_SM_WANT_ACK;
+		jabber_sm_request_ack(ic);
+	}
+}
+
+/* Drop everything the server says it has received. h is a 32-bit counter
+   that is allowed to wrap. */
+static void jabber_sm_handle_ack(struct im_connection *ic, const char *hs)
+{
+	struct jabber_data *jd = ic->proto_data;
+	gint32 pending;
+
+	if (!hs) {
+		return;
+	}
+
+	pending = (gint32) (jd->sm_out - (guint32) g_ascii_strtoull(hs, NULL, 10));
+
+	/* Raw XML console input isn't counted on our side, so the server
+	   may have seen more than we think we sent. */
+	if (pending < 0) {
+		jd->sm_out -= pending;
+		pending = 0;
+	}
+
+	while (g_queue_get_length(&jd->sm_unacked) > pending) {
+		g_free(g_queue_pop_head(&jd->sm_unacked));
+	}
+}
+
+/* Keepalive: ask for an ack if anything's outstanding. */
+void jabber_sm_keepalive(struct im_connection *ic)
+{
+	struct jabber_data *jd = ic->proto_data;
+
+	if ((jd->flags & JFLAG_SM_ENABLED) && !(jd->flags & JFLAG_SM_RESUMING) &&
+	    !g_queue_is_empty(&jd->sm_unacked)) {
+		jabber_sm_request_ack(ic);
+	}
+}
+
+/* Called for every top-level element, counts the ones the server will
+   count too. */
+void jabber_sm_count_in(struct im_connection *ic, struct xt_node *node)
+{
+	struct jabber_data *jd = ic->proto_data;
+
+	if ((jd->flags & JFLAG_SM_ENABLED) && jabber_sm_is_stanza(node->name)) {
+		jd->sm_in++;
+	}
+}
+
+xt_status jabber_sm_pkt(struct xt_node *node, gpointer data)
+{
+	struct im_connection *ic = data;
+	struct jabber_data *jd = ic->proto_data;
+	char *s;
+
+	if (!(s = xt_find_attr(node, "xmlns")) || strcmp(s, XMLNS_SM) != 0) {
+		return XT_HANDLED;
+	}
+
+	if (strcmp(node->name, "r") == 0) {
+		char a[64];
+
+		g_snprintf(a, sizeof(a), "<a xmlns='%s' h='%u'/>", XMLNS_SM, jd->sm_in);
+		if (!jabber_write(ic, a, strlen(a))) {
+			return XT_ABORT;
+		}
+	} else if (strcmp(node->name, "a") == 0) {
+		jabber_sm_handle_ack(ic, xt_find_attr(node, "h"));
+	} else if (strcmp(node->name, "enabled") == 0) {
+		g_free(jd->sm_id);
+		jd->sm_id = NULL;
+		jd->sm_in = 0;
+
+		if ((s = xt_find_attr(node, "resume")) &&
+		    (strcmp(s, "true") == 0 || strcmp(s, "1") == 0)) {
+			jd->sm_id = g_strdup(xt_find_attr(node, "id"));
+		}
+	} else if (strcmp(node->name, "resumed") == 0) {
+		GList *l;
+
+		b_event_remove(jd->sm_resume_id);
+		jd->sm_resume_id = 0;
+		jd->flags &= ~JFLAG_SM_RESUMING;
+
+		jabber_sm_handle_ack(ic, xt_find_attr(node, "h"));
+		imcb_log(ic, "Session resumed");
+
+		/* The server still has the client state from before, but
+		   a change while we were away would've been dropped. */
+		if (jd->flags & JFLAG_CSI) {
+			char csi[64];
+
+			g_snprintf(csi, sizeof(csi), "<%s xmlns='%s'/>",
+			           (jd->flags & JFLAG_CSI_INACTIVE) ? "inactive" : "active", XMLNS_CSI);
+			if (!jabber_write(ic, csi, strlen(csi))) {
+				return XT_ABORT;
+			}
+		}
+
+		/* Whatever the server didn't get yet, plus what was sent
+		   while we were away. */
+		for (l = jd->sm_unacked.head; l; l = l->next) {
+			if (!jabber_write(ic, l->data, strlen(l->data))) {
+				return XT_ABORT;
+			}
+		}
+		if (!g_queue_is_empty(&jd->sm_unacked) && !jabber_sm_request_ack(ic)) {
+			return XT_ABORT;
+		}
+	} else if (strcmp(node->name, "failed") == 0) {
+		if (jd->flags & JFLAG_SM_RESUMING) {
+			imcb_error(ic, "Could not resume session");
+			imc_logout(ic, TRUE);
+			return XT_ABORT;
+		}
+
+		/* Enabling failed, just carry on without it. */
+		jd->flags &= ~JFLAG_SM_ENABLED;
+		jabber_sm_queue_clear(jd);
+	}
+
+	return XT_HANDLED;
+}
+
+/* Called from jabber_stream_ready() once we're authenticated again on a
+   new connection. Returns FALSE if resumption isn't possible. */
+gboolean jabber_sm_resume(struct im_connection *ic)
+{
+	struct jabber_data *jd = ic->proto_data;
+	struct xt_node *node;
+
+	/* Set again by jabber_pkt_features() if the new stream offers it. */
+	if (!(jd->flags & JFLAG_SM_SUPPORTED)) {
+		return FALSE;
+	}
+
+	node = jabber_sm_resume_node(ic);
+	jabber_write_packet(ic, node);
+	xt_free_node(node);
+
+	return TRUE;
+}
+
+/* The <resume/> request, sent on its own or inside a SASL2 <authenticate/>. */
+struct xt_node *jabber_sm_resume_node(struct im_connection *ic)
+{
+	struct jabber_data *jd = ic->proto_data;
+	struct xt_node *node;
+	char h[16];
+
+	g_snprintf(h, sizeof(h), "%u", jd->sm_in);
+	node = xt_new_node("resume", NULL, NULL);
+	xt_add_attr(node, "xmlns", XMLNS_SM);
+	xt_add_attr(node, "previd", jd->sm_id);
+	xt_add_attr(node, "h", h);
+
+	return node;
+}
+
+static gboolean jabber_sm_resume_timeout(gpointer data, gint fd, b_input_condition cond)
+{
+	struct im_connection *ic = data;
+	struct jabber_data *jd = ic->proto_data;
+
+	jd->sm_resume_id = 0;
+	imcb_error(ic, "Timeout while resuming session");
+	imc_logout(ic, TRUE);
+
+	return FALSE;
+}
+
+static gboolean jabber_sm_reconnect(gpointer data, gint fd, b_input_condition cond)
+{
+	struct im_connection *ic = data;
+	struct jabber_data *jd = ic->proto_data;
+
+	/* Set the timeout first, jabber_connect() may log out right away. */
+	jd->sm_resume_id = b_timeout_add(JABBER_SM_RESUME_TIMEOUT, jabber_sm_resume_timeout, ic);
+	jabber_connect(ic);
+
+	return FALSE;
+}
+
+/* Called when the connection died on us. Returns TRUE if we're trying to
+   resume the session, FALSE if the caller should just log out. */
+gboolean jabber_sm_connection_lost(struct im_connection *ic)
+{
+	struct jabber_data *jd = ic->proto_data;
+
+	if (!jd->sm_id || !(ic->flags & OPT_LOGGED_IN) ||
+	    (ic->flags & OPT_LOGGING_OUT) || (jd->flags & JFLAG_SM_RESUMING) ||
+	    !set_getbool(&ic->acc->set, "sasl")) {
+		return FALSE;
+	}
+
+	imcb_log(ic, "Connection lost, trying to resume session");
+
+	if (jd->ssl) {
+		ssl_disconnect(jd->ssl);
+	} else if (jd->fd >= 0) {
+		closesocket(jd->fd);
+	}
+	if (jd->r_inpa > 0) {
+		b_event_remove(jd->r_inpa);
+	}
+	if (jd->w_inpa > 0) {
+		b_event_remove(jd->w_inpa);
+	}
+	g_free(jd->txq);
+	jabber_compress_free(ic);
+
+	jd->ssl = NULL;
+	jd->fd = jd->r_inpa = jd->w_inpa = -1;
+	jd->txq = NULL;
+	jd->tx_len = 0;
+
+	/* Start from scratch except for what we know about the server and
+	   the session we want back. That includes the client state, which
+	   the server keeps with the session. */
+	jd->flags &= JFLAG_XMLCONSOLE | JFLAG_GMAILNOTIFY | JFLAG_GTALK |
+	             JFLAG_HIPCHAT | JFLAG_ROSTER_VER | JFLAG_SM_ENABLED |
+	             JFLAG_CARBONS | JFLAG_CSI | JFLAG_CSI_INACTIVE;
+	jd->flags |= JFLAG_SM_RESUMING;
+
+	/* Not from here, the caller may still be using the old connection. */
+	jd->sm_resume_id = b_timeout_add(0, jabber_sm_reconnect, ic);
+
+	return TRUE;
+}
+
+void jabber_sm_free(struct im_connection *ic)
+{
+	struct jabber_data *jd = ic->proto_data;
+
+	if (jd->sm_resume_id) {
+		b_event_remove(jd->sm_resume_id);
+		jd->sm_resume_id = 0;
+	}
+
+	jabber_sm_queue_clear(jd);
+	g_free(jd->sm_id);
+	jd->sm_id = NULL;
+}
@@ -295,6 +295,7 @@ struct im_connection *imcb_new(account_t *acc)
 	ic->bee = acc->bee;
 	ic->acc = acc;
 	acc->ic = ic;
+	ic->handle = b_handle_new(ic);
 
 	/* figure out if we have hashing functions compatible with handle_cmp */
 	if (acc->prpl->handle_cmp == g_ascii_strcasecmp) {
@@ -331,6 +332,7 @@ void imc_free(struct im_connection *ic)
 		g_hash_table_destroy(ic->bee_users);
 	}
 
+	b_handle_free(ic->handle);
 	connections = g_slist_remove(connections, ic);
 	g_free(ic);
 }
@@ -467,6 +469,7 @@ void imcb_connected(struct im_connection *ic)
 	/* Apparently we're connected successfully, so reset the
 	   exponential backoff timer. */
 	ic->acc->auto_reconnect_delay = 0;
+	account_login_done(ic->acc);
 
 	if (ic->bee->ui->imc_connected) {
 		ic->bee->ui->imc_connected(ic);
@@ -478,7 +481,7 @@ gboolean auto_reconnect(gpointer data, gint fd, b_input_condition cond)
 	account_t *a = data;
 
 	a->reconnect = 0;
-	account_on(a->bee, a);
+	account_login(a, LOGIN_PRIO_RECONNECT);
 
 	return(FALSE);          /* Only have to run the timeout once */
 }
@@ -487,13 +490,17 @@ void cancel_auto_reconnect(account_t *a)
 {
 	b_event_remove(a->reconnect);
 	a->reconnect = 0;
+
+	/* Waiting in the login queue is just as much a reconnect. */
+	if (a->login_waiting) {
+		account_login_done(a);
+	}
 }
 
 void imc_logout(struct im_connection *ic, int allow_reconnect)
 {
 	bee_t *bee = ic->bee;
 	account_t *a;
-	GSList *l;
 	int delay;
 
 	/* Nested calls might happen sometimes, this is probably the best
@@ -526,17 +533,13 @@ void imc_logout(struct im_connection *ic, int allow_reconnect)
 		         "an OAuth token: account %s set password \"\"", a->tag);
 	}
 
-	for (l = bee->users; l; ) {
-		bee_user_t *bu = l->data;
-		GSList *next = l->next;
-
-		if (bu->ic == ic) {
-			bee_user_free(bee, bu);
-		}
-
-		l = next;
+	while (ic->users) {
+		bee_user_free(bee, ic->users->data);
 	}
 
+	bee_queue_clear(ic->acc);
+	account_login_done(ic->acc);
+
 	b_event_remove(ic->keepalive);
 	ic->keepalive = 0;
 	ic->acc->prpl->logout(ic);
@@ -552,8 +555,12 @@ void imc_logout(struct im_connection *ic, int allow_reconnect)
 	} else if (allow_reconnect && set_getbool(&bee->set, "auto_reconnect") &&
 	           set_getbool(&a->set, "auto_reconnect") &&
 	           (delay = account_reconnect_delay(a)) > 0) {
-		imcb_log(ic, "Reconnecting in %d seconds..", delay);
-		a->reconnect = b_timeout_add(delay * 1000, auto_reconnect, a);
+		/* Spread it out a bit (+/- 25%), or everyone who lost their
+		   connection to the same server at the same time will be back
+		   at the same time too. */
+		delay = delay * 1000 * g_random_double_range(0.75, 1.25);
+		imcb_log(ic, "Reconnecting in %d seconds..", (delay + 500) / 1000);
+		a->reconnect = b_timeout_add(delay, auto_reconnect, a);
 	}
 
 	imc_free(ic);
@@ -754,10 +761,27 @@ int imc_chat_msg(struct groupchat *c, char *msg, int flags)
 
 static char *imc_away_state_find(GList *gcm, char *away, char **message);
 
+/* Inactive means either idle (according to the UI) or away. */
+void imc_inactive_send_update(struct im_connection *ic)
+{
+	char *away;
+
+	if (ic->acc->prpl->set_inactive == NULL) {
+		return;
+	}
+
+	away = set_getstr(&ic->acc->set, "away") ?
+	       : set_getstr(&ic->bee->set, "away");
+
+	ic->acc->prpl->set_inactive(ic, ic->bee->idle || (away && *away));
+}
+
 int imc_away_send_update(struct im_connection *ic)
 {
 	char *away, *msg = NULL;
 
+	imc_inactive_send_update(ic);
+
 	if (ic->acc->prpl->away_states == NULL ||
 	    ic->acc->prpl->set_away == NULL) {
 		return 0;
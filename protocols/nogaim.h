@@ -97,8 +97,17 @@ struct im_connection {
 	GSList *groupchats;
 	GSList *chatlist;
 	GHashTable *bee_users;
+	GList *users; /* struct bee_user, only the ones of this connection */
+
+	/* Pass IMC_HANDLE(ic) to async callbacks instead of ic itself, and
+	   get it back with imc_by_handle(), which returns NULL once the
+	   connection is gone. */
+	b_handle_t handle;
 };
 
+#define IMC_HANDLE(ic) B_HANDLE_TO_POINTER((ic)->handle)
+#define imc_by_handle(data) ((struct im_connection *) b_handle_get(B_HANDLE_FROM_POINTER(data)))
+
 struct groupchat {
 	struct im_connection *ic;
 
@@ -159,6 +168,10 @@ typedef enum {
 
 	/* The protocol is not suitable for OTR, see OPT_NOOTR */
 	PRPL_OPT_NOOTR = 1 << 12,
+
+	/* Messages with newlines arrive as one message, so the send queue
+	 * may join consecutive messages to the same contact. */
+	PRPL_OPT_MULTILINE_MSG = 1 << 13,
 } prpl_options_t;
 
 struct prpl {
@@ -292,8 +305,11 @@ struct prpl {
 	 */
 	void (* chat_list) (struct im_connection *, const char *server);
 
+	/* Called when the user goes idle/away or comes back, so the protocol
+	 * can tell the server whether anyone's actually watching. */
+	void (* set_inactive) (struct im_connection *, gboolean inactive);
+
 	/* Some placeholders so eventually older plugins may cooperate with newer BitlBees. */
-	void *resv1;
 	void *resv2;
 	void *resv3;
 	void *resv4;
@@ -380,6 +396,7 @@ G_GNUC_DEPRECATED G_MODULE_EXPORT void imcb_clean_handle(struct im_connection *i
 
 /* Actions, or whatever. */
 int imc_away_send_update(struct im_connection *ic);
+void imc_inactive_send_update(struct im_connection *ic);
 int imc_chat_msg(struct groupchat *c, char *msg, int flags);
 
 void imc_add_allow(struct im_connection *ic, char *handle);
@@ -175,10 +175,9 @@ gboolean try_write_to_ui(gpointer data, gint fd, b_input_condition cond)
 	fstat(px->fd, &fs);
 
 	if (fs.st_size > tx_bytes) {
-		char buf[1024];
-		size_t n = MIN(fs.st_size - tx_bytes, sizeof(buf));
+		size_t n = MIN(fs.st_size - tx_bytes, sizeof(ft->buffer));
 
-		if (read(px->fd, buf, n) == n && ft->write(ft, buf, n)) {
+		if (read(px->fd, ft->buffer, n) == n && ft->write(ft, ft->buffer, n)) {
 			px->ui_wants_data = FALSE;
 		} else {
 			purple_xfer_cancel_local(px->xfer);
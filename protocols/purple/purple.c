@@ -34,8 +34,6 @@
 #define PURPLE_MESSAGE_REMOTE_SEND 0x10000
 #endif
 
-GSList *purple_connections;
-
 /* This makes me VERY sad... :-( But some libpurple callbacks come in without
    any context so this is the only way to get that. Don't want to support
    libpurple in daemon mode anyway. */
@@ -66,19 +64,11 @@ struct purple_roomlist_data {
 };
 
 
+/* Every PurpleAccount we create has a handle for its connection in
+   ui_data, cleared before the account goes away. */
 struct im_connection *purple_ic_by_pa(PurpleAccount *pa)
 {
-	GSList *i;
-	struct purple_data *pd;
-
-	for (i = purple_connections; i; i = i->next) {
-		pd = ((struct im_connection *) i->data)->proto_data;
-		if (pd->account == pa) {
-			return i->data;
-		}
-	}
-
-	return NULL;
+	return pa ? imc_by_handle(pa->ui_data) : NULL;
 }
 
 static struct im_connection *purple_ic_by_gc(PurpleConnection *gc)
@@ -391,13 +381,9 @@ static void purple_login(account_t *acc)
 	}
 	local_bee = acc->bee;
 
-	/* For now this is needed in the _connected() handlers if using
-	   GLib event handling, to make sure we're not handling events
-	   on dead connections. */
-	purple_connections = g_slist_prepend(purple_connections, ic);
-
 	ic->proto_data = pd = g_new0(struct purple_data, 1);
 	pd->account = purple_account_new(acc->user, acc->prpl->data);
+	pd->account->ui_data = IMC_HANDLE(ic);
 	pd->input_requests = g_hash_table_new_full(g_direct_hash, g_direct_equal,
 	                                           NULL, g_free);
 	pd->next_request_id = 0;
@@ -432,7 +418,7 @@ static void purple_logout(struct im_connection *ic)
 	}
 
 	purple_account_set_enabled(pd->account, "BitlBee", FALSE);
-	purple_connections = g_slist_remove(purple_connections, ic);
+	pd->account->ui_data = NULL;
 	purple_accounts_remove(pd->account);
 	imcb_chat_list_free(ic);
 	g_free(pd->chat_list_server);
@@ -29,8 +29,6 @@
 #include "twitter_lib.h"
 #include "url.h"
 
-GSList *twitter_connections = NULL;
-
 static int twitter_filter_cmp(struct twitter_filter *tf1,
                               struct twitter_filter *tf2)
 {
@@ -252,16 +250,54 @@ static GSList *twitter_filter_parse(struct groupchat *c, const char *text)
  */
 gboolean twitter_main_loop(gpointer data, gint fd, b_input_condition cond)
 {
-	struct im_connection *ic = data;
+	struct im_connection *ic = imc_by_handle(data);
+	struct twitter_data *td;
 
 	// Check if we are still logged in...
-	if (!g_slist_find(twitter_connections, ic)) {
+	if (!ic) {
 		return FALSE;
 	}
 
 	// Do stuff..
-	return twitter_get_timeline(ic, -1) &&
-	       ((ic->flags & OPT_LOGGED_IN) == OPT_LOGGED_IN);
+	if (!twitter_get_timeline(ic, -1)) {
+		return FALSE;
+	}
+
+	if ((ic->flags & OPT_LOGGED_IN) != OPT_LOGGED_IN) {
+		td = ic->proto_data;
+		td->main_loop_id = 0;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/**
+ * Called after every timeline fetch in polling mode: poll less often while
+ * nothing's happening, back to fetch_interval as soon as something is.
+ */
+void twitter_poll_adjust(struct im_connection *ic, gboolean active)
+{
+	struct twitter_data *td = ic->proto_data;
+	int base = set_getint(&ic->acc->set, "fetch_interval");
+	int next;
+
+	if (td->main_loop_id == 0) {
+		return;
+	}
+
+	if (active) {
+		next = base;
+	} else {
+		next = MIN(td->poll_interval + td->poll_interval / 2,
+		           base * TWITTER_POLL_BACKOFF_MAX);
+	}
+
+	if (next != td->poll_interval) {
+		b_event_remove(td->main_loop_id);
+		td->poll_interval = next;
+		td->main_loop_id = b_timeout_add(next * 1000, twitter_main_loop, IMC_HANDLE(ic));
+	}
 }
 
 static void twitter_main_loop_start(struct im_connection *ic)
@@ -283,7 +319,7 @@ static void twitter_main_loop_start(struct im_connection *ic)
 
 	// Run this once. After this queue the main loop function (or open the
 	// stream if available).
-	twitter_main_loop(ic, -1, 0);
+	twitter_main_loop(IMC_HANDLE(ic), -1, 0);
 
 	if (set_getbool(&ic->acc->set, "stream")) {
 		/* That fetch was just to get backlog, the stream will give
@@ -296,9 +332,10 @@ static void twitter_main_loop_start(struct im_connection *ic)
 	} else {
 		/* Not using the streaming API, so keep polling the old-
 		   fashioned way. :-( */
+		td->poll_interval = set_getint(&ic->acc->set, "fetch_interval");
 		td->main_loop_id =
-		        b_timeout_add(set_getint(&ic->acc->set, "fetch_interval") * 1000,
-		                      twitter_main_loop, ic);
+		        b_timeout_add(td->poll_interval * 1000,
+		                      twitter_main_loop, IMC_HANDLE(ic));
 	}
 }
 
@@ -307,7 +344,7 @@ struct groupchat *twitter_groupchat_init(struct im_connection *ic)
 	char *name_hint;
 	struct groupchat *gc;
 	struct twitter_data *td = ic->proto_data;
-	GSList *l;
+	GList *l;
 
 	if (td->timeline_gc) {
 		return td->timeline_gc;
@@ -319,11 +356,9 @@ struct groupchat *twitter_groupchat_init(struct im_connection *ic)
 	imcb_chat_name_hint(gc, name_hint);
 	g_free(name_hint);
 
-	for (l = ic->bee->users; l; l = l->next) {
+	for (l = ic->users; l; l = l->next) {
 		bee_user_t *bu = l->data;
-		if (bu->ic == ic) {
-			imcb_chat_add_buddy(gc, bu->handle);
-		}
+		imcb_chat_add_buddy(gc, bu->handle);
 	}
 	imcb_chat_add_buddy(gc, ic->acc->user);
 
@@ -380,7 +415,7 @@ static void twitter_oauth_start(struct im_connection *ic)
 		imcb_log(ic, "Warning: OAuth only works with Twitter.");
 	}
 
-	td->oauth_info = oauth_request_token(get_oauth_service(ic), twitter_oauth_callback, ic);
+	td->oauth_info = oauth_request_token(get_oauth_service(ic), twitter_oauth_callback, IMC_HANDLE(ic));
 
 	/* We need help from the user to complete OAuth login, so don't time
 	   out on this login. */
@@ -389,10 +424,10 @@ static void twitter_oauth_start(struct im_connection *ic)
 
 static gboolean twitter_oauth_callback(struct oauth_info *info)
 {
-	struct im_connection *ic = info->data;
+	struct im_connection *ic = imc_by_handle(info->data);
 	struct twitter_data *td;
 
-	if (!g_slist_find(twitter_connections, ic)) {
+	if (!ic) {
 		return FALSE;
 	}
 
@@ -560,6 +595,9 @@ static void twitter_init(account_t * acc)
 	s = set_add(&acc->set, "_last_tweet", "0", NULL, acc);
 	s->flags |= SET_HIDDEN | SET_NOSAVE;
 
+	s = set_add(&acc->set, "_users", NULL, NULL, acc);
+	s->flags |= SET_HIDDEN | SET_NULL_OK;
+
 	s = set_add(&acc->set, "in_korea", "false", set_eval_bool, acc);
 	s->flags |= SET_HIDDEN;
 
@@ -596,7 +634,6 @@ static void twitter_login(account_t * acc)
 
 	imcb_log(ic, "Connecting");
 
-	twitter_connections = g_slist_append(twitter_connections, ic);
 	td = g_new0(struct twitter_data, 1);
 	ic->proto_data = td;
 	td->user = g_strdup(acc->user);
@@ -680,6 +717,15 @@ static void twitter_logout(struct im_connection *ic)
 		g_slist_foreach(td->noretweets_ids, (GFunc) g_free, NULL);
 		g_slist_free(td->noretweets_ids);
 
+		g_slist_foreach(td->follow_ids, (GFunc) g_free, NULL);
+		g_slist_free(td->follow_ids);
+		if (td->users) {
+			g_hash_table_destroy(td->users);
+		}
+		if (td->lookup_ids) {
+			g_ptr_array_free(td->lookup_ids, TRUE);
+		}
+
 		http_close(td->stream);
 		twitter_filter_remove_all(ic);
 		oauth_info_free(td->oauth_info);
@@ -687,11 +733,11 @@ static void twitter_logout(struct im_connection *ic)
 		g_free(td->prefix);
 		g_free(td->url_host);
 		g_free(td->url_path);
+		g_free(td->home_timeline_etag);
+		g_free(td->mentions_etag);
 		g_free(td->log);
 		g_free(td);
 	}
-
-	twitter_connections = g_slist_remove(twitter_connections, ic);
 }
 
 static void twitter_handle_command(struct im_connection *ic, char *message);
@@ -901,7 +947,7 @@ static guint64 twitter_message_id_from_command_arg(struct im_connection *ic, cha
 			twitter_log_local_user.handle = td->user;
 		} else {
 			/* Beware of dangling pointers! */
-			if (!g_slist_find(ic->bee->users, bu)) {
+			if (!g_list_find(ic->users, bu)) {
 				bu = NULL;
 			}
 		}
@@ -910,9 +956,68 @@ static guint64 twitter_message_id_from_command_arg(struct im_connection *ic, cha
 	return id;
 }
 
+typedef enum {
+	TWITTER_CMD_UNDO,
+	TWITTER_CMD_FAVOURITE,
+	TWITTER_CMD_FOLLOW,
+	TWITTER_CMD_UNFOLLOW,
+	TWITTER_CMD_MUTE,
+	TWITTER_CMD_UNMUTE,
+	TWITTER_CMD_REPORT,
+	TWITTER_CMD_RT,
+	TWITTER_CMD_REPLY,
+	TWITTER_CMD_GREPLY,
+	TWITTER_CMD_RAWREPLY,
+	TWITTER_CMD_URL,
+	TWITTER_CMD_POST,
+	TWITTER_CMD_STATS,
+} twitter_cmd_t;
+
+static void twitter_poll_stats(struct im_connection *ic)
+{
+	struct twitter_data *td = ic->proto_data;
+	struct twitter_poll_stats *st = &td->poll_stats;
+
+	twitter_log(ic, "Timeline requests: %d, not modified: %d, "
+	            "nothing new: %d, new statuses: %d",
+	            st->requests, st->not_modified, st->skipped, st->parsed);
+	twitter_log(ic, "CPU time: %.3fs parsing",
+	            (double) st->parse_time / CLOCKS_PER_SEC);
+	if (td->main_loop_id) {
+		twitter_log(ic, "Polling every %d seconds", td->poll_interval);
+	}
+}
+
+static const struct twitter_command {
+	char *command;
+	twitter_cmd_t id;
+} twitter_commands[] = {
+	{ "undo",      TWITTER_CMD_UNDO },
+	{ "favourite", TWITTER_CMD_FAVOURITE },
+	{ "favorite",  TWITTER_CMD_FAVOURITE },
+	{ "fav",       TWITTER_CMD_FAVOURITE },
+	{ "like",      TWITTER_CMD_FAVOURITE },
+	{ "follow",    TWITTER_CMD_FOLLOW },
+	{ "unfollow",  TWITTER_CMD_UNFOLLOW },
+	{ "mute",      TWITTER_CMD_MUTE },
+	{ "unmute",    TWITTER_CMD_UNMUTE },
+	{ "report",    TWITTER_CMD_REPORT },
+	{ "spam",      TWITTER_CMD_REPORT },
+	{ "rt",        TWITTER_CMD_RT },
+	{ "reply",     TWITTER_CMD_REPLY },
+	{ "greply",    TWITTER_CMD_GREPLY },
+	{ "rawreply",  TWITTER_CMD_RAWREPLY },
+	{ "url",       TWITTER_CMD_URL },
+	{ "post",      TWITTER_CMD_POST },
+	{ "stats",     TWITTER_CMD_STATS },
+	{ NULL }
+};
+
 static void twitter_handle_command(struct im_connection *ic, char *message)
 {
+	static cmdtab_t twitter_cmdtab = CMDTAB_INIT;
 	struct twitter_data *td = ic->proto_data;
+	const struct twitter_command *tc;
 	char *cmds, **cmd, *new = NULL;
 	guint64 in_reply_to = 0, id;
 	gboolean allow_post =
@@ -920,6 +1025,10 @@ static void twitter_handle_command(struct im_connection *ic, char *message)
 	gboolean auto_populate_reply_metadata = FALSE;
 	bee_user_t *bu = NULL;
 
+	if (twitter_cmdtab.len == 0) {
+		cmdtab_add_array(&twitter_cmdtab, twitter_commands, sizeof(twitter_commands[0]));
+	}
+
 	cmds = g_strdup(message);
 	cmd = split_command_parts(cmds, 2);
 
@@ -927,107 +1036,149 @@ static void twitter_handle_command(struct im_connection *ic, char *message)
 		goto eof;
 	} else if (!set_getbool(&ic->acc->set, "commands") && allow_post) {
 		/* Not supporting commands if "commands" is set to true/strict. */
-	} else if (g_strcasecmp(cmd[0], "undo") == 0) {
-		if (cmd[1] == NULL) {
-			twitter_status_destroy(ic, td->last_status_id);
-		} else if ((id = twitter_message_id_from_command_arg(ic, cmd[1], NULL))) {
-			twitter_status_destroy(ic, id);
-		} else {
-			twitter_log(ic, "Could not undo last action");
-		}
+	} else if ((tc = cmdtab_find(&twitter_cmdtab, cmd[0]))) {
+		/* Commands missing arguments break out of the switch and are
+		   treated like any other text. */
+		switch (tc->id) {
+		case TWITTER_CMD_UNDO:
+			if (cmd[1] == NULL) {
+				twitter_status_destroy(ic, td->last_status_id);
+			} else if ((id = twitter_message_id_from_command_arg(ic, cmd[1], NULL))) {
+				twitter_status_destroy(ic, id);
+			} else {
+				twitter_log(ic, "Could not undo last action");
+			}
 
-		goto eof;
-	} else if ((g_strcasecmp(cmd[0], "favourite") == 0 ||
-	            g_strcasecmp(cmd[0], "favorite") == 0 ||
-	            g_strcasecmp(cmd[0], "fav") == 0 ||
-	            g_strcasecmp(cmd[0], "like") == 0) && cmd[1]) {
-		if ((id = twitter_message_id_from_command_arg(ic, cmd[1], NULL))) {
-			twitter_favourite_tweet(ic, id);
-		} else {
-			twitter_log(ic, "Please provide a message ID or username.");
-		}
-		goto eof;
-	} else if (g_strcasecmp(cmd[0], "follow") == 0 && cmd[1]) {
-		twitter_add_buddy(ic, cmd[1], NULL);
-		goto eof;
-	} else if (g_strcasecmp(cmd[0], "unfollow") == 0 && cmd[1]) {
-		twitter_remove_buddy(ic, cmd[1], NULL);
-		goto eof;
-	} else if (g_strcasecmp(cmd[0], "mute") == 0 && cmd[1]) {
-		twitter_mute_create_destroy(ic, cmd[1], 1);
-		goto eof;
-	} else if (g_strcasecmp(cmd[0], "unmute") == 0 && cmd[1]) {
-		twitter_mute_create_destroy(ic, cmd[1], 0);
-		goto eof;
-	} else if ((g_strcasecmp(cmd[0], "report") == 0 ||
-	            g_strcasecmp(cmd[0], "spam") == 0) && cmd[1]) {
-		char *screen_name;
-
-		/* Report nominally works on users but look up the user who
-		   posted the given ID if the user wants to do it that way */
-		twitter_message_id_from_command_arg(ic, cmd[1], &bu);
-		if (bu) {
-			screen_name = bu->handle;
-		} else {
-			screen_name = cmd[1];
-		}
+			goto eof;
+		case TWITTER_CMD_FAVOURITE:
+			if (!cmd[1]) {
+				break;
+			}
+			if ((id = twitter_message_id_from_command_arg(ic, cmd[1], NULL))) {
+				twitter_favourite_tweet(ic, id);
+			} else {
+				twitter_log(ic, "Please provide a message ID or username.");
+			}
+			goto eof;
+		case TWITTER_CMD_FOLLOW:
+			if (!cmd[1]) {
+				break;
+			}
+			twitter_add_buddy(ic, cmd[1], NULL);
+			goto eof;
+		case TWITTER_CMD_UNFOLLOW:
+			if (!cmd[1]) {
+				break;
+			}
+			twitter_remove_buddy(ic, cmd[1], NULL);
+			goto eof;
+		case TWITTER_CMD_MUTE:
+			if (!cmd[1]) {
+				break;
+			}
+			twitter_mute_create_destroy(ic, cmd[1], 1);
+			goto eof;
+		case TWITTER_CMD_UNMUTE:
+			if (!cmd[1]) {
+				break;
+			}
+			twitter_mute_create_destroy(ic, cmd[1], 0);
+			goto eof;
+		case TWITTER_CMD_REPORT: {
+			char *screen_name;
 
-		twitter_report_spam(ic, screen_name);
-		goto eof;
-	} else if (g_strcasecmp(cmd[0], "rt") == 0 && cmd[1]) {
-		id = twitter_message_id_from_command_arg(ic, cmd[1], NULL);
+			if (!cmd[1]) {
+				break;
+			}
 
-		td->last_status_id = 0;
-		if (id) {
-			twitter_status_retweet(ic, id);
-		} else {
-			twitter_log(ic, "User `%s' does not exist or didn't "
-			            "post any statuses recently", cmd[1]);
-		}
+			/* Report nominally works on users but look up the user who
+			   posted the given ID if the user wants to do it that way */
+			twitter_message_id_from_command_arg(ic, cmd[1], &bu);
+			if (bu) {
+				screen_name = bu->handle;
+			} else {
+				screen_name = cmd[1];
+			}
 
-		goto eof;
-	} else if (g_strcasecmp(cmd[0], "reply") == 0 && cmd[1] && cmd[2]) {
-		id = twitter_message_id_from_command_arg(ic, cmd[1], &bu);
-		if (!id || !bu) {
-			twitter_log(ic, "User `%s' does not exist or didn't "
-			            "post any statuses recently", cmd[1]);
+			twitter_report_spam(ic, screen_name);
 			goto eof;
 		}
-		message = new = g_strdup_printf("@%s %s", bu->handle, cmd[2]);
-		in_reply_to = id;
-		allow_post = TRUE;
-	} else if (g_strcasecmp(cmd[0], "greply") == 0 && cmd[1] && cmd[2]) {
-		id = twitter_message_id_from_command_arg(ic, cmd[1], &bu);
-		if (!id || !bu) {
-			twitter_log(ic, "User `%s' does not exist or didn't "
-			            "post any statuses recently", cmd[1]);
+		case TWITTER_CMD_RT:
+			if (!cmd[1]) {
+				break;
+			}
+			id = twitter_message_id_from_command_arg(ic, cmd[1], NULL);
+
+			td->last_status_id = 0;
+			if (id) {
+				twitter_status_retweet(ic, id);
+			} else {
+				twitter_log(ic, "User `%s' does not exist or didn't "
+				            "post any statuses recently", cmd[1]);
+			}
+
 			goto eof;
-		}
-		message = new = g_strdup_printf("%s", cmd[2]);
-		in_reply_to = id;
-		auto_populate_reply_metadata = TRUE;
-		allow_post = TRUE;
-	} else if (g_strcasecmp(cmd[0], "rawreply") == 0 && cmd[1] && cmd[2]) {
-		id = twitter_message_id_from_command_arg(ic, cmd[1], NULL);
-		if (!id) {
-			twitter_log(ic, "Tweet `%s' does not exist", cmd[1]);
+		case TWITTER_CMD_REPLY:
+			if (!cmd[1] || !cmd[2]) {
+				break;
+			}
+			id = twitter_message_id_from_command_arg(ic, cmd[1], &bu);
+			if (!id || !bu) {
+				twitter_log(ic, "User `%s' does not exist or didn't "
+				            "post any statuses recently", cmd[1]);
+				goto eof;
+			}
+			message = new = g_strdup_printf("@%s %s", bu->handle, cmd[2]);
+			in_reply_to = id;
+			allow_post = TRUE;
+			break;
+		case TWITTER_CMD_GREPLY:
+			if (!cmd[1] || !cmd[2]) {
+				break;
+			}
+			id = twitter_message_id_from_command_arg(ic, cmd[1], &bu);
+			if (!id || !bu) {
+				twitter_log(ic, "User `%s' does not exist or didn't "
+				            "post any statuses recently", cmd[1]);
+				goto eof;
+			}
+			message = new = g_strdup_printf("%s", cmd[2]);
+			in_reply_to = id;
+			auto_populate_reply_metadata = TRUE;
+			allow_post = TRUE;
+			break;
+		case TWITTER_CMD_RAWREPLY:
+			if (!cmd[1] || !cmd[2]) {
+				break;
+			}
+			id = twitter_message_id_from_command_arg(ic, cmd[1], NULL);
+			if (!id) {
+				twitter_log(ic, "Tweet `%s' does not exist", cmd[1]);
+				goto eof;
+			}
+			message = cmd[2];
+			in_reply_to = id;
+			allow_post = TRUE;
+			break;
+		case TWITTER_CMD_URL:
+			id = twitter_message_id_from_command_arg(ic, cmd[1], &bu);
+			if (!id) {
+				twitter_log(ic, "Tweet `%s' does not exist", cmd[1]);
+			} else {
+				twitter_status_show_url(ic, id);
+			}
+			goto eof;
+		case TWITTER_CMD_POST:
+			message += 5;
+			allow_post = TRUE;
+			break;
+		case TWITTER_CMD_STATS:
+			if (cmd[1]) {
+				break;
+			}
+			twitter_poll_stats(ic);
 			goto eof;
 		}
-		message = cmd[2];
-		in_reply_to = id;
-		allow_post = TRUE;
-	} else if (g_strcasecmp(cmd[0], "url") == 0) {
-		id = twitter_message_id_from_command_arg(ic, cmd[1], &bu);
-		if (!id) {
-			twitter_log(ic, "Tweet `%s' does not exist", cmd[1]);
-		} else {
-			twitter_status_show_url(ic, id);
-		}
-		goto eof;
-
-	} else if (g_strcasecmp(cmd[0], "post") == 0) {
-		message += 5;
-		allow_post = TRUE;
 	}
 
 	if (allow_post) {
@@ -50,6 +50,15 @@ typedef enum {
 
 struct twitter_log_data;
 
+/* Timeline/mentions polling, see the "stats" command. */
+struct twitter_poll_stats {
+	int requests;
+	int not_modified;       /* 304 replies, nothing to parse */
+	int skipped;            /* Nothing we hadn't seen yet */
+	int parsed;
+	clock_t parse_time;
+};
+
 struct twitter_data {
 	char* user;
 	struct oauth_info *oauth_info;
@@ -60,12 +69,21 @@ struct twitter_data {
 	guint64 timeline_id;
 
 	GSList *follow_ids;
+	/* Contact list lookup during login, see twitter_get_users_lookup() */
+	GHashTable *users;
+	GPtrArray *lookup_ids;
+	guint lookup_pos;
+	int lookups_running;
 	GSList *mutes_ids;
 	GSList *noretweets_ids;
 	GSList *filters;
 
 	guint64 last_status_id; /* For undo */
 	gint main_loop_id;
+	int poll_interval; /* Seconds, between fetch_interval and TWITTER_POLL_BACKOFF_MAX times that */
+	char *home_timeline_etag;
+	char *mentions_etag;
+	struct twitter_poll_stats poll_stats;
 	gint filter_update_id;
 	struct http_request *stream;
 	struct http_request *filter_stream;
@@ -87,6 +105,10 @@ struct twitter_data {
 };
 
 #define TWITTER_FILTER_UPDATE_WAIT 3000
+
+/* Without new statuses, the poll interval grows by half each time, up to
+   this many times fetch_interval. */
+#define TWITTER_POLL_BACKOFF_MAX 5
 struct twitter_filter {
 	twitter_filter_type_t type;
 	char *text;
@@ -107,13 +129,6 @@ struct twitter_log_data {
 	struct bee_user *bu;
 };
 
-/**
- * This has the same function as the msn_connections GSList. We use this to
- * make sure the connection is still alive in callbacks before we do anything
- * else.
- */
-extern GSList *twitter_connections;
-
 /**
  * Evil hack: Fake bee_user which will always point at the local user.
  * Sometimes used as a return value by twitter_message_id_from_command_arg.
@@ -129,5 +144,6 @@ char *twitter_parse_error(struct http_request *req);
 
 void twitter_log(struct im_connection *ic, char *format, ...);
 struct groupchat *twitter_groupchat_init(struct im_connection *ic);
+void twitter_poll_adjust(struct im_connection *ic, gboolean active);
 
 #endif //_TWITTER_H
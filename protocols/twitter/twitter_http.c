@@ -42,12 +42,9 @@
 
 static char *twitter_url_append(char *url, char *key, char *value);
 
-/**
- * Do a request.
- * This is actually pretty generic function... Perhaps it should move to the lib/http_client.c
- */
-struct http_request *twitter_http(struct im_connection *ic, char *url_string, http_input_function func,
-                                  gpointer data, int is_post, char **arguments, int arguments_len)
+static struct http_request *twitter_http_req(struct im_connection *ic, char *url_string, http_input_function func,
+                                             gpointer data, int is_post, char **arguments, int arguments_len,
+                                             const char *etag)
 {
 	struct twitter_data *td = ic->proto_data;
 	char *tmp;
@@ -111,6 +108,10 @@ struct http_request *twitter_http(struct im_connection *ic, char *url_string, ht
 		g_free(userpass_base64);
 	}
 
+	if (etag) {
+		g_string_append_printf(request, "If-None-Match: %s\r\n", etag);
+	}
+
 	// Do POST stuff..
 	if (is_post) {
 		// Append the Content-Type and url-encoded arguments.
@@ -137,6 +138,27 @@ error:
 	return ret;
 }
 
+/**
+ * Do a request.
+ * This is actually pretty generic function... Perhaps it should move to the lib/http_client.c
+ */
+struct http_request *twitter_http(struct im_connection *ic, char *url_string, http_input_function func,
+                                  gpointer data, int is_post, char **arguments, int arguments_len)
+{
+	return twitter_http_req(ic, url_string, func, data, is_post, arguments, arguments_len, NULL);
+}
+
+/**
+ * Conditional GET: if etag (from an earlier reply) is set and nothing
+ * changed since, the reply is a bodyless 304.
+ */
+struct http_request *twitter_http_etag(struct im_connection *ic, char *url_string, http_input_function func,
+                                       gpointer data, char **arguments, int arguments_len,
+                                       const char *etag)
+{
+	return twitter_http_req(ic, url_string, func, data, 0, arguments, arguments_len, etag);
+}
+
 struct http_request *twitter_http_f(struct im_connection *ic, char *url_string, http_input_function func,
                                     gpointer data, int is_post, char **arguments, int arguments_len,
                                     twitter_http_flags_t flags)
@@ -40,6 +40,9 @@ struct http_request *twitter_http(struct im_connection *ic, char *url_string, ht
 struct http_request *twitter_http_f(struct im_connection *ic, char *url_string, http_input_function func,
                                     gpointer data, int is_post, char** arguments, int arguments_len,
                                     twitter_http_flags_t flags);
+struct http_request *twitter_http_etag(struct im_connection *ic, char *url_string, http_input_function func,
+                                       gpointer data, char** arguments, int arguments_len,
+                                       const char *etag);
 
 #endif //_TWITTER_HTTP_H
 
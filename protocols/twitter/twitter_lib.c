@@ -36,6 +36,7 @@
 #include "base64.h"
 #include "twitter_lib.h"
 #include "json_util.h"
+#include "json_stream.h"
 #include <ctype.h>
 #include <errno.h>
 
@@ -252,7 +253,7 @@ void twitter_get_friends_ids(struct im_connection *ic, gint64 next_cursor)
 
 	args[0] = "cursor";
 	args[1] = g_strdup_printf("%" G_GINT64_FORMAT, next_cursor);
-	twitter_http(ic, TWITTER_FRIENDS_IDS_URL, twitter_http_get_friends_ids, ic, 0, args, 2);
+	twitter_http(ic, TWITTER_FRIENDS_IDS_URL, twitter_http_get_friends_ids, IMC_HANDLE(ic), 0, args, 2);
 
 	g_free(args[1]);
 }
@@ -266,7 +267,7 @@ void twitter_get_mutes_ids(struct im_connection *ic, gint64 next_cursor)
 
 	args[0] = "cursor";
 	args[1] = g_strdup_printf("%" G_GINT64_FORMAT, next_cursor);
-	twitter_http(ic, TWITTER_MUTES_IDS_URL, twitter_http_get_mutes_ids, ic, 0, args, 2);
+	twitter_http(ic, TWITTER_MUTES_IDS_URL, twitter_http_get_mutes_ids, IMC_HANDLE(ic), 0, args, 2);
 
 	g_free(args[1]);
 }
@@ -280,7 +281,7 @@ void twitter_get_noretweets_ids(struct im_connection *ic, gint64 next_cursor)
 
 	args[0] = "cursor";
 	args[1] = g_strdup_printf("%" G_GINT64_FORMAT, next_cursor);
-	twitter_http(ic, TWITTER_NORETWEETS_IDS_URL, twitter_http_get_noretweets_ids, ic, 0, args, 2);
+	twitter_http(ic, TWITTER_NORETWEETS_IDS_URL, twitter_http_get_noretweets_ids, IMC_HANDLE(ic), 0, args, 2);
 
 	g_free(args[1]);
 }
@@ -332,10 +333,10 @@ static void twitter_http_get_friends_ids(struct http_request *req)
 	struct twitter_xml_list *txl;
 	struct twitter_data *td;
 
-	ic = req->data;
+	ic = imc_by_handle(req->data);
 
 	// Check if the connection is still active.
-	if (!g_slist_find(twitter_connections, ic)) {
+	if (!ic) {
 		return;
 	}
 
@@ -371,13 +372,13 @@ static void twitter_http_get_friends_ids(struct http_request *req)
  */
 static void twitter_http_get_mutes_ids(struct http_request *req)
 {
-	struct im_connection *ic = req->data;
+	struct im_connection *ic = imc_by_handle(req->data);
 	json_value *parsed;
 	struct twitter_xml_list *txl;
 	struct twitter_data *td;
 
 	// Check if the connection is stil active
-	if (!g_slist_find(twitter_connections, ic)) {
+	if (!ic) {
 		return;
 	}
 
@@ -416,13 +417,13 @@ static void twitter_http_get_mutes_ids(struct http_request *req)
  */
 static void twitter_http_get_noretweets_ids(struct http_request *req)
 {
-	struct im_connection *ic = req->data;
+	struct im_connection *ic = imc_by_handle(req->data);
 	json_value *parsed;
 	struct twitter_xml_list *txl;
 	struct twitter_data *td;
 
 	// Check if the connection is stil active
-	if (!g_slist_find(twitter_connections, ic)) {
+	if (!ic) {
 		return;
 	}
 
@@ -465,32 +466,155 @@ static void twitter_http_get_noretweets_ids(struct http_request *req)
 static gboolean twitter_xt_get_users(json_value *node, struct twitter_xml_list *txl);
 static void twitter_http_get_users_lookup(struct http_request *req);
 
-static void twitter_get_users_lookup(struct im_connection *ic)
+/* We can request up to 100 users at a time, and have a few of those
+   requests going at once. */
+#define TWITTER_USERS_LOOKUP_MAX 100
+#define TWITTER_USERS_LOOKUP_PARALLEL 4
+
+/* Names are looked up again after a week, people do rename sometimes. */
+#define TWITTER_USER_CACHE_AGE (7 * 86400)
+
+struct twitter_cached_user {
+	char *screen_name;
+	char *name;
+	time_t looked_up;
+};
+
+static void twitter_cached_user_free(gpointer data)
+{
+	struct twitter_cached_user *cu = data;
+
+	g_free(cu->screen_name);
+	g_free(cu->name);
+	g_free(cu);
+}
+
+/* The names of everyone we follow, from the last login, are kept in the
+   hidden _users setting: one "id<TAB>screen_name<TAB>name<TAB>time" line
+   each. Contacts found there don't have to be looked up again. */
+static GHashTable *twitter_user_cache_load(struct im_connection *ic)
+{
+	GHashTable *cache = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+	                                          twitter_cached_user_free);
+	char *s = set_getstr(&ic->acc->set, "_users");
+	char **lines, **f;
+	int i;
+
+	if (s == NULL) {
+		return cache;
+	}
+
+	lines = g_strsplit(s, "\n", 0);
+	for (i = 0; lines[i]; i++) {
+		f = g_strsplit(lines[i], "\t", 4);
+		if (g_strv_length(f) == 4 && *f[0] && *f[1]) {
+			struct twitter_cached_user *cu = g_new0(struct twitter_cached_user, 1);
+
+			cu->screen_name = g_strdup(f[1]);
+			cu->name = g_strdup(f[2]);
+			cu->looked_up = g_ascii_strtoll(f[3], NULL, 10);
+			g_hash_table_replace(cache, g_strdup(f[0]), cu);
+		}
+		g_strfreev(f);
+	}
+	g_strfreev(lines);
+
+	return cache;
+}
+
+static void twitter_user_cache_save(struct im_connection *ic)
+{
+	struct twitter_data *td = ic->proto_data;
+	GString *s = g_string_new("");
+	GHashTableIter iter;
+	gpointer id, value;
+
+	g_hash_table_iter_init(&iter, td->users);
+	while (g_hash_table_iter_next(&iter, &id, &value)) {
+		struct twitter_cached_user *cu = value;
+
+		g_string_append_printf(s, "%s\t%s\t%s\t%ld\n", (char *) id,
+		                       cu->screen_name, cu->name ? cu->name : "",
+		                       (long) cu->looked_up);
+	}
+
+	set_setstr(&ic->acc->set, "_users", s->len ? s->str : NULL);
+	g_string_free(s, TRUE);
+}
+
+static void twitter_users_lookup_next(struct im_connection *ic)
 {
 	struct twitter_data *td = ic->proto_data;
 	char *args[2] = {
 		"user_id",
 		NULL,
 	};
-	GString *ids = g_string_new("");
+	GString *ids;
 	int i;
 
-	/* We can request up to 100 users at a time. */
-	for (i = 0; i < 100 && td->follow_ids; i++) {
-		g_string_append_printf(ids, ",%s", (char *) td->follow_ids->data);
-		g_free(td->follow_ids->data);
-		td->follow_ids = g_slist_remove(td->follow_ids, td->follow_ids->data);
-	}
-	if (ids->len > 0) {
+	while (td->lookups_running < TWITTER_USERS_LOOKUP_PARALLEL &&
+	       td->lookup_pos < td->lookup_ids->len) {
+		ids = g_string_new("");
+		for (i = 0; i < TWITTER_USERS_LOOKUP_MAX && td->lookup_pos < td->lookup_ids->len; i++) {
+			g_string_append_printf(ids, ",%s",
+			                       (char *) g_ptr_array_index(td->lookup_ids, td->lookup_pos++));
+		}
+
 		args[1] = ids->str + 1;
+		td->lookups_running++;
 		/* POST, because I think ids can be up to 1KB long. */
-		twitter_http(ic, TWITTER_USERS_LOOKUP_URL, twitter_http_get_users_lookup, ic, 1, args, 2);
-	} else {
+		if (!twitter_http(ic, TWITTER_USERS_LOOKUP_URL, twitter_http_get_users_lookup, IMC_HANDLE(ic), 1, args, 2)) {
+			td->lookups_running--;
+		}
+		g_string_free(ids, TRUE);
+	}
+
+	if (td->lookups_running == 0) {
 		/* We have all users. Continue with login. (Get statuses.) */
+		twitter_user_cache_save(ic);
+		g_hash_table_destroy(td->users);
+		td->users = NULL;
+		g_ptr_array_free(td->lookup_ids, TRUE);
+		td->lookup_ids = NULL;
+
 		td->flags |= TWITTER_HAVE_FRIENDS;
 		twitter_login_finish(ic);
 	}
-	g_string_free(ids, TRUE);
+}
+
+static void twitter_get_users_lookup(struct im_connection *ic)
+{
+	struct twitter_data *td = ic->proto_data;
+	GHashTable *cache = twitter_user_cache_load(ic);
+	time_t now = time(NULL);
+	gpointer key, value;
+	GSList *l;
+
+	td->users = g_hash_table_new_full(g_str_hash, g_str_equal, g_free,
+	                                  twitter_cached_user_free);
+	td->lookup_ids = g_ptr_array_new_with_free_func(g_free);
+	td->lookup_pos = 0;
+
+	/* Whatever isn't cached (or is too old) has to be looked up. The ids
+	   move over to either td->users or td->lookup_ids. */
+	for (l = td->follow_ids; l; l = l->next) {
+		if (g_hash_table_lookup_extended(cache, l->data, &key, &value) &&
+		    now - ((struct twitter_cached_user *) value)->looked_up < TWITTER_USER_CACHE_AGE) {
+			struct twitter_cached_user *cu = value;
+
+			g_hash_table_steal(cache, key);
+			g_free(key);
+			twitter_add_buddy(ic, cu->screen_name, cu->name);
+			g_hash_table_replace(td->users, l->data, cu);
+		} else {
+			g_ptr_array_add(td->lookup_ids, l->data);
+		}
+	}
+	g_slist_free(td->follow_ids);
+	td->follow_ids = NULL;
+	g_hash_table_destroy(cache);
+
+	twitter_users_lookup_next(ic);
 }
 
 /**
@@ -502,19 +626,28 @@ static void twitter_get_users_lookup(struct im_connection *ic)
  */
 static void twitter_http_get_users_lookup(struct http_request *req)
 {
-	struct im_connection *ic = req->data;
+	struct im_connection *ic = imc_by_handle(req->data);
+	struct twitter_data *td;
 	json_value *parsed;
 	struct twitter_xml_list *txl;
 	GSList *l = NULL;
 	struct twitter_xml_user *user;
 
 	// Check if the connection is still active.
-	if (!g_slist_find(twitter_connections, ic)) {
+	if (!ic) {
 		return;
 	}
 
+	td = ic->proto_data;
+	td->lookups_running--;
+
 	// Get the user list from the parsed xml feed.
 	if (!(parsed = twitter_parse_response(ic, req))) {
+		/* Unless that was the end of this connection, carry on with
+		   the rest. */
+		if (imc_by_handle(req->data)) {
+			twitter_users_lookup_next(ic);
+		}
 		return;
 	}
 
@@ -524,16 +657,30 @@ static void twitter_http_get_users_lookup(struct http_request *req)
 	twitter_xt_get_users(parsed, txl);
 	json_value_free(parsed);
 
-	// Add the users as buddies.
+	// Add the users as buddies, and remember them for next time.
 	for (l = txl->list; l; l = g_slist_next(l)) {
+		struct twitter_cached_user *cu;
+
 		user = l->data;
+		if (!user->screen_name) {
+			continue;
+		}
 		twitter_add_buddy(ic, user->screen_name, user->name);
+
+		cu = g_new0(struct twitter_cached_user, 1);
+		cu->screen_name = g_strdup(user->screen_name);
+		cu->name = g_strdup(user->name);
+		if (cu->name) {
+			g_strdelimit(cu->name, "\t\r\n", ' ');
+		}
+		cu->looked_up = time(NULL);
+		g_hash_table_replace(td->users, g_strdup_printf("%" G_GUINT64_FORMAT, user->uid), cu);
 	}
 
 	// Free the structure.
 	txl_free(txl);
 
-	twitter_get_users_lookup(ic);
+	twitter_users_lookup_next(ic);
 }
 
 struct twitter_xml_user *twitter_xt_get_user(const json_value *node)
@@ -786,39 +933,6 @@ static void expand_entities(char **text, const json_value *node, const json_valu
 	g_free(quote_kort);
 }
 
-/**
- * Function to fill a twitter_xml_list struct.
- * It sets:
- *  - all <status>es within the <status> element and
- *  - the next_cursor.
- */
-static gboolean twitter_xt_get_status_list(struct im_connection *ic, const json_value *node,
-                                           struct twitter_xml_list *txl)
-{
-	struct twitter_xml_status *txs;
-	int i;
-
-	// Set the type of the list.
-	txl->type = TXL_STATUS;
-
-	if (node->type != json_array) {
-		return FALSE;
-	}
-
-	// The root <statuses> node should hold the list of statuses <status>
-	// Walk over the nodes children.
-	for (i = 0; i < node->u.array.length; i++) {
-		txs = twitter_xt_get_status(node->u.array.values[i]);
-		if (!txs) {
-			continue;
-		}
-
-		txl->list = g_slist_prepend(txl->list, txs);
-	}
-
-	return TRUE;
-}
-
 /* Will log messages either way. Need to keep track of IDs for stream deduping.
    Plus, show_ids is on by default and I don't see why anyone would disable it. */
 static char *twitter_msg_add_id(struct im_connection *ic,
@@ -1032,14 +1146,14 @@ static gboolean twitter_stream_handle_object(struct im_connection *ic, json_valu
 
 static void twitter_http_stream(struct http_request *req)
 {
-	struct im_connection *ic = req->data;
+	struct im_connection *ic = imc_by_handle(req->data);
 	struct twitter_data *td;
 	json_value *parsed;
 	int len = 0;
 	char c, *nl;
 	gboolean from_filter;
 
-	if (!g_slist_find(twitter_connections, ic)) {
+	if (!ic) {
 		return;
 	}
 
@@ -1224,7 +1338,7 @@ gboolean twitter_open_stream(struct im_connection *ic)
 	char *args[2] = { "with", "followings" };
 
 	if ((td->stream = twitter_http(ic, TWITTER_USER_STREAM_URL,
-	                               twitter_http_stream, ic, 0, args, 2))) {
+	                               twitter_http_stream, IMC_HANDLE(ic), 0, args, 2))) {
 		/* This flag must be enabled or we'll get no data until EOF
 		   (which err, kind of, defeats the purpose of a streaming API). */
 		td->stream->flags |= HTTPC_STREAMING;
@@ -1278,7 +1392,7 @@ static gboolean twitter_filter_stream(struct im_connection *ic)
 	}
 
 	if ((td->filter_stream = twitter_http(ic, TWITTER_FILTER_STREAM_URL,
-	                                      twitter_http_stream, ic, 0,
+	                                      twitter_http_stream, IMC_HANDLE(ic), 0,
 	                                      args, 4))) {
 		/* This flag must be enabled or we'll get no data until EOF
 		   (which err, kind of, defeats the purpose of a streaming API). */
@@ -1294,7 +1408,7 @@ static gboolean twitter_filter_stream(struct im_connection *ic)
 
 static void twitter_filter_users_post(struct http_request *req)
 {
-	struct im_connection *ic = req->data;
+	struct im_connection *ic = imc_by_handle(req->data);
 	struct twitter_data *td;
 	struct twitter_filter *tf;
 	GList *users = NULL;
@@ -1307,7 +1421,7 @@ static void twitter_filter_users_post(struct http_request *req)
 	int i;
 
 	// Check if the connection is still active.
-	if (!g_slist_find(twitter_connections, ic)) {
+	if (!ic) {
 		return;
 	}
 
@@ -1403,7 +1517,7 @@ gboolean twitter_open_filter_stream(struct im_connection *ic)
 	args[1] = ustr->str;
 	req = twitter_http(ic, TWITTER_USERS_LOOKUP_URL,
 	                   twitter_filter_users_post,
-	                   ic, 0, args, 2);
+	                   IMC_HANDLE(ic), 0, args, 2);
 
 	g_string_free(ustr, TRUE);
 	return req != NULL;
@@ -1453,6 +1567,7 @@ void twitter_flush_timeline(struct im_connection *ic)
 	guint64 last_id = 0;
 	GSList *output = NULL;
 	GSList *l;
+	int shown = 0;
 
 	imcb_connected(ic);
 
@@ -1485,6 +1600,7 @@ void twitter_flush_timeline(struct im_connection *ic)
 		struct twitter_xml_status *txs = output->data;
 		if (txs->id != last_id) {
 			twitter_status_show(ic, txs);
+			shown++;
 		}
 		last_id = txs->id;
 		output = g_slist_remove(output, txs);
@@ -1495,10 +1611,77 @@ void twitter_flush_timeline(struct im_connection *ic)
 
 	td->flags &= ~(TWITTER_DOING_TIMELINE | TWITTER_GOT_TIMELINE | TWITTER_GOT_MENTIONS);
 	td->home_timeline_obj = td->mentions_obj = NULL;
+
+	twitter_poll_adjust(ic, shown > 0);
+}
+
+/* A timeline or mentions request in progress. Its reply is parsed while
+   it comes in, so each status is handled (and freed) as soon as it's
+   complete instead of keeping the whole body and its parse tree around. */
+struct twitter_timeline_req {
+	gpointer ic;            /* IMC_HANDLE() */
+	twitter_flags_t got;    /* TWITTER_GOT_TIMELINE or TWITTER_GOT_MENTIONS */
+	json_stream_t *js;
+	struct twitter_xml_list *txl;
+	int new;
+};
+
+static void twitter_http_get_timeline(struct http_request *req);
+
+static struct twitter_timeline_req *twitter_timeline_req_new(struct im_connection *ic, twitter_flags_t got)
+{
+	struct twitter_timeline_req *tr = g_new0(struct twitter_timeline_req, 1);
+
+	tr->ic = IMC_HANDLE(ic);
+	tr->got = got;
+	tr->txl = g_new0(struct twitter_xml_list, 1);
+	tr->txl->type = TXL_STATUS;
+
+	return tr;
+}
+
+static void twitter_timeline_req_free(struct twitter_timeline_req *tr)
+{
+	json_stream_free(tr->js);
+	txl_free(tr->txl);
+	g_free(tr);
+}
+
+/* The "id" of every item in the top-level array. Statuses we've already
+   shown (since_id should've taken care of them already) are skipped
+   without building them. */
+static gboolean twitter_timeline_filter(json_stream_t *js, const json_value *id, gpointer data)
+{
+	struct twitter_timeline_req *tr = data;
+	struct im_connection *ic = imc_by_handle(tr->ic);
+	struct twitter_data *td;
+
+	if (!ic) {
+		return TRUE;
+	}
+
+	td = ic->proto_data;
+	return !(td->timeline_id && id->type == json_integer &&
+	         (guint64) id->u.integer <= td->timeline_id);
 }
 
-static void twitter_http_get_home_timeline(struct http_request *req);
-static void twitter_http_get_mentions(struct http_request *req);
+/* Called for every item in the top-level array. */
+static gboolean twitter_timeline_status(json_stream_t *js, json_value *v, gpointer data)
+{
+	struct twitter_timeline_req *tr = data;
+	struct twitter_xml_status *txs;
+
+	if (!imc_by_handle(tr->ic)) {
+		return FALSE;
+	}
+
+	if ((txs = twitter_xt_get_status(v))) {
+		tr->txl->list = g_slist_prepend(tr->txl->list, txs);
+		tr->new++;
+	}
+
+	return TRUE;
+}
 
 /**
  * Get the timeline.
@@ -1506,6 +1689,8 @@ static void twitter_http_get_mentions(struct http_request *req);
 static void twitter_get_home_timeline(struct im_connection *ic, gint64 next_cursor)
 {
 	struct twitter_data *td = ic->proto_data;
+	struct twitter_timeline_req *tr;
+	struct http_request *req;
 
 	txl_free(td->home_timeline_obj);
 	td->home_timeline_obj = NULL;
@@ -1523,8 +1708,13 @@ static void twitter_get_home_timeline(struct im_connection *ic, gint64 next_curs
 		args[7] = g_strdup_printf("%" G_GUINT64_FORMAT, td->timeline_id);
 	}
 
-	if (twitter_http(ic, TWITTER_HOME_TIMELINE_URL, twitter_http_get_home_timeline, ic, 0, args,
-	                 td->timeline_id ? 8 : 6) == NULL) {
+	tr = twitter_timeline_req_new(ic, TWITTER_GOT_TIMELINE);
+	td->poll_stats.requests++;
+	if ((req = twitter_http_etag(ic, TWITTER_HOME_TIMELINE_URL, twitter_http_get_timeline, tr, args,
+	                             td->timeline_id ? 8 : 6, td->home_timeline_etag))) {
+		req->flags |= HTTPC_STREAMING;
+	} else {
+		twitter_timeline_req_free(tr);
 		if (++td->http_fails >= 5) {
 			imcb_error(ic, "Could not retrieve %s: %s",
 			           TWITTER_HOME_TIMELINE_URL, "connection failed");
@@ -1545,6 +1735,8 @@ static void twitter_get_home_timeline(struct im_connection *ic, gint64 next_curs
 static void twitter_get_mentions(struct im_connection *ic, gint64 next_cursor)
 {
 	struct twitter_data *td = ic->proto_data;
+	struct twitter_timeline_req *tr;
+	struct http_request *req;
 
 	txl_free(td->mentions_obj);
 	td->mentions_obj = NULL;
@@ -1565,8 +1757,13 @@ static void twitter_get_mentions(struct im_connection *ic, gint64 next_cursor)
 	args[6] = "tweet_mode";
 	args[7] = "extended";
 
-	if (twitter_http(ic, TWITTER_MENTIONS_URL, twitter_http_get_mentions,
-	                 ic, 0, args, 8) == NULL) {
+	tr = twitter_timeline_req_new(ic, TWITTER_GOT_MENTIONS);
+	td->poll_stats.requests++;
+	if ((req = twitter_http_etag(ic, TWITTER_MENTIONS_URL, twitter_http_get_timeline,
+	                             tr, args, 8, td->mentions_etag))) {
+		req->flags |= HTTPC_STREAMING;
+	} else {
+		twitter_timeline_req_free(tr);
 		if (++td->http_fails >= 5) {
 			imcb_error(ic, "Could not retrieve %s: %s",
 			           TWITTER_MENTIONS_URL, "connection failed");
@@ -1580,81 +1777,94 @@ static void twitter_get_mentions(struct im_connection *ic, gint64 next_cursor)
 }
 
 /**
- * Callback for getting the home timeline.
+ * Callback for the home timeline and mentions, called every time more of
+ * the reply comes in and once more at the end.
  */
-static void twitter_http_get_home_timeline(struct http_request *req)
+static void twitter_http_get_timeline(struct http_request *req)
 {
-	struct im_connection *ic = req->data;
+	struct twitter_timeline_req *tr = req->data;
+	struct im_connection *ic = imc_by_handle(tr->ic);
 	struct twitter_data *td;
-	json_value *parsed;
-	struct twitter_xml_list *txl;
+	json_stream_status_t st = JSON_STREAM_MORE;
+	twitter_flags_t got;
+	gpointer *obj, handle;
+	char **etag, *s;
+	clock_t start;
 
 	// Check if the connection is still active.
-	if (!g_slist_find(twitter_connections, ic)) {
+	if (!ic) {
+		if (req->flags & HTTPC_EOF) {
+			twitter_timeline_req_free(tr);
+		}
 		return;
 	}
 
 	td = ic->proto_data;
-
-	// The root <statuses> node should hold the list of statuses <status>
-	if (!(parsed = twitter_parse_response(ic, req))) {
-		goto end;
+	if (tr->got == TWITTER_GOT_TIMELINE) {
+		obj = &td->home_timeline_obj;
+		etag = &td->home_timeline_etag;
+	} else {
+		obj = &td->mentions_obj;
+		etag = &td->mentions_etag;
 	}
 
-	txl = g_new0(struct twitter_xml_list, 1);
-	txl->list = NULL;
-
-	twitter_xt_get_status_list(ic, parsed, txl);
-	json_value_free(parsed);
-
-	td->home_timeline_obj = txl;
-
-end:
-	if (!g_slist_find(twitter_connections, ic)) {
-		return;
+	/* Errors are reported from the whole body, so only eat it if it's
+	   what we asked for. */
+	if (req->status_code == 200 && req->reply_body) {
+		if (tr->js == NULL) {
+			tr->js = json_stream_new_values(1, twitter_timeline_status, tr, 0);
+			json_stream_set_filter(tr->js, "id", twitter_timeline_filter);
+		}
+		start = clock();
+		st = json_stream_feed(tr->js, req->reply_body, req->body_size);
+		if ((req->flags & HTTPC_EOF) && st != JSON_STREAM_ERROR) {
+			st = json_stream_end(tr->js);
+		}
+		td->poll_stats.parse_time += clock() - start;
+		http_flush_bytes(req, req->body_size);
 	}
 
-	td->flags |= TWITTER_GOT_TIMELINE;
-
-	twitter_flush_timeline(ic);
-}
-
-/**
- * Callback for getting mentions.
- */
-static void twitter_http_get_mentions(struct http_request *req)
-{
-	struct im_connection *ic = req->data;
-	struct twitter_data *td;
-	json_value *parsed;
-	struct twitter_xml_list *txl;
-
-	// Check if the connection is still active.
-	if (!g_slist_find(twitter_connections, ic)) {
+	if (!(req->flags & HTTPC_EOF)) {
 		return;
 	}
 
-	td = ic->proto_data;
+	if (req->status_code == 304) {
+		td->http_fails = 0;
+		td->poll_stats.not_modified++;
+	} else if (req->status_code != 200) {
+		/* Just for the error message, and possibly a logout. */
+		twitter_parse_response(ic, req);
+	} else if (st == JSON_STREAM_ERROR) {
+		imcb_error(ic, "Could not retrieve %s: %s",
+		           tr->got == TWITTER_GOT_TIMELINE ? TWITTER_HOME_TIMELINE_URL :
+		           TWITTER_MENTIONS_URL, "JSON parse error");
+	} else {
+		td->http_fails = 0;
+		if ((s = get_rfc822_header(req->reply_headers, "ETag", 0))) {
+			g_free(*etag);
+			*etag = s;
+		}
+		if (tr->new > 0) {
+			td->poll_stats.parsed++;
+		} else {
+			td->poll_stats.skipped++;
+		}
 
-	// The root <statuses> node should hold the list of statuses <status>
-	if (!(parsed = twitter_parse_response(ic, req))) {
-		goto end;
+		txl_free(*obj);
+		*obj = tr->txl;
+		tr->txl = NULL;
 	}
 
-	txl = g_new0(struct twitter_xml_list, 1);
-	txl->list = NULL;
-
-	twitter_xt_get_status_list(ic, parsed, txl);
-	json_value_free(parsed);
-
-	td->mentions_obj = txl;
+	handle = tr->ic;
+	got = tr->got;
+	twitter_timeline_req_free(tr);
 
-end:
-	if (!g_slist_find(twitter_connections, ic)) {
+	/* twitter_parse_response() might have logged us out. */
+	if (!imc_by_handle(handle)) {
 		return;
 	}
 
-	td->flags |= TWITTER_GOT_MENTIONS;
+	td->flags |= got;
 
 	twitter_flush_timeline(ic);
 }
@@ -1665,12 +1875,12 @@ end:
  */
 static void twitter_http_post(struct http_request *req)
 {
-	struct im_connection *ic = req->data;
+	struct im_connection *ic = imc_by_handle(req->data);
 	struct twitter_data *td;
 	json_value *parsed, *id;
 
 	// Check if the connection is still active.
-	if (!g_slist_find(twitter_connections, ic)) {
+	if (!ic) {
 		return;
 	}
 
@@ -1733,7 +1943,7 @@ void twitter_post_status(struct im_connection *ic, char *msg, guint64 in_reply_t
 		in_reply_to = 1;
 	}
 
-	twitter_http(ic, TWITTER_STATUS_UPDATE_URL, twitter_http_post, ic, 1,
+	twitter_http(ic, TWITTER_STATUS_UPDATE_URL, twitter_http_post, IMC_HANDLE(ic), 1,
 	             args, args_len);
 	if (in_reply_to_str) {
 		g_free(in_reply_to_str);
@@ -1757,7 +1967,7 @@ void twitter_direct_messages_new(struct im_connection *ic, char *who, char *msg)
 	args[2] = "text";
 	args[3] = msg;
 	// Use the same callback as for twitter_post_status, since it does basically the same.
-	twitter_http(ic, TWITTER_DIRECT_MESSAGES_NEW_URL, twitter_http_post, ic, 1, args, 4);
+	twitter_http(ic, TWITTER_DIRECT_MESSAGES_NEW_URL, twitter_http_post, IMC_HANDLE(ic), 1, args, 4);
 }
 
 void twitter_friendships_create_destroy(struct im_connection *ic, char *who, int create)
@@ -1767,7 +1977,7 @@ void twitter_friendships_create_destroy(struct im_connection *ic, char *who, int
 	args[0] = "screen_name";
 	args[1] = who;
 	twitter_http(ic, create ? TWITTER_FRIENDSHIPS_CREATE_URL : TWITTER_FRIENDSHIPS_DESTROY_URL,
-	             twitter_http_post, ic, 1, args, 2);
+	             twitter_http_post, IMC_HANDLE(ic), 1, args, 2);
 }
 
 /**
@@ -1780,7 +1990,7 @@ void twitter_mute_create_destroy(struct im_connection *ic, char *who, int create
 	args[0] = "screen_name";
 	args[1] = who;
 	twitter_http(ic, create ? TWITTER_MUTES_CREATE_URL : TWITTER_MUTES_DESTROY_URL,
-		     twitter_http_post, ic, 1, args, 2);
+		     twitter_http_post, IMC_HANDLE(ic), 1, args, 2);
 }
 
 void twitter_status_destroy(struct im_connection *ic, guint64 id)
@@ -1789,7 +1999,7 @@ void twitter_status_destroy(struct im_connection *ic, guint64 id)
 
 	url = g_strdup_printf("%s%" G_GUINT64_FORMAT "%s",
 	                      TWITTER_STATUS_DESTROY_URL, id, ".json");
-	twitter_http_f(ic, url, twitter_http_post, ic, 1, NULL, 0,
+	twitter_http_f(ic, url, twitter_http_post, IMC_HANDLE(ic), 1, NULL, 0,
 	               TWITTER_HTTP_USER_ACK);
 	g_free(url);
 }
@@ -1800,7 +2010,7 @@ void twitter_status_retweet(struct im_connection *ic, guint64 id)
 
 	url = g_strdup_printf("%s%" G_GUINT64_FORMAT "%s",
 	                      TWITTER_STATUS_RETWEET_URL, id, ".json");
-	twitter_http_f(ic, url, twitter_http_post, ic, 1, NULL, 0,
+	twitter_http_f(ic, url, twitter_http_post, IMC_HANDLE(ic), 1, NULL, 0,
 	               TWITTER_HTTP_USER_ACK);
 	g_free(url);
 }
@@ -1817,7 +2027,7 @@ void twitter_report_spam(struct im_connection *ic, char *screen_name)
 
 	args[1] = screen_name;
 	twitter_http_f(ic, TWITTER_REPORT_SPAM_URL, twitter_http_post,
-	               ic, 1, args, 2, TWITTER_HTTP_USER_ACK);
+	               IMC_HANDLE(ic), 1, args, 2, TWITTER_HTTP_USER_ACK);
 }
 
 /**
@@ -1832,18 +2042,18 @@ void twitter_favourite_tweet(struct im_connection *ic, guint64 id)
 
 	args[1] = g_strdup_printf("%" G_GUINT64_FORMAT, id);
 	twitter_http_f(ic, TWITTER_FAVORITE_CREATE_URL, twitter_http_post,
-	               ic, 1, args, 2, TWITTER_HTTP_USER_ACK);
+	               IMC_HANDLE(ic), 1, args, 2, TWITTER_HTTP_USER_ACK);
 	g_free(args[1]);
 }
 
 static void twitter_http_status_show_url(struct http_request *req)
 {
-	struct im_connection *ic = req->data;
+	struct im_connection *ic = imc_by_handle(req->data);
 	json_value *parsed, *id;
 	const char *name;
 
 	// Check if the connection is still active.
-	if (!g_slist_find(twitter_connections, ic)) {
+	if (!ic) {
 		return;
 	}
 
@@ -1871,6 +2081,6 @@ static void twitter_http_status_show_url(struct http_request *req)
 void twitter_status_show_url(struct im_connection *ic, guint64 id)
 {
 	char *url = g_strdup_printf("%s%" G_GUINT64_FORMAT "%s", TWITTER_STATUS_SHOW_URL, id, ".json");
-	twitter_http(ic, url, twitter_http_status_show_url, ic, 0, NULL, 0);
+	twitter_http(ic, url, twitter_http_status_show_url, IMC_HANDLE(ic), 0, NULL, 0);
 	g_free(url);
 }
@@ -48,26 +48,18 @@ void root_command_string(irc_t *irc, char *command)
 
 void root_command(irc_t *irc, char *cmd[])
 {
-	int i, len;
+	const command_t *c;
 
 	if (!cmd[0]) {
 		return;
 	}
 
-	len = strlen(cmd[0]);
-	for (i = 0; root_commands[i].command; i++) {
-		if (g_strncasecmp(root_commands[i].command, cmd[0], len) == 0) {
-			if (root_commands[i + 1].command &&
-			    g_strncasecmp(root_commands[i + 1].command, cmd[0], len) == 0) {
-				/* Only match on the first letters if the match is unique. */
-				break;
-			}
+	/* Only match on the first letters if the match is unique. */
+	if ((c = cmdtab_find_prefix(root_command_table(), cmd[0]))) {
+		MIN_ARGS(c->required_parameters);
 
-			MIN_ARGS(root_commands[i].required_parameters);
-
-			root_commands[i].execute(irc, cmd);
-			return;
-		}
+		c->execute(irc, cmd);
+		return;
 	}
 
 	irc_rootmsg(irc, "Unknown command: %s. Please use \x02help commands\x02 to get a list of available commands.",
@@ -102,17 +94,22 @@ static void cmd_help(irc_t *irc, char **cmd)
 }
 
 static void cmd_account(irc_t *irc, char **cmd);
+static void cmd_account_on_all(irc_t *irc, login_prio_t prio);
 static void bitlbee_whatsnew(irc_t *irc);
 
+static void cmd_identify_checked(irc_t *irc, storage_status_t status, gpointer data);
+
 static void cmd_identify(irc_t *irc, char **cmd)
 {
-	storage_status_t status;
 	gboolean load = TRUE;
 	char *password = cmd[1];
 
 	if (irc->status & USTATUS_IDENTIFIED) {
 		irc_rootmsg(irc, "You're already logged in.");
 		return;
+	} else if (irc->status & USTATUS_AUTH_PENDING) {
+		irc_rootmsg(irc, "Still checking your password, please wait.");
+		return;
 	}
 
 	if (cmd[1] == NULL) {
@@ -142,9 +139,16 @@ static void cmd_identify(irc_t *irc, char **cmd)
 		return;
 	}
 
-	status = auth_check_pass(irc, irc->user->nick, password);
+	auth_check_pass(irc, irc->user->nick, password, cmd_identify_checked, GINT_TO_POINTER(load), NULL);
+}
+
+static void cmd_identify_checked(irc_t *irc, storage_status_t status, gpointer data)
+{
+	gboolean load = GPOINTER_TO_INT(data);
+
+	/* auth_check_pass() set irc->password if it was right. */
 	if (load && (status == STORAGE_OK)) {
-		status = storage_load(irc, password);
+		status = storage_load(irc, irc->password);
 	}
 
 	switch (status) {
@@ -204,11 +208,10 @@ static void cmd_identify(irc_t *irc, char **cmd)
 
 gboolean cmd_identify_finish(gpointer data, gint fd, b_input_condition cond)
 {
-	char *account_on[] = { "account", "on", NULL };
 	irc_t *irc = data;
 
 	if (set_getbool(&irc->b->set, "auto_connect")) {
-		cmd_account(irc, account_on);
+		cmd_account_on_all(irc, LOGIN_PRIO_CONNECT);
 	}
 
 	b_event_remove(irc->login_source_id);
@@ -261,11 +264,20 @@ static void cmd_register(irc_t *irc, char **cmd)
 	}
 }
 
+static void cmd_drop_checked(irc_t *irc, storage_status_t status, gpointer data);
+
 static void cmd_drop(irc_t *irc, char **cmd)
 {
-	storage_status_t status;
+	if (irc->status & USTATUS_AUTH_PENDING) {
+		irc_rootmsg(irc, "Still checking your password, please wait.");
+		return;
+	}
+
+	auth_check_pass(irc, irc->user->nick, cmd[1], cmd_drop_checked, NULL, NULL);
+}
 
-	status = auth_check_pass(irc, irc->user->nick, cmd[1]);
+static void cmd_drop_checked(irc_t *irc, storage_status_t status, gpointer data)
+{
 	if (status == STORAGE_OK) {
 		status = storage_remove(irc->user->nick);
 	}
@@ -401,6 +413,29 @@ static int cmd_account_set_checkflags(irc_t *irc, set_t *s)
 	return 1;
 }
 
+static void cmd_account_on_all(irc_t *irc, login_prio_t prio)
+{
+	account_t *a;
+
+	if (irc->b->accounts == NULL) {
+		irc_rootmsg(irc, "No accounts known. Use `account add' to add one.");
+		return;
+	}
+
+	irc_rootmsg(irc, "Trying to get all accounts connected...");
+
+	for (a = irc->b->accounts; a; a = a->next) {
+		if (!a->ic && a->auto_connect && a->prpl != &protocol_missing) {
+			if (strcmp(a->pass, PASSWORD_PENDING) == 0) {
+				irc_rootmsg(irc, "Enter password for account %s "
+				            "first (use /OPER)", a->tag);
+			} else {
+				account_login(a, prio);
+			}
+		}
+	}
+}
+
 static void cmd_account(irc_t *irc, char **cmd)
 {
 	account_t *a;
@@ -503,6 +538,8 @@ static void cmd_account(irc_t *irc, char **cmd)
 				con = " (connected)";
 			} else if (a->ic) {
 				con = " (connecting)";
+			} else if (a->login_waiting) {
+				con = " (waiting to connect)";
 			} else if (a->reconnect) {
 				con = " (awaiting reconnect)";
 			} else {
@@ -526,22 +563,7 @@ static void cmd_account(irc_t *irc, char **cmd)
 	} else if (cmd[2]) {
 		/* Try the following two only if cmd[2] == NULL */
 	} else if (len >= 2 && g_strncasecmp(cmd[1], "on", len) == 0) {
-		if (irc->b->accounts) {
-			irc_rootmsg(irc, "Trying to get all accounts connected...");
-
-			for (a = irc->b->accounts; a; a = a->next) {
-				if (!a->ic && a->auto_connect && a->prpl != &protocol_missing) {
-					if (strcmp(a->pass, PASSWORD_PENDING) == 0) {
-						irc_rootmsg(irc, "Enter password for account %s "
-						            "first (use /OPER)", a->tag);
-					} else {
-						account_on(irc->b, a);
-					}
-				}
-			}
-		} else {
-			irc_rootmsg(irc, "No accounts known. Use `account add' to add one.");
-		}
+		cmd_account_on_all(irc, LOGIN_PRIO_USER);
 
 		return;
 	} else if (len >= 2 && g_strncasecmp(cmd[1], "off", len) == 0) {
@@ -550,7 +572,7 @@ static void cmd_account(irc_t *irc, char **cmd)
 		for (a = irc->b->accounts; a; a = a->next) {
 			if (a->ic) {
 				account_off(irc->b, a);
-			} else if (a->reconnect) {
+			} else if (a->reconnect || a->login_waiting) {
 				cancel_auto_reconnect(a);
 			}
 		}
@@ -581,6 +603,7 @@ static void cmd_account(irc_t *irc, char **cmd)
 		else if (a->ic) {
 			irc_rootmsg(irc, "Account is still logged in, can't delete");
 		} else {
+			account_cache_remove(a, a->tag);
 			account_del(irc->b, a);
 			irc_rootmsg(irc, "Account deleted");
 		}
@@ -597,19 +620,39 @@ static void cmd_account(irc_t *irc, char **cmd)
 			irc_rootmsg(irc, "%s", msg);
 			g_free(msg);
 		} else {
-			account_on(irc->b, a);
+			account_login(a, LOGIN_PRIO_USER);
 		}
 	} else if (len >= 2 && g_strncasecmp(cmd[2], "off", len) == 0) {
 		if (a->ic) {
 			account_off(irc->b, a);
-		} else if (a->reconnect) {
+		} else if (a->reconnect || a->login_waiting) {
 			cancel_auto_reconnect(a);
 			irc_rootmsg(irc, "Reconnect cancelled");
 		} else {
 			irc_rootmsg(irc, "Account already offline");
 		}
 	} else if (len >= 1 && g_strncasecmp(cmd[2], "set", len) == 0) {
+		char *tag = g_strdup(a->tag);
+
 		cmd_set_real(irc, cmd + 2, &a->set, cmd_account_set_checkflags);
+
+		/* Cache files go by tag, don't leave the old ones behind. */
+		if (strcmp(tag, a->tag) != 0) {
+			account_cache_remove(a, tag);
+		}
+		g_free(tag);
+	} else if (len >= 1 && g_strncasecmp(cmd[2], "queue", len) == 0) {
+		bee_queue_t *q = a->sendq;
+
+		if (q == NULL) {
+			irc_rootmsg(irc, "Send queue for %s is empty, nothing was rate limited yet", a->tag);
+		} else {
+			irc_rootmsg(irc, "Send queue for %s: %u waiting (peak %u)",
+			            a->tag, g_queue_get_length(&q->msgs), q->max_depth);
+			irc_rootmsg(irc, "%" G_GUINT64_FORMAT " sent, %" G_GUINT64_FORMAT " delayed, "
+			            "%" G_GUINT64_FORMAT " merged, %" G_GUINT64_FORMAT " dropped",
+			            q->sent, q->queued, q->coalesced, q->dropped);
+		}
 	} else {
 		irc_rootmsg(irc,
 		            "Unknown command: %s [...] %s. Please use \x02help commands\x02 to get a list of available commands.", "account",
@@ -1482,6 +1525,7 @@ static void cmd_group(irc_t *irc, char **cmd)
 		irc_rootmsg(irc, "End of group list");
 	} else if (g_strncasecmp(cmd[1], "info", len) == 0) {
 		bee_group_t *bg;
+		GList *ul;
 		int n = 0;
 
 		MIN_ARGS(2);
@@ -1491,8 +1535,8 @@ static void cmd_group(irc_t *irc, char **cmd)
 			if (strchr(irc->umode, 'b')) {
 				irc_rootmsg(irc, "Members of %s:", cmd[2]);
 			}
-			for (l = irc->b->users; l; l = l->next) {
-				bee_user_t *bu = l->data;
+			for (ul = irc->b->users; ul; ul = ul->next) {
+				bee_user_t *bu = ul->data;
 				if (bu->group == bg) {
 					irc_rootmsg(irc, "%d. %s", n++, bu->nick ? : bu->handle);
 				}
@@ -1594,7 +1638,6 @@ static void bitlbee_whatsnew(irc_t *irc)
 	set_setstr(&irc->b->set, "last_version", s);
 }
 
-/* IMPORTANT: Keep this list sorted! The short command logic needs that. */
 command_t root_commands[] = {
 	{ "account",        1, cmd_account,        0 },
 	{ "add",            2, cmd_add,            0 },
@@ -1619,43 +1662,35 @@ command_t root_commands[] = {
 	{ "set",            0, cmd_set,            0 },
 	{ "transfer",       0, cmd_transfer,       0 },
 	{ "yes",            0, cmd_yesno,          0 },
-	/* Not expecting too many plugins adding root commands so just make a
-	   dumb array with some empty entried at the end. */
-	{ NULL },
-	{ NULL },
-	{ NULL },
-	{ NULL },
-	{ NULL },
-	{ NULL },
-	{ NULL },
-	{ NULL },
-	{ NULL },
+	{ NULL }
 };
-static const int num_root_commands = sizeof(root_commands) / sizeof(command_t);
 
-gboolean root_command_add(const char *command, int params, void (*func)(irc_t *, char **args), int flags)
+/* The built-in commands above plus anything added by plugins, sorted for
+   the short command logic. */
+cmdtab_t *root_command_table(void)
 {
-	int i;
+	static cmdtab_t tab = CMDTAB_INIT;
 
-	if (root_commands[num_root_commands - 2].command) {
-		/* Planning fail! List is full. */
-		return FALSE;
+	if (tab.len == 0) {
+		cmdtab_add_array(&tab, root_commands, sizeof(command_t));
 	}
 
-	for (i = 0; root_commands[i].command; i++) {
-		if (g_strcasecmp(root_commands[i].command, command) == 0) {
-			return FALSE;
-		} else if (g_strcasecmp(root_commands[i].command, command) > 0) {
-			break;
-		}
+	return &tab;
+}
+
+gboolean root_command_add(const char *command, int params, void (*func)(irc_t *, char **args), int flags)
+{
+	command_t *c;
+
+	if (cmdtab_find(root_command_table(), command)) {
+		return FALSE;
 	}
-	memmove(root_commands + i + 1, root_commands + i,
-	        sizeof(command_t) * (num_root_commands - i - 1));
 
-	root_commands[i].command = g_strdup(command);
-	root_commands[i].required_parameters = params;
-	root_commands[i].execute = func;
-	root_commands[i].flags = flags;
+	c = g_new0(command_t, 1);
+	c->command = g_strdup(command);
+	c->required_parameters = params;
+	c->execute = func;
+	c->flags = flags;
 
-	return TRUE;
+	return cmdtab_add(root_command_table(), c->command, c);
 }
@@ -497,12 +497,15 @@ static storage_status_t xml_remove(const char *nick)
 	lc = g_strdup(nick);
 	nick_lc(NULL, lc);
 	g_snprintf(s, 511, "%s%s%s", global.conf->configdir, lc, ".xml");
-	g_free(lc);
 
 	if (unlink(s) == -1) {
+		g_free(lc);
 		return STORAGE_OTHER_ERROR;
 	}
 
+	account_cache_remove_nick(lc);
+	g_free(lc);
+
 	return STORAGE_OK;
 }
 
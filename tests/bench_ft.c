@@ -0,0 +1,174 @@
+/* Pushes data through the file transfer relay (ft_relay in bee_ft.c) the
+   way a DCC <-> SOCKS5 transfer does, over local socketpairs: a peer
+   sends into the receiving side's socket, the relay moves it to the
+   sending side's socket and a client at the other end reads it. Reports
+   the throughput of the read()/write() path and of the splice() path.
+   Not part of the test suite, build it with "make bench" and run it as
+   ./bench_ft [megabytes]. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <glib.h>
+#include "bitlbee.h"
+#include "ft.h"
+
+global_t global;        /* Against global namespace pollution */
+
+double gettime()
+{
+	struct timeval time[1];
+
+	gettimeofday(time, 0);
+	return((double) time->tv_sec + (double) time->tv_usec / 1000000);
+}
+
+void sighandler_shutdown_setup()
+{
+	/* no-op. originally defined in unix.c, needed by bitlbee.c */
+}
+
+static struct {
+	file_transfer_t ft;
+	ft_relay_t *relay;
+	int in[2], out[2];
+	gint recv_inpa;
+	size_t total, produced, drained;
+	char chunk[65536];
+} b;
+
+static void bench_sent(file_transfer_t *ft, unsigned int len)
+{
+}
+
+static void bench_error(file_transfer_t *ft, const char *msg)
+{
+	fprintf(stderr, "relay failed: %s\n", msg);
+	exit(1);
+}
+
+/* The IM peer, sending as fast as the receiving socket takes it. */
+static gboolean bench_produce(gpointer data, gint fd, b_input_condition cond)
+{
+	size_t n = MIN(sizeof(b.chunk), b.total - b.produced);
+	ssize_t st;
+
+	if ((st = write(fd, b.chunk, n)) > 0) {
+		b.produced += st;
+	}
+
+	return b.produced < b.total;
+}
+
+/* The IRC client, reading whatever the relay sends it. */
+static gboolean bench_drain(gpointer data, gint fd, b_input_condition cond)
+{
+	char buf[65536];
+	ssize_t st;
+
+	while ((st = read(fd, buf, sizeof(buf))) > 0) {
+		b.drained += st;
+	}
+	if (st == 0 || b.drained >= b.total) {
+		b_main_quit();
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+/* The receiving side without splice(): recv() into the transfer's buffer
+   and copy that into the relay, like dcc.c and s5bytestream.c do. */
+static gboolean bench_recv(gpointer data, gint fd, b_input_condition cond)
+{
+	ssize_t st = recv(b.in[0], b.ft.buffer, sizeof(b.ft.buffer), 0);
+
+	if (st < 0 && sockerr_again()) {
+		if (fd == -1) {
+			b.recv_inpa = b_input_add(b.in[0], B_EV_IO_READ, bench_recv, NULL);
+		}
+		return TRUE;
+	} else if (st <= 0) {
+		bench_error(&b.ft, "receiving side closed");
+	}
+
+	b.recv_inpa = 0;
+	ft_relay_write(b.relay, b.ft.buffer, st);
+
+	return FALSE;
+}
+
+static gboolean bench_write_request(file_transfer_t *ft)
+{
+	bench_recv(NULL, -1, 0);
+
+	return TRUE;
+}
+
+static gboolean bench_read_done(file_transfer_t *ft, unsigned int len)
+{
+	return TRUE;
+}
+
+static void bench_relay(const char *name, size_t total, gboolean splice)
+{
+	gint64 start, t;
+
+	memset(&b.ft, 0, sizeof(b.ft));
+	b.total = total;
+	b.produced = b.drained = 0;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, b.in) < 0 ||
+	    socketpair(AF_UNIX, SOCK_STREAM, 0, b.out) < 0) {
+		perror("socketpair");
+		exit(1);
+	}
+	sock_make_nonblocking(b.in[0]);
+	sock_make_nonblocking(b.in[1]);
+	sock_make_nonblocking(b.out[0]);
+	sock_make_nonblocking(b.out[1]);
+
+	b.ft.file_size = total;
+	b.ft.write_request = bench_write_request;
+	if (splice) {
+		b.ft.read_fd = b.in[0];
+		b.ft.read_done = bench_read_done;
+	}
+	b.relay = ft_relay_new(&b.ft, b.out[0], bench_sent, bench_error);
+
+	b_input_add(b.in[1], B_EV_IO_WRITE, bench_produce, NULL);
+	b_input_add(b.out[1], B_EV_IO_READ, bench_drain, NULL);
+
+	start = g_get_monotonic_time();
+	ft_relay_start(b.relay);
+	b_main_run();
+	t = g_get_monotonic_time() - start;
+
+	printf("%-10s %6" G_GSIZE_FORMAT " MB %8.1f MB/s\n", name, b.drained >> 20,
+	       (double) b.drained / MAX(t, 1));
+
+	if (b.recv_inpa) {
+		b_event_remove(b.recv_inpa);
+		b.recv_inpa = 0;
+	}
+	ft_relay_free(b.relay);
+	closesocket(b.in[0]);
+	closesocket(b.in[1]);
+	closesocket(b.out[0]);
+	closesocket(b.out[1]);
+}
+
+int main(int argc, char **argv)
+{
+	size_t total = (size_t) (argc > 1 ? atoi(argv[1]) : 512) << 20;
+
+	b_main_init();
+	memset(b.chunk, 'x', sizeof(b.chunk));
+
+	bench_relay("read/write", total, FALSE);
+	bench_relay("splice", total, TRUE);
+
+	return 0;
+}
@@ -0,0 +1,108 @@
+/* Compares json_parse() with json_stream on a Twitter-like timeline (or the
+   file given on the command line). Not part of the test suite, build it
+   with "make bench". */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "json.h"
+#include "json_stream.h"
+
+#define BENCH_CHUNK 4096
+
+static int bench_values;
+
+static gboolean bench_value(json_stream_t *js, json_value *v, gpointer data)
+{
+	bench_values++;
+	return TRUE;
+}
+
+static GString *bench_timeline(int n)
+{
+	GString *s = g_string_new("[");
+	int i;
+
+	for (i = 0; i < n; i++) {
+		g_string_append_printf(s, "%s{\"created_at\": \"Wed Aug 27 13:08:45 +0000 2008\", "
+		                       "\"id\": %d, \"id_str\": \"%d\", \"full_text\": \"Status number %d, "
+		                       "with some \\\"quotes\\\" and \\u00e9\\u00e8 in it \\ud83d\\ude00 "
+		                       "http:\\/\\/example.com\\/%d\", \"truncated\": false, "
+		                       "\"entities\": {\"hashtags\": [], \"urls\": [{\"url\": "
+		                       "\"http:\\/\\/t.co\\/x\", \"indices\": [10, 32]}]}, "
+		                       "\"in_reply_to_status_id\": null, \"user\": {\"id\": %d, "
+		                       "\"name\": \"User %d\", \"screen_name\": \"user%d\", "
+		                       "\"followers_count\": 1234, \"verified\": false}, "
+		                       "\"retweet_count\": 3, \"favorited\": false, \"lang\": \"en\"}",
+		                       i ? ", " : "", 1000000 + i, 1000000 + i, i, i, i % 50, i % 50, i % 50);
+	}
+	g_string_append(s, "]");
+
+	return s;
+}
+
+int main(int argc, char **argv)
+{
+	char *doc, *buf;
+	gsize len, i;
+	gint64 start, t_parse, t_stream;
+	int rounds, r;
+
+	if (argc > 1) {
+		if (!g_file_get_contents(argv[1], &doc, &len, NULL)) {
+			fprintf(stderr, "Can't read %s\n", argv[1]);
+			return 1;
+		}
+	} else {
+		GString *s = bench_timeline(200);
+		len = s->len;
+		doc = g_string_free(s, FALSE);
+	}
+
+	/* About 100MB worth of JSON either way. */
+	rounds = MAX(1, 100000000 / len);
+	buf = g_malloc(len + 1);
+
+	start = g_get_monotonic_time();
+	for (r = 0; r < rounds; r++) {
+		json_value *v;
+
+		memcpy(buf, doc, len + 1);
+		if (!(v = json_parse(buf, len))) {
+			fprintf(stderr, "json_parse() failed\n");
+			return 1;
+		}
+		json_value_free(v);
+	}
+	t_parse = g_get_monotonic_time() - start;
+
+	start = g_get_monotonic_time();
+	for (r = 0; r < rounds; r++) {
+		json_stream_t *js = json_stream_new_values(1, bench_value, NULL, 0);
+		json_stream_status_t st = JSON_STREAM_MORE;
+
+		/* Like http_client would hand it to us. */
+		memcpy(buf, doc, len + 1);
+		for (i = 0; i < len && st == JSON_STREAM_MORE; i += BENCH_CHUNK) {
+			st = json_stream_feed(js, buf + i, MIN(BENCH_CHUNK, len - i));
+		}
+		if (st != JSON_STREAM_ERROR) {
+			st = json_stream_end(js);
+		}
+		if (st != JSON_STREAM_DONE) {
+			fprintf(stderr, "json_stream failed: %s\n", json_stream_error(js));
+			return 1;
+		}
+		json_stream_free(js);
+	}
+	t_stream = g_get_monotonic_time() - start;
+
+	printf("%" G_GSIZE_FORMAT " bytes, %d rounds, %d values\n", len, rounds, bench_values / rounds);
+	printf("json_parse:  %8.1f MB/s\n", (double) len * rounds / MAX(t_parse, 1));
+	printf("json_stream: %8.1f MB/s\n", (double) len * rounds / MAX(t_stream, 1));
+
+	g_free(buf);
+	g_free(doc);
+	return 0;
+}
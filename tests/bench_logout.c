@@ -0,0 +1,95 @@
+/* Logs out a number of accounts with a lot of contacts each, which used
+   to walk every contact of every account for each one that went away.
+   Not part of the test suite, build it with "make bench" and run it as
+   ./bench_logout [accounts [contacts]]. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <glib.h>
+#include "bitlbee.h"
+
+global_t global;        /* Against global namespace pollution */
+
+double gettime()
+{
+	struct timeval time[1];
+
+	gettimeofday(time, 0);
+	return((double) time->tv_sec + (double) time->tv_usec / 1000000);
+}
+
+void sighandler_shutdown_setup()
+{
+	/* no-op. originally defined in unix.c, needed by bitlbee.c */
+}
+
+static void bench_logout_prpl(struct im_connection *ic)
+{
+}
+
+static struct prpl bench_prpl = {
+	.name = "bench",
+	.logout = bench_logout_prpl,
+	.handle_cmp = g_ascii_strcasecmp,
+};
+
+int main(int argc, char **argv)
+{
+	int accounts = argc > 1 ? atoi(argv[1]) : 10;
+	int contacts = argc > 2 ? atoi(argv[2]) : 2000;
+	struct im_connection **ics;
+	gint64 start, t, slowest = 0;
+	int sock[2], i, j;
+	irc_t *irc;
+
+	b_main_init();
+	global.conf = conf_load(0, NULL);
+	global.conf->runmode = RUNMODE_DAEMON;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sock) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+	irc = irc_new(sock[0]);
+	ics = g_new0(struct im_connection *, accounts);
+
+	start = g_get_monotonic_time();
+	for (i = 0; i < accounts; i++) {
+		char s[32];
+
+		g_snprintf(s, sizeof(s), "user%d", i);
+		ics[i] = imcb_new(account_add(irc->b, &bench_prpl, s, "pass"));
+		for (j = 0; j < contacts; j++) {
+			g_snprintf(s, sizeof(s), "buddy%d_%d", i, j);
+			imcb_add_buddy(ics[i], s, NULL);
+		}
+	}
+	t = g_get_monotonic_time() - start;
+	printf("add     %d x %d contacts %10.1f ms\n", accounts, contacts, t / 1000.0);
+
+	/* Every other one first, so the others are still around while
+	   these go. */
+	start = g_get_monotonic_time();
+	for (i = 0; i < accounts; i++) {
+		int n = i * 2 < accounts ? i * 2 : (i * 2 - accounts) | 1;
+		gint64 one = g_get_monotonic_time();
+
+		imc_logout(ics[n], FALSE);
+		slowest = MAX(slowest, g_get_monotonic_time() - one);
+	}
+	t = g_get_monotonic_time() - start;
+	printf("logout  %d x %d contacts %10.1f ms (slowest account %.1f ms)\n",
+	       accounts, contacts, t / 1000.0, slowest / 1000.0);
+
+	if (irc->b->users != NULL) {
+		fprintf(stderr, "contacts left after logging out everything\n");
+		return 1;
+	}
+
+	g_free(ics);
+
+	return 0;
+}
@@ -0,0 +1,158 @@
+/* Compares the old way of sending an incoming message to the client
+   (strip_html() on a copy, word_wrap() into another copy, then one
+   irc_write() per line) with irc_send_msg_render(), on a few kinds of
+   messages. Not part of the test suite, build it with "make bench". */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <glib.h>
+#include "bitlbee.h"
+
+global_t global;        /* Against global namespace pollution */
+
+double gettime()
+{
+	struct timeval time[1];
+
+	gettimeofday(time, 0);
+	return((double) time->tv_sec + (double) time->tv_usec / 1000000);
+}
+
+void sighandler_shutdown_setup()
+{
+	/* no-op. originally defined in unix.c, needed by bitlbee.c */
+}
+
+static volatile gsize bench_sink;
+
+static char *bench_message(const char *kind)
+{
+	GString *s = g_string_new("");
+	int i;
+
+	if (strcmp(kind, "short") == 0) {
+		g_string_append(s, "hey, are you coming tonight?");
+	} else if (strcmp(kind, "long") == 0) {
+		for (i = 0; i < 40; i++) {
+			g_string_append(s, "the meeting ran late again, ");
+		}
+	} else if (strcmp(kind, "multiline") == 0) {
+		for (i = 0; i < 10; i++) {
+			g_string_append_printf(s, "line %d of a small paste\n", i);
+		}
+	} else if (strcmp(kind, "html") == 0) {
+		for (i = 0; i < 8; i++) {
+			g_string_append(s, "<b>really</b> &amp; <a href=\"https://example.com/\">this</a> &lt;3<br/>");
+		}
+	} else if (strcmp(kind, "utf8") == 0) {
+		for (i = 0; i < 30; i++) {
+			g_string_append(s, "\xc3\xa9t\xc3\xa9 \xe2\x82\xac \xf0\x9f\x98\x80 ");
+		}
+	}
+
+	return g_string_free(s, FALSE);
+}
+
+/* What bee_irc_user_msg() used to do. */
+static void bench_old(irc_user_t *iu, const char *msg, int flags)
+{
+	char *s = g_strdup(msg), *wrapped;
+
+	if (flags & IRC_RENDER_HTML) {
+		strip_html(s);
+	}
+	wrapped = word_wrap(s, IRC_WORD_WRAP);
+	irc_send_msg_ts(iu, "PRIVMSG", "#bitlbee", wrapped, NULL, 0);
+	g_free(wrapped);
+	g_free(s);
+}
+
+static void bench_render(irc_t *irc, irc_user_t *iu, const char *kind, int flags)
+{
+	char *msg = bench_message(kind);
+	gint64 start, t_old, t_new;
+	gsize out_old, out_new;
+	int rounds = 200000, r;
+
+	g_string_truncate(irc->sendbuffer, 0);
+	start = g_get_monotonic_time();
+	for (r = 0; r < rounds; r++) {
+		bench_old(iu, msg, flags);
+		bench_sink += irc->sendbuffer->len;
+		g_string_truncate(irc->sendbuffer, 0);
+	}
+	t_old = g_get_monotonic_time() - start;
+	bench_old(iu, msg, flags);
+	out_old = irc->sendbuffer->len;
+
+	g_string_truncate(irc->sendbuffer, 0);
+	start = g_get_monotonic_time();
+	for (r = 0; r < rounds; r++) {
+		irc_send_msg_render(iu, "PRIVMSG", "#bitlbee", msg, NULL, 0, flags);
+		bench_sink += irc->sendbuffer->len;
+		g_string_truncate(irc->sendbuffer, 0);
+	}
+	t_new = g_get_monotonic_time() - start;
+	irc_send_msg_render(iu, "PRIVMSG", "#bitlbee", msg, NULL, 0, flags);
+	out_new = irc->sendbuffer->len;
+	g_string_truncate(irc->sendbuffer, 0);
+
+	printf("%-10s %5" G_GSIZE_FORMAT " bytes %8.0f msg/s -> %8.0f msg/s (%" G_GSIZE_FORMAT
+	       " -> %" G_GSIZE_FORMAT " bytes out)\n", kind, strlen(msg),
+	       (double) rounds * G_USEC_PER_SEC / MAX(t_old, 1),
+	       (double) rounds * G_USEC_PER_SEC / MAX(t_new, 1), out_old, out_new);
+
+	g_free(msg);
+}
+
+static void bench_strip_html(void)
+{
+	char *msg = bench_message("html"), *buf = g_strdup(msg);
+	gsize len = strlen(msg);
+	gint64 start, t;
+	int rounds = 500000, r;
+
+	start = g_get_monotonic_time();
+	for (r = 0; r < rounds; r++) {
+		memcpy(buf, msg, len + 1);
+		strip_html(buf);
+		bench_sink += buf[0];
+	}
+	t = g_get_monotonic_time() - start;
+
+	printf("%-10s %5" G_GSIZE_FORMAT " bytes %8.1f MB/s\n", "strip_html", len,
+	       (double) len * rounds / MAX(t, 1));
+
+	g_free(buf);
+	g_free(msg);
+}
+
+int main(int argc, char **argv)
+{
+	int sock[2];
+	irc_t *irc;
+	irc_user_t *iu;
+
+	b_main_init();
+	global.conf = conf_load(0, NULL);
+	global.conf->runmode = RUNMODE_DAEMON;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, sock) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+	irc = irc_new(sock[0]);
+	iu = irc_user_new(irc, "alice");
+
+	bench_render(irc, iu, "short", 0);
+	bench_render(irc, iu, "long", 0);
+	bench_render(irc, iu, "multiline", 0);
+	bench_render(irc, iu, "utf8", 0);
+	bench_render(irc, iu, "html", IRC_RENDER_HTML);
+	bench_strip_html();
+
+	return 0;
+}
@@ -0,0 +1,170 @@
+/* Compares the lib/scan.c primitives with the byte-by-byte loops they
+   replaced, on IRC-sized lines and on a big chunk of text (the file given
+   on the command line, or some generated chat). Not part of the test
+   suite, build it with "make bench". */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "scan.h"
+
+static volatile gsize bench_sink;
+
+/* What irc_splitlines() and strip_newlines() used to do. */
+static const char *old_find_newline(const char *s)
+{
+	for (; *s; s++) {
+		if (*s == '\r' || *s == '\n') {
+			return s;
+		}
+	}
+	return NULL;
+}
+
+/* What strip_html() used to do, minus the decoding. */
+static const char *old_find_markup(const char *s)
+{
+	for (; *s; s++) {
+		if (*s == '<' || *s == '&') {
+			return s;
+		}
+	}
+	return NULL;
+}
+
+/* What irc_send_msg_render() used to do: one character at a time. */
+static const char *old_find_special(const char *s)
+{
+	for (; *s; s += g_utf8_skip[(guchar) *s]) {
+		if (*s == '\r' || *s == '\n' || (*s & 0x80)) {
+			return s;
+		}
+	}
+	return NULL;
+}
+
+static GString *bench_text(int lines)
+{
+	static const char *words[] = { "hey", "are", "you", "coming", "tonight?", "I", "think", "so,", "the",
+		                       "meeting", "ran", "late", "again", "-", "https://example.com/a/b", "lol",
+		                       "\xc3\xa9t\xc3\xa9", "ok", "&amp;", "<b>really</b>", NULL };
+	GString *s = g_string_new("");
+	int i, j, n;
+
+	for (n = 0; words[n]; n++) {
+		;
+	}
+	for (i = 0; i < lines; i++) {
+		g_string_append(s, "PRIVMSG #bitlbee :");
+		for (j = 0; j < 8 + (i * 7) % 40; j++) {
+			g_string_append_printf(s, "%s ", words[(i * 31 + j * 17) % n]);
+		}
+		g_string_append(s, "\r\n");
+	}
+
+	return s;
+}
+
+typedef const char *(*bench_old_func)(const char *s);
+typedef const char *(*bench_new_func)(const char *s, gsize len);
+
+static const char *new_find_newline(const char *s, gsize len)
+{
+	return scan_any(s, len, "\r\n");
+}
+
+static const char *new_find_markup(const char *s, gsize len)
+{
+	return scan_any(s, len, "<&");
+}
+
+static const char *new_find_special(const char *s, gsize len)
+{
+	return scan_any_8bit(s, len, "\r\n");
+}
+
+/* Walks through all of text, finding every match one after the other,
+   like the callers do. The new versions count the strlen() too. */
+static void bench_find(const char *name, const char *text, gsize total,
+                       bench_old_func old, bench_new_func new)
+{
+	gint64 start, t_old, t_new;
+	const char *s, *end = text + strlen(text);
+	int rounds = MAX(1, 200000000 / total), r;
+
+	start = g_get_monotonic_time();
+	for (r = 0; r < rounds; r++) {
+		for (s = text; (s = old(s)); s++) {
+			bench_sink++;
+		}
+	}
+	t_old = g_get_monotonic_time() - start;
+
+	start = g_get_monotonic_time();
+	for (r = 0; r < rounds; r++) {
+		end = text + strlen(text);
+		for (s = text; (s = new(s, end - s)); s++) {
+			bench_sink++;
+		}
+	}
+	t_new = g_get_monotonic_time() - start;
+
+	printf("%-16s %8.1f MB/s -> %8.1f MB/s\n", name,
+	       (double) total * rounds / MAX(t_old, 1), (double) total * rounds / MAX(t_new, 1));
+}
+
+static void bench_utf8(const char *name, const char *text, gsize len)
+{
+	gint64 start, t_old, t_new;
+	int rounds = MAX(1, 200000000 / len), r;
+
+	start = g_get_monotonic_time();
+	for (r = 0; r < rounds; r++) {
+		bench_sink += g_utf8_validate(text, len, NULL);
+	}
+	t_old = g_get_monotonic_time() - start;
+
+	start = g_get_monotonic_time();
+	for (r = 0; r < rounds; r++) {
+		bench_sink += scan_utf8_valid(text, len);
+	}
+	t_new = g_get_monotonic_time() - start;
+
+	printf("%-16s %8.1f MB/s -> %8.1f MB/s\n", name,
+	       (double) len * rounds / MAX(t_old, 1), (double) len * rounds / MAX(t_new, 1));
+}
+
+int main(int argc, char **argv)
+{
+	char *doc, *line, *eol;
+	gsize len;
+
+	if (argc > 1) {
+		if (!g_file_get_contents(argv[1], &doc, &len, NULL)) {
+			fprintf(stderr, "Can't read %s\n", argv[1]);
+			return 1;
+		}
+	} else {
+		GString *s = bench_text(20000);
+		len = s->len;
+		doc = g_string_free(s, FALSE);
+	}
+
+	/* One typical line, like irc_process() and irc_send_msg() see them. */
+	eol = strstr(doc, "\r\n");
+	line = g_strndup(doc, eol ? eol - doc : MIN(len, 200));
+
+	printf("%" G_GSIZE_FORMAT " bytes, lines of %" G_GSIZE_FORMAT " bytes\n", len, strlen(line));
+	printf("%-16s %13s    %13s\n", "", "old", "new");
+	bench_find("newlines", doc, len, old_find_newline, new_find_newline);
+	bench_find("markup", doc, len, old_find_markup, new_find_markup);
+	bench_find("markup, line", line, strlen(line), old_find_markup, new_find_markup);
+	bench_find("render, line", line, strlen(line), old_find_special, new_find_special);
+	bench_utf8("UTF-8", doc, len);
+	bench_utf8("UTF-8, line", line, strlen(line));
+
+	g_free(line);
+	g_free(doc);
+	return 0;
+}
@@ -0,0 +1,265 @@
+/* Counts allocations per stanza when parsing an XMPP stream with and
+   without xt_parser.arena_depth, and when building outgoing packets. Also
+   times dispatching stanzas to handlers and the lookups they do. Feed
+   it a recorded session (everything the server sent, for example from
+   BITLBEE_DEBUG output) or it uses a small built-in one. Build it with
+   "make bench". Counting works by wrapping malloc() and friends, which
+   only works with glibc. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+#include "xmltree.h"
+
+#define BENCH_CHUNK 4096
+
+static long bench_allocs;
+static int bench_stanzas;
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t n, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+void *malloc(size_t size)
+{
+	bench_allocs++;
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t n, size_t size)
+{
+	bench_allocs++;
+	return __libc_calloc(n, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	bench_allocs++;
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	__libc_free(ptr);
+}
+
+static const char bench_header[] =
+	"<?xml version='1.0'?><stream:stream xmlns='jabber:client' "
+	"xmlns:stream='http://etherx.jabber.org/streams' id='4242' from='example.com' "
+	"version='1.0' xml:lang='en'>";
+
+static const char bench_session[] =
+	"<stream:features><bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'/>"
+	"<session xmlns='urn:ietf:params:xml:ns:xmpp-session'><optional/></session>"
+	"<sm xmlns='urn:xmpp:sm:3'/><c xmlns='http://jabber.org/protocol/caps' hash='sha-1' "
+	"node='http://prosody.im' ver='abcdefghijklmnopqrstuvwxyz0='/></stream:features>"
+	"<iq type='result' id='BeeX00001'><bind xmlns='urn:ietf:params:xml:ns:xmpp-bind'>"
+	"<jid>user@example.com/BitlBee-1234</jid></bind></iq>"
+	"<iq type='result' id='BeeX00002' to='user@example.com/BitlBee-1234'>"
+	"<query xmlns='jabber:iq:roster' ver='42'>"
+	"<item jid='alice@example.com' subscription='both' name='Alice'><group>Friends</group></item>"
+	"<item jid='bob@example.org' subscription='both'><group>Work</group></item>"
+	"<item jid='carol@example.net' subscription='to' name='Carol'/>"
+	"</query></iq>"
+	"<presence from='alice@example.com/phone' to='user@example.com/BitlBee-1234'>"
+	"<show>away</show><status>On the road</status><priority>5</priority>"
+	"<c xmlns='http://jabber.org/protocol/caps' hash='sha-1' node='http://conversations.im' "
+	"ver='np49gv/zJSk2oPK/mPy3qqeXJqg='/>"
+	"<delay xmlns='urn:xmpp:delay' from='example.com' stamp='2012-06-01T12:00:00Z'/></presence>"
+	"<presence from='bob@example.org/laptop' to='user@example.com/BitlBee-1234'>"
+	"<priority>1</priority><x xmlns='vcard-temp:x:update'><photo>0123456789abcdef</photo></x>"
+	"</presence>"
+	"<message from='alice@example.com/phone' to='user@example.com/BitlBee-1234' type='chat' "
+	"id='purple1234'><active xmlns='http://jabber.org/protocol/chatstates'/>"
+	"<body>Hey, are you coming tonight? &lt;3</body>"
+	"<request xmlns='urn:xmpp:receipts'/><markable xmlns='urn:xmpp:chat-markers:0'/>"
+	"<origin-id xmlns='urn:xmpp:sid:0' id='0f1e2d3c-4b5a-6978-8796-a5b4c3d2e1f0'/></message>"
+	"<message from='alice@example.com/phone' to='user@example.com/BitlBee-1234' type='chat'>"
+	"<composing xmlns='http://jabber.org/protocol/chatstates'/></message>"
+	"<iq type='get' from='example.com' to='user@example.com/BitlBee-1234' id='ping1'>"
+	"<ping xmlns='urn:xmpp:ping'/></iq>"
+	"<r xmlns='urn:xmpp:sm:3'/>";
+
+static xt_status bench_handler(struct xt_node *node, gpointer data)
+{
+	bench_stanzas++;
+	return XT_HANDLED;
+}
+
+static const struct xt_handler_entry bench_handlers[] = {
+	{ NULL, "stream:stream", bench_handler },
+	{ NULL, NULL, NULL }
+};
+
+static void bench_parse(const char *doc, gsize len, int arena_depth, int rounds)
+{
+	gint64 start = g_get_monotonic_time();
+	long allocs = bench_allocs;
+	int r;
+	gsize i;
+
+	bench_stanzas = 0;
+	for (r = 0; r < rounds; r++) {
+		struct xt_parser *xt = xt_new(bench_handlers, NULL);
+
+		xt->arena_depth = arena_depth;
+
+		/* Like jabber_read_callback() does it. */
+		for (i = 0; i < len; i += BENCH_CHUNK) {
+			if (xt_feed(xt, doc + i, MIN(BENCH_CHUNK, len - i)) < 0) {
+				fprintf(stderr, "Parse error\n");
+				exit(1);
+			}
+			xt_handle(xt, NULL, 1);
+			xt_cleanup(xt, NULL, 1);
+		}
+
+		xt_free(xt);
+	}
+
+	printf("Incoming, %-9s %6.1f allocations per stanza, %6.2f µs per stanza\n",
+	       arena_depth >= 0 ? "arena:" : "no arena:",
+	       (double) (bench_allocs - allocs) / MAX(bench_stanzas, 1),
+	       (double) (g_get_monotonic_time() - start) / MAX(bench_stanzas, 1));
+}
+
+/* Roughly the lookups the jabber handlers do. */
+static xt_status bench_lookup(struct xt_node *node, gpointer data)
+{
+	struct xt_node *c;
+	int *found = data;
+
+	*found += xt_find_attr(node, "from") != NULL;
+	*found += xt_find_attr(node, "type") != NULL;
+	*found += xt_find_attr(node, "id") != NULL;
+	*found += xt_find_node(node->children, "body") != NULL;
+	*found += xt_find_node(node->children, "show") != NULL;
+	*found += xt_find_node_by_attr(node->children, "c", "xmlns",
+	                               "http://jabber.org/protocol/caps") != NULL;
+
+	if ((c = xt_find_node(node->children, "query")) && xt_find_attr(c, "xmlns")) {
+		for (c = c->children; (c = xt_find_node(c, "item")); c = c->next) {
+			*found += xt_find_attr(c, "jid") != NULL;
+		}
+	}
+
+	return XT_HANDLED;
+}
+
+/* Same names as jabber_handlers[]. */
+static const struct xt_handler_entry bench_dispatch_handlers[] = {
+	{ "stream:stream",      "<root>",               bench_lookup },
+	{ "message",            "stream:stream",        bench_lookup },
+	{ "presence",           "stream:stream",        bench_lookup },
+	{ "iq",                 "stream:stream",        bench_lookup },
+	{ "stream:features",    "stream:stream",        bench_lookup },
+	{ "stream:error",       "stream:stream",        bench_lookup },
+	{ "proceed",            "stream:stream",        bench_lookup },
+	{ "challenge",          "stream:stream",        bench_lookup },
+	{ "success",            "stream:stream",        bench_lookup },
+	{ "compressed",         "stream:stream",        bench_lookup },
+	{ "failure",            "stream:stream",        bench_lookup },
+	{ "failure",            "stream:stream",        bench_lookup },
+	{ "r",                  "stream:stream",        bench_lookup },
+	{ "a",                  "stream:stream",        bench_lookup },
+	{ "enabled",            "stream:stream",        bench_lookup },
+	{ "resumed",            "stream:stream",        bench_lookup },
+	{ "failed",             "stream:stream",        bench_lookup },
+	{ NULL,                 NULL,                   NULL }
+};
+
+static void bench_dispatch(int rounds)
+{
+	char *doc = g_strconcat(bench_header, bench_session, "</stream:stream>", NULL);
+	struct xt_node *root = xt_from_string(doc, 0), *c;
+	int found = 0, n = 0, r;
+	struct xt_parser *xt;
+	gint64 start;
+
+	xt = xt_new(bench_dispatch_handlers, &found);
+	xt->root = root;
+
+	start = g_get_monotonic_time();
+	for (r = 0; r < rounds; r++) {
+		for (c = root->children; c; c = c->next) {
+			c->flags &= ~XT_SEEN;
+			xt_handle(xt, c, 0);
+			n++;
+		}
+	}
+
+	printf("Dispatch:           %6.3f µs per stanza (%d lookups hit)\n",
+	       (double) (g_get_monotonic_time() - start) / n, found / rounds);
+
+	xt->root = NULL;
+	xt_free(xt);
+	xt_free_node(root);
+	g_free(doc);
+}
+
+/* What jabber_make_packet() and friends do for a typical message. */
+static void bench_build(int rounds)
+{
+	gint64 start = g_get_monotonic_time();
+	long allocs = bench_allocs;
+	int r;
+
+	for (r = 0; r < rounds; r++) {
+		struct xt_node *node, *c;
+		char *s;
+
+		c = xt_new_node("active", NULL, NULL);
+		xt_add_attr(c, "xmlns", "http://jabber.org/protocol/chatstates");
+		node = xt_new_node("message", NULL, xt_new_node("body", "Sure, see you there!", NULL));
+		xt_add_child(node, c);
+		xt_add_attr(node, "type", "chat");
+		xt_add_attr(node, "to", "alice@example.com/phone");
+		xt_add_attr(node, "id", "BeeX00003");
+		xt_add_attr(node, "xml:lang", "en");
+
+		s = xt_to_string(node);
+		g_free(s);
+		xt_free_node(node);
+	}
+
+	printf("Outgoing:           %6.1f allocations per stanza, %6.2f µs per stanza\n",
+	       (double) (bench_allocs - allocs) / rounds,
+	       (double) (g_get_monotonic_time() - start) / rounds);
+}
+
+int main(int argc, char **argv)
+{
+	char *doc;
+	gsize len;
+	int rounds;
+
+	if (argc > 1) {
+		if (!g_file_get_contents(argv[1], &doc, &len, NULL)) {
+			fprintf(stderr, "Can't read %s\n", argv[1]);
+			return 1;
+		}
+	} else {
+		GString *s = g_string_new(bench_header);
+		int i;
+
+		for (i = 0; i < 100; i++) {
+			g_string_append(s, bench_session);
+		}
+		len = s->len;
+		doc = g_string_free(s, FALSE);
+	}
+
+	/* About 50MB worth of XML. */
+	rounds = MAX(1, 50000000 / len);
+
+	printf("%" G_GSIZE_FORMAT " bytes, %d rounds\n", len, rounds);
+	bench_parse(doc, len, -1, rounds);
+	bench_parse(doc, len, 1, rounds);
+	bench_build(100000);
+	bench_dispatch(200000);
+
+	g_free(doc);
+	return 0;
+}
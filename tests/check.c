@@ -78,6 +78,36 @@ Suite *jabber_sasl_suite(void);
 /* From check_jabber_sasl.c */
 Suite *jabber_util_suite(void);
 
+/* From check_ft.c */
+Suite *ft_suite(void);
+
+/* From check_auth.c */
+Suite *auth_suite(void);
+
+/* From check_login.c */
+Suite *login_suite(void);
+
+/* From check_handle.c */
+Suite *handle_suite(void);
+
+/* From check_json_stream.c */
+Suite *json_stream_suite(void);
+
+/* From check_xmltree.c */
+Suite *xmltree_suite(void);
+
+/* From check_scan.c */
+Suite *scan_suite(void);
+
+/* From check_bee_queue.c */
+Suite *bee_queue_suite(void);
+
+/* From check_http_client.c */
+Suite *http_client_suite(void);
+
+/* From check_backlog.c */
+Suite *backlog_suite(void);
+
 int main(int argc, char **argv)
 {
 	int nf;
@@ -126,6 +156,16 @@ int main(int argc, char **argv)
 	srunner_add_suite(sr, set_suite());
 	srunner_add_suite(sr, jabber_sasl_suite());
 	srunner_add_suite(sr, jabber_util_suite());
+	srunner_add_suite(sr, ft_suite());
+	srunner_add_suite(sr, auth_suite());
+	srunner_add_suite(sr, login_suite());
+	srunner_add_suite(sr, handle_suite());
+	srunner_add_suite(sr, json_stream_suite());
+	srunner_add_suite(sr, xmltree_suite());
+	srunner_add_suite(sr, scan_suite());
+	srunner_add_suite(sr, bee_queue_suite());
+	srunner_add_suite(sr, http_client_suite());
+	srunner_add_suite(sr, backlog_suite());
 	if (no_fork) {
 		srunner_set_fork_status(sr, CK_NOFORK);
 	}
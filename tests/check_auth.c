@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include <glib.h>
+#include <gmodule.h>
+#include <check.h>
+#include <string.h>
+#include <unistd.h>
+#include "bitlbee.h"
+#include "testsuite.h"
+
+double gettime(void);
+
+/* Stands in for a slow directory server. */
+#define FAKE_LATENCY 200000
+
+static storage_status_t fake_check_pass(const char *nick, const char *password)
+{
+	usleep(FAKE_LATENCY);
+	return strcmp(password, "secret") == 0 ? STORAGE_OK : STORAGE_INVALID_PASSWORD;
+}
+
+static auth_backend_t auth_fake = {
+	.name = "fake",
+	.check_pass = fake_check_pass,
+};
+
+static int checks_done, checks_wanted, ticks;
+static storage_status_t results[4];
+
+static void check_done(storage_status_t status, gpointer data)
+{
+	results[GPOINTER_TO_INT(data)] = status;
+	if (++checks_done == checks_wanted) {
+		b_main_quit();
+	}
+}
+
+static gboolean check_tick(gpointer data, gint fd, b_input_condition cond)
+{
+	ticks++;
+	return TRUE;
+}
+
+static void check_auth_setup(void)
+{
+	global.auth = g_list_append(NULL, &auth_fake);
+	global.conf->auth_workers = 2;
+	global.conf->auth_cache_timeout = 0;
+	checks_done = ticks = 0;
+	checks_wanted = 4;
+}
+
+START_TEST(test_check_async)
+{
+	double start;
+	gint tick;
+
+	check_auth_setup();
+	tick = b_timeout_add(10, check_tick, NULL);
+	start = gettime();
+
+	auth_backend_check("fake", "wilmer", "secret", check_done, GINT_TO_POINTER(0));
+	auth_backend_check("fake", "wilmer", "wrong", check_done, GINT_TO_POINTER(1));
+	auth_backend_check("fake", "dx", "secret", check_done, GINT_TO_POINTER(2));
+	auth_backend_check("fake", "dx", "", check_done, GINT_TO_POINTER(3));
+	fail_unless(checks_done == 0, "Checks shouldn't block the caller");
+
+	b_main_run();
+	b_event_remove(tick);
+
+	fail_unless(results[0] == STORAGE_OK);
+	fail_unless(results[1] == STORAGE_INVALID_PASSWORD);
+	fail_unless(results[2] == STORAGE_OK);
+	fail_unless(results[3] == STORAGE_INVALID_PASSWORD);
+
+	/* Two workers, so about twice the latency and not four times. */
+	fail_unless(gettime() - start < 3.5 * FAKE_LATENCY / 1000000.0,
+	            "Checks don't seem to run in parallel");
+	fail_unless(ticks > 5, "Event loop was blocked");
+}
+END_TEST
+
+START_TEST(test_check_cache)
+{
+	check_auth_setup();
+	global.conf->auth_cache_timeout = 60;
+	checks_wanted = 2;
+
+	auth_backend_check("fake", "wilmer", "secret", check_done, GINT_TO_POINTER(0));
+	auth_backend_check("fake", "wilmer", "wrong", check_done, GINT_TO_POINTER(1));
+	b_main_run();
+	fail_unless(results[0] == STORAGE_OK);
+	fail_unless(results[1] == STORAGE_INVALID_PASSWORD);
+
+	/* Only the right password for the right user is remembered. */
+	auth_backend_check("fake", "wilmer", "secret", check_done, GINT_TO_POINTER(2));
+	fail_unless(checks_done == 3 && results[2] == STORAGE_OK, "Cache miss");
+
+	auth_backend_check("fake", "wilmer", "wrong", check_done, GINT_TO_POINTER(3));
+	auth_backend_check("fake", "dx", "secret", check_done, GINT_TO_POINTER(3));
+	fail_unless(checks_done == 3, "Cache hit for the wrong password or user");
+}
+END_TEST
+
+static storage_status_t pass_status;
+
+/* Whatever the client has been sent so far. */
+static char *check_pass_read(irc_t *irc, GIOChannel *ch)
+{
+	GString *out = g_string_new("");
+	char buf[1024];
+	int i, st;
+
+	for (i = 0; i < 5; i++) {
+		b_main_iteration();
+		while ((st = read(g_io_channel_unix_get_fd(ch), buf, sizeof(buf))) > 0) {
+			g_string_append_len(out, buf, st);
+		}
+	}
+
+	return g_string_free(out, FALSE);
+}
+
+static void check_pass_done(irc_t *irc, storage_status_t status, gpointer data)
+{
+	pass_status = status;
+	b_main_quit();
+}
+
+START_TEST(test_check_pass_nick)
+{
+	GIOChannel *ch1, *ch2;
+	irc_t *irc;
+	char *raw;
+
+	check_auth_setup();
+	global.conf->auth_backend = "fake";
+
+	fail_unless(g_io_channel_pair(&ch1, &ch2));
+	g_io_channel_set_flags(ch1, G_IO_FLAG_NONBLOCK, NULL);
+	g_io_channel_set_flags(ch2, G_IO_FLAG_NONBLOCK, NULL);
+	irc = irc_new(g_io_channel_unix_get_fd(ch1));
+	fail_unless(g_io_channel_write_chars(ch2, "NICK bla\r\nUSER a a a a\r\n", -1, NULL,
+	                                     NULL) == G_IO_STATUS_NORMAL);
+	fail_unless(g_io_channel_flush(ch2, NULL) == G_IO_STATUS_NORMAL);
+	g_free(check_pass_read(irc, ch2));
+
+	pass_status = STORAGE_OTHER_ERROR;
+	auth_check_pass(irc, "bla", "secret", check_pass_done, NULL, NULL);
+	fail_unless(irc->status & USTATUS_AUTH_PENDING);
+
+	/* No switching to someone else's nick while the check runs.. */
+	fail_unless(g_io_channel_write_chars(ch2, "NICK victim\r\n", -1, NULL,
+	                                     NULL) == G_IO_STATUS_NORMAL);
+	fail_unless(g_io_channel_flush(ch2, NULL) == G_IO_STATUS_NORMAL);
+	raw = check_pass_read(irc, ch2);
+	fail_unless(strcmp(irc->user->nick, "bla") == 0);
+	fail_unless(strstr(raw, " 437 ") != NULL, "%s", raw);
+	g_free(raw);
+
+	/* ..and if the nick changes anyway, the answer doesn't count. */
+	irc_user_set_nick(irc->user, "victim");
+	b_main_run();
+	fail_unless(pass_status == STORAGE_INVALID_PASSWORD, "status: %d", pass_status);
+	fail_if(irc->status & USTATUS_AUTH_PENDING);
+	fail_unless(irc->password == NULL);
+
+	global.conf->auth_backend = NULL;
+	irc_free(irc);
+}
+END_TEST
+
+Suite *auth_suite(void)
+{
+	Suite *s = suite_create("Auth");
+	TCase *tc_core = tcase_create("Core");
+
+	suite_add_tcase(s, tc_core);
+	tcase_add_test(tc_core, test_check_async);
+	tcase_add_test(tc_core, test_check_cache);
+	tcase_add_test(tc_core, test_check_pass_nick);
+	return s;
+}
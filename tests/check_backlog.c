@@ -0,0 +1,201 @@
+#include <stdlib.h>
+#include <glib.h>
+#include <gmodule.h>
+#include <check.h>
+#include <string.h>
+#include <stdio.h>
+#include "bitlbee.h"
+#include "testsuite.h"
+
+static irc_t *test_backlog_irc(int limit)
+{
+	GIOChannel *ch1, *ch2;
+	irc_t *irc;
+
+	fail_unless(g_io_channel_pair(&ch1, &ch2));
+	g_io_channel_set_flags(ch1, G_IO_FLAG_NONBLOCK, NULL);
+	g_io_channel_set_flags(ch2, G_IO_FLAG_NONBLOCK, NULL);
+
+	irc = irc_new(g_io_channel_unix_get_fd(ch1));
+	fail_unless(g_io_channel_write_chars(ch2, "NICK bla\r\nUSER a a a a\r\n", -1, NULL,
+	                                     NULL) == G_IO_STATUS_NORMAL);
+	fail_unless(g_io_channel_flush(ch2, NULL) == G_IO_STATUS_NORMAL);
+	b_main_iteration();
+
+	set_setint(&irc->b->set, "backlog", limit);
+	set_setstr(&irc->b->set, "display_timestamps", "false");
+
+	return irc;
+}
+
+static void test_backlog_add(irc_t *irc, int n, const char *msg)
+{
+	char *s = g_strdup_printf("message %d: %s", n, msg);
+
+	irc_backlog_add(irc, irc->root, "PRIVMSG", "bla", s, NULL, 0, 0);
+	g_free(s);
+}
+
+/* Replays into an empty sendbuffer and returns what it'd send. */
+static char *test_backlog_replay(irc_t *irc)
+{
+	g_string_truncate(irc->sendbuffer, 0);
+	irc_backlog_replay(irc);
+	return g_strdup(irc->sendbuffer->str);
+}
+
+START_TEST(test_backlog_replay_order)
+{
+	irc_t *irc = test_backlog_irc(65536);
+	char *out, *s, num[32];
+	int i;
+
+	/* Enough for a few blocks, and some left in the tail. */
+	for (i = 0; i < 500; i++) {
+		test_backlog_add(irc, i, "some text that looks a lot like the text before it");
+	}
+	out = test_backlog_replay(irc);
+
+	fail_unless(strstr(out, "Replaying 500 messages") != NULL, "%s", out);
+	fail_unless(strstr(out, "didn't fit") == NULL);
+	for (i = 0, s = out; i < 500; i++) {
+		g_snprintf(num, sizeof(num), ":message %d: ", i);
+		fail_unless((s = strstr(s, num)) != NULL, "message %d missing or out of order", i);
+	}
+	fail_unless(irc->backlog == NULL);
+	fail_unless(irc_backlog_size(irc, NULL) == 0);
+
+	g_free(out);
+	irc_free(irc);
+}
+END_TEST
+
+START_TEST(test_backlog_compress)
+{
+	irc_t *irc = test_backlog_irc(65536);
+	gsize size, raw;
+	char *out;
+	int i;
+
+	for (i = 0; i < 400; i++) {
+		test_backlog_add(irc, i, "the same boring line, over and over and over again");
+	}
+	size = irc_backlog_size(irc, &raw);
+	fail_unless(size <= 65536);
+#ifdef WITH_ZLIB
+	fail_unless(size < raw / 2, "%" G_GSIZE_FORMAT " bytes for %" G_GSIZE_FORMAT, size, raw);
+#else
+	fail_unless(size == raw);
+#endif
+
+	/* Every message still comes out in one piece. */
+	out = test_backlog_replay(irc);
+	fail_unless(strstr(out, ":message 0: the same boring line, over and over and over again\r\n") != NULL);
+	fail_unless(strstr(out, ":message 399: the same boring line, over and over and over again\r\n") != NULL);
+
+	g_free(out);
+	irc_free(irc);
+}
+END_TEST
+
+START_TEST(test_backlog_trim)
+{
+	irc_t *irc = test_backlog_irc(4096);
+	char *out;
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		char *msg = g_strdup_printf("%08x%08x", g_random_int(), g_random_int());
+
+		test_backlog_add(irc, i, msg);
+		fail_unless(irc_backlog_size(irc, NULL) <= 4096);
+		g_free(msg);
+	}
+
+	/* The oldest ones are gone, the newest ones are all there. */
+	out = test_backlog_replay(irc);
+	fail_unless(strstr(out, "didn't fit") != NULL);
+	fail_unless(strstr(out, ":message 0: ") == NULL);
+	fail_unless(strstr(out, ":message 990: ") != NULL);
+	fail_unless(strstr(out, ":message 999: ") != NULL);
+
+	g_free(out);
+	irc_free(irc);
+}
+END_TEST
+
+START_TEST(test_backlog_oversized)
+{
+	irc_t *irc = test_backlog_irc(8192);
+	char *big, *out, *s;
+	int i;
+
+	for (i = 0; i < 5; i++) {
+		test_backlog_add(irc, i, "small");
+	}
+
+	/* Way more than the whole backlog even when compressed, with UTF-8
+	   characters so it can't be cut just anywhere. */
+	big = g_strnfill(20000, 'x');
+	for (i = 0; i < 20000; i++) {
+		big[i] = 'a' + g_random_int_range(0, 26);
+	}
+	for (i = 0; i + 1 < 20000; i += 7) {
+		big[i] = '\xc3';
+		big[i + 1] = '\xa9';
+	}
+	test_backlog_add(irc, 5, big);
+	test_backlog_add(irc, 6, "after");
+	fail_unless(irc_backlog_size(irc, NULL) <= 8192);
+
+	out = test_backlog_replay(irc);
+	fail_unless(strstr(out, "Replaying 7 messages") != NULL, "%s", out);
+	fail_unless(strstr(out, ":message 0: small\r\n") != NULL);
+	fail_unless(strstr(out, ":message 4: small\r\n") != NULL);
+	fail_unless(strstr(out, ":message 5: ") != NULL);
+	fail_unless(strstr(out, ":message 6: after\r\n") != NULL);
+	fail_unless(g_utf8_validate(out, -1, NULL));
+
+	/* Cut short, not dropped. */
+	s = strstr(out, ":message 5: ");
+	fail_unless(strlen(s) < strlen(big));
+
+	g_free(big);
+	g_free(out);
+	irc_free(irc);
+}
+END_TEST
+
+START_TEST(test_backlog_lower_limit)
+{
+	irc_t *irc = test_backlog_irc(65536);
+	char *out;
+	int i;
+
+	for (i = 0; i < 500; i++) {
+		test_backlog_add(irc, i, "some text that looks a lot like the text before it");
+	}
+	set_setint(&irc->b->set, "backlog", 2048);
+	fail_unless(irc_backlog_size(irc, NULL) <= 2048);
+
+	out = test_backlog_replay(irc);
+	fail_unless(strstr(out, ":message 499: ") != NULL);
+
+	g_free(out);
+	irc_free(irc);
+}
+END_TEST
+
+Suite *backlog_suite(void)
+{
+	Suite *s = suite_create("Backlog");
+	TCase *tc_core = tcase_create("Core");
+
+	suite_add_tcase(s, tc_core);
+	tcase_add_test(tc_core, test_backlog_replay_order);
+	tcase_add_test(tc_core, test_backlog_compress);
+	tcase_add_test(tc_core, test_backlog_trim);
+	tcase_add_test(tc_core, test_backlog_oversized);
+	tcase_add_test(tc_core, test_backlog_lower_limit);
+	return s;
+}
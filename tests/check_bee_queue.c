@@ -0,0 +1,153 @@
+#include <stdlib.h>
+#include <glib.h>
+#include <gmodule.h>
+#include <check.h>
+#include <string.h>
+#include "bitlbee.h"
+#include "testsuite.h"
+
+static GString *sent;
+
+static int test_queue_buddy_msg(struct im_connection *ic, char *to, char *message, int flags)
+{
+	g_string_append_printf(sent, "%s:%s|", to, message);
+	return 1;
+}
+
+static gboolean test_queue_quit(gpointer data, gint fd, b_input_condition cond)
+{
+	b_main_quit();
+	return FALSE;
+}
+
+static struct prpl test_queue_prpl;
+static struct im_connection test_queue_ic;
+
+static void test_queue_setup(account_t *a, const char *rate, const char *burst)
+{
+	memset(a, 0, sizeof(*a));
+	test_queue_prpl.buddy_msg = test_queue_buddy_msg;
+	test_queue_prpl.handle_cmp = g_strcasecmp;
+	test_queue_prpl.options = PRPL_OPT_MULTILINE_MSG;
+	a->prpl = &test_queue_prpl;
+	a->ic = &test_queue_ic;
+	set_add(&a->set, "send_burst", burst, set_eval_int, a);
+	set_add(&a->set, "send_rate", rate, set_eval_send_rate, a);
+	sent = g_string_new("");
+}
+
+static void test_queue_teardown(account_t *a)
+{
+	bee_queue_free(a);
+	set_del(&a->set, "send_rate");
+	set_del(&a->set, "send_burst");
+	g_string_free(sent, TRUE);
+}
+
+START_TEST(test_queue_unlimited)
+{
+	account_t a;
+	int i;
+
+	test_queue_setup(&a, "0", "1");
+	for (i = 0; i < 20; i++) {
+		fail_unless(bee_queue_msg(&a, "x", g_strdup("hi"), 0) == 1);
+	}
+	fail_unless(sent->len == 20 * strlen("x:hi|"), "sent: %s", sent->str);
+	fail_unless(a.sendq == NULL);
+
+	test_queue_teardown(&a);
+}
+END_TEST
+
+START_TEST(test_queue_burst)
+{
+	account_t a;
+
+	test_queue_setup(&a, "60", "2");
+	bee_queue_msg(&a, "x", g_strdup("1"), 0);
+	bee_queue_msg(&a, "x", g_strdup("2"), 0);
+	bee_queue_msg(&a, "x", g_strdup("3"), 0);
+	bee_queue_msg(&a, "y", g_strdup("4"), 0);
+	fail_unless(strcmp(sent->str, "x:1|x:2|") == 0, "sent: %s", sent->str);
+	fail_unless(a.sendq->sent == 2);
+	fail_unless(a.sendq->queued == 2);
+	fail_unless(a.sendq->timer != 0);
+
+	/* Switching the limit off flushes the queue, in order. */
+	set_setstr(&a.set, "send_rate", "0");
+	b_timeout_add(10, test_queue_quit, NULL);
+	b_main_run();
+	fail_unless(strcmp(sent->str, "x:1|x:2|x:3|y:4|") == 0, "sent: %s", sent->str);
+	fail_unless(a.sendq->timer == 0);
+
+	test_queue_teardown(&a);
+}
+END_TEST
+
+START_TEST(test_queue_refill)
+{
+	account_t a;
+
+	test_queue_setup(&a, "60", "2");
+	bee_queue_msg(&a, "x", g_strdup("1"), 0);
+	bee_queue_msg(&a, "x", g_strdup("2"), 0);
+	fail_unless(a.sendq->tokens < 1);
+
+	/* A second at 60 per minute is worth one more message. */
+	a.sendq->last_refill -= G_USEC_PER_SEC;
+	bee_queue_msg(&a, "x", g_strdup("3"), 0);
+	fail_unless(strcmp(sent->str, "x:1|x:2|x:3|") == 0, "sent: %s", sent->str);
+	bee_queue_msg(&a, "x", g_strdup("4"), 0);
+	fail_unless(a.sendq->queued == 1);
+
+	/* But an hour never gives more than a burst. */
+	bee_queue_clear(&a);
+	a.sendq->last_refill -= (gint64) 3600 * G_USEC_PER_SEC;
+	bee_queue_msg(&a, "x", g_strdup("5"), 0);
+	fail_unless(a.sendq->tokens <= 1, "tokens: %f", a.sendq->tokens);
+
+	test_queue_teardown(&a);
+}
+END_TEST
+
+START_TEST(test_queue_coalesce)
+{
+	const char *expect = "x:1|x:2\n3|x:?OTR:AAMG.|x:?OTR:AAMH.|x:hello ";
+	account_t a;
+
+	test_queue_setup(&a, "60", "1");
+	bee_queue_msg(&a, "x", g_strdup("1"), 0);
+	bee_queue_msg(&a, "x", g_strdup("2"), 0);
+	bee_queue_msg(&a, "X", g_strdup("3"), 0);
+	fail_unless(a.sendq->queued == 1);
+	fail_unless(a.sendq->coalesced == 1);
+
+	/* Never anything with OTR in it. */
+	bee_queue_msg(&a, "x", g_strdup("?OTR:AAMG."), 0);
+	bee_queue_msg(&a, "x", g_strdup("?OTR:AAMH."), 0);
+	bee_queue_msg(&a, "x", g_strdup("hello \t  \t\t\t\t \t \t \t    \t\t  \t "), 0);
+	fail_unless(a.sendq->queued == 4);
+	fail_unless(a.sendq->coalesced == 1);
+
+	set_setstr(&a.set, "send_rate", "0");
+	b_timeout_add(10, test_queue_quit, NULL);
+	b_main_run();
+	fail_unless(strncmp(sent->str, expect, strlen(expect)) == 0, "sent: %s", sent->str);
+
+	test_queue_teardown(&a);
+}
+END_TEST
+
+Suite *bee_queue_suite(void)
+{
+	Suite *s = suite_create("Queue");
+	TCase *tc_core = tcase_create("Core");
+
+	suite_add_tcase(s, tc_core);
+	tcase_add_test(tc_core, test_queue_unlimited);
+	tcase_add_test(tc_core, test_queue_burst);
+	tcase_add_test(tc_core, test_queue_refill);
+	tcase_add_test(tc_core, test_queue_coalesce);
+	return s;
+}
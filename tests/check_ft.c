@@ -0,0 +1,219 @@
+#include <stdlib.h>
+#include <glib.h>
+#include <gmodule.h>
+#include <check.h>
+#include <string.h>
+#include "bitlbee.h"
+#include "ft.h"
+#include "testsuite.h"
+
+#define TEST_FT_SIZE (1024 * 1024 + 123)
+
+/* Plays both ends of a transfer going through the relay: the receiver
+   handing over data (or having its socket spliced), and a client on the
+   other end that reads a bit slower than the relay writes. */
+static struct {
+	file_transfer_t ft;
+	ft_relay_t *relay;
+	int out[2], in[2];
+	size_t produced, sent, drained, done;
+} t;
+
+static void test_ft_pattern(char *buf, size_t ofs, size_t len)
+{
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		buf[i] = (ofs + i) % 251;
+	}
+}
+
+static void test_ft_sent(file_transfer_t *ft, unsigned int len)
+{
+	t.sent += len;
+}
+
+static void test_ft_error(file_transfer_t *ft, const char *msg)
+{
+	fail("Relay failed: %s", msg);
+}
+
+static gboolean test_ft_drain(gpointer data, gint fd, b_input_condition cond)
+{
+	char buf[4096], expect[4096];
+	ssize_t st;
+
+	if ((st = read(fd, buf, sizeof(buf))) < 0 && sockerr_again()) {
+		return TRUE;
+	}
+	fail_unless(st > 0, "Relay closed the connection after %zd bytes", t.drained);
+
+	test_ft_pattern(expect, t.drained, st);
+	fail_unless(memcmp(buf, expect, st) == 0, "Data corrupted near offset %zd", t.drained);
+	t.drained += st;
+
+	if (t.drained >= TEST_FT_SIZE) {
+		b_main_quit();
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static void test_ft_setup(gboolean small)
+{
+	int bufsize = 4096;
+
+	memset(&t, 0, sizeof(t));
+	fail_if(socketpair(AF_UNIX, SOCK_STREAM, 0, t.out) < 0);
+	fail_if(socketpair(AF_UNIX, SOCK_STREAM, 0, t.in) < 0);
+
+	/* Small buffers, so most writes are partial. */
+	if (small) {
+		setsockopt(t.out[0], SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+		setsockopt(t.out[1], SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+	}
+
+	sock_make_nonblocking(t.out[0]);
+	sock_make_nonblocking(t.out[1]);
+	sock_make_nonblocking(t.in[0]);
+	sock_make_nonblocking(t.in[1]);
+
+	t.ft.file_size = TEST_FT_SIZE;
+	t.relay = ft_relay_new(&t.ft, t.out[0], test_ft_sent, test_ft_error);
+
+	b_input_add(t.out[1], B_EV_IO_READ, test_ft_drain, NULL);
+}
+
+static void test_ft_teardown(void)
+{
+	ft_relay_free(t.relay);
+	closesocket(t.out[0]);
+	closesocket(t.out[1]);
+	closesocket(t.in[0]);
+	closesocket(t.in[1]);
+}
+
+static gboolean test_ft_write_request(file_transfer_t *ft)
+{
+	size_t n = MIN(sizeof(ft->buffer), ft->file_size - t.produced);
+
+	test_ft_pattern(ft->buffer, t.produced, n);
+	t.produced += n;
+
+	return ft_relay_write(t.relay, ft->buffer, n);
+}
+
+START_TEST(test_relay_write)
+{
+	test_ft_setup(TRUE);
+	t.ft.write_request = test_ft_write_request;
+
+	ft_relay_start(t.relay);
+	b_main_run();
+
+	fail_unless(t.produced == TEST_FT_SIZE);
+	fail_unless(t.sent == TEST_FT_SIZE);
+	fail_unless(t.drained == TEST_FT_SIZE);
+	test_ft_teardown();
+}
+END_TEST
+
+/* For the splice test, the IM side's peer keeps its socket filled ... */
+static gboolean test_ft_produce(gpointer data, gint fd, b_input_condition cond)
+{
+	char buf[4096];
+	size_t n = MIN(sizeof(buf), TEST_FT_SIZE - t.produced);
+	ssize_t st;
+
+	test_ft_pattern(buf, t.produced, n);
+	if ((st = write(fd, buf, n)) > 0) {
+		t.produced += st;
+	}
+
+	return t.produced < TEST_FT_SIZE;
+}
+
+static gboolean test_ft_read_done(file_transfer_t *ft, unsigned int len)
+{
+	t.done += len;
+
+	return t.done < ft->file_size;
+}
+
+/* ... and reads from it like dcc.c does, if splice() isn't available. */
+static gboolean test_ft_recv_read(gpointer data, gint fd, b_input_condition cond)
+{
+	ssize_t st = recv(t.in[0], t.ft.buffer, sizeof(t.ft.buffer), 0);
+
+	if (st < 0 && sockerr_again()) {
+		if (fd == -1) {
+			b_input_add(t.in[0], B_EV_IO_READ, test_ft_recv_read, NULL);
+		}
+		return TRUE;
+	}
+	fail_unless(st > 0);
+
+	test_ft_read_done(&t.ft, st);
+	ft_relay_write(t.relay, t.ft.buffer, st);
+
+	return FALSE;
+}
+
+static gboolean test_ft_recv_write_request(file_transfer_t *ft)
+{
+	test_ft_recv_read(NULL, -1, 0);
+
+	return TRUE;
+}
+
+START_TEST(test_relay_splice)
+{
+	test_ft_setup(TRUE);
+	t.ft.write_request = test_ft_recv_write_request;
+	t.ft.read_fd = t.in[0];
+	t.ft.read_done = test_ft_read_done;
+
+	b_input_add(t.in[1], B_EV_IO_WRITE, test_ft_produce, NULL);
+
+	ft_relay_start(t.relay);
+	b_main_run();
+
+	fail_unless(t.done == TEST_FT_SIZE);
+	fail_unless(t.sent == TEST_FT_SIZE);
+	fail_unless(t.drained == TEST_FT_SIZE);
+	test_ft_teardown();
+}
+END_TEST
+
+/* A receiver that had to wait for data, with a sending socket that takes
+   all of it right away: nothing's left to wait for on that side, the
+   relay still has to ask for more. */
+START_TEST(test_relay_recv)
+{
+	test_ft_setup(FALSE);
+	t.ft.write_request = test_ft_recv_write_request;
+
+	b_input_add(t.in[1], B_EV_IO_WRITE, test_ft_produce, NULL);
+
+	ft_relay_start(t.relay);
+	b_main_run();
+
+	fail_unless(t.done == TEST_FT_SIZE);
+	fail_unless(t.sent == TEST_FT_SIZE);
+	fail_unless(t.drained == TEST_FT_SIZE);
+	test_ft_teardown();
+}
+END_TEST
+
+Suite *ft_suite(void)
+{
+	Suite *s = suite_create("FT");
+	TCase *tc_core = tcase_create("Core");
+
+	suite_add_tcase(s, tc_core);
+	tcase_add_test(tc_core, test_relay_write);
+	tcase_add_test(tc_core, test_relay_splice);
+	tcase_add_test(tc_core, test_relay_recv);
+	return s;
+}
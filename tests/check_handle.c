@@ -0,0 +1,79 @@
+#include <stdlib.h>
+#include <glib.h>
+#include <gmodule.h>
+#include <check.h>
+#include <string.h>
+#include "handle.h"
+#include "testsuite.h"
+
+START_TEST(test_handle_get)
+{
+	int a, b;
+	b_handle_t ha = b_handle_new(&a), hb = b_handle_new(&b);
+
+	fail_unless(ha != 0 && hb != 0 && ha != hb);
+	fail_unless(b_handle_get(ha) == &a);
+	fail_unless(b_handle_get(hb) == &b);
+	fail_unless(b_handle_get(0) == NULL);
+	fail_if(b_handle_new(NULL) != 0);
+
+	b_handle_free(ha);
+	fail_unless(b_handle_get(ha) == NULL);
+	fail_unless(b_handle_get(hb) == &b);
+
+	/* Freeing twice is harmless. */
+	b_handle_free(ha);
+	b_handle_free(hb);
+}
+END_TEST
+
+START_TEST(test_handle_stale)
+{
+	int a, b;
+	b_handle_t ha, hb;
+	int i;
+
+	/* Keep recycling the same slot, the old handle shouldn't come back
+	   to life (until the generation count wraps around). */
+	ha = b_handle_new(&a);
+	b_handle_free(ha);
+	for (i = 0; i < 4000; i++) {
+		hb = b_handle_new(&b);
+		fail_if(hb == ha, "Handle reused after %d rounds", i);
+		fail_unless(b_handle_get(ha) == NULL);
+		b_handle_free(hb);
+	}
+}
+END_TEST
+
+START_TEST(test_handle_many)
+{
+	b_handle_t h[1000];
+	int i;
+
+	for (i = 0; i < 1000; i++) {
+		h[i] = b_handle_new(GINT_TO_POINTER(i + 1));
+	}
+	for (i = 0; i < 1000; i += 2) {
+		b_handle_free(h[i]);
+	}
+	for (i = 0; i < 1000; i++) {
+		fail_unless(b_handle_get(h[i]) == (i % 2 ? GINT_TO_POINTER(i + 1) : NULL));
+	}
+	for (i = 1; i < 1000; i += 2) {
+		b_handle_free(h[i]);
+	}
+}
+END_TEST
+
+Suite *handle_suite(void)
+{
+	Suite *s = suite_create("Handle");
+	TCase *tc_core = tcase_create("Core");
+
+	suite_add_tcase(s, tc_core);
+	tcase_add_test(tc_core, test_handle_get);
+	tcase_add_test(tc_core, test_handle_stale);
+	tcase_add_test(tc_core, test_handle_many);
+	return s;
+}
@@ -0,0 +1,106 @@
+#include <stdlib.h>
+#include <glib.h>
+#include <gmodule.h>
+#include <check.h>
+#include <string.h>
+#include "bitlbee.h"
+#include "http_client.h"
+#include "testsuite.h"
+
+/* A tiny server on localhost that sends a Content-Length response in two
+   pieces and then keeps the connection open, so only the length can tell
+   http_client that it's done. */
+static int test_http_listen, test_http_conn = -1;
+static GString *test_http_body;
+static int test_http_status, test_http_calls;
+static gint test_http_timeout;
+
+static gboolean test_http_quit(gpointer data, gint fd, b_input_condition cond)
+{
+	test_http_timeout = 0;
+	b_main_quit();
+	return FALSE;
+}
+
+static gboolean test_http_second(gpointer data, gint fd, b_input_condition cond)
+{
+	fail_unless(write(test_http_conn, "56789", 5) == 5);
+	return FALSE;
+}
+
+static gboolean test_http_accept(gpointer data, gint fd, b_input_condition cond)
+{
+	static const char *reply = "HTTP/1.1 200 OK\r\n"
+	                           "Content-Length: 10\r\n"
+	                           "\r\n"
+	                           "01234";
+
+	test_http_conn = accept(test_http_listen, NULL, NULL);
+	fail_unless(test_http_conn >= 0);
+	fail_unless(write(test_http_conn, reply, strlen(reply)) == strlen(reply));
+	b_timeout_add(50, test_http_second, NULL);
+
+	return FALSE;
+}
+
+static void test_http_stream_func(struct http_request *req)
+{
+	test_http_calls++;
+	g_string_append_len(test_http_body, req->reply_body, req->body_size);
+	http_flush_bytes(req, req->body_size);
+
+	if (req->flags & HTTPC_EOF) {
+		test_http_status = req->status_code;
+		b_main_quit();
+	}
+}
+
+START_TEST(test_http_stream_content_length)
+{
+	struct sockaddr_in sin;
+	socklen_t len = sizeof(sin);
+	struct http_request *req;
+
+	memset(&sin, 0, sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	test_http_listen = socket(AF_INET, SOCK_STREAM, 0);
+	fail_unless(bind(test_http_listen, (struct sockaddr *) &sin, sizeof(sin)) == 0);
+	fail_unless(listen(test_http_listen, 1) == 0);
+	fail_unless(getsockname(test_http_listen, (struct sockaddr *) &sin, &len) == 0);
+	b_input_add(test_http_listen, B_EV_IO_READ, test_http_accept, NULL);
+
+	test_http_body = g_string_new("");
+	test_http_status = test_http_calls = 0;
+	req = http_dorequest("127.0.0.1", ntohs(sin.sin_port), 0, "GET / HTTP/1.1\r\n\r\n",
+	                     test_http_stream_func, NULL);
+	fail_if(req == NULL);
+	req->flags |= HTTPC_STREAMING;
+
+	/* Without the Content-Length check this would just hang until
+	   the timeout. */
+	test_http_timeout = b_timeout_add(5000, test_http_quit, NULL);
+	b_main_run();
+	if (test_http_timeout) {
+		b_event_remove(test_http_timeout);
+	}
+
+	fail_unless(strcmp(test_http_body->str, "0123456789") == 0, "body: %s", test_http_body->str);
+	fail_unless(test_http_status == 200, "status: %d", test_http_status);
+	fail_unless(test_http_calls >= 3, "calls: %d", test_http_calls);
+
+	g_string_free(test_http_body, TRUE);
+	closesocket(test_http_conn);
+	closesocket(test_http_listen);
+}
+END_TEST
+
+Suite *http_client_suite(void)
+{
+	Suite *s = suite_create("HTTP client");
+	TCase *tc_core = tcase_create("Core");
+
+	suite_add_tcase(s, tc_core);
+	tcase_add_test(tc_core, test_http_stream_content_length);
+	return s;
+}
@@ -58,6 +58,32 @@ START_TEST(test_login)
 }
 END_TEST
 
+START_TEST(test_parse_line_buf)
+{
+    char line1[] = "NICK bla";
+    char line2[] = ":prefix PRIVMSG #bitlbee foo :bar baz";
+    char **buf = NULL, **cmd;
+    int size = 0;
+
+    cmd = irc_parse_line_buf(line1, &buf, &size);
+    fail_unless(cmd == buf);
+    fail_unless(strcmp(cmd[0], "NICK") == 0);
+    fail_unless(strcmp(cmd[1], "bla") == 0);
+    fail_unless(cmd[2] == NULL);
+
+    /* Needs a bigger array than the first line. */
+    cmd = irc_parse_line_buf(line2, &buf, &size);
+    fail_unless(cmd == buf && size >= 5);
+    fail_unless(strcmp(cmd[0], "PRIVMSG") == 0);
+    fail_unless(strcmp(cmd[1], "#bitlbee") == 0);
+    fail_unless(strcmp(cmd[2], "foo") == 0);
+    fail_unless(strcmp(cmd[3], "bar baz") == 0);
+    fail_unless(cmd[4] == NULL);
+
+    g_free(buf);
+}
+END_TEST
+
 Suite *irc_suite(void)
 {
 	Suite *s = suite_create("IRC");
@@ -66,5 +92,6 @@ Suite *irc_suite(void)
 	suite_add_tcase(s, tc_core);
 	tcase_add_test(tc_core, test_connect);
 	tcase_add_test(tc_core, test_login);
+	tcase_add_test(tc_core, test_parse_line_buf);
 	return s;
 }
@@ -4,6 +4,7 @@
 #include <check.h>
 #include <string.h>
 #include <stdio.h>
+#include <sys/socket.h>
 #include "jabber/jabber.h"
 
 static struct im_connection *ic;
@@ -128,6 +129,212 @@ START_TEST(check_hipchat_slug)
 }
 END_TEST
 
+/* The caps cache gets saved in the config directory, keep it out of the
+   real one. Not restored afterwards since a save may still be pending. */
+static void check_caps_configdir(void)
+{
+	static char *dir;
+
+	if (dir == NULL) {
+		fail_unless((dir = g_dir_make_tmp("bitlbee-caps-XXXXXX", NULL)) != NULL);
+		global.conf->configdir = g_strconcat(dir, "/", NULL);
+	}
+}
+
+START_TEST(check_caps_hash)
+{
+	/* The "simple generation example" from XEP-0115. */
+	const char *xml =
+	        "<query xmlns='http://jabber.org/protocol/disco#info'>"
+	        "<identity category='client' name='Exodus 0.9.1' type='pc'/>"
+	        "<feature var='http://jabber.org/protocol/caps'/>"
+	        "<feature var='http://jabber.org/protocol/disco#info'/>"
+	        "<feature var='http://jabber.org/protocol/disco#items'/>"
+	        "<feature var='http://jabber.org/protocol/muc'/>"
+	        "</query>";
+	const char *ver = "QgayPKawpkPSDYmwT/WM94uAlu0=";
+	struct xt_node *query = xt_from_string(xml, 0);
+	GSList *features;
+
+	check_caps_configdir();
+	fail_if(jabber_caps_add("not/the/right/hash=", query));
+	fail_if(jabber_caps_lookup("not/the/right/hash="));
+
+	features = jabber_caps_add(ver, query);
+	fail_unless(g_slist_length(features) == 4);
+	fail_unless(jabber_caps_lookup(ver) == features);
+
+	xt_free_node(query);
+}
+END_TEST
+
+/* Anyone can come up with new valid hashes, the cache mustn't just keep
+   growing. */
+START_TEST(check_caps_limit)
+{
+	int i, added = 0;
+
+	check_caps_configdir();
+	for (i = 0; i < 5000; i++) {
+		char *var = g_strdup_printf("urn:test:%d", i), *s, *ver;
+		struct xt_node *query = xt_new_node("query", NULL, NULL);
+		struct xt_node *f = xt_new_node("feature", NULL, NULL);
+		guint8 digest[20];
+		gsize digest_len = sizeof(digest);
+		GChecksum *sha1 = g_checksum_new(G_CHECKSUM_SHA1);
+
+		xt_add_attr(f, "var", var);
+		xt_add_child(query, f);
+		s = g_strdup_printf("%s<", var);
+		g_checksum_update(sha1, (guint8 *) s, strlen(s));
+		g_checksum_get_digest(sha1, digest, &digest_len);
+		ver = g_base64_encode(digest, digest_len);
+
+		if (jabber_caps_add(ver, query)) {
+			added++;
+		}
+
+		g_checksum_free(sha1);
+		xt_free_node(query);
+		g_free(ver);
+		g_free(var);
+		g_free(s);
+	}
+
+	fail_unless(added > 0 && added < 5000, "added %d", added);
+}
+END_TEST
+
+/* Replies to the login requests can overtake <enabled/>, the server
+   doesn't count those and neither should we. */
+START_TEST(check_sm_pipelined)
+{
+	struct jabber_data *jd = ic->proto_data;
+	struct xt_node *iq, *enabled, *r;
+	char buf[512];
+	int sock[2], n;
+
+	fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, sock) == 0);
+	jd->fd = sock[0];
+	jd->flags |= JFLAG_SM_SUPPORTED;
+	set_add(&ic->acc->set, "stream_management", "true", set_eval_bool, ic->acc);
+
+	iq = xt_from_string("<iq type='result' id='roster'/>", 0);
+	enabled = xt_from_string("<enabled xmlns='" XMLNS_SM "' id='x' resume='true'/>", 0);
+	r = xt_from_string("<r xmlns='" XMLNS_SM "'/>", 0);
+
+	fail_unless(jabber_sm_enable(ic));
+	jabber_sm_count_in(ic, iq);
+	jabber_sm_pkt(enabled, ic);
+	jabber_sm_count_in(ic, iq);
+	jabber_sm_pkt(r, ic);
+
+	n = read(sock[1], buf, sizeof(buf) - 1);
+	fail_unless(n > 0);
+	buf[n] = '\0';
+	fail_unless(strstr(buf, " h='1'") != NULL, "%s", buf);
+	fail_unless(strcmp(jd->sm_id, "x") == 0);
+
+	jabber_sm_free(ic);
+	set_del(&ic->acc->set, "stream_management");
+	jd->flags = 0;
+	jd->fd = -1;
+	close(sock[0]);
+	close(sock[1]);
+	xt_free_node(iq);
+	xt_free_node(enabled);
+	xt_free_node(r);
+}
+END_TEST
+
+/* Whether the server thinks we're active or not is part of the session
+   we get back, so it has to stay in sync. */
+START_TEST(check_sm_resume_csi)
+{
+	struct jabber_data *jd = ic->proto_data;
+	struct xt_node *resumed;
+	char buf[512];
+	int sock[2], n;
+
+	fail_unless(socketpair(AF_UNIX, SOCK_STREAM, 0, sock) == 0);
+	set_add(&ic->acc->set, "sasl", "true", set_eval_bool, ic->acc);
+	ic->flags |= OPT_LOGGED_IN;
+	jd->fd = -1;
+	jd->sm_id = g_strdup("x");
+	jd->flags = JFLAG_SM_ENABLED | JFLAG_CSI | JFLAG_CSI_INACTIVE;
+
+	fail_unless(jabber_sm_connection_lost(ic));
+	fail_unless(jd->flags & JFLAG_SM_RESUMING);
+	fail_unless(jd->flags & JFLAG_CSI_INACTIVE);
+
+	jd->fd = sock[0];
+	resumed = xt_from_string("<resumed xmlns='" XMLNS_SM "' previd='x' h='0'/>", 0);
+	fail_unless(jabber_sm_pkt(resumed, ic) == XT_HANDLED);
+	fail_if(jd->flags & JFLAG_SM_RESUMING);
+
+	n = read(sock[1], buf, sizeof(buf) - 1);
+	fail_unless(n > 0);
+	buf[n] = '\0';
+	fail_unless(strncmp(buf, "<inactive xmlns='" XMLNS_CSI "'/>", n) == 0, "%s", buf);
+
+	jabber_sm_free(ic);
+	set_del(&ic->acc->set, "sasl");
+	ic->flags = 0;
+	jd->flags = 0;
+	jd->fd = -1;
+	close(sock[0]);
+	close(sock[1]);
+	xt_free_node(resumed);
+}
+END_TEST
+
+#ifdef WITH_ZLIB
+START_TEST(check_zlib_roundtrip)
+{
+	/* One context for each end of the connection, like talking to a
+	   server that compresses too. */
+	struct jabber_zlib *client = jabber_zlib_new(), *server = jabber_zlib_new();
+	const char *pkts[] = {
+		"<stream:stream to='example.com' xmlns='jabber:client' version='1.0'>",
+		"<presence/><presence/><presence/><presence/><presence/><presence/>",
+		"<message to='a@example.com'><body>hi</body></message>",
+		NULL
+	};
+	char *z, *plain, *p;
+	int i, j, zlen, len, total;
+
+	fail_if(client == NULL || server == NULL);
+
+	for (i = 0; pkts[i]; i++) {
+		z = jabber_zlib_deflate(client, pkts[i], strlen(pkts[i]), &zlen);
+		fail_if(z == NULL);
+
+		/* Every write is flushed, so feeding it byte by byte must
+		   give back exactly the same packet, nothing held back. */
+		plain = g_malloc(strlen(pkts[i]));
+		for (j = total = 0; j < zlen; j++) {
+			p = jabber_zlib_inflate(server, z + j, 1, &len);
+			fail_if(p == NULL);
+			fail_if(total + len > strlen(pkts[i]));
+			memcpy(plain + total, p, len);
+			total += len;
+			g_free(p);
+		}
+		fail_unless(total == strlen(pkts[i]));
+		fail_unless(memcmp(plain, pkts[i], total) == 0);
+
+		g_free(plain);
+		g_free(z);
+	}
+
+	fail_if(jabber_zlib_inflate(client, "<not compressed/>", 17, &len));
+
+	jabber_zlib_free(client);
+	jabber_zlib_free(server);
+}
+END_TEST
+#endif
+
 Suite *jabber_util_suite(void)
 {
 	Suite *s = suite_create("jabber/util");
@@ -145,5 +352,12 @@ Suite *jabber_util_suite(void)
 	tcase_add_test(tc_core, check_buddy_add);
 	tcase_add_test(tc_core, check_compareJID);
 	tcase_add_test(tc_core, check_hipchat_slug);
+	tcase_add_test(tc_core, check_caps_hash);
+	tcase_add_test(tc_core, check_caps_limit);
+	tcase_add_test(tc_core, check_sm_pipelined);
+	tcase_add_test(tc_core, check_sm_resume_csi);
+#ifdef WITH_ZLIB
+	tcase_add_test(tc_core, check_zlib_roundtrip);
+#endif
 	return s;
 }
@@ -0,0 +1,248 @@
+#include <stdlib.h>
+#include <glib.h>
+#include <gmodule.h>
+#include <check.h>
+#include <string.h>
+#include "json.h"
+#include "json_util.h"
+#include "json_stream.h"
+#include "testsuite.h"
+
+static GString *events;
+
+static gboolean test_json_event(json_stream_t *js, json_stream_event_t ev,
+                                const json_value *v, gpointer data)
+{
+	switch (ev) {
+	case JSON_STREAM_OBJECT_START:
+		g_string_append_c(events, '{');
+		break;
+	case JSON_STREAM_OBJECT_END:
+		g_string_append_c(events, '}');
+		break;
+	case JSON_STREAM_ARRAY_START:
+		g_string_append_c(events, '[');
+		break;
+	case JSON_STREAM_ARRAY_END:
+		g_string_append_c(events, ']');
+		break;
+	case JSON_STREAM_KEY:
+		g_string_append_printf(events, "%s:", v->u.string.ptr);
+		break;
+	case JSON_STREAM_VALUE:
+		if (v->type == json_string) {
+			g_string_append_printf(events, "\"%s\"", v->u.string.ptr);
+		} else if (v->type == json_integer) {
+			g_string_append_printf(events, "%" G_GINT64_FORMAT, (gint64) v->u.integer);
+		} else if (v->type == json_double) {
+			g_string_append_printf(events, "%g", v->u.dbl);
+		} else if (v->type == json_boolean) {
+			g_string_append(events, v->u.boolean ? "T" : "F");
+		} else {
+			g_string_append(events, "N");
+		}
+		g_string_append_c(events, ',');
+		break;
+	}
+
+	return TRUE;
+}
+
+/* Feeds doc in pieces of chunk bytes, returns the final status. */
+static json_stream_status_t test_json_feed(json_stream_t *js, const char *doc, size_t chunk)
+{
+	char *buf = g_strdup(doc);
+	size_t len = strlen(buf), i;
+	json_stream_status_t st = JSON_STREAM_MORE;
+
+	for (i = 0; i < len && (st == JSON_STREAM_MORE || st == JSON_STREAM_DONE); i += chunk) {
+		st = json_stream_feed(js, buf + i, MIN(chunk, len - i));
+	}
+	if (st == JSON_STREAM_MORE || st == JSON_STREAM_DONE) {
+		st = json_stream_end(js);
+	}
+
+	g_free(buf);
+	return st;
+}
+
+START_TEST(test_json_stream_events)
+{
+	const char *doc = "{\"a\": [1, -2.5, true, false, null], \"b\": {\"c\": \"d\"}, \"e\": []}";
+	const char *expect = "{a:[1,-2.5,T,F,N,]b:{c:\"d\",}e:[]}";
+	size_t chunk;
+
+	/* Tokens split anywhere should make no difference. */
+	for (chunk = 1; chunk <= strlen(doc); chunk++) {
+		json_stream_t *js = json_stream_new(test_json_event, NULL, 0);
+
+		events = g_string_new("");
+		fail_unless(test_json_feed(js, doc, chunk) == JSON_STREAM_DONE,
+		            "%zu: %s", chunk, json_stream_error(js));
+		fail_unless(strcmp(events->str, expect) == 0, "%zu: %s", chunk, events->str);
+		fail_unless(json_stream_depth(js) == 0);
+
+		g_string_free(events, TRUE);
+		json_stream_free(js);
+	}
+}
+END_TEST
+
+START_TEST(test_json_stream_strings)
+{
+	const char *doc = "[\"a\\\"b\\\\c\\/d\\n\", \"\\u00e9\\u20ac\\ud83d\\ude00\", \"\"]";
+	const char *expect = "[\"a\"b\\c/d\n\",\"\xc3\xa9\xe2\x82\xac\xf0\x9f\x98\x80\",\"\",]";
+	size_t chunk;
+
+	for (chunk = 1; chunk <= strlen(doc); chunk++) {
+		json_stream_t *js = json_stream_new(test_json_event, NULL, 0);
+
+		events = g_string_new("");
+		fail_unless(test_json_feed(js, doc, chunk) == JSON_STREAM_DONE,
+		            "%zu: %s", chunk, json_stream_error(js));
+		fail_unless(strcmp(events->str, expect) == 0, "%zu: %s", chunk, events->str);
+
+		g_string_free(events, TRUE);
+		json_stream_free(js);
+	}
+}
+END_TEST
+
+START_TEST(test_json_stream_in_place)
+{
+	char buf[] = "[\"caf\\u00e9\"]";
+	json_stream_t *js = json_stream_new(test_json_event, NULL, 0);
+
+	/* Strings that are in one piece get decoded right in the buffer. */
+	events = g_string_new("");
+	fail_unless(json_stream_feed(js, buf, strlen(buf)) == JSON_STREAM_DONE);
+	fail_unless(strcmp(buf + 2, "caf\xc3\xa9") == 0, "%s", buf + 2);
+
+	g_string_free(events, TRUE);
+	json_stream_free(js);
+}
+END_TEST
+
+START_TEST(test_json_stream_errors)
+{
+	const char *bad[] = {
+		"[1,]", "[1 2]", "{\"a\" 1}", "{\"a\":1,}", "[\"unterminated", "[1]x",
+		"[tru]", "[-]", "]", "[{]", "[\"\\u12\"]", "{1:2}", "", "[",
+		NULL
+	};
+	int i;
+
+	for (i = 0; bad[i]; i++) {
+		size_t chunk;
+
+		for (chunk = 1; chunk <= strlen(bad[i]) + 1; chunk++) {
+			json_stream_t *js = json_stream_new(test_json_event, NULL, 0);
+
+			events = g_string_new("");
+			fail_unless(test_json_feed(js, bad[i], chunk) == JSON_STREAM_ERROR,
+			            "%s (%zu)", bad[i], chunk);
+			fail_unless(json_stream_error(js) != NULL);
+
+			g_string_free(events, TRUE);
+			json_stream_free(js);
+		}
+	}
+}
+END_TEST
+
+static gboolean test_json_value(json_stream_t *js, json_value *v, gpointer data)
+{
+	const json_value *id = json_o_get(v, "id");
+	const char *text = json_o_str(v, "text");
+
+	fail_unless(v->type == json_object);
+	g_string_append_printf(events, "%" G_GINT64_FORMAT "=%s,",
+	                       id ? (gint64) id->u.integer : -1, text ? text : "?");
+
+	return TRUE;
+}
+
+START_TEST(test_json_stream_values)
+{
+	const char *doc = "[{\"id\": 1, \"text\": \"one\", \"user\": {\"id\": 9}},"
+	                  " {\"id\": 2, \"text\": \"t\\u0077o\", \"x\": [[{}]]}, {\"id\": 3}]";
+	size_t chunk;
+
+	for (chunk = 1; chunk <= strlen(doc); chunk++) {
+		json_stream_t *js = json_stream_new_values(1, test_json_value, NULL, 0);
+
+		events = g_string_new("");
+		fail_unless(test_json_feed(js, doc, chunk) == JSON_STREAM_DONE,
+		            "%zu: %s", chunk, json_stream_error(js));
+		fail_unless(strcmp(events->str, "1=one,2=two,3=?,") == 0, "%zu: %s", chunk, events->str);
+
+		g_string_free(events, TRUE);
+		json_stream_free(js);
+	}
+}
+END_TEST
+
+START_TEST(test_json_stream_multi)
+{
+	const char *doc = "{\"id\":1}\r\n{\"id\":2,\"text\":\"x\"}\r\n\r\n{\"id\":3} ";
+	size_t chunk;
+
+	for (chunk = 1; chunk <= strlen(doc); chunk++) {
+		json_stream_t *js = json_stream_new_values(0, test_json_value, NULL, JSON_STREAM_MULTI);
+
+		events = g_string_new("");
+		fail_unless(test_json_feed(js, doc, chunk) == JSON_STREAM_DONE,
+		            "%zu: %s", chunk, json_stream_error(js));
+		fail_unless(strcmp(events->str, "1=?,2=x,3=?,") == 0, "%zu: %s", chunk, events->str);
+
+		g_string_free(events, TRUE);
+		json_stream_free(js);
+	}
+}
+END_TEST
+
+/* Only even ids. */
+static gboolean test_json_filter(json_stream_t *js, const json_value *v, gpointer data)
+{
+	g_string_append_printf(events, "?%" G_GINT64_FORMAT ",", (gint64) v->u.integer);
+	return v->u.integer % 2 == 0;
+}
+
+START_TEST(test_json_stream_filter)
+{
+	const char *doc = "[{\"id\": 1, \"text\": \"one\", \"user\": {\"id\": 9}},"
+	                  " {\"x\": [{\"id\": 5}], \"id\": 2, \"text\": \"two\"},"
+	                  " {\"text\": \"three\", \"id\": 3, \"x\": [[{}], \"]\"]}, {\"id\": 6}]";
+	size_t chunk;
+
+	for (chunk = 1; chunk <= strlen(doc); chunk++) {
+		json_stream_t *js = json_stream_new_values(1, test_json_value, NULL, 0);
+
+		json_stream_set_filter(js, "id", test_json_filter);
+		events = g_string_new("");
+		fail_unless(test_json_feed(js, doc, chunk) == JSON_STREAM_DONE,
+		            "%zu: %s", chunk, json_stream_error(js));
+		fail_unless(strcmp(events->str, "?1,?2,2=two,?3,?6,6=?,") == 0,
+		            "%zu: %s", chunk, events->str);
+
+		g_string_free(events, TRUE);
+		json_stream_free(js);
+	}
+}
+END_TEST
+
+Suite *json_stream_suite(void)
+{
+	Suite *s = suite_create("JSON stream");
+	TCase *tc_core = tcase_create("Core");
+
+	suite_add_tcase(s, tc_core);
+	tcase_add_test(tc_core, test_json_stream_events);
+	tcase_add_test(tc_core, test_json_stream_strings);
+	tcase_add_test(tc_core, test_json_stream_in_place);
+	tcase_add_test(tc_core, test_json_stream_errors);
+	tcase_add_test(tc_core, test_json_stream_values);
+	tcase_add_test(tc_core, test_json_stream_multi);
+	tcase_add_test(tc_core, test_json_stream_filter);
+	return s;
+}
@@ -0,0 +1,113 @@
+#include <stdlib.h>
+#include <glib.h>
+#include <gmodule.h>
+#include <check.h>
+#include <string.h>
+#include "bitlbee.h"
+#include "testsuite.h"
+
+static GString *started, *waiting;
+
+static void test_login_go(gpointer data)
+{
+	g_string_append(started, data);
+}
+
+static void test_login_wait(gpointer data, int pos)
+{
+	g_string_append_printf(waiting, "%s%d", (char *) data, pos);
+}
+
+static gboolean test_login_quit(gpointer data, gint fd, b_input_condition cond)
+{
+	b_main_quit();
+	return FALSE;
+}
+
+/* One round of the scheduler, which always runs from the main loop. */
+static void test_login_run(void)
+{
+	g_string_truncate(started, 0);
+	g_string_truncate(waiting, 0);
+	b_timeout_add(10, test_login_quit, NULL);
+	b_main_run();
+}
+
+START_TEST(test_login_limits)
+{
+	login_req_t *a, *b, *c, *d;
+
+	started = g_string_new("");
+	waiting = g_string_new("");
+	global.conf->logins_per_protocol = 2;
+	global.conf->logins_per_host = 1;
+
+	a = login_sched_add("jabber", "one.example", "x/a", LOGIN_PRIO_CONNECT,
+	                    test_login_go, test_login_wait, "a");
+	b = login_sched_add("jabber", "ONE.example", "x/b", LOGIN_PRIO_CONNECT,
+	                    test_login_go, test_login_wait, "b");
+	c = login_sched_add("jabber", "two.example", "x/c", LOGIN_PRIO_RECONNECT,
+	                    test_login_go, test_login_wait, "c");
+	d = login_sched_add("jabber", "three.example", "x/d", LOGIN_PRIO_USER,
+	                    test_login_go, test_login_wait, "d");
+	fail_unless(started->len == 0, "Logins shouldn't start right away");
+
+	/* d goes first, b has to wait for a (same server), and c for
+	   either of them (protocol limit). */
+	test_login_run();
+	fail_unless(strcmp(started->str, "da") == 0, "started: %s", started->str);
+	fail_unless(strcmp(waiting->str, "b1c2") == 0, "waiting: %s", waiting->str);
+
+	login_sched_done(a);
+	test_login_run();
+	fail_unless(strcmp(started->str, "b") == 0, "started: %s", started->str);
+	fail_unless(strcmp(waiting->str, "") == 0, "waiting: %s", waiting->str);
+
+	/* Done before it even started. */
+	login_sched_done(c);
+	login_sched_done(d);
+	test_login_run();
+	fail_unless(strcmp(started->str, "") == 0, "started: %s", started->str);
+
+	login_sched_done(b);
+	g_string_free(started, TRUE);
+	g_string_free(waiting, TRUE);
+}
+END_TEST
+
+START_TEST(test_login_unlimited)
+{
+	login_req_t *r[5];
+	int i;
+
+	started = g_string_new("");
+	waiting = g_string_new("");
+	global.conf->logins_per_protocol = 0;
+	global.conf->logins_per_host = 0;
+
+	for (i = 0; i < 5; i++) {
+		r[i] = login_sched_add("twitter", "twitter", "x/t", LOGIN_PRIO_RECONNECT,
+		                       test_login_go, test_login_wait, "t");
+	}
+	test_login_run();
+	fail_unless(strcmp(started->str, "ttttt") == 0, "started: %s", started->str);
+	fail_unless(strcmp(waiting->str, "") == 0, "waiting: %s", waiting->str);
+
+	for (i = 0; i < 5; i++) {
+		login_sched_done(r[i]);
+	}
+	g_string_free(started, TRUE);
+	g_string_free(waiting, TRUE);
+}
+END_TEST
+
+Suite *login_suite(void)
+{
+	Suite *s = suite_create("Login");
+	TCase *tc_core = tcase_create("Core");
+
+	suite_add_tcase(s, tc_core);
+	tcase_add_test(tc_core, test_login_limits);
+	tcase_add_test(tc_core, test_login_unlimited);
+	return s;
+}
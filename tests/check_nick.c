@@ -64,6 +64,41 @@ START_TEST(test_nick_ok_notok)
 }
 END_TEST
 
+START_TEST(test_nick_hash_equal)
+{
+	const char *same[][2] = {
+		{ "foo", "FOO" },
+		{ "bla[]\\~", "BLA{}|^" },
+		{ "Wilmer", "wilmer" },
+		{ "\xc3\x89t\xc3\xa9", "\xc3\xa9T\xc3\x89" },
+		{ NULL, NULL }
+	};
+	const char *diff[][2] = {
+		{ "foo", "fo" },
+		{ "foo", "foo_" },
+		{ "bar", "baz" },
+		{ NULL, NULL }
+	};
+	int i;
+
+	for (i = 0; same[i][0]; i++) {
+		fail_unless(nick_equal(same[i][0], same[i][1]),
+		            "nick_equal() failed: %s %s", same[i][0], same[i][1]);
+		fail_unless(nick_hash(same[i][0]) == nick_hash(same[i][1]),
+		            "nick_hash() differs: %s %s", same[i][0], same[i][1]);
+	}
+
+	for (i = 0; diff[i][0]; i++) {
+		fail_if(nick_equal(diff[i][0], diff[i][1]),
+		        "nick_equal() succeeded: %s %s", diff[i][0], diff[i][1]);
+	}
+
+	fail_unless(nick_cmp(NULL, "FooBar", "foobar") == 0);
+	fail_unless(nick_cmp(NULL, "abc", "abd") < 0);
+	fail_unless(nick_cmp(NULL, "nick%", "nick%") != 0);
+}
+END_TEST
+
 Suite *nick_suite(void)
 {
 	Suite *s = suite_create("Nick");
@@ -73,5 +108,6 @@ Suite *nick_suite(void)
 	tcase_add_test(tc_core, test_nick_ok_ok);
 	tcase_add_test(tc_core, test_nick_ok_notok);
 	tcase_add_test(tc_core, test_nick_strip);
+	tcase_add_test(tc_core, test_nick_hash_equal);
 	return s;
 }
@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <glib.h>
+#include <gmodule.h>
+#include <check.h>
+#include <string.h>
+#include "scan.h"
+#include "testsuite.h"
+
+/* Lots of short random strings, so every length modulo the vector size
+   and every position of the first match gets tried. */
+#define TEST_SCAN_ROUNDS 20000
+#define TEST_SCAN_LEN 80
+
+static const char *test_scan_sets[] = { "\r\n", "<&", "\r\n<&", "x", "\n", "abcdefg", NULL };
+
+static gsize test_scan_random(char *s, const char *alphabet)
+{
+	gsize len = g_random_int_range(0, TEST_SCAN_LEN), i, n = strlen(alphabet);
+
+	for (i = 0; i < len; i++) {
+		/* Mostly boring text, sometimes something interesting. */
+		s[i] = g_random_int_range(0, 8) ? 'a' + g_random_int_range(0, 4) :
+		       alphabet[g_random_int_range(0, n)];
+	}
+	s[len] = '\0';
+
+	return len;
+}
+
+static const char *test_scan_naive(const char *s, gsize len, const char *bytes, gboolean high)
+{
+	gsize i;
+
+	for (i = 0; i < len; i++) {
+		if ((s[i] && strchr(bytes, s[i])) || (high && (guchar) s[i] >= 0x80)) {
+			return s + i;
+		}
+	}
+
+	return NULL;
+}
+
+START_TEST(test_scan_any)
+{
+	char s[TEST_SCAN_LEN + 1];
+	int i, j;
+
+	for (i = 0; i < TEST_SCAN_ROUNDS; i++) {
+		gsize len = test_scan_random(s, "\r\n<&xbg\x80\xe9\xff");
+
+		/* NULs in the middle are just bytes. */
+		if (len > 0 && i % 10 == 0) {
+			s[g_random_int_range(0, len)] = '\0';
+		}
+
+		for (j = 0; test_scan_sets[j]; j++) {
+			fail_unless(scan_any(s, len, test_scan_sets[j]) ==
+			            test_scan_naive(s, len, test_scan_sets[j], FALSE), "%d %d", i, j);
+			fail_unless(scan_any_8bit(s, len, test_scan_sets[j]) ==
+			            test_scan_naive(s, len, test_scan_sets[j], TRUE), "%d %d", i, j);
+		}
+		fail_unless(scan_any(s, len, "") == NULL);
+		fail_unless(scan_any_8bit(s, len, "") == test_scan_naive(s, len, "", TRUE));
+	}
+}
+END_TEST
+
+START_TEST(test_scan_utf8_valid)
+{
+	const char *valid[] = { "", "plain", "h\xc3\xa9", "\xe2\x82\xac", "\xf0\x9f\x98\x80", "\xf4\x8f\xbf\xbf",
+		                "\xed\x9f\xbf", "0123456789abcdef\xc3\xa9", NULL };
+	const char *invalid[] = { "\x80", "\xc0\xaf", "\xc3", "\xe0\x80\xaf", "\xed\xa0\x80", "\xf4\x90\x80\x80",
+		                  "\xf5\x80\x80\x80", "0123456789abcdef\xff", "0123456789abcde\xc3", NULL };
+	char s[TEST_SCAN_LEN + 1];
+	int i;
+
+	for (i = 0; valid[i]; i++) {
+		fail_unless(scan_utf8_valid(valid[i], strlen(valid[i])), "%d", i);
+	}
+	for (i = 0; invalid[i]; i++) {
+		fail_if(scan_utf8_valid(invalid[i], strlen(invalid[i])), "%d", i);
+	}
+	fail_if(scan_utf8_valid("a\0b", 3));
+
+	/* Pieces of valid and broken UTF-8, same answer as GLib every time. */
+	for (i = 0; i < TEST_SCAN_ROUNDS; i++) {
+		gsize len = test_scan_random(s, "\x80\xbf\xc2\xc3\xa9\xe2\x82\xac\xed\xa0\xf0\x9f\x98\xf4\x90");
+
+		fail_unless(scan_utf8_valid(s, len) == g_utf8_validate(s, len, NULL), "%d: %s", i, s);
+	}
+}
+END_TEST
+
+Suite *scan_suite(void)
+{
+	Suite *s = suite_create("Scan");
+	TCase *tc_core = tcase_create("Core");
+
+	suite_add_tcase(s, tc_core);
+	tcase_add_test(tc_core, test_scan_any);
+	tcase_add_test(tc_core, test_scan_utf8_valid);
+	return s;
+}
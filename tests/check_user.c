@@ -59,12 +59,91 @@ fail_unless(user_find(irc, "foo") == NULL);
 fail_if(user_find(irc, "bar") == NULL);
 END_TEST
 #endif
+
+static void fake_logout(struct im_connection *ic)
+{
+}
+
+static struct prpl fake_prpl = {
+	.name = "fake",
+	.logout = fake_logout,
+	.handle_cmp = g_ascii_strcasecmp,
+};
+
+START_TEST(test_user_logout_bulk)
+{
+	irc_t *irc = torture_irc();
+	struct im_connection *ics[10];
+	int i, j;
+
+	for (i = 0; i < 10; i++) {
+		char user[32];
+
+		g_snprintf(user, sizeof(user), "user%d", i);
+		ics[i] = imcb_new(account_add(irc->b, &fake_prpl, user, "pass"));
+		for (j = 0; j < 2000; j++) {
+			char handle[32];
+
+			g_snprintf(handle, sizeof(handle), "buddy%d_%d", i, j);
+			imcb_add_buddy(ics[i], handle, NULL);
+		}
+		fail_unless(g_list_length(ics[i]->users) == 2000);
+	}
+	fail_unless(g_list_length(irc->b->users) == 20000);
+
+	/* Log out every other account; the rest must stay untouched. */
+	for (i = 0; i < 10; i += 2) {
+		imc_logout(ics[i], FALSE);
+	}
+	fail_unless(g_list_length(irc->b->users) == 10000);
+	for (i = 1; i < 10; i += 2) {
+		char handle[32];
+
+		g_snprintf(handle, sizeof(handle), "BUDDY%d_1999", i);
+		fail_unless(g_list_length(ics[i]->users) == 2000);
+		fail_unless(bee_user_by_handle(irc->b, ics[i], handle) != NULL);
+	}
+
+	for (i = 1; i < 10; i += 2) {
+		imc_logout(ics[i], FALSE);
+	}
+	fail_unless(irc->b->users == NULL);
+
+	irc_free(irc);
+}
+END_TEST
+
+START_TEST(test_user_cache_path)
+{
+	irc_t *irc = torture_irc();
+	account_t *a;
+	char *path;
+
+	irc->user->nick = g_strdup("Wilmer");
+	a = account_add(irc->b, &fake_prpl, "user", "pass");
+
+	/* Not ours until the password has been checked. */
+	fail_unless(account_cache_path(a, a->tag, "roster") == NULL);
+
+	irc->status |= USTATUS_IDENTIFIED;
+	path = account_cache_path(a, a->tag, "roster");
+	fail_unless(path != NULL && g_str_has_suffix(path, "wilmer.fake.roster"), "%s", path);
+	g_free(path);
+
+	/* Nothing to save it to. */
+	irc->status &= ~USTATUS_IDENTIFIED;
+	irc_free(irc);
+}
+END_TEST
+
 Suite *user_suite(void)
 {
 	Suite *s = suite_create("User");
 	TCase *tc_core = tcase_create("Core");
 
 	suite_add_tcase(s, tc_core);
+	tcase_add_test(tc_core, test_user_logout_bulk);
+	tcase_add_test(tc_core, test_user_cache_path);
 #if 0
 	tcase_add_test(tc_core, test_user_add);
 	tcase_add_test(tc_core, test_user_add_invalid);
@@ -7,6 +7,7 @@
 #include "set.h"
 #include "misc.h"
 #include "url.h"
+#include "cmdtab.h"
 
 START_TEST(test_strip_linefeed)
 {
@@ -185,6 +186,53 @@ START_TEST(test_http_encode)
 }
 END_TEST
 
+struct {
+	char *orig;
+	char *stripped;
+} strip_html_tests[] = {
+	{
+		"<b>bold</b> &amp; &lt;x&gt; &AMP;",
+		"\x02" "bold" "\x02" " & <x> &",
+	},
+	{
+		"&#65;&#x42;&#x20AC; &nbsp;x &eacute;&iacute;",
+		"AB\xe2\x82\xac  x \xc3\xa9\xc3\xad",
+	},
+	{
+		"a <br/>b<br>c <a href=\"x\">link</a>",
+		"a \nb\nc link",
+	},
+	{
+		"5 < 6 && 7 > 3",
+		"5 < 6 && 7 > 3",
+	},
+	{
+		"&foo; &#; &#x; &#0; &#xD800; &#99999999999;",
+		"&foo; &#; &#x; &#0; &#xD800; &#99999999999;",
+	},
+	{
+		"<unclosed <i>x</i>",
+		"<unclosed " "\x1f" "x" "\x1f",
+	},
+	{
+		NULL, NULL
+	}
+};
+
+START_TEST(test_strip_html)
+{
+    int i;
+    for (i = 0; strip_html_tests[i].orig; i++) {
+        char *s = g_strdup(strip_html_tests[i].orig);
+        strip_html(s);
+        fail_unless(strcmp(s, strip_html_tests[i].stripped) == 0,
+                "%s (expected: %s, got: %s)",
+                strip_html_tests[i].orig, strip_html_tests[i].stripped, s);
+        g_free(s);
+    }
+}
+END_TEST
+
 struct {
 	int limit;
 	char *command;
@@ -231,6 +279,39 @@ START_TEST(test_split_command_parts)
 }
 END_TEST
 
+START_TEST(test_cmdtab)
+{
+	static const struct test_cmd {
+		char *name;
+		int id;
+	} cmds[] = {
+		{ "help", 1 },
+		{ "account", 2 },
+		{ "add", 3 },
+		{ "set", 4 },
+		{ NULL }
+	};
+	cmdtab_t tab = CMDTAB_INIT;
+	const struct test_cmd *c;
+
+	cmdtab_add_array(&tab, cmds, sizeof(cmds[0]));
+	fail_unless(tab.len == 4);
+	fail_if(cmdtab_add(&tab, "HELP", NULL));
+
+	fail_unless((c = cmdtab_find(&tab, "Set")) && c->id == 4);
+	fail_unless(cmdtab_find(&tab, "se") == NULL);
+	fail_unless(cmdtab_find(&tab, "zzz") == NULL);
+
+	fail_unless((c = cmdtab_find_prefix(&tab, "acc")) && c->id == 2);
+	fail_unless((c = cmdtab_find_prefix(&tab, "add")) && c->id == 3);
+	fail_unless(cmdtab_find_prefix(&tab, "a") == NULL);
+	fail_unless((c = cmdtab_find_prefix(&tab, "h")) && c->id == 1);
+
+	cmdtab_free(&tab);
+	fail_unless(tab.len == 0);
+}
+END_TEST
+
 Suite *util_suite(void)
 {
 	Suite *s = suite_create("Util");
@@ -246,6 +327,8 @@ Suite *util_suite(void)
 	tcase_add_test(tc_core, test_set_url_username_pwd);
 	tcase_add_test(tc_core, test_word_wrap);
 	tcase_add_test(tc_core, test_http_encode);
+	tcase_add_test(tc_core, test_strip_html);
 	tcase_add_test(tc_core, test_split_command_parts);
+	tcase_add_test(tc_core, test_cmdtab);
 	return s;
 }
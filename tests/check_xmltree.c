@@ -0,0 +1,155 @@
+#include <stdlib.h>
+#include <glib.h>
+#include <gmodule.h>
+#include <check.h>
+#include <string.h>
+#include "xmltree.h"
+#include "testsuite.h"
+
+static const char *test_xt_stream =
+	"<stream:stream xmlns='jabber:client'>"
+	"<message to='a@b' from='c@d/e' type='chat'><body>hi &amp; &lt;bye&gt;</body>"
+	"<active xmlns='http://jabber.org/protocol/chatstates'/></message>"
+	"<iq id='1' type='result'><query xmlns='jabber:iq:roster'>"
+	"<item jid='x@y' name='X'><group>G</group></item></query></iq>";
+
+static GString *test_xt_out;
+
+static xt_status test_xt_handler(struct xt_node *node, gpointer data)
+{
+	char *s;
+
+	/* Changing parsed nodes has to work with or without an arena. */
+	xt_add_attr(node, "id", "new");
+	xt_add_attr(node, "a", "1");
+	xt_add_attr(node, "b", "2");
+	xt_add_attr(node, "to", "changed");
+	xt_remove_attr(node, "from");
+	xt_add_child(node, xt_new_node("extra", "text", NULL));
+
+	s = xt_to_string(node);
+	g_string_append(test_xt_out, s);
+	g_free(s);
+
+	return XT_HANDLED;
+}
+
+static const struct xt_handler_entry test_xt_handlers[] = {
+	{ NULL, "stream:stream", test_xt_handler },
+	{ NULL, NULL, NULL }
+};
+
+static char *test_xt_parse(int arena_depth, int chunk)
+{
+	struct xt_parser *xt = xt_new(test_xt_handlers, NULL);
+	int i, len = strlen(test_xt_stream);
+
+	test_xt_out = g_string_new("");
+	xt->arena_depth = arena_depth;
+	for (i = 0; i < len; i += chunk) {
+		fail_unless(xt_feed(xt, test_xt_stream + i, MIN(chunk, len - i)) >= 0);
+		fail_unless(xt_handle(xt, NULL, 1));
+		xt_cleanup(xt, NULL, 1);
+	}
+	xt_free(xt);
+
+	return g_string_free(test_xt_out, FALSE);
+}
+
+START_TEST(test_xt_arena)
+{
+	const char *expect =
+		"<message to=\"changed\" b=\"2\" type=\"chat\" id=\"new\" a=\"1\">"
+		"<body>hi &amp; &lt;bye&gt;</body>"
+		"<active xmlns=\"http://jabber.org/protocol/chatstates\"/><extra>text</extra></message>"
+		"<iq id=\"new\" type=\"result\" a=\"1\" b=\"2\" to=\"changed\">"
+		"<query xmlns=\"jabber:iq:roster\"><item jid=\"x@y\" name=\"X\"><group>G</group></item>"
+		"</query><extra>text</extra></iq>";
+	int chunk;
+
+	for (chunk = 1; chunk < 40; chunk += 7) {
+		char *plain = test_xt_parse(-1, chunk);
+		char *arena = test_xt_parse(1, chunk);
+
+		fail_unless(strcmp(plain, expect) == 0, "%d: %s", chunk, plain);
+		fail_unless(strcmp(arena, expect) == 0, "%d: %s", chunk, arena);
+		g_free(plain);
+		g_free(arena);
+	}
+}
+END_TEST
+
+START_TEST(test_xt_attr_grow)
+{
+	struct xt_node *node = xt_new_node("iq", NULL, NULL);
+	char key[16], *s;
+	int i;
+
+	for (i = 0; i < 20; i++) {
+		g_snprintf(key, sizeof(key), "a%d", i);
+		xt_add_attr(node, key, key);
+	}
+	fail_unless(node->attr_size > 20 && node->attr_size <= 64, "size: %d", node->attr_size);
+	fail_unless(strcmp(xt_find_attr(node, "a19"), "a19") == 0);
+	fail_unless(xt_remove_attr(node, "a0"));
+	fail_unless(xt_find_attr(node, "a0") == NULL);
+	fail_unless(strcmp(xt_find_attr(node, "a19"), "a19") == 0);
+
+	xt_free_node(node);
+
+	node = xt_new_node("x", "<\x01\x1f>", NULL);
+	xt_add_attr(node, "k", "&'\"\x7f");
+	s = xt_to_string(node);
+	fail_unless(strcmp(s, "<x k=\"&amp;&apos;&quot;&#x7f;\">&lt;&gt;</x>") == 0, "%s", s);
+	g_free(s);
+	xt_free_node(node);
+}
+END_TEST
+
+START_TEST(test_xt_find)
+{
+	struct xt_node *root, *c;
+
+	root = xt_from_string("<x><stream:Features xmlns:stream='urn:s'><Bind ID='1' type='set'/>"
+	                      "<query id='2'><item><reason>r</reason></item></query>"
+	                      "<items/><item n='last'/></stream:Features></x>", 0);
+	fail_unless(root != NULL);
+	fail_unless(xt_atom_get("Query") == xt_atom_get("query"));
+	fail_unless(strcmp(xt_atom_get("Query"), "query") == 0);
+
+	/* Case and namespace prefixes don't matter. */
+	c = xt_find_node(root->children, "features");
+	fail_unless(c != NULL && strcmp(c->name, "stream:Features") == 0);
+	fail_unless(xt_find_node(root->children, "STREAM:features") == c);
+	fail_unless(xt_find_node(root->children, "feature") == NULL);
+	fail_unless(strcmp(xt_find_attr(c, "xmlns"), "urn:s") == 0);
+
+	fail_unless(strcmp(xt_find_attr(c->children, "id"), "1") == 0);
+	fail_unless(strcmp(xt_find_attr(c->children, "Type"), "set") == 0);
+	fail_unless(xt_find_attr(c->children, "never-seen-anywhere") == NULL);
+	fail_unless(xt_find_node(c->children, "never-seen-anywhere") == NULL);
+	fail_unless(strcmp(xt_find_attr(xt_find_node_by_attr(c->children, "query", "id", "2"),
+	                                "id"), "2") == 0);
+
+	/* Whole names only, <items/> isn't an item. */
+	fail_unless(strcmp(xt_find_path(root, "features/query/item/reason")->text, "r") == 0);
+	fail_unless(strcmp(xt_find_path(c, "item")->name, "item") == 0);
+	fail_unless(strcmp(xt_find_attr(xt_find_path(c, "item"), "n"), "last") == 0);
+	fail_unless(xt_find_node(c->children, "item") == xt_find_path(c, "item"));
+	fail_unless(xt_find_path(c, "item/..") == c);
+
+	xt_free_node(root);
+}
+END_TEST
+
+Suite *xmltree_suite(void)
+{
+	Suite *s = suite_create("XML tree");
+	TCase *tc_core = tcase_create("Core");
+
+	suite_add_tcase(s, tc_core);
+	tcase_add_test(tc_core, test_xt_arena);
+	tcase_add_test(tc_core, test_xt_attr_grow);
+	tcase_add_test(tc_core, test_xt_find);
+	return s;
+}